@@ -0,0 +1,876 @@
+#ifndef _BPLUS_ASYNC_HPP_
+#define _BPLUS_ASYNC_HPP_
+
+/*
+ * Header-only C++20 coroutine layer over bplus.hpp (Linux, io_uring):
+ *
+ *   bp::Db db("/tmp/1.bp");
+ *   bp::async::Loop loop;
+ *   bp::async::Db adb(loop, db);
+ *
+ *   bp::async::Task<> handler(bp::async::Db& adb) {
+ *     std::optional<bp::Value> value = co_await adb.get("key");
+ *     auto range = adb.range("a", "z");
+ *     while (const bp::Entry* entry = co_await range.next()) use(*entry);
+ *   }
+ *
+ *   loop.spawn(handler(adb));
+ *   loop.run();
+ *
+ * Reads walk the tree themselves: head page is searched under the tree
+ * lock, then lock is released and every child page and value block is
+ * read with io_uring, so one thread keeps many lookups in flight instead
+ * of blocking in pread(). Blocks are immutable once written, and reads go
+ * through a duplicate of the file descriptor taken for current file
+ * generation, so concurrent compaction or follower reopen can't pull file
+ * from under in-flight reads.
+ * Writes (set/remove) are executed inline: they hold the tree write lock
+ * and are mostly appends, so there is nothing to overlap.
+ *
+ * Loop is single-threaded: run one Loop (and its own bp::async::Db) per
+ * thread to use several cores.
+ */
+
+#if __cplusplus < 202002L
+#error "bplus-async.hpp requires C++20"
+#endif
+
+#include <coroutine>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "bplus.hpp"
+#include "private/cache.h"
+#include "private/compressor.h"
+#include "private/parse.h"
+#include "private/utils.h"
+
+namespace bp {
+namespace async {
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+/* single read in flight, lives in awaiting coroutine frame */
+struct Read {
+  std::coroutine_handle<> handle;
+  struct iovec iov;
+  int fd;
+  std::uint64_t offset;
+  int result;
+};
+
+template <typename T>
+struct TaskResult {
+  std::optional<T> value;
+
+  void return_value(T result) { value.emplace(std::move(result)); }
+  T take() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void> {
+  void return_void() noexcept {}
+  void take() noexcept {}
+};
+
+}  // namespace detail
+
+/*
+ * Lazy task: starts when awaited and resumes awaiting coroutine
+ * on completion (symmetric transfer, no stack growth).
+ */
+template <typename T>
+class Task {
+ public:
+  struct promise_type : detail::TaskResult<T> {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    Task get_return_object() noexcept {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> handle) noexcept {
+        return handle.promise().continuation;
+      }
+      void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+  };
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  auto operator co_await() noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<> continuation) noexcept {
+        handle.promise().continuation = continuation;
+        return handle;
+      }
+      T await_resume() {
+        if (handle.promise().error) {
+          std::rethrow_exception(handle.promise().error);
+        }
+        return handle.promise().take();
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+      : handle_(handle) {
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/*
+ * Async generator: `while (const T* item = co_await gen.next())`,
+ * item is valid until next call to next().
+ */
+template <typename T>
+class Generator {
+ public:
+  struct promise_type {
+    const T* current = nullptr;
+    std::coroutine_handle<> consumer;
+    std::exception_ptr error;
+
+    Generator get_return_object() noexcept {
+      return Generator(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct YieldAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> handle) noexcept {
+        return handle.promise().consumer;
+      }
+      void await_resume() noexcept {}
+    };
+
+    YieldAwaiter yield_value(const T& value) noexcept {
+      current = &value;
+      return {};
+    }
+    YieldAwaiter final_suspend() noexcept {
+      current = nullptr;
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+  };
+
+  Generator(Generator&& other) noexcept
+      : handle_(std::exchange(other.handle_, {})) {
+  }
+  Generator(const Generator&) = delete;
+  Generator& operator=(const Generator&) = delete;
+
+  ~Generator() {
+    if (handle_) handle_.destroy();
+  }
+
+  auto next() noexcept {
+    struct Awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return handle.done(); }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<> consumer) noexcept {
+        handle.promise().consumer = consumer;
+        return handle;
+      }
+      const T* await_resume() {
+        if (handle.promise().error) {
+          std::exception_ptr error = std::exchange(handle.promise().error, {});
+          std::rethrow_exception(error);
+        }
+        return handle.done() ? nullptr : handle.promise().current;
+      }
+    };
+    return Awaiter{handle_};
+  }
+
+ private:
+  explicit Generator(std::coroutine_handle<promise_type> handle) noexcept
+      : handle_(handle) {
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/*
+ * Minimal io_uring (raw syscalls, no liburing dependency): reads only,
+ * submissions are batched until loop polls for completions.
+ */
+class Ring {
+ public:
+  explicit Ring(unsigned entries) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    fd_ = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd_ < 0) throw Error(BP_EFILE);
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes +
+               params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      if (cq_size_ > sq_size_) sq_size_ = cq_size_;
+      cq_size_ = sq_size_;
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+               IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ = sq_;
+    } else if (sq_ != MAP_FAILED) {
+      cq_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+                 IORING_OFF_CQ_RING);
+    }
+    if (sq_ != MAP_FAILED && cq_ != MAP_FAILED) {
+      sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd_, IORING_OFF_SQES);
+    }
+    if (sqes_ == MAP_FAILED) {
+      unmap();
+      close(fd_);
+      throw Error(BP_EFILE);
+    }
+
+    char* sq = static_cast<char*>(sq_);
+    char* cq = static_cast<char*>(cq_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    sq_entries_ = params.sq_entries;
+    cq_entries_ = params.cq_entries;
+  }
+
+  ~Ring() {
+    unmap();
+    close(fd_);
+  }
+
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  /* queue read, completion count never exceeds CQ size (no overflow) */
+  void read(detail::Read* op) {
+    if (inflight_ >= cq_entries_) {
+      waiting_.push_back(op);
+      return;
+    }
+
+    unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+      enter(0);
+    }
+
+    unsigned index = tail & sq_mask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = op->fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&op->iov);
+    sqe->len = 1;
+    sqe->off = op->offset;
+    sqe->user_data = reinterpret_cast<std::uint64_t>(op);
+    sq_array_[index] = index;
+
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    pending_++;
+    inflight_++;
+  }
+
+  bool idle() const noexcept { return inflight_ == 0 && waiting_.empty(); }
+
+  /* submit queued reads, wait for completions and resume their readers */
+  void poll() {
+    if (inflight_ == 0) return;
+    enter(1);
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    ready_.clear();
+    for (; head != tail; head++) {
+      struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+      detail::Read* op = reinterpret_cast<detail::Read*>(cqe->user_data);
+      op->result = cqe->res;
+      ready_.push_back(op);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    inflight_ -= (unsigned) ready_.size();
+
+    while (!waiting_.empty() && inflight_ < cq_entries_) {
+      detail::Read* op = waiting_.front();
+      waiting_.pop_front();
+      read(op);
+    }
+
+    /* resumed coroutines may only queue new reads, not poll */
+    for (detail::Read* op : ready_) op->handle.resume();
+  }
+
+ private:
+  void enter(unsigned wait) {
+    int ret;
+    do {
+      ret = (int) syscall(__NR_io_uring_enter,
+                          fd_,
+                          pending_,
+                          wait,
+                          wait ? IORING_ENTER_GETEVENTS : 0,
+                          nullptr,
+                          0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) throw Error(BP_EFILEREAD);
+    pending_ -= (unsigned) ret;
+  }
+
+  void unmap() noexcept {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+    if (cq_ != MAP_FAILED && cq_ != sq_) munmap(cq_, cq_size_);
+    if (sq_ != MAP_FAILED) munmap(sq_, sq_size_);
+  }
+
+  int fd_ = -1;
+  void* sq_ = MAP_FAILED;
+  void* cq_ = MAP_FAILED;
+  void* sqes_ = MAP_FAILED;
+  std::size_t sq_size_ = 0;
+  std::size_t cq_size_ = 0;
+  std::size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  struct io_uring_cqe* cqes_ = nullptr;
+  unsigned cq_mask_ = 0;
+  unsigned cq_entries_ = 0;
+
+  unsigned pending_ = 0;
+  unsigned inflight_ = 0;
+  std::deque<detail::Read*> waiting_;
+  std::vector<detail::Read*> ready_;
+};
+
+/*
+ * Event loop: runs spawned tasks until all of them complete.
+ */
+class Loop {
+ public:
+  explicit Loop(unsigned entries = 256) : ring_(entries) {}
+
+  Ring& ring() noexcept { return ring_; }
+
+  /* task runs until its first read right away */
+  void spawn(Task<> task) { start(std::move(task)); }
+
+  /* first exception thrown by spawned task is rethrown here */
+  void run() {
+    while (active_ > 0 && !ring_.idle()) ring_.poll();
+    if (error_) std::rethrow_exception(std::exchange(error_, {}));
+  }
+
+  /* run task to completion and return its result */
+  template <typename T>
+  T wait(Task<T> task) {
+    if constexpr (std::is_void_v<T>) {
+      spawn(std::move(task));
+      run();
+    } else {
+      std::optional<T> result;
+      spawn(store(std::move(task), result));
+      run();
+      return std::move(*result);
+    }
+  }
+
+ private:
+  struct Detached {
+    struct promise_type {
+      Detached get_return_object() noexcept { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() noexcept {}
+      void unhandled_exception() noexcept { std::terminate(); }
+    };
+  };
+
+  Detached start(Task<> task) {
+    active_++;
+    try {
+      co_await task;
+    } catch (...) {
+      if (!error_) error_ = std::current_exception();
+    }
+    active_--;
+  }
+
+  template <typename T>
+  static Task<> store(Task<T> task, std::optional<T>& result) {
+    result.emplace(co_await task);
+  }
+
+  Ring ring_;
+  std::size_t active_ = 0;
+  std::exception_ptr error_;
+};
+
+/*
+ * Asynchronous reads over opened bp::Db, see top of the file.
+ */
+class Db {
+ public:
+  Db(Loop& loop, bp::Db& db) : loop_(loop), db_(db.native()), owner_(db) {}
+
+  Task<std::optional<Value>> get(std::string key) {
+    bp_key_t raw_key = bp::detail::key(key);
+    std::uint64_t now = (std::uint64_t) std::time(nullptr);
+    std::shared_ptr<File> file;
+    bp__kv_t kv;
+    bool leaf;
+
+    /* in-memory head page, may be changed by writers */
+    {
+      Lock lock(db_);
+      bp__page_t* head = db_->head.page;
+      bp__page_search_res_t res;
+
+      file = current();
+      if (bp__buffer_search(db_, head, &raw_key, &res.index) == BP_OK) {
+        /* value is read below, after the lock is released */
+        kv = head->buffer[res.index];
+        leaf = true;
+        if (!live(kv, now)) co_return std::nullopt;
+      } else {
+        check(bp__page_search(db_, head, &raw_key, kNotLoad, &res));
+        if (res.index >= head->length) co_return std::nullopt;
+
+        kv = head->keys[res.index];
+        leaf = head->type == kLeaf;
+        if (BP__KV_EXPIRED(kv.config, now)) co_return std::nullopt;
+        if (leaf && res.cmp != 0) co_return std::nullopt;
+      }
+    }
+
+    /* immutable pages on disk */
+    while (!leaf) {
+      Page page = co_await load(file, kv.offset, kv.config);
+      bp__page_search_res_t res;
+
+      /* buffered message is newer than anything below it */
+      if (bp__buffer_search(db_, page.get(), &raw_key, &res.index) == BP_OK) {
+        kv = page->buffer[res.index];
+        if (!live(kv, now)) co_return std::nullopt;
+        break;
+      }
+
+      check(bp__page_search(db_, page.get(), &raw_key, kNotLoad, &res));
+      if (res.index >= page->length) co_return std::nullopt;
+
+      kv = page->keys[res.index];
+      leaf = page->type == kLeaf;
+      if (BP__KV_EXPIRED(kv.config, now)) co_return std::nullopt;
+      if (leaf && res.cmp != 0) co_return std::nullopt;
+    }
+
+    co_return co_await value(file, kv);
+  }
+
+  /* writes are executed inline, see top of the file */
+  Task<> set(std::string key, std::string value, std::uint64_t expire = 0) {
+    owner_.set(key, value, expire);
+    co_return;
+  }
+
+  Task<bool> remove(std::string key) {
+    co_return owner_.remove(key);
+  }
+
+  /* inclusive [start, end], loads at most one page per tree level at once */
+  Generator<Entry> range(std::string start, std::string end) {
+    bp_key_t raw_start = bp::detail::key(start);
+    bp_key_t raw_end = bp::detail::key(end);
+    std::uint64_t now = (std::uint64_t) std::time(nullptr);
+    std::vector<Frame> stack;
+    std::shared_ptr<File> file;
+    Overlay overlay{KeyLess{db_}};
+
+    {
+      Lock lock(db_);
+      bp__page_t* head;
+
+      file = current();
+      check(bp__page_clone(db_, db_->head.page, &head));
+      Page page(head, PageFree{db_});
+      for (std::uint64_t i = 0; i < head->buffer_length; i++) {
+        overlay_add(overlay, head->buffer[i], raw_start, raw_end);
+      }
+      stack.push_back(bounds(std::move(page), raw_start, raw_end));
+    }
+
+    while (!stack.empty()) {
+      Frame& frame = stack.back();
+      if (frame.index > frame.last) {
+        stack.pop_back();
+        continue;
+      }
+
+      bp__kv_t kv = frame.page->keys[frame.index++];
+      if (BP__KV_EXPIRED(kv.config, now)) continue;
+
+      if (frame.page->type == kLeaf) {
+        /* buffered messages before kv, and the one replacing it */
+        bool replaced = false;
+        while (!overlay.empty()) {
+          auto it = overlay.begin();
+          bp_key_t key = bp::detail::key(it->first);
+          int cmp = db_->compare_cb(&key, reinterpret_cast<bp_key_t*>(&kv));
+          if (cmp > 0) break;
+          replaced = cmp == 0;
+
+          bp__kv_t msg = it->second;
+          std::string msg_key = it->first;
+          overlay.erase(it);
+          if (!live(msg, now)) continue;
+          std::optional<Value> v = co_await value(file, msg);
+          co_yield Entry{std::string_view(msg_key), v->view()};
+        }
+        if (replaced) continue;
+
+        std::optional<Value> v = co_await value(file, kv);
+        co_yield Entry{std::string_view(kv.value, kv.length), v->view()};
+      } else {
+        Page child = co_await load(file, kv.offset, kv.config);
+        /* messages of upper pages are newer, they are already there */
+        for (std::uint64_t i = 0; i < child->buffer_length; i++) {
+          overlay_add(overlay, child->buffer[i], raw_start, raw_end);
+        }
+        stack.push_back(bounds(std::move(child), raw_start, raw_end));
+      }
+    }
+
+    while (!overlay.empty()) {
+      auto it = overlay.begin();
+      bp__kv_t msg = it->second;
+      std::string msg_key = it->first;
+      overlay.erase(it);
+      if (!live(msg, now)) continue;
+      std::optional<Value> v = co_await value(file, msg);
+      co_yield Entry{std::string_view(msg_key), v->view()};
+    }
+  }
+
+ private:
+  struct Free {
+    void operator()(char* p) const noexcept { std::free(p); }
+  };
+  using Buffer = std::unique_ptr<char, Free>;
+
+  /* descriptor and cache generation of one file generation */
+  struct File {
+    File(int fd, std::uint64_t generation, std::uint64_t cache_generation)
+        : fd(fd), generation(generation), cache_generation(cache_generation) {
+    }
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+    ~File() { close(fd); }
+
+    int fd;
+    std::uint64_t generation;
+    std::uint64_t cache_generation;
+  };
+
+  /* page parsed by bp__page_parse(), see private/parse.h */
+  struct PageFree {
+    bp_db_t* db;
+    void operator()(bp__page_t* p) const noexcept { bp__page_destroy(db, p); }
+  };
+  using Page = std::unique_ptr<bp__page_t, PageFree>;
+
+  /* buffered messages seen by range, by key (see private/buffers.h) */
+  struct KeyLess {
+    bp_db_t* db;
+    bool operator()(const std::string& a, const std::string& b) const {
+      bp_key_t ka = bp::detail::key(a);
+      bp_key_t kb = bp::detail::key(b);
+      return db->compare_cb(&ka, &kb) < 0;
+    }
+  };
+  using Overlay = std::map<std::string, bp__kv_t, KeyLess>;
+
+  struct Frame {
+    Page page;
+    std::uint64_t index;
+    std::uint64_t last;
+  };
+
+  class Lock {
+   public:
+    explicit Lock(bp_db_t* db) : db_(db) { bp__rwlock_rdlock(&db_->rwlock); }
+    ~Lock() { bp__rwlock_unlock(&db_->rwlock); }
+
+   private:
+    bp_db_t* db_;
+  };
+
+  struct ReadAwaiter {
+    Ring& ring;
+    detail::Read op;
+
+    bool await_ready() noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      op.handle = handle;
+      ring.read(&op);
+    }
+    int await_resume() const noexcept { return op.result; }
+  };
+
+  static void check(int ret) { bp::detail::check(ret); }
+
+  /* must be called under tree lock */
+  std::shared_ptr<File> current() {
+    if (file_ == nullptr || file_->generation != db_->generation) {
+      int fd = dup(db_->fd);
+      if (fd == -1) throw Error(BP_EFILE);
+      file_ = std::make_shared<File>(fd, db_->generation,
+                                     db_->cache_generation);
+    }
+    return file_;
+  }
+
+  /* same as bp__writer_read() for compressed blocks */
+  Task<std::pair<Buffer, std::size_t>> read(std::shared_ptr<File> file,
+                                            std::uint64_t offset,
+                                            std::uint64_t csize) {
+    if (csize == 0) co_return std::pair<Buffer, std::size_t>(nullptr, 0);
+
+    if (db_->cache != nullptr) {
+      std::uint64_t size;
+      void* data;
+      int ret = bp__cache_get(db_->cache, file->cache_generation, offset,
+                              csize, &size, &data);
+      if (ret == BP_OK) {
+        co_return std::pair<Buffer, std::size_t>(
+            Buffer(static_cast<char*>(data)), (std::size_t) size);
+      }
+      if (ret != BP_ENOTFOUND) throw Error(ret);
+    }
+
+    Buffer compressed(static_cast<char*>(std::malloc(csize)));
+    if (compressed == nullptr) throw Error(BP_EALLOC);
+
+    ReadAwaiter awaiter{loop_.ring(), {}};
+    awaiter.op.iov.iov_base = compressed.get();
+    awaiter.op.iov.iov_len = csize;
+    awaiter.op.fd = file->fd;
+    awaiter.op.offset = offset;
+    int bytes_read = co_await awaiter;
+    if (bytes_read < 0 || (std::uint64_t) bytes_read != csize) {
+      throw Error(BP_EFILEREAD);
+    }
+
+    std::size_t size;
+    if (bp__uncompressed_length(compressed.get(), csize, &size) != BP_OK) {
+      throw Error(BP_EDECOMP);
+    }
+    Buffer data(static_cast<char*>(std::malloc(size)));
+    if (data == nullptr) throw Error(BP_EALLOC);
+    if (bp__uncompress(compressed.get(), csize, data.get(), &size) != BP_OK) {
+      throw Error(BP_EDECOMP);
+    }
+    if (db_->cache != nullptr) {
+      bp__cache_put(db_->cache, file->cache_generation, offset, csize, size,
+                    data.get());
+    }
+    co_return std::pair<Buffer, std::size_t>(std::move(data), size);
+  }
+
+  /* same as bp__page_read_block(), delta chain is read one block at a time */
+  Task<std::pair<Buffer, std::size_t>> block(std::shared_ptr<File> file,
+                                             std::uint64_t offset,
+                                             std::uint64_t config,
+                                             std::uint64_t level = 0) {
+    std::pair<Buffer, std::size_t> block =
+        co_await read(file, offset, BP__KV_LENGTH(config) >> 1);
+    if (!bp__page_is_delta(block.first.get(), block.second)) co_return block;
+
+    std::uint64_t base_offset, base_config, depth;
+    bp__page_delta_base(block.first.get(), &base_offset, &base_config,
+                        &depth);
+    check(bp__page_delta_check(offset, config, level, base_offset,
+                               base_config));
+
+    std::pair<Buffer, std::size_t> base =
+        co_await this->block(file, base_offset, base_config, level + 1);
+    char* merged;
+    std::uint64_t merged_size;
+    check(bp__page_delta_apply(db_, base.first.get(), base.second,
+                               block.first.get(), block.second,
+                               &merged, &merged_size));
+    co_return std::pair<Buffer, std::size_t>(Buffer(merged),
+                                             (std::size_t) merged_size);
+  }
+
+  /* same as bp__page_read(), overflow keys are read asynchronously too */
+  Task<Page> load(std::shared_ptr<File> file,
+                  std::uint64_t offset,
+                  std::uint64_t config) {
+    std::pair<Buffer, std::size_t> data = co_await block(file, offset, config);
+    bp__page_t* raw;
+
+    check(bp__page_create(db_, kLeaf, offset, config, &raw));
+    Page page(raw, PageFree{db_});
+    check(bp__page_parse(db_, raw, data.first.get(), data.second));
+    data.first.release();
+
+    for (std::uint64_t i = 0; i < raw->length + raw->buffer_length; i++) {
+      bp__kv_t* kv = i < raw->length ?
+          &raw->keys[i] :
+          &raw->buffer[i - raw->length];
+      if (kv->key_config == 0) continue;
+
+      std::pair<Buffer, std::size_t> key =
+          co_await read(file, kv->key_offset, kv->key_config);
+      if (key.second != kv->length) throw Error(BP_EFILEREAD);
+      kv->value = key.first.release();
+      kv->allocated = 1;
+    }
+    co_return page;
+  }
+
+  /* same as bp__value_load(), without previous value link */
+  Task<std::optional<Value>> value(std::shared_ptr<File> file, bp__kv_t kv) {
+    std::pair<Buffer, std::size_t> block =
+        co_await read(file, kv.offset, BP__KV_LENGTH(kv.config));
+    bp_value_t value;
+
+    check(bp__value_parse(block.first.get(), block.second, &value));
+    co_return Value::adopt(value.value, (std::size_t) value.length);
+  }
+
+  /* message isn't a removal and hasn't expired */
+  static bool live(const bp__kv_t& msg, std::uint64_t now) {
+    return !BP__MSG_REMOVED(msg.config) && !BP__KV_EXPIRED(msg.config, now);
+  }
+
+  /* keeps message of upper page if there is one for the same key */
+  void overlay_add(Overlay& overlay,
+                   const bp__kv_t& msg,
+                   const bp_key_t& start,
+                   const bp_key_t& end) const {
+    const bp_key_t* key = reinterpret_cast<const bp_key_t*>(&msg);
+    if (db_->compare_cb(key, &start) < 0 || db_->compare_cb(key, &end) > 0) {
+      return;
+    }
+    overlay.emplace(std::string(msg.value, msg.length), msg);
+  }
+
+  std::uint64_t search(const Page& page, const bp_key_t& key, int& cmp) const {
+    bp__page_search_res_t res;
+
+    check(bp__page_search(db_, page.get(), &key, kNotLoad, &res));
+    cmp = res.cmp;
+    return res.index;
+  }
+
+  /* same indexes as bp__page_get_range() */
+  Frame bounds(Page page, const bp_key_t& start, const bp_key_t& end) const {
+    Frame frame;
+    int cmp;
+
+    frame.index = 1;
+    frame.last = 0;
+    if (page->length == 0) {
+      frame.page = std::move(page);
+      return frame;
+    }
+
+    std::uint64_t first = search(page, start, cmp);
+    std::uint64_t last = search(page, end, cmp);
+    if (page->type == kLeaf && cmp != 0) {
+      if (last == 0) {
+        frame.page = std::move(page);
+        return frame;
+      }
+      last--;
+    }
+    if (first <= last) {
+      frame.index = first;
+      frame.last = last;
+    }
+    frame.page = std::move(page);
+    return frame;
+  }
+
+  Loop& loop_;
+  bp_db_t* db_;
+  bp::Db& owner_;
+  std::shared_ptr<File> file_;
+};
+
+}  // namespace async
+}  // namespace bp
+
+#endif /* _BPLUS_ASYNC_HPP_ */
@@ -15,6 +15,11 @@ extern "C" {
 #include "private/errors.h"
 
 typedef struct bp_db_s bp_db_t;
+typedef struct bp_options_s bp_options_t;
+typedef struct bp_cache_stats_s bp_cache_stats_t;
+typedef struct bp_warmup_s bp_warmup_t;
+typedef struct bp_verify_stats_s bp_verify_stats_t;
+typedef struct bp_head_s bp_head_t;
 
 typedef struct bp_key_s bp_key_t;
 typedef struct bp_key_s bp_value_t;
@@ -29,6 +34,10 @@ typedef void (*bp_range_cb)(void* arg,
                             const bp_key_t* key,
                             const bp_value_t* value);
 typedef int (*bp_filter_cb)(void* arg, const bp_key_t* key);
+typedef int (*bp_diff_cb)(void* arg,
+                          const bp_key_t* key,
+                          const bp_value_t* old_value,
+                          const bp_value_t* new_value);
 
 #include "private/tree.h"
 
@@ -38,6 +47,60 @@ typedef int (*bp_filter_cb)(void* arg, const bp_key_t* key);
 int bp_open(bp_db_t* tree, const char* filename);
 int bp_close(bp_db_t* tree);
 
+/*
+ * Open database with options (see bp_options_t below),
+ * NULL options are the same as bp_open()
+ */
+void bp_options_init(bp_options_t* options);
+int bp_open_ex(bp_db_t* tree,
+               const char* filename,
+               const bp_options_t* options);
+
+/*
+ * Follow database written by another process (BP_OPEN_RDONLY only):
+ * pick up heads appended since open or last refresh, or reopen file
+ * if it was replaced by compaction. Cheap if file hasn't changed.
+ */
+int bp_refresh(bp_db_t* tree);
+
+/*
+ * Block cache statistics (counters are shared by all users of cache segment),
+ * returns BP_ENOTFOUND if database was opened without cache
+ */
+int bp_cache_stats(bp_db_t* tree, bp_cache_stats_t* stats);
+
+/*
+ * Read pages ahead of requests after open (see bp_warmup_t below):
+ * interior levels (and leaves with BP_WARMUP_LEAVES) are loaded level by
+ * level with large sorted reads issued by several threads, so that pages
+ * land in OS page cache and block cache (if enabled).
+ * With BP_WARMUP_BACKGROUND returns immediately, database is usable
+ * meanwhile. bp_warmup_wait() waits for completion and returns its result
+ * and amount of bytes read (`loaded` may be NULL).
+ */
+void bp_warmup_init(bp_warmup_t* policy);
+int bp_warmup(bp_db_t* tree, const bp_warmup_t* policy);
+int bp_warmup_wait(bp_db_t* tree, uint64_t* loaded);
+
+/*
+ * Check every page reachable from head and every value they refer to:
+ * blocks are read from file (not block cache) and must decompress and
+ * parse, keys must be sorted and lie within separators of parent pages.
+ * Subtrees are checked by `threads` threads (0 - default, 4), tree lock is
+ * only held for one read at a time. Returns BP_OK or error of the first
+ * damaged block (BP_ECORRUPT if order is broken), `stats` may be NULL.
+ *
+ * bp_scrub_start() repeats the same check in a background thread, pass
+ * after pass, reading no more than `rate` bytes per second (0 - no limit).
+ * It stops by itself on the first error. bp_scrub_status() returns result
+ * so far and progress, bp_scrub_stop() stops the thread (BP_ENOTFOUND if
+ * there is no scrubber).
+ */
+int bp_verify(bp_db_t* tree, uint32_t threads, bp_verify_stats_t* stats);
+int bp_scrub_start(bp_db_t* tree, uint64_t rate);
+int bp_scrub_status(bp_db_t* tree, bp_verify_stats_t* stats);
+int bp_scrub_stop(bp_db_t* tree, bp_verify_stats_t* stats);
+
 /*
  * Get one value by key
  */
@@ -52,7 +115,9 @@ int bp_get_previous(bp_db_t* tree,
                     bp_value_t* previous);
 
 /*
- * Set one value by key (without solving conflicts, overwrite)
+ * Set one value by key (without solving conflicts, overwrite). Values of
+ * 4 GB or more (compressed block size is stored in 32 bits) are rejected
+ * with BP_ETOOLARGE by every write.
  */
 int bp_set(bp_db_t* tree,
            const bp_key_t* key,
@@ -61,6 +126,20 @@ int bp_sets(bp_db_t* tree,
             const char* key,
             const char* value);
 
+/*
+ * Set one value by key, that will be invisible after `expire` time
+ * (seconds since epoch, 0 - never). Expired values don't cost any writes:
+ * they are skipped by reads, dropped by bp_compact and bp_purge_expired.
+ */
+int bp_set_expire(bp_db_t* tree,
+                  const bp_key_t* key,
+                  const bp_value_t* value,
+                  const uint64_t expire);
+int bp_sets_expire(bp_db_t* tree,
+                   const char* key,
+                   const char* value,
+                   const uint64_t expire);
+
 /*
  * Update or create value by key (with solving conflicts)
  * **MVCC**
@@ -156,21 +235,303 @@ int bp_get_filtered_ranges(bp_db_t* tree,
                            bp_range_cb cb,
                            void* arg);
 
+/*
+ * Remove up to `limit` (0 - no limit) expired values or whole expired
+ * subtrees, `purged` (may be NULL) receives number of removed items.
+ * Call repeatedly to sweep database in small batches.
+ */
+int bp_purge_expired(bp_db_t* tree, const uint64_t limit, uint64_t* purged);
+
 /*
  * Run compaction on database
  */
 int bp_compact(bp_db_t* tree);
 
+/*
+ * Offline build: fill empty database from sorted input. Keys must be added
+ * in strictly increasing order (BP_EUNSORTED otherwise, or if database isn't
+ * empty). Values and pages are written once, each page as soon as it is
+ * full, and nothing is visible until bp_build_finish() writes the head.
+ * If tree was written to (or compacted) after the first bp_build_add(),
+ * bp_build_finish() drops the build and returns BP_EBUILDCONFLICT.
+ * Separate handles can build files for disjoint key ranges in parallel.
+ */
+int bp_build_add(bp_db_t* tree, const bp_key_t* key, const bp_value_t* value);
+int bp_build_finish(bp_db_t* tree);
+
+/*
+ * Offline build from `run_count` sorted runs, using up to `threads` threads:
+ * run i has counts[i] kvs keys[i][..], values[i][..], and all keys of run i
+ * must be smaller than keys of run i + 1 (empty runs are skipped). Each run
+ * becomes a subtree built by one thread, roots of subtrees are joined under
+ * new interior pages. Same requirements as bp_build_add, one head write.
+ */
+int bp_build_parallel(bp_db_t* tree,
+                      const uint64_t run_count,
+                      const uint64_t* counts,
+                      const bp_key_t** keys,
+                      const bp_value_t** values,
+                      const uint32_t threads);
+
+/*
+ * Add all kvs of database file `filename` (made by bp_build_add(), or any
+ * other database with the same page size and key order) to tree, atomically.
+ * If its keys sort before or after all keys of tree, its pages are
+ * appended to tree's file and attached to the root, and value blocks are
+ * copied without recompression. Otherwise every kv is inserted one by one
+ * (keeping expiration), with one head write at the end.
+ */
+int bp_ingest(bp_db_t* tree, const char* filename);
+
+/*
+ * Fill empty database from two database files (same key order as tree):
+ * both are read in key order at once and every kv is appended to tree like
+ * with bp_build_add(), value blocks are copied without recompression. Keys
+ * present in both files are taken from one of them, or merge fails with
+ * BP_EMERGECONFLICT (and tree stays empty), depending on `policy`. Failed
+ * merge truncates tree's file back to its size before the merge.
+ */
+#define BP_MERGE_PREFER_A 0
+#define BP_MERGE_PREFER_B 1
+#define BP_MERGE_FAIL 2
+int bp_merge_files(const char* src_a,
+                   const char* src_b,
+                   bp_db_t* dst,
+                   const int policy);
+
+/*
+ * Split database by key range into two new files: kvs with keys below
+ * `split_key` go to `left`, the rest to `right` (files must not exist, or
+ * be empty databases). Each file is written like with bp_build_add(), so it
+ * is compact and independent of tree. Tree stays readable and writable
+ * meanwhile: writes made during the copy are applied to the files after
+ * it, files hold tree as it was at the end of the call (writers wait for
+ * the last of them to be applied).
+ */
+int bp_split_file(bp_db_t* tree,
+                  const bp_key_t* split_key,
+                  const char* left,
+                  const char* right);
+
+/*
+ * Versions of tree: bp_head() gives the last committed head, bp_heads()
+ * scans file backwards for up to `count` heads, newest first (the same way
+ * bp_open looks for the last one). Heads stay valid for this handle until
+ * file is replaced by compaction, bp_diff() returns BP_ENOTFOUND after.
+ */
+int bp_head(bp_db_t* tree, bp_head_t* head);
+int bp_heads(bp_db_t* tree,
+             const uint64_t count,
+             bp_head_t* heads,
+             uint64_t* found);
+
+/*
+ * Call `cb` for every key which differs between `old_head` and `new_head`:
+ * added (old_value is NULL), removed (new_value is NULL) or changed. Pages
+ * are copy-on-write, so both versions share every subtree which wasn't
+ * modified in between, and such subtrees are skipped without reading them:
+ * cost is proportional to the amount of change. Subtrees below buffered
+ * messages are read in full. Keys are in increasing order, values are
+ * freed after callback, non-zero return value of it stops the diff and is
+ * returned.
+ */
+int bp_diff(bp_db_t* tree,
+            const bp_head_t* old_head,
+            const bp_head_t* new_head,
+            bp_diff_cb cb,
+            void* arg);
+
+/*
+ * Split key space into `n` ranges holding roughly equal amounts of data:
+ * range 0 starts with the smallest key, range i (1 <= i <= count) starts
+ * with keys[i - 1]. `keys` should have room for n - 1 keys, their values
+ * are allocated (and zero-terminated) and should be freed by caller.
+ * Computed from separators and page sizes of interior pages, leaves aren't
+ * read. Small trees may give fewer points.
+ */
+int bp_split_points(bp_db_t* tree,
+                    uint64_t n,
+                    bp_key_t* keys,
+                    uint64_t* count);
+
+/*
+ * Call `cb` (with NULL value) for `count` keys picked uniformly at random,
+ * with repeats. The same `seed` picks the same keys in the same tree.
+ * Keys which are only in buffered messages (see `buffer_messages`) are
+ * never picked. Returns BP_ENOTFOUND if tree has no keys.
+ */
+int bp_sample(bp_db_t* tree,
+              uint64_t count,
+              uint64_t seed,
+              bp_range_cb cb,
+              void* arg);
+
 /*
  * Set compare function to define order of keys in database
  */
 void bp_set_compare_cb(bp_db_t* tree, bp_compare_cb cb);
 
+/*
+ * Record every block read and write (offset, size, compressed size,
+ * block type, operation) to a binary trace file.
+ * See include/private/trace.h for the format and `bp_io_replay` tool.
+ * Starting or stopping waits for running bp_compact, which writes to the
+ * trace too.
+ */
+int bp_io_trace_start(bp_db_t* tree, const char* filename);
+int bp_io_trace_stop(bp_db_t* tree);
+
+/*
+ * Record every get/set/remove/range/bulk/compact call with its keys and
+ * value sizes (and values themselves if BP_TRACE_VALUES flag is given)
+ * to a trace file, which can be replayed with `bp_op_replay` tool.
+ */
+#define BP_TRACE_VALUES 1
+int bp_op_trace_start(bp_db_t* tree, const char* filename, int flags);
+int bp_op_trace_stop(bp_db_t* tree);
+
 /*
  * Ensure that all data is written to disk
  */
 int bp_fsync(bp_db_t* tree);
 
+/*
+ * Open database in read-only (follower) mode: file is never written,
+ * all modifying calls return BP_EREADONLY, and bp_refresh() should be used
+ * to see new commits.
+ */
+#define BP_OPEN_RDONLY 1
+
+/*
+ * Back block cache with 2MB pages to cut TLB misses on large caches:
+ * explicit huge pages (MAP_HUGETLB) if they are reserved, transparent ones
+ * otherwise. Private cache is then not shared with forked children, named
+ * cache gets huge pages only if system enables them for shared memory
+ * (/sys/kernel/mm/transparent_hugepage/shmem_enabled).
+ */
+#define BP_OPEN_HUGE_PAGES 2
+
+struct bp_options_s {
+  int flags;
+
+  /*
+   * Cache of decompressed pages and values (disabled if cache_size is 0).
+   * With cache_name set, cache is a named POSIX shared memory segment
+   * (shm_open) and is shared by all processes opening it, otherwise it is
+   * private to this database handle. Segment is never unlinked by bplus,
+   * and first process that creates it defines its size.
+   * Blocks larger than cache_block_size (default: 4096) are not cached.
+   */
+  const char* cache_name;
+  uint64_t cache_size;
+  uint64_t cache_block_size;
+
+  /*
+   * NUMA mode: cache is split into cache_nodes partitions of cache_size
+   * bytes each (BP_CACHE_NUMA_AUTO - one per NUMA node), allocated in
+   * memory of their node. Reads use partition of the node they run on,
+   * so hot pages end up replicated in every node's memory. Partitions
+   * of named cache are named "<cache_name>.<partition>" (except the first
+   * one), all users of the cache should open it with the same cache_nodes.
+   */
+  uint32_t cache_nodes;
+
+  /* run bp_warmup() right after open (NULL - don't) */
+  const bp_warmup_t* warmup;
+
+  /*
+   * Write modified pages as deltas: only changed kvs and a link to
+   * the previous version of the page, instead of the whole page. Readers
+   * apply chain of deltas on top of full page, chain is consolidated into
+   * a full page after delta_chain deltas and by bp_compact()
+   * (0 - always write full pages).
+   */
+  uint32_t delta_chain;
+
+  /*
+   * B-epsilon mode: sets and removes are stored as messages in a buffer
+   * of the root page and moved down to children in batches, once there are
+   * more than buffer_messages of them. Batching makes random writes cheaper
+   * (one rewrite of a leaf is shared by many updates), reads check buffers
+   * on their way down. Values link to previous version (bp_get_previous())
+   * only if it is known without a lookup (0 - write directly to leaves).
+   */
+  uint32_t buffer_messages;
+
+  /*
+   * Keys longer than this (in bytes) are written to their own block, pages
+   * hold only a fixed-size reference to it. Keeps pages small no matter how
+   * large keys are, at the cost of a read per such key when page is loaded
+   * (0 - all keys are inline).
+   */
+  uint32_t inline_key_limit;
+
+  /*
+   * Size (in entries) of in-memory index of value hashes. A value equal to
+   * recently written one points to the existing block instead of a new
+   * copy, such values don't link to previous version (bp_get_previous()).
+   * bp_compact() shares blocks in the compacted file too (0 - no dedup).
+   */
+  uint32_t dedup_slots;
+};
+
+#define BP_CACHE_NUMA_AUTO 0xffffffff
+
+#define BP_WARMUP_BACKGROUND 1
+#define BP_WARMUP_LEAVES 2
+
+struct bp_warmup_s {
+  int flags;
+
+  /* stop after reading this many bytes from file (0 - no limit) */
+  uint64_t budget;
+
+  /* number of reader threads (default: 4) */
+  uint32_t threads;
+
+  /*
+   * Pages read by this handle are remembered and their offsets are saved
+   * to hot_file by bp_close(), next warmup with the same hot_file reads
+   * them first. Ignored if file was replaced (e.g. compacted) meanwhile.
+   */
+  const char* hot_file;
+};
+
+struct bp_cache_stats_s {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t size;
+  uint64_t block_size;
+  uint64_t slots;
+
+  /* bytes of cache mapped with huge pages in this process */
+  uint64_t huge_pages;
+
+  /* number of partitions (see cache_nodes) */
+  uint64_t nodes;
+};
+
+struct bp_verify_stats_s {
+  uint64_t pages;
+  uint64_t values;
+
+  /* compressed bytes of pages and values read */
+  uint64_t bytes;
+
+  /* complete walks over tree */
+  uint64_t passes;
+};
+
+struct bp_head_s {
+  /* root page */
+  uint64_t offset;
+  uint64_t config;
+
+  /* version of file the head belongs to */
+  uint64_t _generation;
+};
+
 struct bp_db_s {
   BP_TREE_PRIVATE
 };
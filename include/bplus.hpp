@@ -0,0 +1,626 @@
+#ifndef _BPLUS_HPP_
+#define _BPLUS_HPP_
+
+/*
+ * Header-only C++17 layer over bplus.h:
+ *
+ *   bp::Db db("/tmp/1.bp");
+ *   db.set("key", "value");
+ *   if (auto value = db.get("key")) use(value->view());
+ *   for (const bp::Entry& e : db.range("a", "z")) use(e.key, e.value);
+ *
+ * Keys and values are stored exactly as given (std::string_view bytes),
+ * unlike bp_sets()/bp_gets() which include terminating zero.
+ * Errors are reported with bp::Error exceptions, missing keys are not errors.
+ */
+
+#if __cplusplus < 201703L
+#error "bplus.hpp requires C++17"
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#define BP_HAS_SPAN 1
+#endif
+
+#include "bplus.h"
+
+namespace bp {
+
+class Db;
+class Range;
+
+class Error : public std::runtime_error {
+ public:
+  explicit Error(int code) : std::runtime_error(describe(code)), code_(code) {
+  }
+
+  int code() const noexcept { return code_; }
+
+ private:
+  static std::string describe(int code) {
+    char buff[32];
+    std::snprintf(buff, sizeof(buff), "bplus error 0x%x", code);
+    return buff;
+  }
+
+  int code_;
+};
+
+namespace detail {
+
+inline void check(int ret) {
+  if (ret != BP_OK) throw Error(ret);
+}
+
+/* engine never modifies keys and values passed to it */
+inline bp_key_t key(std::string_view data) noexcept {
+  bp_key_t result;
+  result.length = data.size();
+  result.value = const_cast<char*>(data.data());
+  result._prev_offset = 0;
+  result._prev_length = 0;
+  return result;
+}
+
+}  // namespace detail
+
+/*
+ * Value either owns buffer allocated by engine (and frees it),
+ * or borrows caller's memory.
+ */
+class Value {
+ public:
+  Value() noexcept = default;
+  Value(const Value&) = delete;
+  Value& operator=(const Value&) = delete;
+
+  Value(Value&& other) noexcept { *this = std::move(other); }
+
+  Value& operator=(Value&& other) noexcept {
+    if (this != &other) {
+      reset();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      owned_ = std::exchange(other.owned_, false);
+      prev_offset_ = std::exchange(other.prev_offset_, 0);
+      prev_length_ = std::exchange(other.prev_length_, 0);
+    }
+    return *this;
+  }
+
+  ~Value() { reset(); }
+
+  static Value borrow(std::string_view data) noexcept {
+    Value value;
+    value.data_ = const_cast<char*>(data.data());
+    value.size_ = data.size();
+    return value;
+  }
+
+  /* takes ownership of malloc()'ed buffer */
+  static Value adopt(char* data, std::size_t size) noexcept {
+    Value value;
+    value.data_ = data;
+    value.size_ = size;
+    value.owned_ = true;
+    return value;
+  }
+
+  const char* data() const noexcept { return data_; }
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  bool owns() const noexcept { return owned_; }
+
+  std::string_view view() const noexcept {
+    return std::string_view(data_, size_);
+  }
+  operator std::string_view() const noexcept { return view(); }
+  std::string str() const { return std::string(data_, size_); }
+
+  void reset() noexcept {
+    if (owned_) std::free(data_);
+    data_ = nullptr;
+    size_ = 0;
+    owned_ = false;
+    prev_offset_ = 0;
+    prev_length_ = 0;
+  }
+
+ private:
+  friend class Db;
+
+  static Value adopt(const bp_value_t& raw) noexcept {
+    Value value;
+    value.data_ = raw.value;
+    value.size_ = raw.length;
+    value.owned_ = true;
+    value.prev_offset_ = raw._prev_offset;
+    value.prev_length_ = raw._prev_length;
+    return value;
+  }
+
+  char* data_ = nullptr;
+  std::size_t size_ = 0;
+  bool owned_ = false;
+  std::uint64_t prev_offset_ = 0;
+  std::uint64_t prev_length_ = 0;
+};
+
+/*
+ * Range entry, views are valid until iterator is advanced
+ */
+struct Entry {
+  std::string_view key;
+  std::string_view value;
+};
+
+/*
+ * Lazy range: entries are fetched in chunks into a reused buffer, and
+ * subtrees beyond current chunk are pruned (not loaded) with key filter.
+ */
+class Range {
+ public:
+  class iterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Entry*;
+    using reference = const Entry&;
+
+    iterator() noexcept = default;
+
+    reference operator*() const noexcept { return range_->entries_[index_]; }
+    pointer operator->() const noexcept { return &range_->entries_[index_]; }
+
+    iterator& operator++() {
+      if (++index_ == range_->entries_.size()) {
+        index_ = 0;
+        if (!range_->fetch()) range_ = nullptr;
+      }
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const noexcept {
+      return range_ == other.range_ && index_ == other.index_;
+    }
+    bool operator!=(const iterator& other) const noexcept {
+      return !(*this == other);
+    }
+
+   private:
+    friend class Range;
+
+    explicit iterator(Range* range) noexcept : range_(range) {}
+
+    Range* range_ = nullptr;
+    std::size_t index_ = 0;
+  };
+
+  Range(const Range&) = delete;
+  Range& operator=(const Range&) = delete;
+  Range(Range&&) = default;
+  Range& operator=(Range&&) = default;
+
+  iterator begin() {
+    first_ = true;
+    done_ = false;
+    return fetch() ? iterator(this) : iterator();
+  }
+  iterator end() noexcept { return iterator(); }
+
+ private:
+  friend class Db;
+
+  struct Slot {
+    std::size_t key;
+    std::size_t key_size;
+    std::size_t value;
+    std::size_t value_size;
+  };
+
+  Range(bp_db_t* db,
+        std::string_view start,
+        std::string_view end,
+        std::size_t chunk)
+      : db_(db), start_(start), end_(end), chunk_(chunk == 0 ? 1 : chunk) {
+  }
+
+  static int filter_cb(void* arg, const bp_key_t* /* key */) {
+    Range* self = static_cast<Range*>(arg);
+    return self->seen_ < self->quota_;
+  }
+
+  static void range_cb(void* arg,
+                       const bp_key_t* key,
+                       const bp_value_t* value) {
+    Range* self = static_cast<Range*>(arg);
+    std::string_view k(key->value, key->length);
+    std::size_t offset;
+
+    if (self->seen_++ == 0 && !self->first_ && k == self->last_) {
+      /* first key of next chunk is the last one of previous */
+      return;
+    }
+
+    try {
+      offset = self->arena_.size();
+      self->arena_.insert(self->arena_.end(), k.begin(), k.end());
+      self->arena_.insert(self->arena_.end(),
+                          value->value,
+                          value->value + value->length);
+      self->slots_.push_back(
+          Slot{offset, k.size(), offset + k.size(), value->length});
+    } catch (...) {
+      /* exceptions can't cross C frames */
+      self->failed_ = true;
+    }
+  }
+
+  bool fetch() {
+    entries_.clear();
+    if (done_) return false;
+
+    arena_.clear();
+    slots_.clear();
+    seen_ = 0;
+    failed_ = false;
+
+    /* continue from last key of previous chunk (inclusive) */
+    bp_key_t start = detail::key(first_ ? std::string_view(start_) : last_);
+    bp_key_t end = detail::key(end_);
+    quota_ = chunk_ + (first_ ? 0 : 1);
+
+    detail::check(
+        bp_get_filtered_range(db_, &start, &end, filter_cb, range_cb, this));
+    if (failed_) throw std::bad_alloc();
+
+    first_ = false;
+    if (seen_ < quota_) done_ = true;
+    if (slots_.empty()) return false;
+
+    for (const Slot& slot : slots_) {
+      entries_.push_back(
+          Entry{std::string_view(arena_.data() + slot.key, slot.key_size),
+                std::string_view(arena_.data() + slot.value,
+                                 slot.value_size)});
+    }
+    last_.assign(entries_.back().key);
+
+    return true;
+  }
+
+  bp_db_t* db_;
+  std::string start_;
+  std::string end_;
+  std::string last_;
+  std::size_t chunk_;
+
+  bool first_ = true;
+  bool done_ = false;
+  bool failed_ = false;
+  std::size_t seen_ = 0;
+  std::size_t quota_ = 0;
+
+  std::vector<char> arena_;
+  std::vector<Slot> slots_;
+  std::vector<Entry> entries_;
+};
+
+/*
+ * Bulk set, keys and values are moved in. Order doesn't matter,
+ * batch is sorted with database's compare function on apply.
+ */
+class Batch {
+ public:
+  Batch() = default;
+  Batch(const Batch&) = delete;
+  Batch& operator=(const Batch&) = delete;
+  Batch(Batch&&) = default;
+  Batch& operator=(Batch&&) = default;
+
+  Batch& set(std::string key, std::string value) {
+    keys_.push_back(std::move(key));
+    values_.push_back(std::move(value));
+    return *this;
+  }
+
+  void reserve(std::size_t count) {
+    keys_.reserve(count);
+    values_.reserve(count);
+  }
+
+  std::size_t size() const noexcept { return keys_.size(); }
+  bool empty() const noexcept { return keys_.empty(); }
+
+  void clear() noexcept {
+    keys_.clear();
+    values_.clear();
+  }
+
+ private:
+  friend class Db;
+
+  std::vector<std::string> keys_;
+  std::vector<std::string> values_;
+};
+
+struct Options {
+  bool read_only = false;
+  bool huge_pages = false;
+
+  /* see bp_options_t */
+  const char* cache_name = nullptr;
+  std::uint64_t cache_size = 0;
+  std::uint64_t cache_block_size = 0;
+  std::uint32_t cache_nodes = 0;
+
+  /* see bp_warmup_t, run at open if set */
+  const bp_warmup_t* warmup = nullptr;
+
+  /* see bp_options_t, 0 - write full pages */
+  std::uint32_t delta_chain = 0;
+
+  /* see bp_options_t, 0 - write directly to leaves */
+  std::uint32_t buffer_messages = 0;
+
+  /* see bp_options_t, 0 - all keys are inline */
+  std::uint32_t inline_key_limit = 0;
+
+  /* see bp_options_t, 0 - no dedup */
+  std::uint32_t dedup_slots = 0;
+};
+
+/*
+ * Move-only database handle, closed on destruction
+ */
+class Db {
+ public:
+  Db() noexcept = default;
+
+  explicit Db(const std::string& filename, const Options& options = Options())
+      : db_(new bp_db_t) {
+    bp_options_t raw;
+
+    bp_options_init(&raw);
+    raw.flags = (options.read_only ? BP_OPEN_RDONLY : 0) |
+                (options.huge_pages ? BP_OPEN_HUGE_PAGES : 0);
+    raw.cache_name = options.cache_name;
+    raw.cache_size = options.cache_size;
+    raw.cache_block_size = options.cache_block_size;
+    raw.cache_nodes = options.cache_nodes;
+    raw.warmup = options.warmup;
+    raw.delta_chain = options.delta_chain;
+    raw.buffer_messages = options.buffer_messages;
+    raw.inline_key_limit = options.inline_key_limit;
+    raw.dedup_slots = options.dedup_slots;
+
+    int ret = bp_open_ex(db_.get(), filename.c_str(), &raw);
+    if (ret != BP_OK) {
+      db_.reset();
+      throw Error(ret);
+    }
+  }
+
+  Db(const Db&) = delete;
+  Db& operator=(const Db&) = delete;
+  Db(Db&& other) noexcept = default;
+
+  Db& operator=(Db&& other) noexcept {
+    if (this != &other) {
+      close();
+      db_ = std::move(other.db_);
+    }
+    return *this;
+  }
+
+  ~Db() { close(); }
+
+  void close() noexcept {
+    if (db_ == nullptr) return;
+    bp_close(db_.get());
+    db_.reset();
+  }
+
+  bool is_open() const noexcept { return db_ != nullptr; }
+  bp_db_t* native() const noexcept { return db_.get(); }
+
+  std::optional<Value> get(std::string_view key) const {
+    bp_key_t raw_key = detail::key(key);
+    bp_value_t raw_value;
+
+    int ret = bp_get(db_.get(), &raw_key, &raw_value);
+    if (ret == BP_ENOTFOUND) return std::nullopt;
+    detail::check(ret);
+
+    return Value::adopt(raw_value);
+  }
+
+  /*
+   * Copy value into caller's buffer, returns full size of value
+   * (which may be bigger than buffer - then value is truncated)
+   */
+  std::optional<std::size_t> get_into(std::string_view key,
+                                      char* buff,
+                                      std::size_t size) const {
+    std::optional<Value> value = get(key);
+    if (!value) return std::nullopt;
+
+    std::memcpy(buff, value->data(), std::min(size, value->size()));
+    return value->size();
+  }
+
+#ifdef BP_HAS_SPAN
+  std::optional<std::size_t> get_into(std::string_view key,
+                                      std::span<char> buff) const {
+    return get_into(key, buff.data(), buff.size());
+  }
+#endif
+
+  /* reuses capacity of `out` */
+  bool get_into(std::string_view key, std::string& out) const {
+    std::optional<Value> value = get(key);
+    if (!value) return false;
+
+    out.assign(value->data(), value->size());
+    return true;
+  }
+
+  /* previous version of value (MVCC) */
+  std::optional<Value> previous(const Value& value) const {
+    bp_value_t raw_value = detail::key(value.view());
+    bp_value_t raw_previous;
+
+    raw_value._prev_offset = value.prev_offset_;
+    raw_value._prev_length = value.prev_length_;
+
+    int ret = bp_get_previous(db_.get(), &raw_value, &raw_previous);
+    if (ret == BP_ENOTFOUND) return std::nullopt;
+    detail::check(ret);
+
+    return Value::adopt(raw_previous);
+  }
+
+  /* expire - seconds since epoch, 0 - never */
+  void set(std::string_view key,
+           std::string_view value,
+           std::uint64_t expire = 0) {
+    bp_key_t raw_key = detail::key(key);
+    bp_value_t raw_value = detail::key(value);
+
+    detail::check(bp_set_expire(db_.get(), &raw_key, &raw_value, expire));
+  }
+
+  /* returns false if key wasn't found */
+  bool remove(std::string_view key) {
+    bp_key_t raw_key = detail::key(key);
+
+    int ret = bp_remove(db_.get(), &raw_key);
+    if (ret == BP_ENOTFOUND) return false;
+    detail::check(ret);
+
+    return true;
+  }
+
+  void apply(Batch&& batch) {
+    std::size_t count = batch.size();
+    std::vector<bp_key_t> keys(count);
+    std::vector<bp_value_t> values(count);
+    std::vector<std::size_t> order(count);
+    bp_compare_cb compare = db_->compare_cb;
+
+    for (std::size_t i = 0; i < count; i++) {
+      keys[i] = detail::key(batch.keys_[i]);
+      values[i] = detail::key(batch.values_[i]);
+      order[i] = i;
+    }
+
+    /* later sets of the same key win */
+    std::stable_sort(order.begin(),
+                     order.end(),
+                     [&](std::size_t a, std::size_t b) {
+                       return compare(&keys[a], &keys[b]) < 0;
+                     });
+
+    std::vector<bp_key_t> sorted_keys(count);
+    std::vector<bp_value_t> sorted_values(count);
+    for (std::size_t i = 0; i < count; i++) {
+      sorted_keys[i] = keys[order[i]];
+      sorted_values[i] = values[order[i]];
+    }
+
+    if (count != 0) {
+      const bp_key_t* k = sorted_keys.data();
+      const bp_value_t* v = sorted_values.data();
+      detail::check(bp_bulk_set(db_.get(), count, &k, &v));
+    }
+
+    batch.clear();
+  }
+
+  /* both ends are inclusive */
+  Range range(std::string_view start,
+              std::string_view end,
+              std::size_t chunk = 64) const {
+    return Range(db_.get(), start, end, chunk);
+  }
+
+  void compact() { detail::check(bp_compact(db_.get())); }
+
+  /* keys must be strictly increasing, see bp_build_add */
+  void build_add(std::string_view key, std::string_view value) {
+    bp_key_t raw_key = detail::key(key);
+    bp_value_t raw_value = detail::key(value);
+    detail::check(bp_build_add(db_.get(), &raw_key, &raw_value));
+  }
+  void build_finish() { detail::check(bp_build_finish(db_.get())); }
+  void ingest(const std::string& filename) {
+    detail::check(bp_ingest(db_.get(), filename.c_str()));
+  }
+  void merge_files(const std::string& src_a,
+                   const std::string& src_b,
+                   int policy = BP_MERGE_PREFER_A) {
+    detail::check(
+        bp_merge_files(src_a.c_str(), src_b.c_str(), db_.get(), policy));
+  }
+  void split_file(std::string_view split_key,
+                  const std::string& left,
+                  const std::string& right) {
+    bp_key_t raw_key = detail::key(split_key);
+    detail::check(
+        bp_split_file(db_.get(), &raw_key, left.c_str(), right.c_str()));
+  }
+
+  /* throws Error with code of the first damaged block */
+  bp_verify_stats_t verify(std::uint32_t threads = 0) {
+    bp_verify_stats_t stats;
+    detail::check(bp_verify(db_.get(), threads, &stats));
+    return stats;
+  }
+
+  void fsync() { detail::check(bp_fsync(db_.get())); }
+  void refresh() { detail::check(bp_refresh(db_.get())); }
+
+  void warmup(const bp_warmup_t& policy) {
+    detail::check(bp_warmup(db_.get(), &policy));
+  }
+
+  /* bytes loaded by last warmup */
+  std::uint64_t warmup_wait() {
+    std::uint64_t loaded;
+    detail::check(bp_warmup_wait(db_.get(), &loaded));
+    return loaded;
+  }
+
+  std::uint64_t purge_expired(std::uint64_t limit = 0) {
+    std::uint64_t purged;
+    detail::check(bp_purge_expired(db_.get(), limit, &purged));
+    return purged;
+  }
+
+  void set_compare(bp_compare_cb cb) noexcept {
+    bp_set_compare_cb(db_.get(), cb);
+  }
+
+ private:
+  std::unique_ptr<bp_db_t> db_;
+};
+
+}  // namespace bp
+
+#endif /* _BPLUS_HPP_ */
@@ -0,0 +1,114 @@
+#ifndef _PRIVATE_BUFFERS_H_
+#define _PRIVATE_BUFFERS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * B-epsilon mode: interior pages carry a buffer of pending messages. Message
+ * is a kv with key and value offset/config, just like in leaves, or with zero
+ * length in config for removal. With tree's buffer_messages set, writes land
+ * in head page's buffer. Once buffer holds more than buffer_messages
+ * messages, the largest batch going to one child is moved down: to child's
+ * buffer, or applied to it if it is a leaf. One rewrite of child is then
+ * shared by all updates of the batch. Messages of upper pages are newer than
+ * anything below them, reads check buffers on the way down.
+ *
+ * Writes in other modes replace message of the same key in place (if there
+ * is one on their way down), so buffers written in B-epsilon mode stay valid.
+ *
+ * Buffer is stored in front of page's kvs (numbers are big-endian uint64):
+ *   BP__BUFFER_MARKER, count, count * kv
+ */
+#define BP__BUFFER_MARKER (~(uint64_t) 0 - 1)
+#define BP__BUFFER_HEADER_SIZE 16
+#define BP__MSG_REMOVED(config) (BP__KV_LENGTH(config) == 0)
+
+struct bp__page_s;
+struct bp__kv_s;
+
+typedef struct bp__buffer_range_s bp__buffer_range_t;
+
+int bp__buffer_search(bp_db_t* t,
+                      struct bp__page_s* page,
+                      const bp_key_t* key,
+                      uint64_t* index);
+int bp__buffer_put(bp_db_t* t,
+                   struct bp__page_s* page,
+                   const struct bp__kv_s* msg);
+void bp__buffer_remove_idx(struct bp__page_s* page, const uint64_t index);
+void bp__buffer_destroy(struct bp__page_s* page);
+
+/* copy messages with lower <= key < upper (NULL - no bound) */
+int bp__buffer_copy(bp_db_t* t,
+                    struct bp__page_s* source,
+                    struct bp__page_s* target,
+                    const bp_key_t* lower,
+                    const bp_key_t* upper);
+
+/*
+ * Write to interior page: `*handled` is 0 if there is nothing to do with
+ * page's buffer and write should go to a child.
+ */
+int bp__buffer_insert(bp_db_t* t,
+                      struct bp__page_s* page,
+                      const bp_key_t* key,
+                      const bp_value_t* value,
+                      const uint64_t expire,
+                      bp_update_cb update_cb,
+                      void* arg,
+                      int* handled);
+int bp__buffer_remove(bp_db_t* t,
+                      struct bp__page_s* page,
+                      const bp_key_t* key,
+                      bp_remove_cb remove_cb,
+                      void* arg,
+                      int* handled);
+
+/*
+ * Move messages down until page's buffer fits, returns BP_ESPLITPAGE if
+ * page (not head) is full after splits of its children. Page itself isn't
+ * saved, head page is replaced if it was split.
+ */
+int bp__buffer_flush(bp_db_t* t, struct bp__page_s** page);
+
+/*
+ * Range over interior page: results of children are passed through
+ * bp__buffer_range_cb, which merges page's messages into them.
+ */
+void bp__buffer_range_init(bp__buffer_range_t* range,
+                           bp_db_t* t,
+                           struct bp__page_s* page,
+                           const bp_key_t* start,
+                           const bp_key_t* end,
+                           bp_filter_cb filter,
+                           bp_range_cb cb,
+                           void* arg);
+int bp__buffer_range_filter(void* arg, const bp_key_t* key);
+void bp__buffer_range_cb(void* arg,
+                         const bp_key_t* key,
+                         const bp_value_t* value);
+int bp__buffer_range_finish(bp__buffer_range_t* range, int ret);
+
+struct bp__buffer_range_s {
+  bp_db_t* t;
+  struct bp__page_s* page;
+  uint64_t index;
+  uint64_t end;
+  uint64_t now;
+
+  bp_filter_cb filter;
+  bp_range_cb cb;
+  void* arg;
+
+  int ret;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_BUFFERS_H_ */
@@ -0,0 +1,138 @@
+#ifndef _PRIVATE_CACHE_H_
+#define _PRIVATE_CACHE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cache of decompressed blocks, optionally shared between processes.
+ *
+ * Segment layout:
+ *   header: magic, geometry, generation counter and table of open files
+ *   slots:  slot_count * slot_size bytes, grouped in sets of
+ *           BP__CACHE_WAYS slots
+ *
+ * Blocks are immutable, so a block is identified by (generation, offset,
+ * compressed size), where generation is assigned to each (dev, ino, inode
+ * generation) triple when it is seen first (or created by bplus). Inode
+ * generation (FS_IOC_GETVERSION, 0 where unsupported) changes when inode
+ * number is reused by another file. Each slot is protected by
+ * sequence counter: odd - slot is being written, readers copy data out and
+ * retry (treat as miss) if counter has changed meanwhile.
+ */
+#define BP__CACHE_MAGIC "BPCACHE2"
+#define BP__CACHE_WAYS 4
+#define BP__CACHE_FILES 64
+#define BP__CACHE_BLOCK_SIZE 4096
+#define BP__CACHE_HUGE_PAGE (2 * 1024 * 1024)
+#define BP__CACHE_NODES 16
+#define BP__CACHE_NODE_IDS 1024
+#define BP__CACHE_CPUS 4096
+
+typedef struct bp__cache_s bp__cache_t;
+typedef struct bp__cache_header_s bp__cache_header_t;
+typedef struct bp__cache_file_s bp__cache_file_t;
+typedef struct bp__cache_slot_s bp__cache_slot_t;
+
+/*
+ * With nodes != 0 cache is split into partitions (BP_CACHE_NUMA_AUTO - one
+ * per NUMA node) of `size` bytes each, placed in memory of their nodes.
+ * Gets and puts go to partition of the node calling thread runs on.
+ */
+int bp__cache_create(const char* name,
+                     const uint64_t size,
+                     const uint64_t block_size,
+                     const int huge,
+                     const uint32_t nodes,
+                     bp__cache_t** cache);
+void bp__cache_destroy(bp__cache_t* cache);
+
+/* counters summed over partitions */
+void bp__cache_stats(bp__cache_t* cache, bp_cache_stats_t* stats);
+
+int bp__cache_file(bp__cache_t* cache,
+                   const int fd,
+                   const int fresh,
+                   uint64_t* generation);
+
+int bp__cache_get(bp__cache_t* cache,
+                  const uint64_t generation,
+                  const uint64_t offset,
+                  const uint64_t csize,
+                  uint64_t* size,
+                  void** data);
+void bp__cache_put(bp__cache_t* cache,
+                   const uint64_t generation,
+                   const uint64_t offset,
+                   const uint64_t csize,
+                   const uint64_t size,
+                   const void* data);
+
+/* put block to every partition, e.g. interior pages read by warmup */
+void bp__cache_put_all(bp__cache_t* cache,
+                       const uint64_t generation,
+                       const uint64_t offset,
+                       const uint64_t csize,
+                       const uint64_t size,
+                       const void* data);
+
+struct bp__cache_file_s {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t ino_generation;
+  uint64_t size;
+  uint64_t generation;
+};
+
+struct bp__cache_header_s {
+  char magic[8];
+  uint64_t size;
+  uint64_t block_size;
+  uint64_t slot_size;
+  uint64_t slot_count;
+
+  volatile uint32_t ready;
+  volatile uint32_t lock;
+  uint64_t generation;
+  uint64_t clock;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+
+  bp__cache_file_t files[BP__CACHE_FILES];
+};
+
+struct bp__cache_slot_s {
+  volatile uint32_t seq;
+  uint32_t length;
+  uint64_t generation;
+  uint64_t offset;
+  uint64_t csize;
+};
+
+struct bp__cache_s {
+  void* mem;
+  uint64_t size;
+  bp__cache_header_t* header;
+  char* slots;
+
+  /* mapping may be larger than size: rounded up to huge page */
+  uint64_t map_size;
+  int hugetlb;
+
+  /* partitions (nodes[0] is this one) and partition of each CPU */
+  bp__cache_t** nodes;
+  uint32_t node_count;
+  unsigned char* cpu_nodes;
+  uint32_t cpu_count;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_CACHE_H_ */
@@ -0,0 +1,68 @@
+#ifndef _PRIVATE_CURSOR_H_
+#define _PRIVATE_CURSOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "private/values.h"
+
+/*
+ * Cursor walks visible kvs of a subtree in key order, one leaf at a time,
+ * and returns them as they are stored (value offset and config), values
+ * aren't read. Pages on the path from root to the current leaf are kept
+ * loaded.
+ * For every leaf, its kvs are merged with buffered messages of the pages
+ * above which route to it (lower <= key < upper, bounds are separators on
+ * the path): the topmost message of a key is the newest one, removed and
+ * expired kvs are skipped.
+ *
+ * Root is head page (or its clone), or any page below it. Its file shouldn't
+ * be replaced by compaction while cursor is open.
+ */
+#define BP__CURSOR_MAX_LEVELS 32
+
+struct bp__page_s;
+
+typedef struct bp__cursor_s bp__cursor_t;
+typedef struct bp__cursor_level_s bp__cursor_level_t;
+
+void bp__cursor_init(bp_db_t* t, struct bp__page_s* root, bp__cursor_t* c);
+void bp__cursor_destroy(bp__cursor_t* c);
+
+/*
+ * Next kv, BP_ENOTFOUND after the last one. Key of kv points into loaded
+ * pages and is valid until the next call.
+ */
+int bp__cursor_next(bp__cursor_t* c, bp__kv_t** kv);
+
+struct bp__cursor_level_s {
+  struct bp__page_s* page;
+
+  /* child on the path (interior page) */
+  uint64_t index;
+};
+
+struct bp__cursor_s {
+  bp_db_t* tree;
+  struct bp__page_s* root;
+  uint64_t now;
+
+  /* path from root, root page itself isn't owned by cursor */
+  bp__cursor_level_t levels[BP__CURSOR_MAX_LEVELS];
+  uint64_t depth;
+  int started;
+
+  /* visible kvs of current leaf */
+  bp__kv_t* kvs;
+  uint64_t length;
+  uint64_t capacity;
+  uint64_t index;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_CURSOR_H_ */
@@ -0,0 +1,57 @@
+#ifndef _PRIVATE_DEDUP_H_
+#define _PRIVATE_DEDUP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Value dedup index: direct-mapped table from hash of value's data to its
+ * value block (offset and config). It lives in memory of one handle and
+ * starts empty after open, newer blocks replace older ones in their slot.
+ * Entries are only hints: before block is shared, it is read back and
+ * compared with the value, so collisions or stale entries just miss.
+ *
+ * Shared blocks have no previous value link, bp_get_previous returns
+ * BP_ENOTFOUND for them (compaction drops all links anyway).
+ */
+
+typedef struct bp__dedup_s bp__dedup_t;
+typedef struct bp__dedup_slot_s bp__dedup_slot_t;
+
+int bp__dedup_create(bp__dedup_t** dedup, const uint64_t slot_count);
+void bp__dedup_destroy(bp__dedup_t* dedup);
+
+uint64_t bp__dedup_hash(const char* data, const uint64_t length);
+
+/* BP_ENOTFOUND if there is no block with such hash and length */
+int bp__dedup_get(bp__dedup_t* dedup,
+                  const uint64_t hash,
+                  const uint64_t length,
+                  uint64_t* offset,
+                  uint64_t* config);
+void bp__dedup_put(bp__dedup_t* dedup,
+                   const uint64_t hash,
+                   const uint64_t length,
+                   const uint64_t offset,
+                   const uint64_t config);
+
+struct bp__dedup_slot_s {
+  uint64_t hash;
+  uint64_t length;
+  uint64_t offset;
+  uint64_t config;
+};
+
+struct bp__dedup_s {
+  uint64_t slot_count;
+  bp__dedup_slot_t* slots;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_DEDUP_H_ */
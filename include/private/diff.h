@@ -0,0 +1,89 @@
+#ifndef _PRIVATE_DIFF_H_
+#define _PRIVATE_DIFF_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "private/cursor.h"
+
+/*
+ * Diff of two versions (roots) of a tree in one file. Each side is a stream
+ * of items in key order: child pointers (with lower bound of their subtree)
+ * and leaf kvs. When both streams start with the same child pointer (offset
+ * and config), the subtree is shared and skipped on both sides. Otherwise
+ * the pointer with the smaller lower bound is replaced by its children, so
+ * only pages which differ are read. Kvs are compared by key and value
+ * offset/config. Subtree of a page with buffered messages is walked with a
+ * cursor (messages are applied to kvs below), it is never skipped.
+ */
+#define BP__DIFF_MAX_LEVELS 32
+
+/* bp_heads() reads file backward by this many bytes (multiple of head) */
+#define BP__HEADS_CHUNK (2048 * BP__HEAD_SIZE)
+
+struct bp__page_s;
+
+typedef struct bp__diff_frame_s bp__diff_frame_t;
+typedef struct bp__diff_stream_s bp__diff_stream_t;
+typedef struct bp__diff_values_s bp__diff_values_t;
+
+/* kv of old or new version is NULL if key is missing there */
+typedef int (*bp__diff_cb)(void* arg,
+                           const bp__kv_t* old_kv,
+                           const bp__kv_t* new_kv);
+
+/* stops at the first error of cb */
+int bp__diff(bp_db_t* t,
+             struct bp__page_s* old_root,
+             struct bp__page_s* new_root,
+             bp__diff_cb cb,
+             void* arg);
+
+/* bp_head(), bp_heads() and bp_diff() under read lock */
+void bp__head(bp_db_t* t, bp_head_t* head);
+int bp__heads(bp_db_t* t,
+              const uint64_t count,
+              bp_head_t* heads,
+              uint64_t* found);
+int bp__diff_heads(bp_db_t* t,
+                   const bp_head_t* old_head,
+                   const bp_head_t* new_head,
+                   bp_diff_cb cb,
+                   void* arg);
+
+struct bp__diff_frame_s {
+  struct bp__page_s* page;
+  uint64_t index;
+
+  /* lower bound of page (NULL - none), points to a page of frame below */
+  const bp__kv_t* lower;
+
+  /* page has buffered messages: its kvs come from cursor */
+  int walk;
+  bp__cursor_t cursor;
+  bp__kv_t* next;
+};
+
+/* loads values of changed kvs for user's callback */
+struct bp__diff_values_s {
+  bp_db_t* tree;
+  bp_diff_cb cb;
+  void* arg;
+};
+
+struct bp__diff_stream_s {
+  bp_db_t* tree;
+  uint64_t now;
+
+  /* root page of frame 0 isn't owned by stream */
+  bp__diff_frame_t frames[BP__DIFF_MAX_LEVELS];
+  uint64_t depth;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_DIFF_H_ */
@@ -10,6 +10,8 @@
 #define BP_EFILEFLUSH      0x105
 #define BP_EFILERENAME     0x106
 #define BP_ECOMPACT_EXISTS 0x107
+#define BP_EREADONLY       0x108
+#define BP_ECORRUPT        0x109
 
 #define BP_ECOMP 0x201
 #define BP_EDECOMP 0x202
@@ -17,11 +19,16 @@
 #define BP_EALLOC  0x301
 #define BP_EMUTEX  0x302
 #define BP_ERWLOCK 0x303
+#define BP_ECACHE  0x304
 
 #define BP_ENOTFOUND       0x401
 #define BP_ESPLITPAGE      0x402
 #define BP_EEMPTYPAGE      0x403
 #define BP_EUPDATECONFLICT 0x404
 #define BP_EREMOVECONFLICT 0x405
+#define BP_EUNSORTED       0x406
+#define BP_EMERGECONFLICT  0x407
+#define BP_EBUILDCONFLICT  0x408
+#define BP_ETOOLARGE       0x409
 
 #endif /* _PRIVATE_ERRORS_H_ */
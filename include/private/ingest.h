@@ -0,0 +1,91 @@
+#ifndef _PRIVATE_INGEST_H_
+#define _PRIVATE_INGEST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "private/values.h"
+
+/*
+ * Builder keeps one open page per level: kvs are appended to the leaf, full
+ * page (page_size - 1 kvs, the most a page holds between writes) is saved
+ * and its first key is appended to the page of the level above. Pages are
+ * never read back. Finish saves open pages bottom-up, the top one is root.
+ *
+ * Parallel build runs one builder per run of keys, threads share the file
+ * through writer's append lock. Roots of runs are then appended in order to
+ * level 1 of another builder, so subtrees may have different heights.
+ */
+#define BP__BUILD_MAX_LEVELS 32
+
+struct bp__page_s;
+
+typedef struct bp__builder_s bp__builder_t;
+typedef struct bp__build_job_s bp__build_job_t;
+
+int bp__builder_create(bp__builder_t** builder);
+void bp__builder_destroy(bp_db_t* t, bp__builder_t* b);
+/*
+ * Append kv of source, its value block is copied (see bp__value_copy).
+ * BP_EUNSORTED if key isn't larger than all keys added before.
+ */
+int bp__builder_copy(bp_db_t* t,
+                     bp_db_t* source,
+                     bp__builder_t* b,
+                     const bp__kv_t* kv);
+/* save open pages, BP_ENOTFOUND if nothing was added */
+int bp__builder_root(bp_db_t* t, bp__builder_t* b, bp__kv_t* root);
+
+/* BP_EUNSORTED if t isn't empty */
+int bp__build_check_empty(bp_db_t* t);
+/* load root and write it as head of t */
+int bp__build_head(bp_db_t* t, const bp__kv_t* root);
+
+int bp__build_add(bp_db_t* t, const bp_key_t* key, const bp_value_t* value);
+int bp__build_finish(bp_db_t* t);
+
+int bp__build_parallel(bp_db_t* t,
+                       const uint64_t run_count,
+                       const uint64_t* counts,
+                       const bp_key_t** keys,
+                       const bp_value_t** values,
+                       const uint32_t threads);
+
+/* drop unfinished build, called by bp_close */
+void bp__build_destroy(bp_db_t* t);
+
+int bp__ingest(bp_db_t* t, const char* filename);
+
+struct bp__builder_s {
+  struct bp__page_s* levels[BP__BUILD_MAX_LEVELS];
+
+  /* last key of the last saved leaf */
+  bp__kv_t last;
+
+  /* file generation of bp_build_add() builds, pages are written to it */
+  uint64_t generation;
+};
+
+struct bp__build_job_s {
+  bp_db_t* tree;
+
+  uint64_t run_count;
+  const uint64_t* counts;
+  const bp_key_t** keys;
+  const bp_value_t** values;
+
+  /* next run to build, and the first error */
+  uint64_t next_run;
+  int ret;
+
+  /* first key and root page of every run */
+  bp__kv_t* roots;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_INGEST_H_ */
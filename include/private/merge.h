@@ -0,0 +1,22 @@
+#ifndef _PRIVATE_MERGE_H_
+#define _PRIVATE_MERGE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Merge walks both source files with cursors (see cursor.h) side by side,
+ * and appends the smaller kv to a builder (see ingest.h) of target. Value
+ * blocks are copied as they are, pages of target are written once.
+ */
+int bp__merge_files(bp_db_t* t,
+                    const char* src_a,
+                    const char* src_b,
+                    const int policy);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_MERGE_H_ */
@@ -7,6 +7,7 @@ extern "C" {
 
 #include "private/tree.h"
 #include "private/values.h"
+#include "private/buffers.h"
 
 typedef struct bp__page_s bp__page_t;
 typedef struct bp__page_search_res_s bp__page_search_res_t;
@@ -21,6 +22,36 @@ enum search_type {
   kLoad = 1
 };
 
+/*
+ * Delta page: when tree's delta_chain is not 0, bp__page_save writes only
+ * kvs changed since page was read (or saved last time), on top of that
+ * previous version of page. Delta block has the same type and config as
+ * full page, but starts with a header (big-endian uint64s):
+ *   BP__DELTA_MARKER, base offset, base config, depth
+ * and is followed by entries sorted by key: op (upsert/remove), kv (as in
+ * full page). Marker is never a valid key length. Depth is a number of
+ * deltas in chain, chain is consolidated into a full page once its depth
+ * reaches delta_chain (and by compaction).
+ */
+#define BP__DELTA_MARKER (~(uint64_t) 0)
+#define BP__DELTA_HEADER_SIZE 32
+#define BP__DELTA_MAX_DEPTH 64
+
+/*
+ * Copy (compaction, ingestion) writes every overflow key block once, even if
+ * separators and messages refer to it too: source blocks are mapped to
+ * copies by a direct-mapped table (dedup.h), a miss writes one more copy.
+ */
+#define BP__COPY_KEY_SLOTS 1024
+
+/* changes of buffered messages (see buffers.h) go before changes of kvs */
+enum delta_op {
+  kDeltaUpsert = 0,
+  kDeltaRemove = 1,
+  kDeltaBufferUpsert = 2,
+  kDeltaBufferRemove = 3
+};
+
 int bp__page_create(bp_db_t* t,
                     const enum page_type type,
                     const uint64_t offset,
@@ -36,6 +67,19 @@ int bp__page_load(bp_db_t* t,
                   bp__page_t** page);
 int bp__page_save(bp_db_t* t, bp__page_t* page);
 
+int bp__page_is_delta(const char* buff, const uint64_t size);
+void bp__page_delta_base(const char* buff,
+                         uint64_t* offset,
+                         uint64_t* config,
+                         uint64_t* depth);
+int bp__page_delta_apply(bp_db_t* t,
+                         const char* base,
+                         const uint64_t base_size,
+                         const char* delta,
+                         const uint64_t delta_size,
+                         char** result,
+                         uint64_t* result_size);
+
 int bp__page_load_value(bp_db_t* t,
                         bp__page_t* page,
                         const uint64_t index,
@@ -46,6 +90,7 @@ int bp__page_save_value(bp_db_t* t,
                         const int cmp,
                         const bp_key_t* key,
                         const bp_value_t* value,
+                        const uint64_t expire,
                         bp_update_cb cb,
                         void* arg);
 
@@ -54,6 +99,11 @@ int bp__page_search(bp_db_t* t,
                     const bp_key_t* key,
                     const enum search_type type,
                     bp__page_search_res_t* result);
+int bp__page_lookup(bp_db_t* t,
+                    bp__page_t* page,
+                    const bp_key_t* key,
+                    uint64_t* offset,
+                    uint64_t* config);
 int bp__page_get(bp_db_t* t,
                  bp__page_t* page,
                  const bp_key_t* key,
@@ -69,6 +119,7 @@ int bp__page_insert(bp_db_t* t,
                     bp__page_t* page,
                     const bp_key_t* key,
                     const bp_value_t* value,
+                    const uint64_t expire,
                     bp_update_cb update_cb,
                     void* arg);
 int bp__page_bulk_insert(bp_db_t* t,
@@ -85,6 +136,31 @@ int bp__page_remove(bp_db_t* t,
                     bp_remove_cb remove_cb,
                     void* arg);
 int bp__page_copy(bp_db_t* source, bp_db_t* target, bp__page_t* page);
+int bp__page_purge(bp_db_t* t,
+                   bp__page_t* page,
+                   const uint64_t now,
+                   uint64_t* count);
+void bp__page_make_leaf(bp__page_t* page);
+
+/*
+ * Copy the lowest (or the highest, with `last`) key of subtree to `bound`,
+ * buffered messages included, BP_ENOTFOUND if subtree is empty.
+ */
+int bp__page_bound(bp_db_t* t,
+                   bp__page_t* page,
+                   const int last,
+                   bp__kv_t* bound);
+
+/*
+ * Make saved subtree `root` the first (or the last) child of head. All its
+ * keys sort before (after) keys of the tree, `root_min` is its lowest key and
+ * `tree_min` the lowest key of the tree. Head is saved, not written.
+ */
+int bp__page_attach(bp_db_t* t,
+                    bp__page_t* root,
+                    const bp__kv_t* root_min,
+                    const bp__kv_t* tree_min,
+                    const int first);
 
 int bp__page_remove_idx(bp_db_t* t, bp__page_t* page, const uint64_t index);
 int bp__page_split(bp_db_t* t,
@@ -108,6 +184,17 @@ struct bp__page_s {
   void* buff_;
   int is_head;
 
+  /* pending messages of interior page, sorted by key (see buffers.h) */
+  bp__kv_t* buffer;
+  uint64_t buffer_length;
+  uint64_t buffer_size;
+  uint64_t buffer_capacity;
+
+  /* serialized page as it is stored at offset (base for next delta) */
+  char* orig_;
+  uint64_t orig_size;
+  uint64_t depth;
+
   bp__kv_t keys[1];
 };
 
@@ -0,0 +1,54 @@
+#ifndef _PRIVATE_PARSE_H_
+#define _PRIVATE_PARSE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "private/pages.h"
+
+/*
+ * Parts of page and value reads which do no I/O, for readers doing reads
+ * on their own (bplus-async.hpp, warmup). Parsed page is searched with
+ * bp__page_search (kNotLoad) and bp__buffer_search.
+ */
+
+/* base of delta block at offset, read at `level` of chain, is valid */
+int bp__page_delta_check(const uint64_t offset,
+                         const uint64_t config,
+                         const uint64_t level,
+                         const uint64_t base_offset,
+                         const uint64_t base_config);
+
+/*
+ * Entry of unapplied delta block at `o` (the first one is at
+ * BP__DELTA_HEADER_SIZE), it is followed by the next one at
+ * o + 8 + BP__KV_SIZE(*kv). BP_ENOTFOUND - no more entries.
+ */
+int bp__page_delta_entry(const char* buff,
+                         const uint64_t size,
+                         const uint64_t o,
+                         uint64_t* op,
+                         bp__kv_t* kv);
+
+/*
+ * Fill page (its type is taken from config) from serialized block, delta
+ * chain applied. Page owns `buff` on success, kvs point into it. Overflow
+ * keys aren't loaded: their value is NULL, see bp__kv_load_key.
+ */
+int bp__page_parse(bp_db_t* t,
+                   bp__page_t* page,
+                   char* buff,
+                   const uint64_t size);
+
+/* value of uncompressed value block, value->value is allocated */
+int bp__value_parse(const char* buff,
+                    const uint64_t size,
+                    bp_value_t* value);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_PARSE_H_ */
@@ -0,0 +1,62 @@
+#ifndef _PRIVATE_SAMPLE_H_
+#define _PRIVATE_SAMPLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "private/values.h"
+
+/*
+ * Split points: top interior levels are read breadth first until there are
+ * BP__SPLIT_OVERSAMPLE children per requested range (or only leaves are
+ * left). Each child weighs as much as its compressed page, times average
+ * fanout of read pages for every level between it and the deepest leaf.
+ * A point is put at the separator of the child which crosses next 1/n of
+ * total weight. Leaves are never read.
+ *
+ * Sampling descends from head picking a random slot of page_size in every
+ * page, and starts over if slot is empty (Olken's acceptance/rejection).
+ * Leaves may be at different depths (bp_build_parallel, bp_ingest attach
+ * subtrees of any height), so a kv of leaf which is k levels above the
+ * deepest one is accepted with another 1/page_size^k: every kv is picked
+ * with the same probability. The deepest level is found by reading interior
+ * pages once per written head (it is kept until head changes). Kvs removed
+ * or expired by messages of buffers above them are rejected too, keys which
+ * are only in buffers (not yet flushed to leaves) are never picked.
+ */
+#define BP__SPLIT_OVERSAMPLE 8
+#define BP__SAMPLE_ATTEMPTS 100000
+
+typedef struct bp__split_item_s bp__split_item_t;
+
+int bp__split_points(bp_db_t* t,
+                     const uint64_t n,
+                     bp_key_t* keys,
+                     uint64_t* count);
+int bp__sample(bp_db_t* t,
+               const uint64_t count,
+               const uint64_t seed,
+               bp_range_cb cb,
+               void* arg);
+
+struct bp__split_item_s {
+  uint64_t offset;
+  uint64_t config;
+  uint64_t depth;
+
+  /* compressed page (1 for kv of leaf head), weight is derived from it */
+  uint64_t bytes;
+  double weight;
+
+  /* separator of parent, the first child has none */
+  int has_lower;
+  bp__kv_t lower;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_SAMPLE_H_ */
@@ -0,0 +1,50 @@
+#ifndef _PRIVATE_SPLIT_H_
+#define _PRIVATE_SPLIT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Range split: snapshot of head is walked with a cursor (see cursor.h) and
+ * every kv goes to the builder (see ingest.h) of its side, with its value
+ * block copied as it is. Tree is read-locked only for one kv at a time.
+ * Then writes which landed meanwhile are caught up: diff (see diff.h) of
+ * snapshot and the current head is applied to both files, under read lock,
+ * and current head becomes the snapshot. This repeats until head stays
+ * the same, at most BP__SPLIT_ROUNDS - 1 times. The last round is applied
+ * under write lock, which is held until both files are closed, so writes
+ * acknowledged before the split returns are never missed. If compaction
+ * replaces the file the split starts over.
+ */
+#define BP__SPLIT_ROUNDS 8
+#define BP__SPLIT_STALE -1
+
+struct bp__page_s;
+
+typedef struct bp__split_s bp__split_t;
+
+int bp__split_file(bp_db_t* t,
+                   const bp_key_t* key,
+                   const char* left,
+                   const char* right);
+
+struct bp__split_s {
+  bp_db_t* tree;
+  const bp_key_t* key;
+
+  /* left: keys < key, right: the rest */
+  bp_db_t sides[2];
+
+  struct bp__page_s* snapshot;
+  uint64_t generation;
+  int stale;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_SPLIT_H_ */
@@ -0,0 +1,117 @@
+#ifndef _PRIVATE_TRACE_H_
+#define _PRIVATE_TRACE_H_
+
+#include <stdint.h>
+#include "private/threads.h"
+#include "private/writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * I/O trace file format (all integers in network byte order):
+ *
+ *   header: "BPIOTRC1"
+ *   record: uint64_t time     - microseconds since trace start
+ *           uint64_t offset   - file offset of block
+ *           uint32_t size     - on-disk (compressed) size
+ *           uint32_t raw_size - uncompressed size
+ *           uint8_t  io       - enum bp__trace_io
+ *           uint8_t  block    - enum block_type
+ *           uint8_t  op       - enum bp__trace_op
+ *           uint8_t  file     - 0 - database, 1 - compaction target
+ *           uint8_t  reserved[4]
+ */
+
+/*
+ * Operation trace file format (all integers in network byte order):
+ *
+ *   header: "BPOPTRC2"
+ *   record: uint64_t time     - microseconds since trace start
+ *           uint8_t  op       - enum bp__trace_op
+ *           uint8_t  flags    - BP__OPTRACE_VALUES if value bytes follow
+ *           uint8_t  reserved[6]
+ *           uint64_t count    - number of entries
+ *   entry:  uint64_t key length, key bytes
+ *           uint64_t value length, value bytes (only with BP__OPTRACE_VALUES)
+ *
+ * Range records have start key as key and end key as value,
+ * compaction records have no entries.
+ */
+#define BP__TRACE_MAGIC "BPIOTRC1"
+#define BP__OPTRACE_MAGIC "BPOPTRC2"
+#define BP__OPTRACE_HEADER_SIZE 24
+#define BP__OPTRACE_VALUES 1
+#define BP__TRACE_MAGIC_SIZE 8
+#define BP__TRACE_RECORD_SIZE 32
+#define BP__TRACE_BUFFER_SIZE (BP__TRACE_RECORD_SIZE * 2048)
+
+#define BP__TRACE_OP(tree, op)\
+    if ((tree)->trace != NULL) bp__trace_set_op(op);
+
+#define BP__OPTRACE(tree, op, count, keys, values)\
+    if ((tree)->op_trace != NULL) {\
+      bp__trace_op_record((tree)->op_trace,\
+                          op,\
+                          count,\
+                          keys,\
+                          values,\
+                          (tree)->op_trace_values);\
+    }
+
+typedef struct bp__trace_s bp__trace_t;
+
+enum bp__trace_io {
+  kTraceRead = 0,
+  kTraceWrite = 1,
+  kTraceReopen = 2
+};
+
+enum bp__trace_op {
+  kTraceOpNone = 0,
+  kTraceOpOpen = 1,
+  kTraceOpGet = 2,
+  kTraceOpSet = 3,
+  kTraceOpBulk = 4,
+  kTraceOpRemove = 5,
+  kTraceOpRange = 6,
+  kTraceOpCompact = 7
+};
+
+int bp__trace_create(bp__writer_t* w,
+                     const char* filename,
+                     const char* magic,
+                     bp__trace_t** trace);
+int bp__trace_destroy(bp__trace_t* trace);
+
+void bp__trace_set_op(const enum bp__trace_op op);
+void bp__trace_record(bp__writer_t* w,
+                      const enum bp__trace_io io,
+                      const enum block_type block,
+                      const uint64_t offset,
+                      const uint64_t size,
+                      const uint64_t raw_size);
+void bp__trace_op_record(bp__trace_t* trace,
+                         const enum bp__trace_op op,
+                         const uint64_t count,
+                         const bp_key_t* keys,
+                         const bp_value_t* values,
+                         const int with_values);
+
+struct bp__trace_s {
+  int fd;
+  bp__mutex_t mutex;
+
+  bp__writer_t* owner;
+  uint64_t start;
+
+  uint64_t used;
+  char buff[BP__TRACE_BUFFER_SIZE];
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_TRACE_H_ */
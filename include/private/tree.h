@@ -14,16 +14,38 @@ extern "C" {
 #define BP_TREE_PRIVATE\
     BP_WRITER_PRIVATE\
     bp__rwlock_t rwlock;\
+    bp__mutex_t compact_lock;\
+    bp__mutex_t sample_lock;\
+    uint64_t sample_generation;\
+    uint64_t sample_offset;\
+    uint64_t sample_height;\
     bp__tree_head_t head;\
-    bp_compare_cb compare_cb;
+    bp_compare_cb compare_cb;\
+    struct bp__trace_s* op_trace;\
+    int op_trace_values;\
+    struct bp__warmup_s* warmup;\
+    uint64_t delta_chain;\
+    uint64_t buffer_messages;\
+    uint64_t inline_key_limit;\
+    struct bp__dedup_s* dedup;\
+    struct bp__builder_s* builder;\
+    struct bp__scrub_s* scrub;
 
 typedef struct bp__tree_head_s bp__tree_head_t;
 
 int bp__init(bp_db_t* tree);
+int bp__update(bp_db_t* tree,
+               const bp_key_t* key,
+               const bp_value_t* value,
+               const uint64_t expire,
+               bp_update_cb update_cb,
+               void* arg);
 void bp__destroy(bp_db_t* tree);
 
 int bp__tree_read_head(bp__writer_t* w, void* data);
 int bp__tree_write_head(bp__writer_t* w, void* data);
+int bp__tree_create_head(bp__writer_t* w, void* data);
+int bp__tree_miss_head(bp__writer_t* w, void* data);
 
 int bp__default_compare_cb(const bp_key_t* a, const bp_key_t* b);
 int bp__default_filter_cb(void* arg, const bp_key_t* key);
@@ -9,7 +9,32 @@ extern "C" {
 #include <stdint.h>
 
 #define BP__KV_HEADER_SIZE 24
-#define BP__KV_SIZE(kv) BP__KV_HEADER_SIZE + kv.length
+#define BP__KV_SIZE(kv) (BP__KV_HEADER_SIZE +\
+                         ((kv).key_config != 0 ?\
+                             BP__KV_OVERFLOW_SIZE :\
+                             (kv).length))
+/*
+ * Overflow key: keys longer than tree's inline_key_limit are written to
+ * their own block once, kv in page holds only offset and config of that
+ * block (and has BP__KV_OVERFLOW bit in serialized length). Copies of kv
+ * (separators in parent pages) share the block.
+ */
+#define BP__KV_OVERFLOW ((uint64_t) 1 << 63)
+#define BP__KV_OVERFLOW_SIZE 16
+/* size of serialized kv by its (big-endian decoded) length field */
+#define BP__KV_STORED_SIZE(length) (BP__KV_HEADER_SIZE +\
+                                    (((length) & BP__KV_OVERFLOW) ?\
+                                        BP__KV_OVERFLOW_SIZE :\
+                                        (length)))
+/*
+ * High 32 bits of kv config hold expiration time (seconds since epoch,
+ * 0 - never expires): of the value for leaf kvs, of the whole subtree
+ * (latest expiration of its kvs) for child page kvs.
+ */
+#define BP__KV_LENGTH(config) ((config) & 0xffffffff)
+#define BP__KV_EXPIRE(config) ((config) >> 32)
+#define BP__KV_EXPIRED(config, now)\
+    (BP__KV_EXPIRE(config) != 0 && BP__KV_EXPIRE(config) <= (now))
 #define BP__STOVAL(str, key)\
     key.value = (char*) str;\
     key.length = strlen(str) + 1;
@@ -25,20 +50,45 @@ int bp__value_load(bp_db_t* t,
                    const uint64_t offset,
                    const uint64_t length,
                    bp_value_t* value);
+/*
+ * Compressed value block must fit low 32 bits of kv config (the high ones
+ * are expiration), BP_ETOOLARGE otherwise. Checked before write changes
+ * anything.
+ */
+int bp__value_check(const bp_value_t* value);
 int bp__value_save(bp_db_t* t,
                    const bp_value_t* value,
                    const bp__kv_t* previous,
                    uint64_t* offset,
                    uint64_t* length);
 
+/*
+ * Copy value block (`length` is its config without expiration) to another
+ * file. Previous value link is dropped, blocks without one are copied
+ * as they are, without recompression.
+ */
+int bp__value_copy(bp_db_t* source,
+                   bp_db_t* target,
+                   uint64_t* offset,
+                   uint64_t* length);
+
 int bp__kv_copy(const bp__kv_t* source, bp__kv_t* target, int alloc);
 
+/* write key out of line if it is too long to be inline */
+int bp__kv_save_key(bp_db_t* t, bp__kv_t* kv);
+/* read key of overflow kv, kv owns it after */
+int bp__kv_load_key(bp_db_t* t, bp__kv_t* kv);
+
 struct bp__kv_s {
   BP_KEY_FIELDS
 
   uint64_t offset;
   uint64_t config;
 
+  /* key block of overflow key (0 - key is inline) */
+  uint64_t key_offset;
+  uint64_t key_config;
+
   uint8_t allocated;
 };
 
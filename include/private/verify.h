@@ -0,0 +1,89 @@
+#ifndef _PRIVATE_VERIFY_H_
+#define _PRIVATE_VERIFY_H_
+
+#include <stdint.h>
+#include "private/threads.h"
+#include "private/values.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Verifier walks the tree from one head, depth first. Every page is parsed,
+ * its keys (and buffered messages) must be strictly increasing and lie
+ * within separators of parent. Blocks are read past block cache and must
+ * decompress, value blocks may only link to older blocks. The format has
+ * no checksums, damage is found by decompression, parsing and order.
+ *
+ * Tree lock is taken for one read at a time, so writers aren't blocked by
+ * a walk. Blocks never move within one generation of file, a walk started
+ * before compaction is repeated from the new head.
+ *
+ * bp_verify() reads top levels in calling thread until there are
+ * BP__VERIFY_TASKS subtrees per thread, threads take them one by one.
+ */
+#define BP__VERIFY_THREADS 4
+#define BP__VERIFY_TASKS 8
+
+/* longest sleep of scrubber (us), and pause between its passes (ms) */
+#define BP__VERIFY_SLEEP 100000
+#define BP__SCRUB_PAUSE 1000
+
+/* walk was stopped or file was replaced, not an error */
+#define BP__VERIFY_STOPPED -1
+
+typedef struct bp__verify_s bp__verify_t;
+typedef struct bp__verify_task_s bp__verify_task_t;
+typedef struct bp__scrub_s bp__scrub_t;
+
+int bp__verify(bp_db_t* tree, uint32_t threads, bp_verify_stats_t* stats);
+
+int bp__scrub_start(bp_db_t* tree, const uint64_t rate);
+int bp__scrub_status(bp_db_t* tree, bp_verify_stats_t* stats);
+
+/* stop scrubber and free it, called by bp_close */
+int bp__scrub_stop(bp_db_t* tree, bp_verify_stats_t* stats);
+
+struct bp__verify_task_s {
+  uint64_t offset;
+  uint64_t config;
+
+  /* separators of parents around subtree, if there are any */
+  int has_lower;
+  int has_upper;
+  bp__kv_t lower;
+  bp__kv_t upper;
+};
+
+struct bp__verify_s {
+  bp_db_t* tree;
+  uint64_t generation;
+
+  int stop;
+  int stale;
+
+  /* scrubber reads no more than rate bytes per second since started */
+  uint64_t rate;
+  uint64_t started;
+
+  /* subtrees left for threads */
+  bp__verify_task_t* tasks;
+  uint64_t task_count;
+  uint64_t next_task;
+
+  bp_verify_stats_t stats;
+  int ret;
+};
+
+struct bp__scrub_s {
+  bp__verify_t verify;
+  pthread_t thread;
+  int result;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_VERIFY_H_ */
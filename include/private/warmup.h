@@ -0,0 +1,69 @@
+#ifndef _PRIVATE_WARMUP_H_
+#define _PRIVATE_WARMUP_H_
+
+#include <stdint.h>
+#include "private/threads.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Warmup reads pages level by level: offsets of one level are sorted,
+ * neighbours (no more than BP__WARMUP_GAP bytes apart) are merged into
+ * runs of up to BP__WARMUP_RUN bytes, and runs are read by reader threads.
+ * Children of interior pages found in a run form the next level.
+ *
+ * Hot file format (all numbers are big-endian uint64):
+ *   magic, device, inode, count, count * (offset, config)
+ */
+#define BP__WARMUP_GAP (64 * 1024)
+#define BP__WARMUP_RUN (1024 * 1024)
+#define BP__WARMUP_THREADS 4
+#define BP__WARMUP_HOT 4096
+#define BP__WARMUP_MAGIC "BPHOT001"
+
+typedef struct bp__warmup_s bp__warmup_t;
+typedef struct bp__warmup_page_s bp__warmup_page_t;
+
+int bp__warmup_start(bp_db_t* tree, const bp_warmup_t* policy);
+int bp__warmup_wait(bp_db_t* tree, uint64_t* loaded);
+
+/* stop warmup, save hot file and free everything, called by bp_close */
+void bp__warmup_destroy(bp_db_t* tree);
+
+/* remember page read by tree, for hot file */
+void bp__warmup_record(bp_db_t* tree,
+                       const uint64_t offset,
+                       const uint64_t config);
+
+struct bp__warmup_page_s {
+  uint64_t offset;
+  uint64_t config;
+  uint64_t generation;
+};
+
+struct bp__warmup_s {
+  bp_warmup_t policy;
+  char* hot_file;
+
+  pthread_t thread;
+  int running;
+  int stop;
+
+  int result;
+  uint64_t loaded;
+
+  /*
+   * Direct-mapped table of recently read pages. Readers update it
+   * without locks, torn entries are harmless: any (offset, size) pair
+   * read from the same file names valid bytes.
+   */
+  bp__warmup_page_t* hot;
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _PRIVATE_WARMUP_H_ */
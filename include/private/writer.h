@@ -10,8 +10,14 @@ extern "C" {
 
 #define BP_WRITER_PRIVATE \
     int fd;\
+    int flags;\
     char* filename;\
     uint64_t filesize;\
+    uint64_t generation;\
+    struct bp__trace_s* trace;\
+    struct bp__cache_s* cache;\
+    uint64_t cache_generation;\
+    bp__mutex_t* append_lock;\
     char padding[BP_PADDING];
 
 typedef struct bp__writer_s bp__writer_t;
@@ -22,21 +28,35 @@ enum comp_type {
   kCompressed = 1
 };
 
+enum block_type {
+  kHeadBlock = 0,
+  kPageBlock = 1,
+  kLeafBlock = 2,
+  kValueBlock = 3,
+  kPaddingBlock = 4
+};
+
 int bp__writer_create(bp__writer_t* w, const char* filename);
 int bp__writer_destroy(bp__writer_t* w);
 
 int bp__writer_fsync(bp__writer_t* w);
+int bp__writer_stat(bp__writer_t* w, uint64_t* size, int* replaced);
+
+/* drop blocks appended past `size`, which nothing references */
+int bp__writer_truncate(bp__writer_t* w, const uint64_t size);
 
 int bp__writer_compact_name(bp__writer_t* w, char** compact_name);
 int bp__writer_compact_finalize(bp__writer_t* s, bp__writer_t* t);
 
 int bp__writer_read(bp__writer_t* w,
                     const enum comp_type comp,
+                    const enum block_type block,
                     const uint64_t offset,
                     uint64_t* size,
                     void** data);
 int bp__writer_write(bp__writer_t* w,
                      const enum comp_type comp,
+                     const enum block_type block,
                      const void* data,
                      uint64_t* offset,
                      uint64_t* size);
@@ -45,6 +65,7 @@ int bp__writer_find(bp__writer_t* w,
                     const enum comp_type comp,
                     const uint64_t size,
                     void* data,
+                    const uint64_t limit,
                     bp__writer_cb seek,
                     bp__writer_cb miss);
 
@@ -1,15 +1,80 @@
 #include <stdlib.h> /* malloc */
-#include <string.h> /* strlen */
+#include <string.h> /* strlen, memcpy */
+#include <time.h> /* time */
 
 #include "bplus.h"
 #include "private/utils.h"
+#include "private/trace.h"
+#include "private/cache.h"
+#include "private/warmup.h"
+#include "private/dedup.h"
+#include "private/ingest.h"
+#include "private/merge.h"
+#include "private/diff.h"
+#include "private/verify.h"
+#include "private/sample.h"
+#include "private/split.h"
 
 
 int bp_open(bp_db_t* tree, const char* filename) {
+  return bp_open_ex(tree, filename, NULL);
+}
+
+
+void bp_options_init(bp_options_t* options) {
+  memset(options, 0, sizeof(*options));
+}
+
+
+int bp_open_ex(bp_db_t* tree,
+               const char* filename,
+               const bp_options_t* options) {
   int ret;
 
   ret = bp__rwlock_init(&tree->rwlock);
   if (ret != BP_OK) return ret;
+  ret = bp__mutex_init(&tree->compact_lock);
+  if (ret != BP_OK) {
+    bp__rwlock_destroy(&tree->rwlock);
+    return ret;
+  }
+  ret = bp__mutex_init(&tree->sample_lock);
+  if (ret != BP_OK) {
+    bp__mutex_destroy(&tree->compact_lock);
+    bp__rwlock_destroy(&tree->rwlock);
+    return ret;
+  }
+
+  tree->flags = options == NULL ? 0 : options->flags;
+  tree->generation = 0;
+  tree->sample_generation = 0;
+  tree->trace = NULL;
+  tree->op_trace = NULL;
+  tree->cache = NULL;
+  tree->warmup = NULL;
+  tree->delta_chain = options == NULL ? 0 : options->delta_chain;
+  tree->buffer_messages = options == NULL ? 0 : options->buffer_messages;
+  tree->inline_key_limit = options == NULL ? 0 : options->inline_key_limit;
+  tree->dedup = NULL;
+  tree->builder = NULL;
+  tree->scrub = NULL;
+
+  if (options != NULL && options->dedup_slots != 0) {
+    ret = bp__dedup_create(&tree->dedup, options->dedup_slots);
+    if (ret != BP_OK) goto fatal;
+  }
+
+  if (options != NULL && options->cache_size != 0) {
+    ret = bp__cache_create(options->cache_name,
+                           options->cache_size,
+                           options->cache_block_size == 0 ?
+                               BP__CACHE_BLOCK_SIZE :
+                               options->cache_block_size,
+                           options->flags & BP_OPEN_HUGE_PAGES,
+                           options->cache_nodes,
+                           &tree->cache);
+    if (ret != BP_OK) goto fatal;
+  }
 
   ret = bp__writer_create((bp__writer_t*) tree, filename);
   if (ret != BP_OK) goto fatal;
@@ -19,24 +84,93 @@ int bp_open(bp_db_t* tree, const char* filename) {
   ret = bp__init(tree);
   if (ret != BP_OK) goto fatal;
 
+  /* warmup is an optimization, its result is reported by bp_warmup_wait */
+  if (options != NULL && options->warmup != NULL) {
+    bp__warmup_start(tree, options->warmup);
+  }
+
   return BP_OK;
 
 fatal:
+  if (tree->cache != NULL) {
+    bp__cache_destroy(tree->cache);
+    tree->cache = NULL;
+  }
+  bp__dedup_destroy(tree->dedup);
+  tree->dedup = NULL;
+  bp__mutex_destroy(&tree->sample_lock);
+  bp__mutex_destroy(&tree->compact_lock);
   bp__rwlock_destroy(&tree->rwlock);
   return ret;
 }
 
 
 int bp_close(bp_db_t* tree) {
+  /* background warmup and scrubber take tree lock too */
+  bp__warmup_destroy(tree);
+  bp__scrub_stop(tree, NULL);
+
   bp__rwlock_wrlock(&tree->rwlock);
+  if (tree->trace != NULL) {
+    bp__trace_destroy(tree->trace);
+    tree->trace = NULL;
+  }
+  if (tree->op_trace != NULL) {
+    bp__trace_destroy(tree->op_trace);
+    tree->op_trace = NULL;
+  }
+  bp__build_destroy(tree);
   bp__destroy(tree);
+  if (tree->cache != NULL) {
+    bp__cache_destroy(tree->cache);
+    tree->cache = NULL;
+  }
+  bp__dedup_destroy(tree->dedup);
+  tree->dedup = NULL;
   bp__rwlock_unlock(&tree->rwlock);
 
+  bp__mutex_destroy(&tree->sample_lock);
+  bp__mutex_destroy(&tree->compact_lock);
   bp__rwlock_destroy(&tree->rwlock);
   return BP_OK;
 }
 
 
+void bp_warmup_init(bp_warmup_t* policy) {
+  memset(policy, 0, sizeof(*policy));
+}
+
+
+int bp_warmup(bp_db_t* tree, const bp_warmup_t* policy) {
+  return bp__warmup_start(tree, policy);
+}
+
+
+int bp_warmup_wait(bp_db_t* tree, uint64_t* loaded) {
+  return bp__warmup_wait(tree, loaded);
+}
+
+
+int bp_verify(bp_db_t* tree, uint32_t threads, bp_verify_stats_t* stats) {
+  return bp__verify(tree, threads, stats);
+}
+
+
+int bp_scrub_start(bp_db_t* tree, uint64_t rate) {
+  return bp__scrub_start(tree, rate);
+}
+
+
+int bp_scrub_status(bp_db_t* tree, bp_verify_stats_t* stats) {
+  return bp__scrub_status(tree, stats);
+}
+
+
+int bp_scrub_stop(bp_db_t* tree, bp_verify_stats_t* stats) {
+  return bp__scrub_stop(tree, stats);
+}
+
+
 int bp__init(bp_db_t* tree) {
   int ret;
   /*
@@ -48,8 +182,11 @@ int bp__init(bp_db_t* tree) {
                         kNotCompressed,
                         BP__HEAD_SIZE,
                         &tree->head,
+                        0,
                         bp__tree_read_head,
-                        bp__tree_write_head);
+                        tree->flags & BP_OPEN_RDONLY ?
+                            bp__tree_create_head :
+                            bp__tree_write_head);
   if (ret == BP_OK) {
     /* set default compare function */
     bp_set_compare_cb(tree, bp__default_compare_cb);
@@ -68,10 +205,108 @@ void bp__destroy(bp_db_t* tree) {
 }
 
 
+/*
+ * Open file at the same path and load its head first, the handle keeps
+ * the old file (and stays usable) if that fails.
+ */
+static int bp__reopen(bp_db_t* tree) {
+  int ret;
+  bp_db_t fresh;
+
+  /* shares options and cache of tree, its locks are never used */
+  memcpy(&fresh, tree, sizeof(fresh));
+  fresh.trace = NULL;
+  fresh.head.page = NULL;
+
+  ret = bp__writer_create((bp__writer_t*) &fresh, tree->filename);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__init(&fresh);
+  if (ret != BP_OK) {
+    bp__destroy(&fresh);
+    return ret;
+  }
+
+  /* compare function of tree is kept */
+  bp__destroy(tree);
+  tree->fd = fresh.fd;
+  tree->filename = fresh.filename;
+  tree->filesize = fresh.filesize;
+  tree->generation = fresh.generation;
+  tree->cache_generation = fresh.cache_generation;
+  tree->head = fresh.head;
+
+  return BP_OK;
+}
+
+
+int bp_refresh(bp_db_t* tree) {
+  int ret;
+  int replaced;
+  uint64_t size;
+  uint64_t limit;
+  bp__tree_head_t head;
+
+  if (!(tree->flags & BP_OPEN_RDONLY)) return BP_OK;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+
+  ret = bp__writer_stat((bp__writer_t*) tree, &size, &replaced);
+  if (ret != BP_OK) goto done;
+
+  if (replaced || size < tree->filesize) {
+    ret = bp__reopen(tree);
+    goto done;
+  }
+
+  /* nothing was appended */
+  if (size == tree->filesize) goto done;
+
+  /*
+   * Heads are written after pages they point to and are never split
+   * by padding, so the newest one (if any) is between the end of
+   * the previous scan and the end of file.
+   */
+  limit = tree->filesize - (tree->filesize % BP_PADDING);
+  tree->filesize = size;
+
+  head = tree->head;
+  tree->head.page = NULL;
+  ret = bp__writer_find((bp__writer_t*) tree,
+                        kNotCompressed,
+                        BP__HEAD_SIZE,
+                        &tree->head,
+                        limit,
+                        bp__tree_read_head,
+                        bp__tree_miss_head);
+  if (ret == BP_OK) {
+    bp__page_destroy(tree, head.page);
+  } else {
+    /* keep old head, new one isn't written yet */
+    tree->head = head;
+    if (ret == BP_ENOTFOUND) ret = BP_OK;
+  }
+
+done:
+  bp__rwlock_unlock(&tree->rwlock);
+  return ret;
+}
+
+
+int bp_cache_stats(bp_db_t* tree, bp_cache_stats_t* stats) {
+  if (tree->cache == NULL) return BP_ENOTFOUND;
+
+  bp__cache_stats(tree->cache, stats);
+  return BP_OK;
+}
+
+
 int bp_get(bp_db_t* tree, const bp_key_t* key, bp_value_t* value) {
   int ret;
 
   bp__rwlock_rdlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpGet)
+  BP__OPTRACE(tree, kTraceOpGet, 1, key, NULL)
 
   ret = bp__page_get(tree, tree->head.page, key, value);
 
@@ -87,6 +322,7 @@ int bp_get_previous(bp_db_t* tree,
   if (value->_prev_offset == 0 && value->_prev_length == 0) {
     return BP_ENOTFOUND;
   }
+  BP__TRACE_OP(tree, kTraceOpGet)
   return bp__value_load(tree,
                         value->_prev_offset,
                         value->_prev_length,
@@ -99,11 +335,34 @@ int bp_update(bp_db_t* tree,
               const bp_value_t* value,
               bp_update_cb update_cb,
               void* arg) {
+  return bp__update(tree, key, value, 0, update_cb, arg);
+}
+
+
+int bp__update(bp_db_t* tree,
+               const bp_key_t* key,
+               const bp_value_t* value,
+               const uint64_t expire,
+               bp_update_cb update_cb,
+               void* arg) {
   int ret;
 
-  bp__rwlock_wrlock(&tree->rwlock);
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
 
-  ret = bp__page_insert(tree, tree->head.page, key, value, update_cb, arg);
+  ret = bp__value_check(value);
+  if (ret != BP_OK) return ret;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpSet)
+  BP__OPTRACE(tree, kTraceOpSet, 1, key, value)
+
+  ret = bp__page_insert(tree,
+                        tree->head.page,
+                        key,
+                        value,
+                        expire > 0xffffffff ? 0xffffffff : expire,
+                        update_cb,
+                        arg);
   if (ret == BP_OK) {
     ret = bp__tree_write_head((bp__writer_t*) tree, NULL);
   }
@@ -124,8 +383,18 @@ int bp_bulk_update(bp_db_t* tree,
   bp_key_t* keys_iter = (bp_key_t*) *keys;
   bp_value_t* values_iter = (bp_value_t*) *values;
   uint64_t left = count;
+  uint64_t i;
+
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  for (i = 0; i < count; i++) {
+    ret = bp__value_check(&values_iter[i]);
+    if (ret != BP_OK) return ret;
+  }
 
   bp__rwlock_wrlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpBulk)
+  BP__OPTRACE(tree, kTraceOpBulk, count, keys_iter, values_iter)
 
   ret = bp__page_bulk_insert(tree,
                              tree->head.page,
@@ -150,6 +419,14 @@ int bp_set(bp_db_t* tree, const bp_key_t* key, const bp_value_t* value) {
 }
 
 
+int bp_set_expire(bp_db_t* tree,
+                  const bp_key_t* key,
+                  const bp_value_t* value,
+                  const uint64_t expire) {
+  return bp__update(tree, key, value, expire, NULL, NULL);
+}
+
+
 int bp_bulk_set(bp_db_t* tree,
                 const uint64_t count,
                 const bp_key_t** keys,
@@ -164,7 +441,11 @@ int bp_removev(bp_db_t* tree,
                void *arg) {
   int ret;
 
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
   bp__rwlock_wrlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpRemove)
+  BP__OPTRACE(tree, kTraceOpRemove, 1, key, NULL)
 
   ret = bp__page_remove(tree, tree->head.page, key, remove_cb, arg);
   if (ret == BP_OK) {
@@ -182,10 +463,39 @@ int bp_remove(bp_db_t* tree, const bp_key_t* key) {
 }
 
 
-int bp_compact(bp_db_t* tree) {
+int bp_purge_expired(bp_db_t* tree, const uint64_t limit, uint64_t* purged) {
+  int ret;
+  uint64_t count;
+  uint64_t offset;
+
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpRemove)
+
+  count = limit == 0 ? (uint64_t) -1 : limit;
+  offset = tree->head.page->offset;
+
+  ret = bp__page_purge(tree, tree->head.page, (uint64_t) time(NULL), &count);
+  if (ret == BP_OK && tree->head.page->offset != offset) {
+    ret = bp__tree_write_head((bp__writer_t*) tree, NULL);
+  }
+
+  if (purged != NULL) {
+    *purged = (limit == 0 ? (uint64_t) -1 : limit) - count;
+  }
+
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
+static int bp__compact(bp_db_t* tree) {
   int ret;
   char* compacted_name;
   bp_db_t compacted;
+  bp__dedup_t* dedup;
 
   /* get name of compacted database (prefixed with .compact) */
   ret = bp__writer_compact_name((bp__writer_t*) tree, &compacted_name);
@@ -196,27 +506,182 @@ int bp_compact(bp_db_t* tree) {
   free(compacted_name);
   if (ret != BP_OK) return ret;
 
+  /* equal values share blocks in compacted file, index is kept after */
+  if (tree->dedup != NULL) {
+    ret = bp__dedup_create(&compacted.dedup, tree->dedup->slot_count);
+    if (ret != BP_OK) {
+      bp_close(&compacted);
+      return ret;
+    }
+  }
+
   /* destroy stub head page */
   bp__page_destroy(&compacted, compacted.head.page);
 
   bp__rwlock_rdlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpCompact)
+  BP__OPTRACE(tree, kTraceOpCompact, 0, NULL, NULL)
 
   /* clone source tree's head page */
   ret = bp__page_clone(&compacted, tree->head.page, &compacted.head.page);
 
+  /* writes to compacted file are traced too */
+  compacted.trace = tree->trace;
+
   bp__rwlock_unlock(&tree->rwlock);
 
   /* copy all pages starting from head */
   ret = bp__page_copy(tree, &compacted, compacted.head.page);
-  if (ret != BP_OK) return ret;
+  if (ret == BP_OK) {
+    ret = bp__tree_write_head((bp__writer_t*) &compacted, NULL);
+  }
 
-  ret = bp__tree_write_head((bp__writer_t*) &compacted, NULL);
+  compacted.trace = NULL;
   if (ret != BP_OK) return ret;
 
+  dedup = compacted.dedup;
+  compacted.dedup = NULL;
+
   bp__rwlock_wrlock(&tree->rwlock);
 
   ret = bp__writer_compact_finalize((bp__writer_t*) tree,
                                     (bp__writer_t*) &compacted);
+  if (ret == BP_OK) {
+    bp__dedup_destroy(tree->dedup);
+    tree->dedup = dedup;
+    dedup = NULL;
+  }
+  bp__rwlock_unlock(&tree->rwlock);
+  bp__dedup_destroy(dedup);
+
+  return ret;
+}
+
+
+int bp_compact(bp_db_t* tree) {
+  int ret;
+
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  /*
+   * Compaction reads and writes without tree lock, and the compacted file
+   * shares I/O trace of tree: it can't be started or stopped meanwhile.
+   */
+  bp__mutex_lock(&tree->compact_lock);
+  ret = bp__compact(tree);
+  bp__mutex_unlock(&tree->compact_lock);
+
+  return ret;
+}
+
+
+int bp_build_add(bp_db_t* tree, const bp_key_t* key, const bp_value_t* value) {
+  int ret;
+
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  ret = bp__value_check(value);
+  if (ret != BP_OK) return ret;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  ret = bp__build_add(tree, key, value);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
+int bp_build_finish(bp_db_t* tree) {
+  int ret;
+
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpBulk)
+  ret = bp__build_finish(tree);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
+int bp_build_parallel(bp_db_t* tree,
+                      const uint64_t run_count,
+                      const uint64_t* counts,
+                      const bp_key_t** keys,
+                      const bp_value_t** values,
+                      const uint32_t threads) {
+  int ret;
+
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpBulk)
+  ret = bp__build_parallel(tree, run_count, counts, keys, values, threads);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
+int bp_ingest(bp_db_t* tree, const char* filename) {
+  if (tree->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  return bp__ingest(tree, filename);
+}
+
+
+int bp_merge_files(const char* src_a,
+                   const char* src_b,
+                   bp_db_t* dst,
+                   const int policy) {
+  if (dst->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
+
+  return bp__merge_files(dst, src_a, src_b, policy);
+}
+
+
+int bp_split_file(bp_db_t* tree,
+                  const bp_key_t* split_key,
+                  const char* left,
+                  const char* right) {
+  BP__TRACE_OP(tree, kTraceOpCompact)
+  return bp__split_file(tree, split_key, left, right);
+}
+
+
+int bp_head(bp_db_t* tree, bp_head_t* head) {
+  bp__rwlock_rdlock(&tree->rwlock);
+  bp__head(tree, head);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return BP_OK;
+}
+
+
+int bp_heads(bp_db_t* tree,
+             const uint64_t count,
+             bp_head_t* heads,
+             uint64_t* found) {
+  int ret;
+
+  bp__rwlock_rdlock(&tree->rwlock);
+  ret = bp__heads(tree, count, heads, found);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
+int bp_diff(bp_db_t* tree,
+            const bp_head_t* old_head,
+            const bp_head_t* new_head,
+            bp_diff_cb cb,
+            void* arg) {
+  int ret;
+
+  bp__rwlock_rdlock(&tree->rwlock);
+  ret = bp__diff_heads(tree, old_head, new_head, cb, arg);
   bp__rwlock_unlock(&tree->rwlock);
 
   return ret;
@@ -232,6 +697,11 @@ int bp_get_filtered_range(bp_db_t* tree,
   int ret;
 
   bp__rwlock_rdlock(&tree->rwlock);
+  BP__TRACE_OP(tree, kTraceOpRange)
+  if (tree->op_trace != NULL) {
+    /* end key is always stored as value */
+    bp__trace_op_record(tree->op_trace, kTraceOpRange, 1, start, end, 1);
+  }
 
   ret = bp__page_get_range(tree,
                            tree->head.page,
@@ -264,6 +734,35 @@ int bp_get_range(bp_db_t* tree,
 /* Wrappers to allow string to string set/get/remove */
 
 
+int bp_split_points(bp_db_t* tree,
+                    uint64_t n,
+                    bp_key_t* keys,
+                    uint64_t* count) {
+  int ret;
+
+  bp__rwlock_rdlock(&tree->rwlock);
+  ret = bp__split_points(tree, n, keys, count);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
+int bp_sample(bp_db_t* tree,
+              uint64_t count,
+              uint64_t seed,
+              bp_range_cb cb,
+              void* arg) {
+  int ret;
+
+  bp__rwlock_rdlock(&tree->rwlock);
+  ret = bp__sample(tree, count, seed, cb, arg);
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
 int bp_gets(bp_db_t* tree, const char* key, char** value) {
   int ret;
   bp_key_t bkey;
@@ -300,6 +799,20 @@ int bp_sets(bp_db_t* tree, const char* key, const char* value) {
 }
 
 
+int bp_sets_expire(bp_db_t* tree,
+                   const char* key,
+                   const char* value,
+                   const uint64_t expire) {
+  bp_key_t bkey;
+  bp_value_t bvalue;
+
+  BP__STOVAL(key, bkey);
+  BP__STOVAL(value, bvalue);
+
+  return bp_set_expire(tree, &bkey, &bvalue, expire);
+}
+
+
 int bp_bulk_updates(bp_db_t* tree,
                     const uint64_t count,
                     const char** keys,
@@ -404,6 +917,82 @@ void bp_set_compare_cb(bp_db_t* tree, bp_compare_cb cb) {
 }
 
 
+int bp_io_trace_start(bp_db_t* tree, const char* filename) {
+  int ret;
+
+  /* running compaction writes to the current trace, wait for it */
+  bp__mutex_lock(&tree->compact_lock);
+  bp__rwlock_wrlock(&tree->rwlock);
+  if (tree->trace != NULL) {
+    ret = bp__trace_destroy(tree->trace);
+    tree->trace = NULL;
+    if (ret != BP_OK) goto fatal;
+  }
+
+  ret = bp__trace_create((bp__writer_t*) tree,
+                         filename,
+                         BP__TRACE_MAGIC,
+                         &tree->trace);
+
+fatal:
+  bp__rwlock_unlock(&tree->rwlock);
+  bp__mutex_unlock(&tree->compact_lock);
+  return ret;
+}
+
+
+int bp_io_trace_stop(bp_db_t* tree) {
+  int ret = BP_OK;
+
+  bp__mutex_lock(&tree->compact_lock);
+  bp__rwlock_wrlock(&tree->rwlock);
+  if (tree->trace != NULL) {
+    ret = bp__trace_destroy(tree->trace);
+    tree->trace = NULL;
+  }
+  bp__rwlock_unlock(&tree->rwlock);
+  bp__mutex_unlock(&tree->compact_lock);
+
+  return ret;
+}
+
+
+int bp_op_trace_start(bp_db_t* tree, const char* filename, int flags) {
+  int ret;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  if (tree->op_trace != NULL) {
+    ret = bp__trace_destroy(tree->op_trace);
+    tree->op_trace = NULL;
+    if (ret != BP_OK) goto fatal;
+  }
+
+  tree->op_trace_values = (flags & BP_TRACE_VALUES) != 0;
+  ret = bp__trace_create((bp__writer_t*) tree,
+                         filename,
+                         BP__OPTRACE_MAGIC,
+                         &tree->op_trace);
+
+fatal:
+  bp__rwlock_unlock(&tree->rwlock);
+  return ret;
+}
+
+
+int bp_op_trace_stop(bp_db_t* tree) {
+  int ret = BP_OK;
+
+  bp__rwlock_wrlock(&tree->rwlock);
+  if (tree->op_trace != NULL) {
+    ret = bp__trace_destroy(tree->op_trace);
+    tree->op_trace = NULL;
+  }
+  bp__rwlock_unlock(&tree->rwlock);
+
+  return ret;
+}
+
+
 int bp_fsync(bp_db_t* tree) {
   int ret;
 
@@ -443,6 +1032,30 @@ int bp__tree_read_head(bp__writer_t* w, void* data) {
 }
 
 
+int bp__tree_create_head(bp__writer_t* w, void* data) {
+  int ret;
+  bp_db_t* t = (bp_db_t*) w;
+
+  if (t->head.page != NULL) return BP_OK;
+
+  /* TODO: page size should be configurable */
+  t->head.page_size = 64;
+
+  /* Create empty leaf page */
+  ret = bp__page_create(t, kLeaf, 0, 1, &t->head.page);
+  if (ret != BP_OK) return ret;
+
+  t->head.page->is_head = 1;
+
+  return BP_OK;
+}
+
+
+int bp__tree_miss_head(bp__writer_t* w, void* data) {
+  return BP_ENOTFOUND;
+}
+
+
 int bp__tree_write_head(bp__writer_t* w, void* data) {
   int ret;
   bp_db_t* t = (bp_db_t*) w;
@@ -450,16 +1063,8 @@ int bp__tree_write_head(bp__writer_t* w, void* data) {
   uint64_t offset;
   uint64_t size;
 
-  if (t->head.page == NULL) {
-    /* TODO: page size should be configurable */
-    t->head.page_size = 64;
-
-    /* Create empty leaf page */
-    ret = bp__page_create(t, kLeaf, 0, 1, &t->head.page);
-    if (ret != BP_OK) return ret;
-
-    t->head.page->is_head = 1;
-  }
+  ret = bp__tree_create_head(w, data);
+  if (ret != BP_OK) return ret;
 
   /* Update head's position */
   t->head.offset = t->head.page->offset;
@@ -476,6 +1081,7 @@ int bp__tree_write_head(bp__writer_t* w, void* data) {
   size = BP__HEAD_SIZE;
   ret = bp__writer_write(w,
                          kNotCompressed,
+                         kHeadBlock,
                          &nhead,
                          &offset,
                          &size);
@@ -0,0 +1,464 @@
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memmove */
+#include <time.h> /* time */
+
+#include "bplus.h"
+#include "private/buffers.h"
+#include "private/pages.h"
+
+
+int bp__buffer_search(bp_db_t* t,
+                      bp__page_t* page,
+                      const bp_key_t* key,
+                      uint64_t* index) {
+  uint64_t low = 0;
+  uint64_t high = page->buffer_length;
+  uint64_t middle;
+  int cmp;
+
+  while (low < high) {
+    middle = low + (high - low) / 2;
+    cmp = t->compare_cb((bp_key_t*) &page->buffer[middle], key);
+    if (cmp == 0) {
+      *index = middle;
+      return BP_OK;
+    }
+    if (cmp < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  *index = low;
+  return BP_ENOTFOUND;
+}
+
+
+int bp__buffer_put(bp_db_t* t, bp__page_t* page, const bp__kv_t* msg) {
+  int ret;
+  uint64_t index;
+  uint64_t capacity;
+  bp__kv_t* grown;
+
+  /* newer message replaces older one */
+  if (bp__buffer_search(t, page, (bp_key_t*) msg, &index) == BP_OK) {
+    bp__buffer_remove_idx(page, index);
+  }
+
+  if (page->buffer_length == page->buffer_capacity) {
+    capacity = page->buffer_capacity == 0 ? 16 : page->buffer_capacity * 2;
+    grown = realloc(page->buffer, (size_t) capacity * sizeof(*grown));
+    if (grown == NULL) return BP_EALLOC;
+    page->buffer = grown;
+    page->buffer_capacity = capacity;
+  }
+
+  memmove(&page->buffer[index + 1],
+          &page->buffer[index],
+          (size_t) (page->buffer_length - index) * sizeof(*page->buffer));
+  ret = bp__kv_copy(msg, &page->buffer[index], 1);
+  if (ret != BP_OK) {
+    memmove(&page->buffer[index],
+            &page->buffer[index + 1],
+            (size_t) (page->buffer_length - index) * sizeof(*page->buffer));
+    return ret;
+  }
+
+  page->buffer_length++;
+  page->buffer_size += BP__KV_SIZE((*msg));
+  return BP_OK;
+}
+
+
+void bp__buffer_remove_idx(bp__page_t* page, const uint64_t index) {
+  page->buffer_size -= BP__KV_SIZE(page->buffer[index]);
+  if (page->buffer[index].allocated) free(page->buffer[index].value);
+
+  page->buffer_length--;
+  memmove(&page->buffer[index],
+          &page->buffer[index + 1],
+          (size_t) (page->buffer_length - index) * sizeof(*page->buffer));
+}
+
+
+void bp__buffer_destroy(bp__page_t* page) {
+  uint64_t i;
+
+  for (i = 0; i < page->buffer_length; i++) {
+    if (page->buffer[i].allocated) free(page->buffer[i].value);
+  }
+  free(page->buffer);
+
+  page->buffer = NULL;
+  page->buffer_length = 0;
+  page->buffer_size = 0;
+  page->buffer_capacity = 0;
+}
+
+
+int bp__buffer_copy(bp_db_t* t,
+                    bp__page_t* source,
+                    bp__page_t* target,
+                    const bp_key_t* lower,
+                    const bp_key_t* upper) {
+  int ret;
+  uint64_t i;
+  bp_key_t* key;
+
+  for (i = 0; i < source->buffer_length; i++) {
+    key = (bp_key_t*) &source->buffer[i];
+    if (lower != NULL && t->compare_cb(key, lower) < 0) continue;
+    if (upper != NULL && t->compare_cb(key, upper) >= 0) break;
+
+    ret = bp__buffer_put(t, target, &source->buffer[i]);
+    if (ret != BP_OK) return ret;
+  }
+
+  return BP_OK;
+}
+
+
+/* value of the newest version of key (if it is live), for callbacks */
+static int bp__buffer_previous(bp_db_t* t,
+                               bp__page_t* page,
+                               const bp_key_t* key,
+                               const int found,
+                               const uint64_t index,
+                               bp__kv_t* previous) {
+  uint64_t config;
+  int ret;
+
+  if (found) {
+    previous->offset = page->buffer[index].offset;
+    config = page->buffer[index].config;
+  } else {
+    ret = bp__page_lookup(t, page, key, &previous->offset, &config);
+    if (ret != BP_OK) return ret;
+  }
+
+  if (BP__MSG_REMOVED(config) ||
+      BP__KV_EXPIRED(config, (uint64_t) time(NULL))) {
+    return BP_ENOTFOUND;
+  }
+
+  previous->length = BP__KV_LENGTH(config);
+  return BP_OK;
+}
+
+
+/* replaced message's overflow key block is reused */
+static int bp__buffer_msg_key(bp_db_t* t,
+                              bp__page_t* page,
+                              const int found,
+                              const uint64_t index,
+                              bp__kv_t* msg) {
+  if (!found) return bp__kv_save_key(t, msg);
+
+  msg->key_offset = page->buffer[index].key_offset;
+  msg->key_config = page->buffer[index].key_config;
+  return BP_OK;
+}
+
+
+int bp__buffer_insert(bp_db_t* t,
+                      bp__page_t* page,
+                      const bp_key_t* key,
+                      const bp_value_t* value,
+                      const uint64_t expire,
+                      bp_update_cb update_cb,
+                      void* arg,
+                      int* handled) {
+  int ret;
+  int found;
+  int live;
+  uint64_t index;
+  bp__kv_t previous;
+  bp__kv_t msg;
+
+  found = bp__buffer_search(t, page, key, &index) == BP_OK;
+  *handled = found || (t->buffer_messages != 0 && page->is_head);
+  if (!*handled) return BP_OK;
+
+  /* lookup below head is only needed to solve conflicts */
+  live = 0;
+  if (found || update_cb != NULL) {
+    ret = bp__buffer_previous(t, page, key, found, index, &previous);
+    if (ret != BP_OK && ret != BP_ENOTFOUND) return ret;
+    live = ret == BP_OK;
+  }
+
+  if (live && update_cb != NULL) {
+    bp_value_t prev_value;
+
+    ret = bp__value_load(t, previous.offset, previous.length, &prev_value);
+    if (ret != BP_OK) return ret;
+
+    ret = update_cb(arg, &prev_value, value);
+    free(prev_value.value);
+
+    if (!ret) return BP_EUPDATECONFLICT;
+  }
+
+  msg.value = key->value;
+  msg.length = key->length;
+  ret = bp__buffer_msg_key(t, page, found, index, &msg);
+  if (ret != BP_OK) return ret;
+  ret = bp__value_save(t,
+                       value,
+                       live ? &previous : NULL,
+                       &msg.offset,
+                       &msg.config);
+  if (ret != BP_OK) return ret;
+  msg.config |= expire << 32;
+
+  return bp__buffer_put(t, page, &msg);
+}
+
+
+int bp__buffer_remove(bp_db_t* t,
+                      bp__page_t* page,
+                      const bp_key_t* key,
+                      bp_remove_cb remove_cb,
+                      void* arg,
+                      int* handled) {
+  int ret;
+  int found;
+  uint64_t index;
+  bp__kv_t previous;
+  bp__kv_t msg;
+
+  found = bp__buffer_search(t, page, key, &index) == BP_OK;
+  *handled = found || (t->buffer_messages != 0 && page->is_head);
+  if (!*handled) return BP_OK;
+
+  ret = bp__buffer_previous(t, page, key, found, index, &previous);
+  if (ret != BP_OK) return ret;
+
+  /* remove only if remove_cb returns BP_OK */
+  if (remove_cb != NULL) {
+    bp_value_t prev_value;
+
+    ret = bp__value_load(t, previous.offset, previous.length, &prev_value);
+    if (ret != BP_OK) return ret;
+
+    ret = remove_cb(arg, &prev_value);
+    free(prev_value.value);
+
+    if (!ret) return BP_EREMOVECONFLICT;
+  }
+
+  /* removal message hides all older versions */
+  msg.value = key->value;
+  msg.length = key->length;
+  msg.offset = 0;
+  msg.config = 0;
+  ret = bp__buffer_msg_key(t, page, found, index, &msg);
+  if (ret != BP_OK) return ret;
+  return bp__buffer_put(t, page, &msg);
+}
+
+
+/* apply message to leaf which has room for one more kv */
+static int bp__buffer_apply(bp_db_t* t, bp__page_t* leaf, const bp__kv_t* msg) {
+  int ret;
+  bp__page_search_res_t res;
+
+  ret = bp__page_search(t, leaf, (bp_key_t*) msg, kNotLoad, &res);
+  if (ret != BP_OK) return ret;
+
+  if (res.cmp == 0) bp__page_remove_idx(t, leaf, res.index);
+  if (BP__MSG_REMOVED(msg->config)) return BP_OK;
+
+  bp__page_shiftr(t, leaf, res.index);
+  ret = bp__kv_copy(msg, &leaf->keys[res.index], 1);
+  if (ret != BP_OK) {
+    bp__page_shiftl(t, leaf, res.index);
+    return ret;
+  }
+
+  leaf->byte_size += BP__KV_SIZE((*msg));
+  leaf->length++;
+  return BP_OK;
+}
+
+
+/* move `count` messages starting at `first` from parent to child */
+static int bp__buffer_push(bp_db_t* t,
+                           bp__page_t* parent,
+                           const uint64_t first,
+                           uint64_t count,
+                           bp__page_t* child) {
+  int ret;
+
+  if (child->type == kPage) {
+    for (; count > 0; count--) {
+      ret = bp__buffer_put(t, child, &parent->buffer[first]);
+      if (ret != BP_OK) return ret;
+      bp__buffer_remove_idx(parent, first);
+    }
+    return bp__buffer_flush(t, &child);
+  }
+
+  /* leaf is split once full, the rest of batch waits in parent */
+  for (; count > 0 && child->length < t->head.page_size; count--) {
+    ret = bp__buffer_apply(t, child, &parent->buffer[first]);
+    if (ret != BP_OK) return ret;
+    bp__buffer_remove_idx(parent, first);
+  }
+
+  return child->length == t->head.page_size ? BP_ESPLITPAGE : BP_OK;
+}
+
+
+int bp__buffer_flush(bp_db_t* t, bp__page_t** page) {
+  int ret;
+  uint64_t i, j, m;
+  uint64_t first, count;
+  uint64_t best, best_first, best_count;
+  bp__page_t* p = *page;
+  bp__page_t* child;
+
+  if (t->buffer_messages == 0) return BP_OK;
+
+  while (p->buffer_length > t->buffer_messages) {
+    /* messages and children are both sorted, find the largest batch */
+    i = 0;
+    first = 0;
+    count = 0;
+    best = 0;
+    best_first = 0;
+    best_count = 0;
+    for (m = 0; m < p->buffer_length; m++) {
+      j = i;
+      while (j + 1 < p->length &&
+             t->compare_cb((bp_key_t*) &p->keys[j + 1],
+                           (bp_key_t*) &p->buffer[m]) <= 0) {
+        j++;
+      }
+      if (j != i) {
+        i = j;
+        first = m;
+        count = 0;
+      }
+      count++;
+      if (count > best_count) {
+        best = i;
+        best_first = first;
+        best_count = count;
+      }
+    }
+
+    ret = bp__page_load(t, p->keys[best].offset, p->keys[best].config, &child);
+    if (ret != BP_OK) return ret;
+
+    ret = bp__buffer_push(t, p, best_first, best_count, child);
+    if (ret == BP_ESPLITPAGE) {
+      ret = bp__page_split(t, p, best, child);
+    } else if (ret == BP_OK) {
+      ret = bp__page_save(t, child);
+      if (ret == BP_OK) {
+        p->keys[best].offset = child->offset;
+        p->keys[best].config = child->config;
+      }
+    }
+
+    bp__page_destroy(t, child);
+    if (ret != BP_OK) return ret;
+
+    if (p->length == t->head.page_size) {
+      /* Notify caller that it should split page */
+      if (!p->is_head) return BP_ESPLITPAGE;
+
+      /* messages are split between halves, new head has none */
+      ret = bp__page_split_head(t, &p);
+      *page = p;
+      if (ret != BP_OK) return ret;
+    }
+  }
+
+  return BP_OK;
+}
+
+
+void bp__buffer_range_init(bp__buffer_range_t* range,
+                           bp_db_t* t,
+                           bp__page_t* page,
+                           const bp_key_t* start,
+                           const bp_key_t* end,
+                           bp_filter_cb filter,
+                           bp_range_cb cb,
+                           void* arg) {
+  range->t = t;
+  range->page = page;
+  range->now = (uint64_t) time(NULL);
+  range->filter = filter;
+  range->cb = cb;
+  range->arg = arg;
+  range->ret = BP_OK;
+
+  /* messages within [start, end] */
+  bp__buffer_search(t, page, start, &range->index);
+  if (bp__buffer_search(t, page, end, &range->end) == BP_OK) range->end++;
+  if (range->end < range->index) range->end = range->index;
+}
+
+
+int bp__buffer_range_filter(void* arg, const bp_key_t* key) {
+  bp__buffer_range_t* range = arg;
+  return range->filter(range->arg, key);
+}
+
+
+/* pass message at range->index to callback, if it is a live value */
+static void bp__buffer_range_msg(bp__buffer_range_t* range) {
+  bp__kv_t* msg = &range->page->buffer[range->index++];
+  bp_value_t value;
+  int ret;
+
+  if (BP__MSG_REMOVED(msg->config)) return;
+  if (BP__KV_EXPIRED(msg->config, range->now)) return;
+  if (!range->filter(range->arg, (bp_key_t*) msg)) return;
+
+  ret = bp__value_load(range->t,
+                       msg->offset,
+                       BP__KV_LENGTH(msg->config),
+                       &value);
+  if (ret != BP_OK) {
+    range->ret = ret;
+    return;
+  }
+
+  range->cb(range->arg, (bp_key_t*) msg, &value);
+  free(value.value);
+}
+
+
+void bp__buffer_range_cb(void* arg,
+                         const bp_key_t* key,
+                         const bp_value_t* value) {
+  bp__buffer_range_t* range = arg;
+  bp_db_t* t = range->t;
+  int cmp;
+
+  while (range->ret == BP_OK && range->index < range->end) {
+    cmp = t->compare_cb((bp_key_t*) &range->page->buffer[range->index], key);
+    if (cmp > 0) break;
+
+    bp__buffer_range_msg(range);
+
+    /* message is newer than kv with the same key */
+    if (cmp == 0) return;
+  }
+  if (range->ret != BP_OK) return;
+
+  range->cb(range->arg, key, value);
+}
+
+
+int bp__buffer_range_finish(bp__buffer_range_t* range, int ret) {
+  while (range->ret == BP_OK && range->index < range->end) {
+    bp__buffer_range_msg(range);
+  }
+  return ret != BP_OK ? ret : range->ret;
+}
@@ -0,0 +1,694 @@
+/* MAP_ANONYMOUS, sched_getcpu */
+#define _GNU_SOURCE
+
+#include "bplus.h"
+#include "private/cache.h"
+#include "private/utils.h"
+
+#include <fcntl.h> /* O_RDWR, O_CREAT */
+#include <unistd.h> /* close, ftruncate, usleep */
+#include <sched.h> /* sched_yield, sched_getcpu */
+#include <errno.h> /* errno */
+#include <sys/mman.h> /* mmap, shm_open */
+#include <sys/stat.h> /* fstat */
+#include <sys/ioctl.h> /* ioctl */
+#include <linux/fs.h> /* FS_IOC_GETVERSION */
+#include <sys/syscall.h> /* SYS_mbind */
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* memcpy, memcmp */
+#include <stdio.h> /* fopen, fgets, sscanf */
+
+/* how long to wait for other process to initialize segment (ms) */
+#define BP__CACHE_WAIT 1000
+
+#define BP__CACHE_ALIGN(size) (((size) + BP_PADDING - 1) & ~(BP_PADDING - 1))
+
+#define BP__CACHE_SLOT(cache, index)\
+    ((bp__cache_slot_t*) ((cache)->slots +\
+                          (index) * (cache)->header->slot_size))
+
+#define BP__CACHE_DATA(slot) ((char*) (slot) + sizeof(bp__cache_slot_t))
+
+#define BP__CACHE_HUGE_ALIGN(size)\
+    (((size) + BP__CACHE_HUGE_PAGE - 1) & ~(uint64_t) (BP__CACHE_HUGE_PAGE - 1))
+
+
+static int bp__cache_init(bp__cache_t* cache, const uint64_t block_size) {
+  bp__cache_header_t* header = cache->header;
+  uint64_t start = BP__CACHE_ALIGN(sizeof(*header));
+
+  if (cache->size < start) return BP_ECACHE;
+
+  header->size = cache->size;
+  header->block_size = block_size;
+  header->slot_size = BP__CACHE_ALIGN(sizeof(bp__cache_slot_t) + block_size);
+  header->slot_count = (cache->size - start) / header->slot_size;
+  header->slot_count -= header->slot_count % BP__CACHE_WAYS;
+  if (header->slot_count == 0) return BP_ECACHE;
+
+  memcpy(header->magic, BP__CACHE_MAGIC, sizeof(header->magic));
+
+  /* other processes may start using segment now */
+  __sync_synchronize();
+  header->ready = 1;
+
+  return BP_OK;
+}
+
+
+static int bp__cache_attach(bp__cache_t* cache, int fd) {
+  struct stat st;
+  int i;
+
+  /* creator may not have resized segment yet */
+  for (i = 0; i < BP__CACHE_WAIT; i++) {
+    if (fstat(fd, &st) != 0) return BP_ECACHE;
+    if ((uint64_t) st.st_size >= sizeof(*cache->header)) break;
+    usleep(1000);
+  }
+  if (i == BP__CACHE_WAIT) return BP_ECACHE;
+
+  cache->size = (uint64_t) st.st_size;
+  cache->map_size = cache->size;
+  cache->mem = mmap(NULL,
+                    (size_t) cache->size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED,
+                    fd,
+                    0);
+  if (cache->mem == MAP_FAILED) return BP_ECACHE;
+  cache->header = (bp__cache_header_t*) cache->mem;
+
+  for (i = 0; i < BP__CACHE_WAIT && !cache->header->ready; i++) usleep(1000);
+  __sync_synchronize();
+
+  if (!cache->header->ready ||
+      memcmp(cache->header->magic, BP__CACHE_MAGIC, 8) != 0 ||
+      cache->header->size != cache->size) {
+    munmap(cache->mem, (size_t) cache->size);
+    return BP_ECACHE;
+  }
+
+  return BP_OK;
+}
+
+
+static void* bp__cache_map_private(bp__cache_t* cache, const int huge) {
+  void* mem;
+  char* aligned;
+  uint64_t slack;
+
+  if (!huge) {
+    /* shared with forked children */
+    return mmap(NULL,
+                (size_t) cache->size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS,
+                -1,
+                0);
+  }
+
+  /*
+   * Shared anonymous memory is shmem, which rarely has transparent huge
+   * pages enabled, hence private mapping (children get a copy).
+   */
+  cache->map_size = BP__CACHE_HUGE_ALIGN(cache->size);
+
+#ifdef MAP_HUGETLB
+  /* explicit huge pages, if they are reserved (vm.nr_hugepages) */
+  mem = mmap(NULL,
+             (size_t) cache->map_size,
+             PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+             -1,
+             0);
+  if (mem != MAP_FAILED) {
+    cache->hugetlb = 1;
+    return mem;
+  }
+#endif
+
+  /* transparent huge pages, region must be aligned to be covered by them */
+  mem = mmap(NULL,
+             (size_t) (cache->map_size + BP__CACHE_HUGE_PAGE),
+             PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS,
+             -1,
+             0);
+  if (mem == MAP_FAILED) return mem;
+
+  aligned = (char*) BP__CACHE_HUGE_ALIGN((uint64_t) (uintptr_t) mem);
+  slack = (uint64_t) (aligned - (char*) mem);
+  if (slack != 0) munmap(mem, (size_t) slack);
+  munmap(aligned + cache->map_size, (size_t) (BP__CACHE_HUGE_PAGE - slack));
+
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, (size_t) cache->map_size, MADV_HUGEPAGE);
+#endif
+
+  return aligned;
+}
+
+
+/* prefer memory of given node for pages that weren't touched yet */
+static void bp__cache_bind(bp__cache_t* cache, const int node) {
+#if defined(SYS_mbind) && defined(__linux__)
+  unsigned long mask;
+
+  if (node < 0 || node >= (int) (sizeof(mask) * 8)) return;
+  mask = 1UL << node;
+
+  /* MPOL_PREFERRED, errors are not fatal - cache just isn't local */
+  syscall(SYS_mbind,
+          cache->mem,
+          (unsigned long) cache->map_size,
+          1,
+          &mask,
+          (unsigned long) (sizeof(mask) * 8 + 1),
+          0);
+#endif
+}
+
+
+static int bp__cache_segment(const char* name,
+                             const uint64_t size,
+                             const uint64_t block_size,
+                             const int huge,
+                             const int node,
+                             bp__cache_t** cache) {
+  int ret;
+  int fd;
+  bp__cache_t* c;
+
+  c = malloc(sizeof(*c));
+  if (c == NULL) return BP_EALLOC;
+
+  c->size = size;
+  c->map_size = size;
+  c->hugetlb = 0;
+  c->mem = MAP_FAILED;
+  c->nodes = NULL;
+  c->node_count = 1;
+  c->cpu_nodes = NULL;
+  c->cpu_count = 0;
+
+  if (name == NULL) {
+    /* private to this process (and its children) */
+    c->mem = bp__cache_map_private(c, huge);
+    if (c->mem == MAP_FAILED) {
+      ret = BP_ECACHE;
+      goto fatal;
+    }
+    bp__cache_bind(c, node);
+    c->header = (bp__cache_header_t*) c->mem;
+    ret = bp__cache_init(c, block_size);
+  } else {
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd != -1) {
+      /* we've created it - initialize */
+      if (ftruncate(fd, (off_t) size) == 0) {
+        c->mem = mmap(NULL,
+                      (size_t) size,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      fd,
+                      0);
+      }
+      if (c->mem == MAP_FAILED) {
+        ret = BP_ECACHE;
+      } else {
+        bp__cache_bind(c, node);
+        c->header = (bp__cache_header_t*) c->mem;
+        ret = bp__cache_init(c, block_size);
+      }
+
+      /* don't leave broken segment for others */
+      if (ret != BP_OK) shm_unlink(name);
+    } else if (errno == EEXIST) {
+      /* already exists - use its geometry */
+      fd = shm_open(name, O_RDWR, 0);
+      if (fd == -1) {
+        ret = BP_ECACHE;
+        goto fatal;
+      }
+      ret = bp__cache_attach(c, fd);
+      if (ret != BP_OK) {
+        c->mem = MAP_FAILED;
+      } else {
+        bp__cache_bind(c, node);
+      }
+    } else {
+      ret = BP_ECACHE;
+      goto fatal;
+    }
+    close(fd);
+  }
+
+  if (ret != BP_OK) goto fatal;
+
+#ifdef MADV_HUGEPAGE
+  /* effective only if shmem huge pages are enabled by system */
+  if (name != NULL && huge) {
+    madvise(c->mem, (size_t) c->map_size, MADV_HUGEPAGE);
+  }
+#endif
+
+  c->slots = (char*) c->mem + BP__CACHE_ALIGN(sizeof(*c->header));
+  *cache = c;
+  return BP_OK;
+
+fatal:
+  if (c->mem != MAP_FAILED) munmap(c->mem, (size_t) c->map_size);
+  free(c);
+  return ret;
+}
+
+
+/* marks numbers of sysfs list like "0-3,8-11" below size in set */
+static int bp__cache_list(const char* path,
+                          unsigned char* set,
+                          const unsigned long size) {
+  char list[1024];
+  FILE* f;
+  char* p;
+  unsigned long first, last, i;
+
+  f = fopen(path, "r");
+  if (f == NULL) return BP_EFILE;
+  if (fgets(list, sizeof(list), f) == NULL) list[0] = 0;
+  fclose(f);
+
+  memset(set, 0, (size_t) size);
+  for (p = list; *p >= '0' && *p <= '9';) {
+    first = strtoul(p, &p, 10);
+    last = first;
+    if (*p == '-') last = strtoul(p + 1, &p, 10);
+    for (i = first; i <= last && i < size; i++) set[i] = 1;
+    if (*p == ',') p++;
+  }
+
+  return BP_OK;
+}
+
+
+/*
+ * Number of online NUMA nodes, their ids and index of node of each CPU.
+ * Node ids may have gaps (offline or memoryless nodes), so they are taken
+ * from "online" list rather than probed one by one.
+ */
+static uint32_t bp__cache_numa(unsigned char* cpu_nodes,
+                               const uint32_t cpu_count,
+                               int* node_ids) {
+  char path[64];
+  unsigned char online[BP__CACHE_NODE_IDS];
+  unsigned char* cpus;
+  uint32_t node, count, cpu;
+
+  node_ids[0] = 0;
+  if (bp__cache_list("/sys/devices/system/node/online",
+                     online,
+                     sizeof(online)) != BP_OK) {
+    return 1;
+  }
+
+  cpus = malloc(cpu_count);
+  if (cpus == NULL) return 1;
+
+  count = 0;
+  for (node = 0; node < BP__CACHE_NODE_IDS && count < BP__CACHE_NODES;
+       node++) {
+    if (!online[node]) continue;
+
+    sprintf(path, "/sys/devices/system/node/node%u/cpulist", (unsigned) node);
+    if (bp__cache_list(path, cpus, cpu_count) != BP_OK) continue;
+    for (cpu = 0; cpu < cpu_count; cpu++) {
+      if (cpus[cpu]) cpu_nodes[cpu] = (unsigned char) count;
+    }
+    node_ids[count++] = (int) node;
+  }
+
+  free(cpus);
+  return count == 0 ? 1 : count;
+}
+
+
+int bp__cache_create(const char* name,
+                     const uint64_t size,
+                     const uint64_t block_size,
+                     const int huge,
+                     const uint32_t nodes,
+                     bp__cache_t** cache) {
+  int ret;
+  bp__cache_t* c;
+  char* part_name;
+  unsigned char* cpu_nodes;
+  int node_ids[BP__CACHE_NODES];
+  uint32_t numa;
+  uint32_t count;
+  uint32_t i;
+
+  if (nodes == 0) return bp__cache_segment(name, size, block_size, huge, -1,
+                                           cache);
+
+  part_name = NULL;
+  if (name != NULL) {
+    part_name = malloc(strlen(name) + 16);
+    if (part_name == NULL) return BP_EALLOC;
+  }
+
+  c = NULL;
+  cpu_nodes = calloc(BP__CACHE_CPUS, 1);
+  if (cpu_nodes == NULL) {
+    ret = BP_EALLOC;
+    goto fatal;
+  }
+  numa = bp__cache_numa(cpu_nodes, BP__CACHE_CPUS, node_ids);
+
+  ret = bp__cache_segment(name, size, block_size, huge, node_ids[0], &c);
+  if (ret != BP_OK) goto fatal;
+
+  ret = BP_EALLOC;
+  c->cpu_count = BP__CACHE_CPUS;
+  c->cpu_nodes = cpu_nodes;
+  cpu_nodes = NULL;
+
+  count = nodes == BP_CACHE_NUMA_AUTO ? numa : nodes;
+  if (count > BP__CACHE_NODES) count = BP__CACHE_NODES;
+
+  /* more partitions than nodes (or no NUMA info) - spread CPUs over them */
+  if (count != numa) {
+    for (i = 0; i < c->cpu_count; i++) c->cpu_nodes[i] = i % count;
+  }
+
+  c->nodes = calloc(count, sizeof(*c->nodes));
+  if (c->nodes == NULL) goto fatal;
+  c->nodes[0] = c;
+
+  /*
+   * Partition 0 holds the file table used for generations of all
+   * partitions, others are named "<name>.<partition>".
+   */
+  for (i = 1; i < count; i++) {
+    if (part_name != NULL) sprintf(part_name, "%s.%u", name, (unsigned) i);
+    ret = bp__cache_segment(part_name,
+                            size,
+                            block_size,
+                            huge,
+                            node_ids[i % numa],
+                            &c->nodes[i]);
+    if (ret != BP_OK) goto fatal;
+    c->node_count++;
+  }
+
+  free(part_name);
+  *cache = c;
+  return BP_OK;
+
+fatal:
+  free(part_name);
+  free(cpu_nodes);
+  if (c != NULL) bp__cache_destroy(c);
+  return ret;
+}
+
+
+void bp__cache_destroy(bp__cache_t* cache) {
+  uint32_t i;
+
+  for (i = 1; i < cache->node_count; i++) bp__cache_destroy(cache->nodes[i]);
+  free(cache->nodes);
+  free(cache->cpu_nodes);
+
+  munmap(cache->mem, (size_t) cache->map_size);
+  free(cache);
+}
+
+
+/* partition of NUMA node we are running on */
+static bp__cache_t* bp__cache_local(bp__cache_t* cache) {
+#ifdef __linux__
+  int cpu;
+
+  if (cache->node_count == 1) return cache;
+
+  cpu = sched_getcpu();
+  if (cpu < 0 || (uint32_t) cpu >= cache->cpu_count) return cache;
+  return cache->nodes[cache->cpu_nodes[cpu] % cache->node_count];
+#else
+  return cache;
+#endif
+}
+
+
+/* bytes of this process' mapping backed by huge pages */
+static uint64_t bp__cache_huge_size(bp__cache_t* cache) {
+  FILE* smaps;
+  char line[256];
+  unsigned long start, end, kb;
+  unsigned long from = (unsigned long) cache->mem;
+  unsigned long to = from + (unsigned long) cache->map_size;
+  uint64_t total;
+  int inside;
+
+  if (cache->hugetlb) return cache->map_size;
+
+  /* transparent huge pages are only visible in smaps */
+  smaps = fopen("/proc/self/smaps", "r");
+  if (smaps == NULL) return 0;
+
+  total = 0;
+  inside = 0;
+  while (fgets(line, sizeof(line), smaps) != NULL) {
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      inside = start < to && end > from;
+    } else if (inside &&
+               (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+                sscanf(line, "ShmemPmdMapped: %lu kB", &kb) == 1)) {
+      total += (uint64_t) kb * 1024;
+    }
+  }
+  fclose(smaps);
+
+  return total;
+}
+
+
+int bp__cache_file(bp__cache_t* cache,
+                   const int fd,
+                   const int fresh,
+                   uint64_t* generation) {
+  bp__cache_header_t* header = cache->header;
+  bp__cache_file_t* file;
+  bp__cache_file_t* victim;
+  struct stat st;
+  int version;
+  int i;
+
+  if (fstat(fd, &st) != 0) return BP_EFILE;
+
+  /* tmpfs and others have no inode generation, size check below remains */
+  version = 0;
+  if (ioctl(fd, FS_IOC_GETVERSION, &version) != 0) version = 0;
+
+  while (__sync_lock_test_and_set(&header->lock, 1)) sched_yield();
+
+  file = NULL;
+  victim = &header->files[0];
+  for (i = 0; i < BP__CACHE_FILES; i++) {
+    if (header->files[i].dev == (uint64_t) st.st_dev &&
+        header->files[i].ino == (uint64_t) st.st_ino &&
+        header->files[i].ino_generation == (uint64_t) (unsigned) version &&
+        header->files[i].generation != 0) {
+      file = &header->files[i];
+      break;
+    }
+    if (header->files[i].generation < victim->generation) {
+      victim = &header->files[i];
+    }
+  }
+
+  /*
+   * Files are append-only, if it is smaller than we've seen -
+   * inode was reused by some other file.
+   */
+  if (file == NULL || fresh || (uint64_t) st.st_size < file->size) {
+    if (file == NULL) file = victim;
+    file->dev = (uint64_t) st.st_dev;
+    file->ino = (uint64_t) st.st_ino;
+    file->ino_generation = (uint64_t) (unsigned) version;
+    file->generation = ++header->generation;
+  }
+  file->size = (uint64_t) st.st_size;
+  *generation = file->generation;
+
+  __sync_lock_release(&header->lock);
+
+  return BP_OK;
+}
+
+
+void bp__cache_stats(bp__cache_t* cache, bp_cache_stats_t* stats) {
+  bp__cache_header_t* header;
+  uint32_t i;
+
+  memset(stats, 0, sizeof(*stats));
+  for (i = 0; i < cache->node_count; i++) {
+    header = (i == 0 ? cache : cache->nodes[i])->header;
+    stats->hits += header->hits;
+    stats->misses += header->misses;
+    stats->inserts += header->inserts;
+    stats->size += header->size;
+    stats->slots += header->slot_count;
+    stats->huge_pages += bp__cache_huge_size(i == 0 ? cache : cache->nodes[i]);
+  }
+  stats->block_size = cache->header->block_size;
+  stats->nodes = cache->node_count;
+}
+
+
+static uint64_t bp__cache_set(bp__cache_t* cache,
+                              const uint64_t generation,
+                              const uint64_t offset) {
+  uint64_t hash = bp__compute_hashl(offset) + generation * 2654435761u;
+  return (hash % (cache->header->slot_count / BP__CACHE_WAYS)) *
+         BP__CACHE_WAYS;
+}
+
+
+int bp__cache_get(bp__cache_t* cache,
+                  const uint64_t generation,
+                  const uint64_t offset,
+                  const uint64_t csize,
+                  uint64_t* size,
+                  void** data) {
+  bp__cache_header_t* header;
+  bp__cache_slot_t* slot;
+  uint64_t set;
+  uint32_t seq;
+  uint32_t length;
+  char* copy;
+  int i;
+
+  cache = bp__cache_local(cache);
+  header = cache->header;
+  set = bp__cache_set(cache, generation, offset);
+
+  for (i = 0; i < BP__CACHE_WAYS; i++) {
+    slot = BP__CACHE_SLOT(cache, set + i);
+
+    seq = slot->seq;
+    if (seq & 1) continue;
+    __sync_synchronize();
+
+    if (slot->generation != generation ||
+        slot->offset != offset ||
+        slot->csize != csize) {
+      continue;
+    }
+
+    length = slot->length;
+    if (length == 0 || length > header->block_size) continue;
+
+    copy = malloc(length);
+    if (copy == NULL) return BP_EALLOC;
+    memcpy(copy, BP__CACHE_DATA(slot), length);
+
+    /* slot was overwritten while we were copying it */
+    __sync_synchronize();
+    if (slot->seq != seq) {
+      free(copy);
+      continue;
+    }
+
+    __sync_fetch_and_add(&header->hits, 1);
+    *size = length;
+    *data = copy;
+    return BP_OK;
+  }
+
+  __sync_fetch_and_add(&header->misses, 1);
+  return BP_ENOTFOUND;
+}
+
+
+static void bp__cache_put_one(bp__cache_t* cache,
+                              const uint64_t generation,
+                              const uint64_t offset,
+                              const uint64_t csize,
+                              const uint64_t size,
+                              const void* data) {
+  bp__cache_header_t* header = cache->header;
+  bp__cache_slot_t* slot;
+  bp__cache_slot_t* victim;
+  uint64_t set;
+  uint32_t seq;
+  int i;
+
+  if (size == 0 || size > header->block_size) return;
+
+  set = bp__cache_set(cache, generation, offset);
+  victim = NULL;
+  for (i = 0; i < BP__CACHE_WAYS; i++) {
+    slot = BP__CACHE_SLOT(cache, set + i);
+    if (slot->generation == generation &&
+        slot->offset == offset &&
+        slot->csize == csize) {
+      /* someone else has cached it already */
+      return;
+    }
+    if (victim == NULL && slot->generation == 0) victim = slot;
+  }
+
+  if (victim == NULL) {
+    victim = BP__CACHE_SLOT(
+        cache,
+        set + __sync_fetch_and_add(&header->clock, 1) % BP__CACHE_WAYS);
+  }
+
+  /* slot is being written by someone else, give up */
+  seq = victim->seq;
+  if ((seq & 1) || !__sync_bool_compare_and_swap(&victim->seq, seq, seq + 1)) {
+    return;
+  }
+
+  victim->generation = generation;
+  victim->offset = offset;
+  victim->csize = csize;
+  victim->length = (uint32_t) size;
+  memcpy(BP__CACHE_DATA(victim), data, (size_t) size);
+
+  __sync_synchronize();
+  victim->seq = seq + 2;
+
+  __sync_fetch_and_add(&header->inserts, 1);
+}
+
+
+void bp__cache_put(bp__cache_t* cache,
+                   const uint64_t generation,
+                   const uint64_t offset,
+                   const uint64_t csize,
+                   const uint64_t size,
+                   const void* data) {
+  bp__cache_put_one(bp__cache_local(cache),
+                    generation,
+                    offset,
+                    csize,
+                    size,
+                    data);
+}
+
+
+void bp__cache_put_all(bp__cache_t* cache,
+                       const uint64_t generation,
+                       const uint64_t offset,
+                       const uint64_t csize,
+                       const uint64_t size,
+                       const void* data) {
+  uint32_t i;
+
+  bp__cache_put_one(cache, generation, offset, csize, size, data);
+  for (i = 1; i < cache->node_count; i++) {
+    bp__cache_put_one(cache->nodes[i], generation, offset, csize, size, data);
+  }
+}
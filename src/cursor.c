@@ -0,0 +1,208 @@
+#include <stdlib.h> /* realloc, free */
+#include <time.h> /* time */
+
+#include "bplus.h"
+#include "private/cursor.h"
+#include "private/pages.h"
+
+
+void bp__cursor_init(bp_db_t* t, bp__page_t* root, bp__cursor_t* c) {
+  c->tree = t;
+  c->root = root;
+  c->now = (uint64_t) time(NULL);
+  c->depth = 0;
+  c->started = 0;
+  c->kvs = NULL;
+  c->length = 0;
+  c->capacity = 0;
+  c->index = 0;
+}
+
+
+void bp__cursor_destroy(bp__cursor_t* c) {
+  /* root is at level 0 */
+  while (c->depth > 1) {
+    bp__page_destroy(c->tree, c->levels[--c->depth].page);
+  }
+  c->depth = 0;
+
+  free(c->kvs);
+  c->kvs = NULL;
+  c->length = 0;
+  c->capacity = 0;
+  c->index = 0;
+}
+
+
+/* load leftmost path below the current child of the last level */
+static int bp__cursor_descend(bp__cursor_t* c) {
+  int ret;
+  bp__cursor_level_t* top = &c->levels[c->depth - 1];
+  bp__page_t* child;
+
+  while (top->page->type == kPage) {
+    if (c->depth == BP__CURSOR_MAX_LEVELS) return BP_EFILEREAD;
+
+    ret = bp__page_load(c->tree,
+                        top->page->keys[top->index].offset,
+                        top->page->keys[top->index].config,
+                        &child);
+    if (ret != BP_OK) return ret;
+
+    top = &c->levels[c->depth++];
+    top->page = child;
+    top->index = 0;
+  }
+
+  return BP_OK;
+}
+
+
+/* index of the first kv >= key */
+static uint64_t bp__cursor_bound(bp_db_t* t,
+                                 const bp__kv_t* kvs,
+                                 const uint64_t length,
+                                 const bp__kv_t* key) {
+  uint64_t low = 0, high = length, mid;
+
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (t->compare_cb((bp_key_t*) &kvs[mid], (bp_key_t*) key) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+
+static int bp__cursor_push(bp__cursor_t* c, const bp__kv_t* kv) {
+  bp__kv_t* grown;
+
+  if (c->length == c->capacity) {
+    c->capacity = c->capacity == 0 ? 64 : c->capacity * 2;
+    grown = realloc(c->kvs, (size_t) c->capacity * sizeof(*c->kvs));
+    if (grown == NULL) return BP_EALLOC;
+    c->kvs = grown;
+  }
+
+  return bp__kv_copy(kv, &c->kvs[c->length++], 0);
+}
+
+
+/* merge leaf's kvs with messages routed to it, newest first */
+static int bp__cursor_collect(bp__cursor_t* c) {
+  int ret;
+  bp_db_t* t = c->tree;
+  bp__page_t* page;
+  const bp__kv_t* lists[BP__CURSOR_MAX_LEVELS];
+  const bp__kv_t* lower = NULL;
+  const bp__kv_t* upper = NULL;
+  const bp__kv_t* best;
+  uint64_t pos[BP__CURSOR_MAX_LEVELS];
+  uint64_t end[BP__CURSOR_MAX_LEVELS];
+  uint64_t l, leaf = c->depth - 1;
+  int64_t winner;
+
+  /* separators deeper on the path are tighter */
+  for (l = 0; l < leaf; l++) {
+    page = c->levels[l].page;
+    if (c->levels[l].index > 0) lower = &page->keys[c->levels[l].index];
+    if (c->levels[l].index + 1 < page->length) {
+      upper = &page->keys[c->levels[l].index + 1];
+    }
+  }
+
+  for (l = 0; l < leaf; l++) {
+    page = c->levels[l].page;
+    lists[l] = page->buffer;
+    pos[l] = lower == NULL ?
+        0 :
+        bp__cursor_bound(t, page->buffer, page->buffer_length, lower);
+    end[l] = upper == NULL ?
+        page->buffer_length :
+        bp__cursor_bound(t, page->buffer, page->buffer_length, upper);
+  }
+  lists[leaf] = c->levels[leaf].page->keys;
+  pos[leaf] = 0;
+  end[leaf] = c->levels[leaf].page->length;
+
+  c->length = 0;
+  c->index = 0;
+  for (;;) {
+    winner = -1;
+    best = NULL;
+    for (l = 0; l <= leaf; l++) {
+      if (pos[l] == end[l]) continue;
+      if (best == NULL ||
+          t->compare_cb((bp_key_t*) &lists[l][pos[l]], (bp_key_t*) best) < 0) {
+        winner = (int64_t) l;
+        best = &lists[l][pos[l]];
+      }
+    }
+    if (best == NULL) break;
+
+    /* older versions of the same key */
+    for (l = 0; l <= leaf; l++) {
+      if (pos[l] != end[l] &&
+          t->compare_cb((bp_key_t*) &lists[l][pos[l]], (bp_key_t*) best) == 0) {
+        pos[l]++;
+      }
+    }
+
+    if ((uint64_t) winner != leaf && BP__MSG_REMOVED(best->config)) continue;
+    if (BP__KV_EXPIRED(best->config, c->now)) continue;
+
+    ret = bp__cursor_push(c, best);
+    if (ret != BP_OK) return ret;
+  }
+
+  return BP_OK;
+}
+
+
+static int bp__cursor_next_leaf(bp__cursor_t* c) {
+  int ret;
+  bp__cursor_level_t* top;
+
+  if (!c->started) {
+    c->started = 1;
+    c->levels[0].page = c->root;
+    c->levels[0].index = 0;
+    c->depth = 1;
+  } else {
+    if (c->depth == 0) return BP_ENOTFOUND;
+
+    /* leaf is done, move to the next child of the closest page */
+    if (c->depth > 1) bp__page_destroy(c->tree, c->levels[c->depth - 1].page);
+    c->depth--;
+    while (c->depth > 0) {
+      top = &c->levels[c->depth - 1];
+      if (++top->index < top->page->length) break;
+
+      if (c->depth > 1) bp__page_destroy(c->tree, top->page);
+      c->depth--;
+    }
+    if (c->depth == 0) return BP_ENOTFOUND;
+  }
+
+  ret = bp__cursor_descend(c);
+  if (ret != BP_OK) return ret;
+
+  return bp__cursor_collect(c);
+}
+
+
+int bp__cursor_next(bp__cursor_t* c, bp__kv_t** kv) {
+  int ret;
+
+  while (c->index == c->length) {
+    ret = bp__cursor_next_leaf(c);
+    if (ret != BP_OK) return ret;
+  }
+
+  *kv = &c->kvs[c->index++];
+  return BP_OK;
+}
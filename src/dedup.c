@@ -0,0 +1,83 @@
+#include "bplus.h"
+#include "private/dedup.h"
+#include "private/utils.h"
+
+#include <stdlib.h> /* calloc, free */
+
+
+int bp__dedup_create(bp__dedup_t** dedup, const uint64_t slot_count) {
+  bp__dedup_t* d;
+
+  d = malloc(sizeof(*d));
+  if (d == NULL) return BP_EALLOC;
+
+  /* zero config - empty slot, config of block is never zero */
+  d->slots = calloc((size_t) slot_count, sizeof(*d->slots));
+  if (d->slots == NULL) {
+    free(d);
+    return BP_EALLOC;
+  }
+  d->slot_count = slot_count;
+
+  *dedup = d;
+  return BP_OK;
+}
+
+
+void bp__dedup_destroy(bp__dedup_t* dedup) {
+  if (dedup == NULL) return;
+  free(dedup->slots);
+  free(dedup);
+}
+
+
+/* FNV-1a, slot is picked by bp__compute_hashl of it */
+uint64_t bp__dedup_hash(const char* data, const uint64_t length) {
+  uint64_t i;
+  uint64_t hash = 14695981039346656037u;
+
+  for (i = 0; i < length; i++) {
+    hash ^= (unsigned char) data[i];
+    hash *= 1099511628211u;
+  }
+
+  return hash;
+}
+
+
+static bp__dedup_slot_t* bp__dedup_slot(bp__dedup_t* dedup,
+                                        const uint64_t hash,
+                                        const uint64_t length) {
+  return &dedup->slots[bp__compute_hashl(hash ^ length) % dedup->slot_count];
+}
+
+
+int bp__dedup_get(bp__dedup_t* dedup,
+                  const uint64_t hash,
+                  const uint64_t length,
+                  uint64_t* offset,
+                  uint64_t* config) {
+  bp__dedup_slot_t* slot = bp__dedup_slot(dedup, hash, length);
+
+  if (slot->config == 0 || slot->hash != hash || slot->length != length) {
+    return BP_ENOTFOUND;
+  }
+
+  *offset = slot->offset;
+  *config = slot->config;
+  return BP_OK;
+}
+
+
+void bp__dedup_put(bp__dedup_t* dedup,
+                   const uint64_t hash,
+                   const uint64_t length,
+                   const uint64_t offset,
+                   const uint64_t config) {
+  bp__dedup_slot_t* slot = bp__dedup_slot(dedup, hash, length);
+
+  slot->hash = hash;
+  slot->length = length;
+  slot->offset = offset;
+  slot->config = config;
+}
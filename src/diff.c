@@ -0,0 +1,366 @@
+#include <stdlib.h> /* free */
+#include <time.h> /* time */
+
+#include "bplus.h"
+#include "private/diff.h"
+#include "private/pages.h"
+#include "private/utils.h"
+
+
+static void bp__diff_push(bp__diff_stream_t* s,
+                          bp__page_t* page,
+                          const bp__kv_t* lower) {
+  bp__diff_frame_t* frame = &s->frames[s->depth++];
+
+  frame->page = page;
+  frame->index = 0;
+  frame->lower = lower;
+  frame->walk = page->buffer_length != 0;
+  frame->next = NULL;
+  if (frame->walk) bp__cursor_init(s->tree, page, &frame->cursor);
+}
+
+
+static void bp__diff_pop(bp__diff_stream_t* s) {
+  bp__diff_frame_t* frame = &s->frames[--s->depth];
+
+  if (frame->walk) bp__cursor_destroy(&frame->cursor);
+  if (s->depth != 0) bp__page_destroy(s->tree, frame->page);
+}
+
+
+static void bp__diff_stream_destroy(bp__diff_stream_t* s) {
+  while (s->depth != 0) bp__diff_pop(s);
+}
+
+
+/*
+ * Current item of stream: `*subtree` is 1 for child pointer (`lower` is
+ * lower bound of its subtree), 0 for kv. BP_ENOTFOUND at the end.
+ */
+static int bp__diff_peek(bp__diff_stream_t* s,
+                         bp__kv_t** kv,
+                         const bp__kv_t** lower,
+                         int* subtree) {
+  int ret;
+  bp__diff_frame_t* frame;
+
+  while (s->depth != 0) {
+    frame = &s->frames[s->depth - 1];
+
+    if (frame->walk) {
+      if (frame->next == NULL) {
+        ret = bp__cursor_next(&frame->cursor, &frame->next);
+        if (ret == BP_ENOTFOUND) {
+          bp__diff_pop(s);
+          continue;
+        }
+        if (ret != BP_OK) return ret;
+      }
+      *kv = frame->next;
+      *lower = NULL;
+      *subtree = 0;
+      return BP_OK;
+    }
+
+    /* expired kvs and subtrees are not visible in both versions */
+    while (frame->index < frame->page->length &&
+           BP__KV_EXPIRED(frame->page->keys[frame->index].config, s->now)) {
+      frame->index++;
+    }
+    if (frame->index == frame->page->length) {
+      bp__diff_pop(s);
+      continue;
+    }
+
+    *kv = &frame->page->keys[frame->index];
+    *subtree = frame->page->type == kPage;
+    *lower = frame->index == 0 ? frame->lower : *kv;
+    return BP_OK;
+  }
+
+  return BP_ENOTFOUND;
+}
+
+
+static void bp__diff_next(bp__diff_stream_t* s) {
+  bp__diff_frame_t* frame = &s->frames[s->depth - 1];
+
+  if (frame->walk) {
+    frame->next = NULL;
+  } else {
+    frame->index++;
+  }
+}
+
+
+/* replace current child pointer with its children */
+static int bp__diff_expand(bp__diff_stream_t* s,
+                           const bp__kv_t* kv,
+                           const bp__kv_t* lower) {
+  int ret;
+  bp__page_t* child;
+
+  if (s->depth == BP__DIFF_MAX_LEVELS) return BP_EFILEREAD;
+
+  ret = bp__page_load(s->tree, kv->offset, kv->config, &child);
+  if (ret != BP_OK) return ret;
+
+  /* pointer stays in parent page, lower bound too */
+  bp__diff_next(s);
+  bp__diff_push(s, child, lower);
+
+  return BP_OK;
+}
+
+
+/* NULL bound is the lowest one */
+static int bp__diff_compare(bp_db_t* t,
+                            const bp__kv_t* a,
+                            const bp__kv_t* b) {
+  if (a == NULL) return b == NULL ? 0 : -1;
+  if (b == NULL) return 1;
+  return t->compare_cb((bp_key_t*) a, (bp_key_t*) b);
+}
+
+
+int bp__diff(bp_db_t* t,
+             bp__page_t* old_root,
+             bp__page_t* new_root,
+             bp__diff_cb cb,
+             void* arg) {
+  int ret, ret_a, ret_b, sub_a, sub_b, cmp;
+  bp__diff_stream_t a, b;
+  bp__kv_t* kv_a = NULL;
+  bp__kv_t* kv_b = NULL;
+  const bp__kv_t* lower_a = NULL;
+  const bp__kv_t* lower_b = NULL;
+
+  a.tree = t;
+  a.now = (uint64_t) time(NULL);
+  a.depth = 0;
+  b.tree = t;
+  b.now = a.now;
+  b.depth = 0;
+  bp__diff_push(&a, old_root, NULL);
+  bp__diff_push(&b, new_root, NULL);
+
+  for (;;) {
+    sub_a = 0;
+    sub_b = 0;
+    ret_a = bp__diff_peek(&a, &kv_a, &lower_a, &sub_a);
+    ret_b = bp__diff_peek(&b, &kv_b, &lower_b, &sub_b);
+    if (ret_a != BP_OK && ret_a != BP_ENOTFOUND) {
+      ret = ret_a;
+      break;
+    }
+    if (ret_b != BP_OK && ret_b != BP_ENOTFOUND) {
+      ret = ret_b;
+      break;
+    }
+    if (ret_a == BP_ENOTFOUND) kv_a = NULL;
+    if (ret_b == BP_ENOTFOUND) kv_b = NULL;
+    if (kv_a == NULL && kv_b == NULL) {
+      ret = BP_OK;
+      break;
+    }
+
+    /* the same page in both versions */
+    if (sub_a && sub_b &&
+        kv_a->offset == kv_b->offset &&
+        kv_a->config == kv_b->config) {
+      bp__diff_next(&a);
+      bp__diff_next(&b);
+      continue;
+    }
+
+    /* open the subtree which starts first, or both */
+    if (sub_a && sub_b) {
+      cmp = bp__diff_compare(t, lower_a, lower_b);
+      ret = BP_OK;
+      if (cmp <= 0) ret = bp__diff_expand(&a, kv_a, lower_a);
+      if (ret == BP_OK && cmp >= 0) ret = bp__diff_expand(&b, kv_b, lower_b);
+      if (ret != BP_OK) break;
+      continue;
+    }
+    if (sub_a && (kv_b == NULL || bp__diff_compare(t, lower_a, kv_b) <= 0)) {
+      ret = bp__diff_expand(&a, kv_a, lower_a);
+      if (ret != BP_OK) break;
+      continue;
+    }
+    if (sub_b && (kv_a == NULL || bp__diff_compare(t, lower_b, kv_a) <= 0)) {
+      ret = bp__diff_expand(&b, kv_b, lower_b);
+      if (ret != BP_OK) break;
+      continue;
+    }
+
+    /* kv of one side is below everything left on the other side */
+    if (kv_a == NULL || sub_a) {
+      cmp = 1;
+    } else if (kv_b == NULL || sub_b) {
+      cmp = -1;
+    } else {
+      cmp = t->compare_cb((bp_key_t*) kv_a, (bp_key_t*) kv_b);
+    }
+
+    ret = BP_OK;
+    if (cmp < 0) {
+      ret = cb(arg, kv_a, NULL);
+      bp__diff_next(&a);
+    } else if (cmp > 0) {
+      ret = cb(arg, NULL, kv_b);
+      bp__diff_next(&b);
+    } else {
+      if (kv_a->offset != kv_b->offset || kv_a->config != kv_b->config) {
+        ret = cb(arg, kv_a, kv_b);
+      }
+      bp__diff_next(&a);
+      bp__diff_next(&b);
+    }
+    if (ret != BP_OK) break;
+  }
+
+  bp__diff_stream_destroy(&a);
+  bp__diff_stream_destroy(&b);
+
+  return ret;
+}
+
+
+void bp__head(bp_db_t* t, bp_head_t* head) {
+  head->offset = t->head.offset;
+  head->config = t->head.config;
+  head->_generation = t->generation;
+}
+
+
+int bp__heads(bp_db_t* t,
+              const uint64_t count,
+              bp_head_t* heads,
+              uint64_t* found) {
+  int ret;
+  char* chunk;
+  bp__tree_head_t* head;
+  bp_head_t* last;
+  uint64_t offset, start, size, end;
+
+  *found = 0;
+
+  /* heads are never split by padding, see bp__writer_find */
+  offset = t->filesize - (t->filesize % BP__HEAD_SIZE);
+  while (*found < count && offset >= BP__HEAD_SIZE) {
+    /* one read per chunk, candidates are scanned in memory */
+    size = offset < BP__HEADS_CHUNK ? offset : BP__HEADS_CHUNK;
+    start = offset - size;
+    ret = bp__writer_read((bp__writer_t*) t,
+                          kNotCompressed,
+                          kHeadBlock,
+                          start,
+                          &size,
+                          (void**) &chunk);
+    if (ret != BP_OK) return ret;
+
+    for (end = offset - start;
+         *found < count && end >= BP__HEAD_SIZE;
+         end -= BP__HEAD_SIZE) {
+      head = (bp__tree_head_t*) (chunk + end - BP__HEAD_SIZE);
+      last = *found == 0 ? NULL : &heads[*found - 1];
+      heads[*found].offset = ntohll(head->offset);
+      heads[*found].config = ntohll(head->config);
+      heads[*found]._generation = t->generation;
+
+      /* a head points to pages written before it */
+      if (bp__compute_hashl(heads[*found].offset) == ntohll(head->hash) &&
+          heads[*found].offset < start + end &&
+          (last == NULL ||
+           last->offset != heads[*found].offset ||
+           last->config != heads[*found].config)) {
+        (*found)++;
+      }
+    }
+    free(chunk);
+    offset = start;
+  }
+
+  return BP_OK;
+}
+
+
+static int bp__diff_values(void* arg,
+                           const bp__kv_t* old_kv,
+                           const bp__kv_t* new_kv) {
+  int ret;
+  bp__diff_values_t* v = arg;
+  bp_value_t old_value, new_value;
+
+  if (old_kv != NULL) {
+    ret = bp__value_load(v->tree,
+                         old_kv->offset,
+                         BP__KV_LENGTH(old_kv->config),
+                         &old_value);
+    if (ret != BP_OK) return ret;
+  }
+  if (new_kv != NULL) {
+    ret = bp__value_load(v->tree,
+                         new_kv->offset,
+                         BP__KV_LENGTH(new_kv->config),
+                         &new_value);
+    if (ret != BP_OK) {
+      if (old_kv != NULL) free(old_value.value);
+      return ret;
+    }
+  }
+
+  ret = v->cb(v->arg,
+              (bp_key_t*) (new_kv != NULL ? new_kv : old_kv),
+              old_kv != NULL ? &old_value : NULL,
+              new_kv != NULL ? &new_value : NULL);
+
+  if (old_kv != NULL) free(old_value.value);
+  if (new_kv != NULL) free(new_value.value);
+
+  return ret;
+}
+
+
+/* root page of head, fresh head of empty database is never written */
+static int bp__diff_root(bp_db_t* t,
+                         const bp_head_t* head,
+                         bp__page_t** page) {
+  if (head->_generation != t->generation) return BP_ENOTFOUND;
+
+  if (BP__KV_LENGTH(head->config) >> 1 == 0) {
+    return bp__page_create(t, kLeaf, 0, 0, page);
+  }
+  return bp__page_load(t, head->offset, head->config, page);
+}
+
+
+int bp__diff_heads(bp_db_t* t,
+                   const bp_head_t* old_head,
+                   const bp_head_t* new_head,
+                   bp_diff_cb cb,
+                   void* arg) {
+  int ret;
+  bp__page_t* old_root;
+  bp__page_t* new_root;
+  bp__diff_values_t values;
+
+  ret = bp__diff_root(t, old_head, &old_root);
+  if (ret != BP_OK) return ret;
+  ret = bp__diff_root(t, new_head, &new_root);
+  if (ret != BP_OK) {
+    bp__page_destroy(t, old_root);
+    return ret;
+  }
+
+  values.tree = t;
+  values.cb = cb;
+  values.arg = arg;
+  ret = bp__diff(t, old_root, new_root, bp__diff_values, &values);
+
+  bp__page_destroy(t, old_root);
+  bp__page_destroy(t, new_root);
+
+  return ret;
+}
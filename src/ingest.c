@@ -0,0 +1,674 @@
+#include <assert.h>
+#include <stdlib.h> /* malloc, free */
+#include <time.h> /* time */
+
+#include "bplus.h"
+#include "private/ingest.h"
+#include "private/pages.h"
+#include "private/threads.h"
+#include "private/trace.h"
+
+
+int bp__builder_create(bp__builder_t** builder) {
+  bp__builder_t* b;
+  uint64_t i;
+
+  b = malloc(sizeof(*b));
+  if (b == NULL) return BP_EALLOC;
+
+  for (i = 0; i < BP__BUILD_MAX_LEVELS; i++) b->levels[i] = NULL;
+  b->last.value = NULL;
+  b->last.length = 0;
+  b->last.allocated = 0;
+  b->generation = 0;
+
+  *builder = b;
+  return BP_OK;
+}
+
+
+void bp__builder_destroy(bp_db_t* t, bp__builder_t* b) {
+  uint64_t i;
+
+  for (i = 0; i < BP__BUILD_MAX_LEVELS; i++) {
+    if (b->levels[i] != NULL) bp__page_destroy(t, b->levels[i]);
+  }
+  if (b->last.allocated) free(b->last.value);
+
+  free(b);
+}
+
+
+/* only empty database can be built, existing kvs would be lost */
+int bp__build_check_empty(bp_db_t* t) {
+  if (t->head.page->type != kLeaf ||
+      t->head.page->length != 0 ||
+      t->head.page->buffer_length != 0) {
+    return BP_EUNSORTED;
+  }
+  return BP_OK;
+}
+
+
+void bp__build_destroy(bp_db_t* t) {
+  if (t->builder == NULL) return;
+
+  bp__builder_destroy(t, t->builder);
+  t->builder = NULL;
+}
+
+
+static int bp__builder_flush(bp_db_t* t,
+                             bp__builder_t* b,
+                             const uint64_t level);
+
+
+/* append child (key of kv, saved page at offset/config) to page of level */
+static int bp__builder_push(bp_db_t* t,
+                            bp__builder_t* b,
+                            const uint64_t level,
+                            const bp__kv_t* key,
+                            const uint64_t offset,
+                            const uint64_t config) {
+  int ret;
+  bp__page_t* parent;
+  bp__kv_t* kv;
+
+  assert(level < BP__BUILD_MAX_LEVELS);
+
+  if (b->levels[level] == NULL) {
+    ret = bp__page_create(t, kPage, 0, 0, &b->levels[level]);
+    if (ret != BP_OK) return ret;
+
+    /* first child brings its own key instead of the empty one */
+    b->levels[level]->length = 0;
+    b->levels[level]->byte_size = 0;
+  }
+  parent = b->levels[level];
+
+  kv = &parent->keys[parent->length];
+  ret = bp__kv_copy(key, kv, 1);
+  if (ret != BP_OK) return ret;
+  kv->offset = offset;
+  kv->config = config;
+  parent->byte_size += BP__KV_SIZE((*kv));
+  parent->length++;
+
+  if (parent->length == t->head.page_size - 1) {
+    return bp__builder_flush(t, b, level);
+  }
+
+  return BP_OK;
+}
+
+
+/* save full (or last) page of level, add it to the page above */
+static int bp__builder_flush(bp_db_t* t,
+                             bp__builder_t* b,
+                             const uint64_t level) {
+  int ret;
+  bp__page_t* page = b->levels[level];
+
+  ret = bp__page_save(t, page);
+  if (ret != BP_OK) return ret;
+
+  /* next key is compared with it */
+  if (page->type == kLeaf) {
+    if (b->last.allocated) free(b->last.value);
+    b->last.allocated = 0;
+    ret = bp__kv_copy(&page->keys[page->length - 1], &b->last, 1);
+    if (ret != BP_OK) return ret;
+  }
+
+  b->levels[level] = NULL;
+  ret = bp__builder_push(t,
+                         b,
+                         level + 1,
+                         &page->keys[0],
+                         page->offset,
+                         page->config);
+  bp__page_destroy(t, page);
+
+  return ret;
+}
+
+
+/* keys must be strictly increasing, over all leaves */
+static int bp__builder_check(bp_db_t* t,
+                             bp__builder_t* b,
+                             const bp_key_t* key) {
+  int ret;
+  bp__page_t* leaf;
+  bp__kv_t* prev;
+
+  if (b->levels[0] == NULL) {
+    ret = bp__page_create(t, kLeaf, 0, 0, &b->levels[0]);
+    if (ret != BP_OK) return ret;
+  }
+  leaf = b->levels[0];
+
+  prev = leaf->length != 0 ? &leaf->keys[leaf->length - 1] :
+         b->last.allocated ? &b->last : NULL;
+  if (prev != NULL && t->compare_cb((bp_key_t*) prev, key) >= 0) {
+    return BP_EUNSORTED;
+  }
+
+  return BP_OK;
+}
+
+
+/* kv with value already in t, key is written if it is an overflow one */
+static int bp__builder_put(bp_db_t* t, bp__builder_t* b, bp__kv_t* kv) {
+  int ret;
+  bp__page_t* leaf = b->levels[0];
+
+  ret = bp__kv_save_key(t, kv);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__kv_copy(kv, &leaf->keys[leaf->length], 1);
+  if (ret != BP_OK) return ret;
+  leaf->byte_size += BP__KV_SIZE((*kv));
+  leaf->length++;
+
+  if (leaf->length == t->head.page_size - 1) {
+    return bp__builder_flush(t, b, 0);
+  }
+
+  return BP_OK;
+}
+
+
+int bp__builder_copy(bp_db_t* t,
+                     bp_db_t* source,
+                     bp__builder_t* b,
+                     const bp__kv_t* kv) {
+  int ret;
+  bp__kv_t copy;
+  uint64_t length = BP__KV_LENGTH(kv->config);
+
+  ret = bp__builder_check(t, b, (bp_key_t*) kv);
+  if (ret != BP_OK) return ret;
+
+  copy.value = kv->value;
+  copy.length = kv->length;
+  copy.allocated = 0;
+  copy.offset = kv->offset;
+  ret = bp__value_copy(source, t, &copy.offset, &length);
+  if (ret != BP_OK) return ret;
+  copy.config = (BP__KV_EXPIRE(kv->config) << 32) | length;
+
+  return bp__builder_put(t, b, &copy);
+}
+
+
+static int bp__builder_add(bp_db_t* t,
+                           bp__builder_t* b,
+                           const bp_key_t* key,
+                           const bp_value_t* value) {
+  int ret;
+  bp__kv_t kv;
+
+  ret = bp__builder_check(t, b, key);
+  if (ret != BP_OK) return ret;
+
+  kv.value = key->value;
+  kv.length = key->length;
+  kv.allocated = 0;
+  ret = bp__value_save(t, value, NULL, &kv.offset, &kv.config);
+  if (ret != BP_OK) return ret;
+
+  return bp__builder_put(t, b, &kv);
+}
+
+
+/*
+ * Save open pages bottom-up. `root` gets the first key of the tree (key is
+ * allocated) and offset/config of its root page.
+ */
+int bp__builder_root(bp_db_t* t, bp__builder_t* b, bp__kv_t* root) {
+  int ret;
+  bp__page_t* page;
+  uint64_t level, top;
+
+  for (level = 0; level < BP__BUILD_MAX_LEVELS; level++) {
+    if (b->levels[level] == NULL) continue;
+
+    /* the only open page left is root */
+    for (top = level + 1;
+         top < BP__BUILD_MAX_LEVELS && b->levels[top] == NULL;
+         top++) {
+    }
+    if (top == BP__BUILD_MAX_LEVELS) break;
+
+    ret = bp__builder_flush(t, b, level);
+    if (ret != BP_OK) return ret;
+  }
+
+  /* nothing was added */
+  if (level == BP__BUILD_MAX_LEVELS) return BP_ENOTFOUND;
+
+  /* page above full pages may have just one child, it is root then */
+  page = b->levels[level];
+  if (page->type == kLeaf || page->length != 1) {
+    ret = bp__page_save(t, page);
+    if (ret != BP_OK) return ret;
+  }
+
+  ret = bp__kv_copy(&page->keys[0], root, 1);
+  if (ret != BP_OK) return ret;
+  if (page->type == kLeaf || page->length != 1) {
+    root->offset = page->offset;
+    root->config = page->config;
+  }
+
+  return BP_OK;
+}
+
+
+/* make built tree head of t */
+int bp__build_head(bp_db_t* t, const bp__kv_t* root) {
+  int ret;
+  bp__page_t* page;
+
+  ret = bp__page_load(t, root->offset, root->config, &page);
+  if (ret != BP_OK) return ret;
+
+  page->is_head = 1;
+  bp__page_destroy(t, t->head.page);
+  t->head.page = page;
+
+  return bp__tree_write_head((bp__writer_t*) t, NULL);
+}
+
+
+int bp__build_add(bp_db_t* t, const bp_key_t* key, const bp_value_t* value) {
+  int ret;
+
+  if (t->builder == NULL) {
+    ret = bp__build_check_empty(t);
+    if (ret != BP_OK) return ret;
+
+    ret = bp__builder_create(&t->builder);
+    if (ret != BP_OK) return ret;
+    t->builder->generation = t->generation;
+  }
+
+  return bp__builder_add(t, t->builder, key, value);
+}
+
+
+int bp__build_finish(bp_db_t* t) {
+  int ret;
+  bp__kv_t root;
+
+  /* nothing was added */
+  if (t->builder == NULL) return BP_OK;
+
+  /* head would replace kvs written since the first add, or file changed */
+  if (bp__build_check_empty(t) != BP_OK ||
+      t->builder->generation != t->generation) {
+    bp__build_destroy(t);
+    return BP_EBUILDCONFLICT;
+  }
+
+  ret = bp__builder_root(t, t->builder, &root);
+  bp__build_destroy(t);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__build_head(t, &root);
+  free(root.value);
+
+  return ret;
+}
+
+
+static void* bp__build_worker(void* arg) {
+  int ret;
+  bp__build_job_t* job = arg;
+  bp_db_t* t = job->tree;
+  bp__builder_t* b;
+  uint64_t run, i;
+
+  while (job->ret == BP_OK) {
+    run = __sync_fetch_and_add(&job->next_run, 1);
+    if (run >= job->run_count) break;
+    if (job->counts[run] == 0) continue;
+
+    ret = bp__builder_create(&b);
+    for (i = 0; ret == BP_OK && i < job->counts[run]; i++) {
+      ret = bp__builder_add(t, b, &job->keys[run][i], &job->values[run][i]);
+    }
+    if (ret == BP_OK) ret = bp__builder_root(t, b, &job->roots[run]);
+    if (b != NULL) bp__builder_destroy(t, b);
+
+    /* first error wins */
+    if (ret != BP_OK) __sync_bool_compare_and_swap(&job->ret, BP_OK, ret);
+  }
+
+  return NULL;
+}
+
+
+int bp__build_parallel(bp_db_t* t,
+                       const uint64_t run_count,
+                       const uint64_t* counts,
+                       const bp_key_t** keys,
+                       const bp_value_t** values,
+                       const uint32_t threads) {
+  int ret;
+  bp__build_job_t job;
+  bp__builder_t* b;
+  struct bp__dedup_s* dedup;
+  bp__kv_t root;
+  bp__mutex_t append_lock;
+  pthread_t* ids;
+  const bp_key_t* last;
+  uint64_t i, started;
+
+  if (t->builder != NULL) return BP_EUNSORTED;
+  ret = bp__build_check_empty(t);
+  if (ret != BP_OK) return ret;
+
+  /* runs follow each other, order inside them is checked by builders */
+  last = NULL;
+  for (i = 0; i < run_count; i++) {
+    if (counts[i] == 0) continue;
+    if (last != NULL && t->compare_cb(last, &keys[i][0]) >= 0) {
+      return BP_EUNSORTED;
+    }
+    last = &keys[i][counts[i] - 1];
+  }
+  if (last == NULL) return BP_OK;
+
+  job.tree = t;
+  job.run_count = run_count;
+  job.counts = counts;
+  job.keys = keys;
+  job.values = values;
+  job.next_run = 0;
+  job.ret = BP_OK;
+  job.roots = calloc((size_t) run_count, sizeof(*job.roots));
+  if (job.roots == NULL) return BP_EALLOC;
+
+  ids = malloc((size_t) threads * sizeof(*ids));
+  ret = ids == NULL ? BP_EALLOC : bp__mutex_init(&append_lock);
+  if (ret != BP_OK) {
+    free(ids);
+    free(job.roots);
+    return ret;
+  }
+
+  /* dedup index isn't shared between threads */
+  dedup = t->dedup;
+  t->dedup = NULL;
+  t->append_lock = &append_lock;
+
+  for (started = 0; started < threads; started++) {
+    if (pthread_create(&ids[started], NULL, bp__build_worker, &job) != 0) {
+      break;
+    }
+  }
+  /* threads that were started build all runs, or this one does */
+  if (started == 0) bp__build_worker(&job);
+  while (started > 0) pthread_join(ids[--started], NULL);
+
+  t->append_lock = NULL;
+  t->dedup = dedup;
+  bp__mutex_destroy(&append_lock);
+  free(ids);
+
+  /* subtrees of runs become children of new interior levels */
+  ret = job.ret;
+  b = NULL;
+  if (ret == BP_OK) ret = bp__builder_create(&b);
+  for (i = 0; ret == BP_OK && i < run_count; i++) {
+    if (counts[i] == 0) continue;
+    ret = bp__builder_push(t,
+                           b,
+                           1,
+                           &job.roots[i],
+                           job.roots[i].offset,
+                           job.roots[i].config);
+  }
+  if (ret == BP_OK) ret = bp__builder_root(t, b, &root);
+  if (b != NULL) bp__builder_destroy(t, b);
+  if (ret == BP_OK) {
+    ret = bp__build_head(t, &root);
+    free(root.value);
+  }
+
+  for (i = 0; i < run_count; i++) {
+    if (job.roots[i].allocated) free(job.roots[i].value);
+  }
+  free(job.roots);
+
+  return ret;
+}
+
+
+/* interior pages above the current one, their messages are newer */
+typedef struct bp__ingest_path_s bp__ingest_path_t;
+
+struct bp__ingest_path_s {
+  bp__page_t* page;
+  const bp__ingest_path_t* up;
+};
+
+
+static int bp__ingest_shadowed(bp_db_t* source,
+                               const bp__ingest_path_t* path,
+                               const bp_key_t* key) {
+  uint64_t index;
+
+  for (; path != NULL; path = path->up) {
+    if (bp__buffer_search(source, path->page, key, &index) == BP_OK) return 1;
+  }
+  return 0;
+}
+
+
+static int bp__ingest_insert(bp_db_t* t,
+                             bp_db_t* source,
+                             const bp__kv_t* kv) {
+  int ret;
+  bp_value_t value;
+
+  ret = bp__value_load(source, kv->offset, BP__KV_LENGTH(kv->config), &value);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__page_insert(t,
+                        t->head.page,
+                        (bp_key_t*) kv,
+                        &value,
+                        BP__KV_EXPIRE(kv->config),
+                        NULL,
+                        NULL);
+  free(value.value);
+
+  return ret;
+}
+
+
+/* insert kvs of source subtree which are visible in source, one by one */
+static int bp__ingest_merge(bp_db_t* t,
+                            bp_db_t* source,
+                            bp__page_t* page,
+                            const bp__ingest_path_t* up,
+                            const uint64_t now) {
+  int ret;
+  uint64_t i;
+  bp__page_t* child;
+  bp__kv_t* kv;
+  bp__ingest_path_t path;
+
+  path.page = page;
+  path.up = up;
+
+  for (i = 0; i < page->length; i++) {
+    kv = &page->keys[i];
+    if (BP__KV_EXPIRED(kv->config, now)) continue;
+
+    if (page->type == kPage) {
+      ret = bp__page_load(source, kv->offset, kv->config, &child);
+      if (ret != BP_OK) return ret;
+
+      ret = bp__ingest_merge(t, source, child, &path, now);
+      bp__page_destroy(source, child);
+    } else if (!bp__ingest_shadowed(source, up, (bp_key_t*) kv)) {
+      ret = bp__ingest_insert(t, source, kv);
+    }
+    if (ret != BP_OK) return ret;
+  }
+
+  for (i = 0; i < page->buffer_length; i++) {
+    kv = &page->buffer[i];
+    if (BP__MSG_REMOVED(kv->config) || BP__KV_EXPIRED(kv->config, now)) {
+      continue;
+    }
+    if (bp__ingest_shadowed(source, up, (bp_key_t*) kv)) continue;
+
+    ret = bp__ingest_insert(t, source, kv);
+    if (ret != BP_OK) return ret;
+  }
+
+  return BP_OK;
+}
+
+
+/*
+ * Merge overlapping source into a copy of head, which replaces head only
+ * once all kvs are there: failed ingest leaves nothing behind.
+ */
+static int bp__ingest_overlap(bp_db_t* t, bp_db_t* source) {
+  int ret;
+  bp__page_t* head = t->head.page;
+  bp__page_t* copy;
+
+  ret = bp__page_clone(t, head, &copy);
+  if (ret != BP_OK) return ret;
+
+  /* inserts go to t->head.page, which is replaced if it is split */
+  t->head.page = copy;
+  ret = bp__ingest_merge(t,
+                         source,
+                         source->head.page,
+                         NULL,
+                         (uint64_t) time(NULL));
+  if (ret == BP_OK) {
+    bp__page_destroy(t, head);
+  } else {
+    bp__page_destroy(t, t->head.page);
+    t->head.page = head;
+  }
+
+  return ret;
+}
+
+
+/* copy source tree to t, make its root head or attach it to head */
+static int bp__ingest_attach(bp_db_t* t,
+                             bp_db_t* source,
+                             const bp__kv_t* tree_min,
+                             const int empty,
+                             const int first) {
+  int ret;
+  bp__page_t* root;
+  bp__kv_t root_min;
+
+  ret = bp__page_clone(t, source->head.page, &root);
+  if (ret != BP_OK) return ret;
+
+  /* appends pages and values (as they are) to t */
+  ret = bp__page_copy(source, t, root);
+  if (ret != BP_OK) goto fatal;
+
+  /* everything has expired */
+  if (root->type == kLeaf && root->length == 0) goto fatal;
+
+  if (empty) {
+    bp__page_destroy(t, t->head.page);
+    t->head.page = root;
+    return BP_OK;
+  }
+
+  root->is_head = 0;
+  ret = bp__page_bound(t, root, 0, &root_min);
+  if (ret != BP_OK) goto fatal;
+
+  ret = bp__page_attach(t, root, &root_min, tree_min, first);
+  if (root_min.allocated) free(root_min.value);
+
+fatal:
+  bp__page_destroy(t, root);
+  return ret;
+}
+
+
+int bp__ingest(bp_db_t* t, const char* filename) {
+  int ret;
+  int empty = 0;
+  bp_db_t source;
+  bp_options_t options;
+  bp__kv_t source_min, source_max, tree_min, tree_max;
+
+  source_min.allocated = 0;
+  source_max.allocated = 0;
+  tree_min.allocated = 0;
+  tree_max.allocated = 0;
+
+  bp_options_init(&options);
+  options.flags = BP_OPEN_RDONLY;
+  ret = bp_open_ex(&source, filename, &options);
+  if (ret != BP_OK) return ret;
+  bp_set_compare_cb(&source, t->compare_cb);
+
+  bp__rwlock_wrlock(&t->rwlock);
+  BP__TRACE_OP(t, kTraceOpBulk)
+
+  /* page size of t limits number of kvs in every page */
+  if (source.head.page_size != t->head.page_size) {
+    ret = BP_EFILEREAD;
+    goto fatal;
+  }
+
+  ret = bp__page_bound(&source, source.head.page, 0, &source_min);
+  if (ret == BP_ENOTFOUND) {
+    ret = BP_OK;
+    goto fatal;
+  }
+  if (ret == BP_OK) {
+    ret = bp__page_bound(&source, source.head.page, 1, &source_max);
+  }
+  if (ret != BP_OK) goto fatal;
+
+  ret = bp__page_bound(t, t->head.page, 0, &tree_min);
+  if (ret == BP_OK) ret = bp__page_bound(t, t->head.page, 1, &tree_max);
+  if (ret == BP_ENOTFOUND) {
+    empty = 1;
+    ret = BP_OK;
+  }
+  if (ret != BP_OK) goto fatal;
+
+  if (empty ||
+      t->compare_cb((bp_key_t*) &source_max, (bp_key_t*) &tree_min) < 0) {
+    ret = bp__ingest_attach(t, &source, &tree_min, empty, 1);
+  } else if (t->compare_cb((bp_key_t*) &source_min,
+                           (bp_key_t*) &tree_max) > 0) {
+    ret = bp__ingest_attach(t, &source, &tree_min, 0, 0);
+  } else {
+    ret = bp__ingest_overlap(t, &source);
+  }
+
+  if (ret == BP_OK) ret = bp__tree_write_head((bp__writer_t*) t, NULL);
+
+fatal:
+  bp__rwlock_unlock(&t->rwlock);
+
+  if (source_min.allocated) free(source_min.value);
+  if (source_max.allocated) free(source_max.value);
+  if (tree_min.allocated) free(tree_min.value);
+  if (tree_max.allocated) free(tree_max.value);
+  bp_close(&source);
+
+  return ret;
+}
@@ -0,0 +1,120 @@
+#include <stdlib.h> /* free */
+
+#include "bplus.h"
+#include "private/cursor.h"
+#include "private/ingest.h"
+#include "private/merge.h"
+#include "private/trace.h"
+#include "private/writer.h"
+
+
+static int bp__merge_open(bp_db_t* t, bp_db_t* source, const char* filename) {
+  int ret;
+  bp_options_t options;
+
+  bp_options_init(&options);
+  options.flags = BP_OPEN_RDONLY;
+  ret = bp_open_ex(source, filename, &options);
+  if (ret != BP_OK) return ret;
+
+  bp_set_compare_cb(source, t->compare_cb);
+  return BP_OK;
+}
+
+
+int bp__merge_files(bp_db_t* t,
+                    const char* src_a,
+                    const char* src_b,
+                    const int policy) {
+  int ret, ret_a, ret_b, cmp;
+  bp_db_t a, b;
+  bp__cursor_t cursor_a, cursor_b;
+  bp__builder_t* builder = NULL;
+  bp__kv_t* kv_a = NULL;
+  bp__kv_t* kv_b = NULL;
+  bp__kv_t root;
+  uint64_t start;
+
+  ret = bp__merge_open(t, &a, src_a);
+  if (ret != BP_OK) return ret;
+  ret = bp__merge_open(t, &b, src_b);
+  if (ret != BP_OK) {
+    bp_close(&a);
+    return ret;
+  }
+  bp__cursor_init(&a, a.head.page, &cursor_a);
+  bp__cursor_init(&b, b.head.page, &cursor_b);
+
+  bp__rwlock_wrlock(&t->rwlock);
+  BP__TRACE_OP(t, kTraceOpBulk)
+  start = t->filesize;
+
+  ret = t->builder != NULL ? BP_EUNSORTED : bp__build_check_empty(t);
+  if (ret == BP_OK) ret = bp__builder_create(&builder);
+  if (ret != BP_OK) goto fatal;
+
+  ret_a = bp__cursor_next(&cursor_a, &kv_a);
+  ret_b = bp__cursor_next(&cursor_b, &kv_b);
+  for (;;) {
+    if (ret_a != BP_OK && ret_a != BP_ENOTFOUND) {
+      ret = ret_a;
+      break;
+    }
+    if (ret_b != BP_OK && ret_b != BP_ENOTFOUND) {
+      ret = ret_b;
+      break;
+    }
+    if (ret_a == BP_ENOTFOUND && ret_b == BP_ENOTFOUND) break;
+
+    if (ret_a == BP_ENOTFOUND) {
+      cmp = 1;
+    } else if (ret_b == BP_ENOTFOUND) {
+      cmp = -1;
+    } else {
+      cmp = t->compare_cb((bp_key_t*) kv_a, (bp_key_t*) kv_b);
+    }
+
+    if (cmp == 0 && policy == BP_MERGE_FAIL) {
+      ret = BP_EMERGECONFLICT;
+      break;
+    }
+
+    /* kv of the other file is dropped */
+    if (cmp < 0 || (cmp == 0 && policy == BP_MERGE_PREFER_A)) {
+      ret = bp__builder_copy(t, &a, builder, kv_a);
+    } else {
+      ret = bp__builder_copy(t, &b, builder, kv_b);
+    }
+    if (ret != BP_OK) break;
+
+    if (cmp <= 0) ret_a = bp__cursor_next(&cursor_a, &kv_a);
+    if (cmp >= 0) ret_b = bp__cursor_next(&cursor_b, &kv_b);
+  }
+  if (ret != BP_OK) goto fatal;
+
+  ret = bp__builder_root(t, builder, &root);
+  if (ret == BP_ENOTFOUND) {
+    ret = BP_OK;
+    goto fatal;
+  }
+  if (ret != BP_OK) goto fatal;
+
+  ret = bp__build_head(t, &root);
+  free(root.value);
+
+fatal:
+  if (builder != NULL) bp__builder_destroy(t, builder);
+
+  /* values and pages of failed merge are unreachable, drop them */
+  if (ret != BP_OK && t->filesize > start) {
+    bp__writer_truncate((bp__writer_t*) t, start);
+  }
+  bp__rwlock_unlock(&t->rwlock);
+
+  bp__cursor_destroy(&cursor_a);
+  bp__cursor_destroy(&cursor_b);
+  bp_close(&a);
+  bp_close(&b);
+
+  return ret;
+}
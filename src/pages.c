@@ -1,10 +1,14 @@
 #include <stdlib.h> /* malloc, free */
 #include <string.h> /* memcpy */
 #include <assert.h> /* assert */
+#include <time.h> /* time */
 
 #include "bplus.h"
 #include "private/pages.h"
+#include "private/dedup.h"
+#include "private/parse.h"
 #include "private/utils.h"
+#include "private/warmup.h"
 
 int bp__page_create(bp_db_t* t,
                     const enum page_type type,
@@ -28,6 +32,8 @@ int bp__page_create(bp_db_t* t,
     p->keys[0].length = 0;
     p->keys[0].offset = 0;
     p->keys[0].config = 0;
+    p->keys[0].key_offset = 0;
+    p->keys[0].key_config = 0;
     p->keys[0].allocated = 0;
     p->byte_size = BP__KV_SIZE(p->keys[0]);
   }
@@ -39,11 +45,28 @@ int bp__page_create(bp_db_t* t,
   p->buff_ = NULL;
   p->is_head = 0;
 
+  p->buffer = NULL;
+  p->buffer_length = 0;
+  p->buffer_size = 0;
+  p->buffer_capacity = 0;
+
+  p->orig_ = NULL;
+  p->orig_size = 0;
+  p->depth = 0;
+
   *page = p;
   return BP_OK;
 }
 
 
+static void bp__page_drop_orig(bp__page_t* page) {
+  /* after read page keeps its block in buff_, orig_ just points to it */
+  if (page->orig_ != page->buff_) free(page->orig_);
+  page->orig_ = NULL;
+  page->orig_size = 0;
+}
+
+
 void bp__page_destroy(bp_db_t* t, bp__page_t* page) {
   /* Free all keys */
   uint64_t i = 0;
@@ -54,6 +77,9 @@ void bp__page_destroy(bp_db_t* t, bp__page_t* page) {
     }
   }
 
+  bp__buffer_destroy(page);
+  bp__page_drop_orig(page);
+
   if (page->buff_ != NULL) {
     free(page->buff_);
     page->buff_ = NULL;
@@ -80,6 +106,8 @@ int bp__page_clone(bp_db_t* t, bp__page_t* page, bp__page_t** clone) {
   }
   (*clone)->byte_size = page->byte_size;
 
+  if (ret == BP_OK) ret = bp__buffer_copy(t, page, *clone, NULL, NULL);
+
   /* if failed - free memory for all allocated keys */
   if (ret != BP_OK) bp__page_destroy(t, *clone);
 
@@ -87,38 +115,399 @@ int bp__page_clone(bp_db_t* t, bp__page_t* page, bp__page_t** clone) {
 }
 
 
-int bp__page_read(bp_db_t* t, bp__page_t* page) {
-  int ret;
-  uint64_t size, o;
+/*
+ * kv at offset `o` of serialized page, BP_ENOTFOUND at the end of page.
+ * Key of overflow kv isn't loaded (value is NULL), see bp__kv_load_key.
+ */
+static int bp__page_next_kv(const char* buff,
+                            const uint64_t size,
+                            const uint64_t o,
+                            bp__kv_t* kv) {
+  if (o == size) return BP_ENOTFOUND;
+  if (size - o < BP__KV_HEADER_SIZE) return BP_EFILEREAD;
+
+  kv->length = ntohll(*(uint64_t*) (buff + o));
+  kv->offset = ntohll(*(uint64_t*) (buff + o + 8));
+  kv->config = ntohll(*(uint64_t*) (buff + o + 16));
+  kv->value = (char*) buff + o + 24;
+  kv->key_offset = 0;
+  kv->key_config = 0;
+  kv->allocated = 0;
+
+  if (kv->length & BP__KV_OVERFLOW) {
+    kv->length &= ~BP__KV_OVERFLOW;
+    if (size - o - BP__KV_HEADER_SIZE < BP__KV_OVERFLOW_SIZE) {
+      return BP_EFILEREAD;
+    }
+    kv->key_offset = ntohll(*(uint64_t*) (buff + o + 24));
+    kv->key_config = ntohll(*(uint64_t*) (buff + o + 32));
+    kv->value = NULL;
+    return kv->key_config == 0 ? BP_EFILEREAD : BP_OK;
+  }
+
+  if (size - o - BP__KV_HEADER_SIZE < kv->length) return BP_EFILEREAD;
+  return BP_OK;
+}
+
+
+static void bp__page_put_kv(char* buff, uint64_t* o, const bp__kv_t* kv) {
+  *(uint64_t*) (buff + *o + 8) = htonll(kv->offset);
+  *(uint64_t*) (buff + *o + 16) = htonll(kv->config);
+  if (kv->key_config != 0) {
+    *(uint64_t*) (buff + *o) = htonll(kv->length | BP__KV_OVERFLOW);
+    *(uint64_t*) (buff + *o + 24) = htonll(kv->key_offset);
+    *(uint64_t*) (buff + *o + 32) = htonll(kv->key_config);
+  } else {
+    *(uint64_t*) (buff + *o) = htonll(kv->length);
+    memcpy(buff + *o + 24, kv->value, kv->length);
+  }
+  *o += BP__KV_SIZE((*kv));
+}
+
+
+/*
+ * Serialized page is an optional buffer of messages followed by kvs, find
+ * where both start.
+ */
+static int bp__page_sections(const char* buff,
+                             const uint64_t size,
+                             uint64_t* count,
+                             uint64_t* kvs) {
   uint64_t i;
-  bp__writer_t* w = (bp__writer_t*) t;
+  bp__kv_t kv;
+
+  *count = 0;
+  *kvs = 0;
+  if (size < BP__BUFFER_HEADER_SIZE ||
+      ntohll(*(uint64_t*) buff) != BP__BUFFER_MARKER) {
+    return BP_OK;
+  }
+
+  *count = ntohll(*(uint64_t*) (buff + 8));
+  *kvs = BP__BUFFER_HEADER_SIZE;
+  for (i = 0; i < *count; i++) {
+    if (bp__page_next_kv(buff, size, *kvs, &kv) != BP_OK) return BP_EFILEREAD;
+    *kvs += BP__KV_SIZE(kv);
+  }
+
+  return BP_OK;
+}
+
+
+int bp__page_is_delta(const char* buff, const uint64_t size) {
+  return size >= BP__DELTA_HEADER_SIZE &&
+         ntohll(*(uint64_t*) buff) == BP__DELTA_MARKER;
+}
+
+
+void bp__page_delta_base(const char* buff,
+                         uint64_t* offset,
+                         uint64_t* config,
+                         uint64_t* depth) {
+  *offset = ntohll(*(uint64_t*) (buff + 8));
+  *config = ntohll(*(uint64_t*) (buff + 16));
+  *depth = ntohll(*(uint64_t*) (buff + 24));
+}
+
+
+/* delta entry at offset `o`: op followed by kv */
+int bp__page_delta_entry(const char* buff,
+                         const uint64_t size,
+                         const uint64_t o,
+                         uint64_t* op,
+                         bp__kv_t* kv) {
+  if (o == size) return BP_ENOTFOUND;
+  if (size - o < 8) return BP_EFILEREAD;
+
+  *op = ntohll(*(uint64_t*) (buff + o));
+  if (*op > kDeltaBufferRemove) return BP_EFILEREAD;
+
+  return bp__page_next_kv(buff, size, o + 8, kv) == BP_OK ?
+      BP_OK :
+      BP_EFILEREAD;
+}
+
+
+/*
+ * Merge sorted kvs of base[o, end) with delta entries of one section (upsert
+ * op and removal op that follows it), starting at `*d`.
+ */
+static int bp__page_merge(bp_db_t* t,
+                          const char* base,
+                          uint64_t o,
+                          const uint64_t end,
+                          const char* delta,
+                          const uint64_t delta_size,
+                          uint64_t* d,
+                          const enum delta_op upsert,
+                          char* out,
+                          uint64_t* r,
+                          uint64_t* count) {
+  int ret_kv, ret_entry;
+  int cmp;
+  uint64_t op = upsert;
+  bp__kv_t kv;
+  bp__kv_t entry;
+
+  *count = 0;
+  ret_kv = bp__page_next_kv(base, end, o, &kv);
+  ret_entry = bp__page_delta_entry(delta, delta_size, *d, &op, &entry);
+  for (;;) {
+    if (ret_kv == BP_EFILEREAD || ret_entry == BP_EFILEREAD) {
+      return BP_EFILEREAD;
+    }
+
+    /* pages with overflow keys are never written as deltas */
+    if ((ret_kv == BP_OK && kv.key_config != 0) ||
+        (ret_entry == BP_OK && entry.key_config != 0)) {
+      return BP_EFILEREAD;
+    }
+
+    /* entries of the next section */
+    if (ret_entry == BP_OK && op != upsert && op != upsert + 1) {
+      ret_entry = BP_ENOTFOUND;
+    }
+
+    if (ret_entry == BP_ENOTFOUND) {
+      if (ret_kv == BP_ENOTFOUND) break;
+      cmp = -1;
+    } else if (ret_kv == BP_ENOTFOUND) {
+      cmp = 1;
+    } else {
+      cmp = t->compare_cb((bp_key_t*) &kv, (bp_key_t*) &entry);
+    }
+
+    if (cmp < 0) {
+      bp__page_put_kv(out, r, &kv);
+      (*count)++;
+      o += BP__KV_SIZE(kv);
+      ret_kv = bp__page_next_kv(base, end, o, &kv);
+      continue;
+    }
+
+    /* entry replaces or removes base kv with the same key */
+    if (cmp == 0) {
+      o += BP__KV_SIZE(kv);
+      ret_kv = bp__page_next_kv(base, end, o, &kv);
+    }
+    if (op == upsert) {
+      bp__page_put_kv(out, r, &entry);
+      (*count)++;
+    }
+
+    *d += 8 + BP__KV_SIZE(entry);
+    ret_entry = bp__page_delta_entry(delta, delta_size, *d, &op, &entry);
+  }
+
+  return BP_OK;
+}
 
-  char* buff = NULL;
+
+int bp__page_delta_apply(bp_db_t* t,
+                         const char* base,
+                         const uint64_t base_size,
+                         const char* delta,
+                         const uint64_t delta_size,
+                         char** result,
+                         uint64_t* result_size) {
+  int ret;
+  uint64_t d, r;
+  uint64_t count, kvs;
+  char* buff;
+
+  ret = bp__page_sections(base, base_size, &count, &kvs);
+  if (ret != BP_OK) return ret;
+
+  /* result is never larger than base plus all upserted kvs */
+  buff = malloc(BP__BUFFER_HEADER_SIZE + base_size + delta_size);
+  if (buff == NULL) return BP_EALLOC;
+
+  /* both base kvs and delta entries are sorted, merge them */
+  d = BP__DELTA_HEADER_SIZE;
+  r = BP__BUFFER_HEADER_SIZE;
+  ret = bp__page_merge(t,
+                       base,
+                       count == 0 ? 0 : BP__BUFFER_HEADER_SIZE,
+                       kvs,
+                       delta,
+                       delta_size,
+                       &d,
+                       kDeltaBufferUpsert,
+                       buff,
+                       &r,
+                       &count);
+  if (ret != BP_OK) goto fatal;
+
+  if (count == 0) {
+    r = 0;
+  } else {
+    *(uint64_t*) buff = htonll(BP__BUFFER_MARKER);
+    *(uint64_t*) (buff + 8) = htonll(count);
+  }
+
+  ret = bp__page_merge(t,
+                       base,
+                       kvs,
+                       base_size,
+                       delta,
+                       delta_size,
+                       &d,
+                       kDeltaUpsert,
+                       buff,
+                       &r,
+                       &count);
+  if (ret != BP_OK) goto fatal;
+
+  /* entries out of order */
+  if (d != delta_size) {
+    ret = BP_EFILEREAD;
+    goto fatal;
+  }
+
+  *result = buff;
+  *result_size = r;
+  return BP_OK;
+
+fatal:
+  free(buff);
+  return ret;
+}
+
+
+int bp__page_delta_check(const uint64_t offset,
+                         const uint64_t config,
+                         const uint64_t level,
+                         const uint64_t base_offset,
+                         const uint64_t base_config) {
+  /* base is always older and of the same kind, chains are short */
+  if (level >= BP__DELTA_MAX_DEPTH ||
+      base_offset >= offset ||
+      (base_config & 1) != (config & 1)) {
+    return BP_EFILEREAD;
+  }
+  return BP_OK;
+}
+
+
+/* read serialized page, applying delta chain if it is stored as delta */
+static int bp__page_read_block(bp_db_t* t,
+                               const uint64_t offset,
+                               const uint64_t config,
+                               const uint64_t level,
+                               char** buff,
+                               uint64_t* size,
+                               uint64_t* depth) {
+  int ret;
+  uint64_t base_offset, base_config, base_depth, base_size;
+  uint64_t result_size;
+  char* base = NULL;
+  char* result = NULL;
+
+  *buff = NULL;
+  *size = BP__KV_LENGTH(config) >> 1;
+  ret = bp__writer_read((bp__writer_t*) t,
+                        kCompressed,
+                        config & 1 ? kLeafBlock : kPageBlock,
+                        offset,
+                        size,
+                        (void**) buff);
+  if (ret != BP_OK) return ret;
+
+  *depth = 0;
+  if (!bp__page_is_delta(*buff, *size)) return BP_OK;
+
+  bp__page_delta_base(*buff, &base_offset, &base_config, depth);
+  ret = bp__page_delta_check(offset, config, level, base_offset, base_config);
+  if (ret != BP_OK) goto fatal;
+
+  ret = bp__page_read_block(t,
+                            base_offset,
+                            base_config,
+                            level + 1,
+                            &base,
+                            &base_size,
+                            &base_depth);
+  if (ret != BP_OK) goto fatal;
+
+  ret = bp__page_delta_apply(t,
+                             base,
+                             base_size,
+                             *buff,
+                             *size,
+                             &result,
+                             &result_size);
+  free(base);
+  if (ret != BP_OK) goto fatal;
+
+  free(*buff);
+  *buff = result;
+  *size = result_size;
+  return BP_OK;
+
+fatal:
+  free(*buff);
+  *buff = NULL;
+  return ret;
+}
+
+
+int bp__page_parse(bp_db_t* t,
+                   bp__page_t* page,
+                   char* buff,
+                   const uint64_t size) {
+  int ret;
+  uint64_t o, m;
+  uint64_t i;
+  uint64_t count;
 
   /* Read page size and leaf flag */
-  size = page->config >> 1;
   page->type = page->config & 1 ? kLeaf : kPage;
 
-  /* Read page data */
-  ret = bp__writer_read(w, kCompressed, page->offset, &size, (void**) &buff);
-  if (ret != BP_OK) return ret;
+  /* Parse buffered messages */
+  bp__buffer_destroy(page);
+  ret = bp__page_sections(buff, size, &count, &o);
+  if (ret == BP_OK && count != 0) {
+    if (page->type == kLeaf) {
+      ret = BP_EFILEREAD;
+    } else {
+      page->buffer = malloc((size_t) count * sizeof(*page->buffer));
+      if (page->buffer == NULL) ret = BP_EALLOC;
+    }
+  }
+  if (ret != BP_OK) {
+    page->length = 0;
+    return ret;
+  }
+  page->buffer_capacity = count;
+  page->buffer_length = count;
+  page->buffer_size = o == 0 ? 0 : o - BP__BUFFER_HEADER_SIZE;
+  for (i = 0, m = BP__BUFFER_HEADER_SIZE; i < count; i++) {
+    bp__page_next_kv(buff, size, m, &page->buffer[i]);
+    m += BP__KV_SIZE(page->buffer[i]);
+  }
 
   /* Parse data */
   i = 0;
-  o = 0;
-  while (o < size) {
-    page->keys[i].length = ntohll(*(uint64_t*) (buff + o));
-    page->keys[i].offset = ntohll(*(uint64_t*) (buff + o + 8));
-    page->keys[i].config = ntohll(*(uint64_t*) (buff + o + 16));
-    page->keys[i].value = buff + o + 24;
-    page->keys[i].allocated = 0;
-
+  while ((ret = bp__page_next_kv(buff, size, o, &page->keys[i])) == BP_OK) {
     o += BP__KV_SIZE(page->keys[i]);
     i++;
+
+    /* only merged delta chain can overflow page */
+    if (i == t->head.page_size && o != size) {
+      ret = BP_EFILEREAD;
+      break;
+    }
+  }
+  if (ret != BP_ENOTFOUND) {
+    page->length = 0;
+    bp__buffer_destroy(page);
+    return BP_EFILEREAD;
   }
   page->length = i;
-  page->byte_size = size;
+  page->byte_size = size - page->buffer_size -
+                    (count == 0 ? 0 : BP__BUFFER_HEADER_SIZE);
 
+  bp__page_drop_orig(page);
   if (page->buff_ != NULL) {
     free(page->buff_);
   }
@@ -128,6 +517,59 @@ int bp__page_read(bp_db_t* t, bp__page_t* page) {
 }
 
 
+int bp__page_read(bp_db_t* t, bp__page_t* page) {
+  int ret;
+  uint64_t size;
+  uint64_t i;
+  uint64_t depth;
+
+  char* buff = NULL;
+
+  /* Read page data */
+  ret = bp__page_read_block(t,
+                            page->offset,
+                            page->config,
+                            0,
+                            &buff,
+                            &size,
+                            &depth);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__page_parse(t, page, buff, size);
+  if (ret != BP_OK) {
+    free(buff);
+    return ret;
+  }
+
+  /* Load overflow keys */
+  for (i = 0; ret == BP_OK && i < page->length + page->buffer_length; i++) {
+    bp__kv_t* kv = i < page->length ?
+        &page->keys[i] :
+        &page->buffer[i - page->length];
+
+    if (kv->key_config != 0 && bp__kv_load_key(t, kv) != BP_OK) {
+      ret = BP_EFILEREAD;
+    }
+  }
+  if (ret != BP_OK) {
+    for (i = 0; i < page->length; i++) {
+      if (page->keys[i].allocated) free(page->keys[i].value);
+    }
+    page->length = 0;
+    bp__buffer_destroy(page);
+    return ret;
+  }
+
+  if (t->warmup != NULL) bp__warmup_record(t, page->offset, page->config);
+
+  page->orig_ = buff;
+  page->orig_size = size;
+  page->depth = depth;
+
+  return BP_OK;
+}
+
+
 int bp__page_load(bp_db_t* t,
                   const uint64_t offset,
                   const uint64_t config,
@@ -151,41 +593,249 @@ int bp__page_load(bp_db_t* t,
 }
 
 
+static int bp__page_delta_put(char* buff,
+                              const uint64_t limit,
+                              uint64_t* d,
+                              const enum delta_op op,
+                              const bp__kv_t* kv) {
+  if (limit - *d < 8 + BP__KV_SIZE((*kv))) return 0;
+
+  *(uint64_t*) (buff + *d) = htonll((uint64_t) op);
+  *d += 8;
+  bp__page_put_kv(buff, d, kv);
+  return 1;
+}
+
+
+/*
+ * Diff of sorted kvs orig[o, end) against `cur`, appends entries with
+ * `upsert` op (and removals after it) to delta. Returns 0 if delta doesn't
+ * fit into limit, or orig isn't sorted.
+ */
+static int bp__page_diff_section(bp_db_t* t,
+                                 const char* orig,
+                                 uint64_t o,
+                                 const uint64_t end,
+                                 const bp__kv_t* cur,
+                                 const uint64_t length,
+                                 const enum delta_op upsert,
+                                 char* buff,
+                                 const uint64_t limit,
+                                 uint64_t* d) {
+  int ret, cmp, fits;
+  uint64_t i;
+  bp__kv_t kv;
+  bp__kv_t prev;
+  const enum delta_op remove = (enum delta_op) (upsert + 1);
+
+  i = 0;
+  fits = 1;
+  ret = bp__page_next_kv(orig, end, o, &kv);
+  while (fits && (ret == BP_OK || i < length)) {
+    /* pages with overflow keys are written in full */
+    if ((ret == BP_OK && kv.key_config != 0) ||
+        (i < length && cur[i].key_config != 0)) {
+      fits = 0;
+      break;
+    }
+
+    if (ret != BP_OK) {
+      cmp = 1;
+    } else if (i == length) {
+      cmp = -1;
+    } else {
+      cmp = t->compare_cb((bp_key_t*) &kv, (bp_key_t*) &cur[i]);
+    }
+
+    if (cmp > 0) {
+      fits = bp__page_delta_put(buff, limit, d, upsert, &cur[i]);
+      i++;
+      continue;
+    }
+
+    if (cmp < 0) {
+      fits = bp__page_delta_put(buff, limit, d, remove, &kv);
+    } else {
+      if (kv.offset != cur[i].offset ||
+          kv.config != cur[i].config ||
+          kv.length != cur[i].length ||
+          memcmp(kv.value, cur[i].value, kv.length) != 0) {
+        fits = bp__page_delta_put(buff, limit, d, upsert, &cur[i]);
+      }
+      i++;
+    }
+
+    prev = kv;
+    o += BP__KV_SIZE(kv);
+    ret = bp__page_next_kv(orig, end, o, &kv);
+    if (ret == BP_OK &&
+        kv.key_config == 0 &&
+        t->compare_cb((bp_key_t*) &prev, (bp_key_t*) &kv) >= 0) {
+      fits = 0;
+    }
+  }
+
+  return fits && ret != BP_EFILEREAD;
+}
+
+
+/*
+ * Changes of page since orig_ as delta block, `*delta` is NULL if page
+ * should be written in full: delta isn't much smaller than page, or keys
+ * are not sorted by compare_cb (merge in bp__page_delta_apply needs it).
+ */
+static int bp__page_diff(bp_db_t* t,
+                         bp__page_t* page,
+                         const uint64_t size,
+                         char** delta,
+                         uint64_t* delta_size) {
+  uint64_t i, d, limit;
+  uint64_t count, kvs;
+  char* buff;
+
+  *delta = NULL;
+
+  limit = size / 2;
+  if (limit < BP__DELTA_HEADER_SIZE) return BP_OK;
+
+  for (i = 1; i < page->length; i++) {
+    if (t->compare_cb((bp_key_t*) &page->keys[i - 1],
+                      (bp_key_t*) &page->keys[i]) >= 0) {
+      return BP_OK;
+    }
+  }
+
+  if (bp__page_sections(page->orig_, page->orig_size, &count, &kvs) != BP_OK) {
+    return BP_OK;
+  }
+
+  buff = malloc(limit);
+  if (buff == NULL) return BP_EALLOC;
+
+  *(uint64_t*) buff = htonll(BP__DELTA_MARKER);
+  *(uint64_t*) (buff + 8) = htonll(page->offset);
+  *(uint64_t*) (buff + 16) = htonll(page->config);
+  *(uint64_t*) (buff + 24) = htonll(page->depth + 1);
+
+  /* buffer is kept sorted by bp__buffer_put */
+  d = BP__DELTA_HEADER_SIZE;
+  if (!bp__page_diff_section(t,
+                             page->orig_,
+                             count == 0 ? 0 : BP__BUFFER_HEADER_SIZE,
+                             kvs,
+                             page->buffer,
+                             page->buffer_length,
+                             kDeltaBufferUpsert,
+                             buff,
+                             limit,
+                             &d) ||
+      !bp__page_diff_section(t,
+                             page->orig_,
+                             kvs,
+                             page->orig_size,
+                             page->keys,
+                             page->length,
+                             kDeltaUpsert,
+                             buff,
+                             limit,
+                             &d)) {
+    free(buff);
+    return BP_OK;
+  }
+
+  *delta = buff;
+  *delta_size = d;
+  return BP_OK;
+}
+
+
 int bp__page_save(bp_db_t* t, bp__page_t* page) {
   int ret;
   bp__writer_t* w = (bp__writer_t*) t;
   uint64_t i;
   uint64_t o;
+  uint64_t size;
+  uint64_t expire;
+  uint64_t delta_size = 0;
   char* buff;
+  char* delta = NULL;
 
   assert(page->type == kLeaf || page->length != 0);
+  assert(page->type == kPage || page->buffer_length == 0);
+
+  /* page expires only when all its kvs (and buffered values) do */
+  expire = 0;
+  for (i = 0; i < page->length + page->buffer_length; i++) {
+    uint64_t config = i < page->length ?
+        page->keys[i].config :
+        page->buffer[i - page->length].config;
+
+    if (i >= page->length && BP__MSG_REMOVED(config)) continue;
+    if (BP__KV_EXPIRE(config) == 0) {
+      expire = 0;
+      break;
+    }
+    if (BP__KV_EXPIRE(config) > expire) {
+      expire = BP__KV_EXPIRE(config);
+    }
+  }
 
-  /* Allocate space for serialization (header + keys); */
-  buff = malloc(page->byte_size);
+  /* Allocate space for serialization (buffer + keys); */
+  size = page->byte_size;
+  if (page->buffer_length != 0) {
+    size += BP__BUFFER_HEADER_SIZE + page->buffer_size;
+  }
+  buff = malloc(size);
   if (buff == NULL) return BP_EALLOC;
 
   o = 0;
+  if (page->buffer_length != 0) {
+    *(uint64_t*) buff = htonll(BP__BUFFER_MARKER);
+    *(uint64_t*) (buff + 8) = htonll(page->buffer_length);
+    o = BP__BUFFER_HEADER_SIZE;
+    for (i = 0; i < page->buffer_length; i++) {
+      bp__page_put_kv(buff, &o, &page->buffer[i]);
+    }
+  }
   for (i = 0; i < page->length; i++) {
-    assert(o + BP__KV_SIZE(page->keys[i]) <= page->byte_size);
-
-    *(uint64_t*) (buff + o) = htonll(page->keys[i].length);
-    *(uint64_t*) (buff + o + 8) = htonll(page->keys[i].offset);
-    *(uint64_t*) (buff + o + 16) = htonll(page->keys[i].config);
-
-    memcpy(buff + o + 24, page->keys[i].value, page->keys[i].length);
+    assert(o + BP__KV_SIZE(page->keys[i]) <= size);
+    bp__page_put_kv(buff, &o, &page->keys[i]);
+  }
+  assert(o == size);
+
+  /* write only changes on top of previous version, if chain isn't long */
+  if (t->delta_chain != 0 &&
+      page->orig_ != NULL &&
+      page->type == (page->config & 1 ? kLeaf : kPage) &&
+      page->depth < t->delta_chain) {
+    ret = bp__page_diff(t, page, size, &delta, &delta_size);
+    if (ret != BP_OK) goto fatal;
 
-    o += BP__KV_SIZE(page->keys[i]);
+    /* nothing has changed, page is already on disk */
+    if (delta != NULL && delta_size == BP__DELTA_HEADER_SIZE) goto fatal;
   }
-  assert(o == page->byte_size);
 
-  page->config = page->byte_size;
+  page->config = delta != NULL ? delta_size : size;
   ret = bp__writer_write(w,
                          kCompressed,
-                         buff,
+                         page->type == kLeaf ? kLeafBlock : kPageBlock,
+                         delta != NULL ? delta : buff,
                          &page->offset,
                          &page->config);
-  page->config = (page->config << 1) | (page->type == kLeaf);
+  page->config = (expire << 32) |
+                 (page->config << 1) |
+                 (page->type == kLeaf);
+  if (ret != BP_OK) goto fatal;
+
+  /* serialized page is the base for the next delta */
+  page->depth = delta != NULL ? page->depth + 1 : 0;
+  bp__page_drop_orig(page);
+  page->orig_ = buff;
+  page->orig_size = size;
+  buff = NULL;
 
+fatal:
+  free(delta);
   free(buff);
   return ret;
 }
@@ -197,7 +847,7 @@ int bp__page_load_value(bp_db_t* t,
                         bp_value_t* value) {
   return bp__value_load(t,
                         page->keys[index].offset,
-                        page->keys[index].config,
+                        BP__KV_LENGTH(page->keys[index].config),
                         value);
 }
 
@@ -208,15 +858,26 @@ int bp__page_save_value(bp_db_t* t,
                         const int cmp,
                         const bp_key_t* key,
                         const bp_value_t* value,
+                        const uint64_t expire,
                         bp_update_cb update_cb,
                         void* arg) {
   int ret;
+  int replace = cmp == 0;
   bp__kv_t previous, tmp;
 
+  /* store key, overflow key of replaced kv is reused */
+  tmp.value = key->value;
+  tmp.length = key->length;
+  tmp.key_offset = replace ? page->keys[index].key_offset : 0;
+  tmp.key_config = replace ? page->keys[index].key_config : 0;
+
   /* replace item with same key from page */
-  if (cmp == 0) {
-    /* solve conflicts if callback was provided */
-    if (update_cb != NULL) {
+  if (replace) {
+    /* expired value is overwritten as if it wasn't there */
+    if (BP__KV_EXPIRED(page->keys[index].config, (uint64_t) time(NULL))) {
+      replace = 0;
+    } else if (update_cb != NULL) {
+      /* solve conflicts if callback was provided */
       bp_value_t prev_value;
 
       ret = bp__page_load_value(t, page, index, &prev_value);
@@ -228,21 +889,23 @@ int bp__page_save_value(bp_db_t* t,
       if (!ret) return BP_EUPDATECONFLICT;
     }
     previous.offset = page->keys[index].offset;
-    previous.length = page->keys[index].config;
+    previous.length = BP__KV_LENGTH(page->keys[index].config);
     bp__page_remove_idx(t, page, index);
   }
 
-  /* store key */
-  tmp.value = key->value;
-  tmp.length = key->length;
+  if (tmp.key_config == 0) {
+    ret = bp__kv_save_key(t, &tmp);
+    if (ret != BP_OK) return ret;
+  }
 
   /* store value */
   ret = bp__value_save(t,
                        value,
-                       cmp == 0 ? &previous : NULL,
+                       replace ? &previous : NULL,
                        &tmp.offset,
                        &tmp.config);
   if (ret != BP_OK) return ret;
+  tmp.config |= expire << 32;
 
   /* Shift all keys right */
   bp__page_shiftr(t, page, index);
@@ -313,21 +976,48 @@ int bp__page_search(bp_db_t* t,
 }
 
 
-int bp__page_get(bp_db_t* t,
-                 bp__page_t* page,
-                 const bp_key_t* key,
-                 bp_value_t* value) {
+int bp__page_lookup(bp_db_t* t,
+                    bp__page_t* page,
+                    const bp_key_t* key,
+                    uint64_t* offset,
+                    uint64_t* config) {
   int ret;
+  uint64_t now = (uint64_t) time(NULL);
   bp__page_search_res_t res;
-  ret = bp__page_search(t, page, key, kLoad, &res);
+
+  /* buffered message is newer than anything below it */
+  if (bp__buffer_search(t, page, key, &res.index) == BP_OK) {
+    *offset = page->buffer[res.index].offset;
+    *config = page->buffer[res.index].config;
+    if (BP__MSG_REMOVED(*config) || BP__KV_EXPIRED(*config, now)) {
+      return BP_ENOTFOUND;
+    }
+    return BP_OK;
+  }
+
+  ret = bp__page_search(t, page, key, kNotLoad, &res);
   if (ret != BP_OK) return ret;
 
-  if (res.child == NULL) {
+  /* expired values (and subtrees) are not loaded at all */
+  if (res.index < page->length &&
+      BP__KV_EXPIRED(page->keys[res.index].config, now)) {
+    return BP_ENOTFOUND;
+  }
+
+  if (page->type == kLeaf) {
     if (res.cmp != 0) return BP_ENOTFOUND;
 
-    return bp__page_load_value(t, page, res.index, value);
+    *offset = page->keys[res.index].offset;
+    *config = page->keys[res.index].config;
+    return BP_OK;
   } else {
-    ret = bp__page_get(t, res.child, key, value);
+    ret = bp__page_load(t,
+                        page->keys[res.index].offset,
+                        page->keys[res.index].config,
+                        &res.child);
+    if (ret != BP_OK) return ret;
+
+    ret = bp__page_lookup(t, res.child, key, offset, config);
     bp__page_destroy(t, res.child);
     res.child = NULL;
     return ret;
@@ -335,15 +1025,30 @@ int bp__page_get(bp_db_t* t,
 }
 
 
-int bp__page_get_range(bp_db_t* t,
-                       bp__page_t* page,
-                       const bp_key_t* start,
-                       const bp_key_t* end,
-                       bp_filter_cb filter,
-                       bp_range_cb cb,
-                       void* arg) {
+int bp__page_get(bp_db_t* t,
+                 bp__page_t* page,
+                 const bp_key_t* key,
+                 bp_value_t* value) {
+  int ret;
+  uint64_t offset, config;
+
+  ret = bp__page_lookup(t, page, key, &offset, &config);
+  if (ret != BP_OK) return ret;
+
+  return bp__value_load(t, offset, BP__KV_LENGTH(config), value);
+}
+
+
+static int bp__page_get_items(bp_db_t* t,
+                              bp__page_t* page,
+                              const bp_key_t* start,
+                              const bp_key_t* end,
+                              bp_filter_cb filter,
+                              bp_range_cb cb,
+                              void* arg) {
   int ret;
   uint64_t i;
+  uint64_t now = (uint64_t) time(NULL);
   bp__page_search_res_t start_res, end_res;
 
   /* find start and end indexes */
@@ -353,14 +1058,18 @@ int bp__page_get_range(bp_db_t* t,
   if (ret != BP_OK) return ret;
 
   if (page->type == kLeaf) {
-    /* on leaf pages end-key should always be greater or equal than first key */
-    if (end_res.cmp > 0 && end_res.index == 0) return BP_OK;
-
-    if (end_res.cmp < 0) end_res.index--;
+    /* end_res points to first key >= end, step back unless it is end itself */
+    if (end_res.cmp != 0) {
+      if (end_res.index == 0) return BP_OK;
+      end_res.index--;
+    }
   }
 
   /* go through each page item */
   for (i = start_res.index; i <= end_res.index; i++) {
+    /* skip expired values and subtrees */
+    if (BP__KV_EXPIRED(page->keys[i].config, now)) continue;
+
     /* run filter */
     if (!filter(arg, (bp_key_t*) &page->keys[i])) continue;
 
@@ -396,46 +1105,96 @@ int bp__page_get_range(bp_db_t* t,
 }
 
 
+int bp__page_get_range(bp_db_t* t,
+                       bp__page_t* page,
+                       const bp_key_t* start,
+                       const bp_key_t* end,
+                       bp_filter_cb filter,
+                       bp_range_cb cb,
+                       void* arg) {
+  int ret;
+  bp__buffer_range_t range;
+
+  if (page->buffer_length == 0) {
+    return bp__page_get_items(t, page, start, end, filter, cb, arg);
+  }
+
+  /* merge buffered messages into results of children */
+  bp__buffer_range_init(&range, t, page, start, end, filter, cb, arg);
+  ret = bp__page_get_items(t,
+                           page,
+                           start,
+                           end,
+                           bp__buffer_range_filter,
+                           bp__buffer_range_cb,
+                           &range);
+  return bp__buffer_range_finish(&range, ret);
+}
+
+
 int bp__page_insert(bp_db_t* t,
                     bp__page_t* page,
                     const bp_key_t* key,
                     const bp_value_t* value,
+                    const uint64_t expire,
                     bp_update_cb update_cb,
                     void* arg) {
   int ret;
+  int handled = 0;
   bp__page_search_res_t res;
-  ret = bp__page_search(t, page, key, kLoad, &res);
-  if (ret != BP_OK) return ret;
 
-  if (res.child == NULL) {
-    /* store value in db file to get offset and config */
-    ret = bp__page_save_value(t,
-                              page,
-                              res.index,
-                              res.cmp,
-                              key,
-                              value,
-                              update_cb,
-                              arg);
+  /* message goes to page's buffer, it is moved down once buffer is full */
+  if (page->type == kPage) {
+    ret = bp__buffer_insert(t,
+                            page,
+                            key,
+                            value,
+                            expire,
+                            update_cb,
+                            arg,
+                            &handled);
     if (ret != BP_OK) return ret;
-  } else {
-    /* Insert kv in child page */
-    ret = bp__page_insert(t, res.child, key, value, update_cb, arg);
-
-    /* kv was inserted but page is full now */
-    if (ret == BP_ESPLITPAGE) {
-      ret = bp__page_split(t, page, res.index, res.child);
-    } else if (ret == BP_OK) {
-      /* Update offsets in page */
-      page->keys[res.index].offset = res.child->offset;
-      page->keys[res.index].config = res.child->config;
+    if (handled && page->is_head) {
+      ret = bp__buffer_flush(t, &page);
+      if (ret != BP_OK) return ret;
     }
+  }
 
-    bp__page_destroy(t, res.child);
-    res.child = NULL;
+  if (!handled) {
+    ret = bp__page_search(t, page, key, kLoad, &res);
+    if (ret != BP_OK) return ret;
 
-    if (ret != BP_OK) {
-      return ret;
+    if (res.child == NULL) {
+      /* store value in db file to get offset and config */
+      ret = bp__page_save_value(t,
+                                page,
+                                res.index,
+                                res.cmp,
+                                key,
+                                value,
+                                expire,
+                                update_cb,
+                                arg);
+      if (ret != BP_OK) return ret;
+    } else {
+      /* Insert kv in child page */
+      ret = bp__page_insert(t, res.child, key, value, expire, update_cb, arg);
+
+      /* kv was inserted but page is full now */
+      if (ret == BP_ESPLITPAGE) {
+        ret = bp__page_split(t, page, res.index, res.child);
+      } else if (ret == BP_OK) {
+        /* Update offsets in page */
+        page->keys[res.index].offset = res.child->offset;
+        page->keys[res.index].config = res.child->config;
+      }
+
+      bp__page_destroy(t, res.child);
+      res.child = NULL;
+
+      if (ret != BP_OK) {
+        return ret;
+      }
     }
   }
 
@@ -467,11 +1226,31 @@ int bp__page_bulk_insert(bp_db_t* t,
                          bp_update_cb update_cb,
                          void* arg) {
   int ret;
+  int handled;
+  uint64_t index;
   bp__page_search_res_t res;
 
   while (*count > 0 &&
          (limit == NULL || t->compare_cb(limit, *keys) > 0)) {
 
+    /* bulk is already batched, only buffered messages are replaced */
+    if (bp__buffer_search(t, page, *keys, &index) == BP_OK) {
+      ret = bp__buffer_insert(t,
+                              page,
+                              *keys,
+                              *values,
+                              0,
+                              update_cb,
+                              arg,
+                              &handled);
+      if (ret != BP_OK && ret != BP_EUPDATECONFLICT) return ret;
+
+      *keys = *keys + 1;
+      *values = *values + 1;
+      *count = *count - 1;
+      continue;
+    }
+
     ret = bp__page_search(t, page, *keys, kLoad, &res);
     if (ret != BP_OK) return ret;
 
@@ -483,6 +1262,7 @@ int bp__page_bulk_insert(bp_db_t* t,
                                 res.cmp,
                                 *keys,
                                 *values,
+                                0,
                                 update_cb,
                                 arg);
       /*
@@ -502,6 +1282,13 @@ int bp__page_bulk_insert(bp_db_t* t,
         new_limit = (bp_key_t*) &page->keys[res.index + 1];
       }
 
+      /* keys with a message in this page stop at it */
+      if (index < page->buffer_length &&
+          (new_limit == NULL ||
+           t->compare_cb((bp_key_t*) &page->buffer[index], new_limit) < 0)) {
+        new_limit = (bp_key_t*) &page->buffer[index];
+      }
+
       ret = bp__page_bulk_insert(t,
                                  res.child,
                                  new_limit,
@@ -541,19 +1328,65 @@ int bp__page_bulk_insert(bp_db_t* t,
 }
 
 
+/*
+ * Remove empty child from page. Last child is replaced with an empty leaf
+ * instead if page has buffered messages, they need a subtree to go to.
+ */
+static int bp__page_drop_child(bp_db_t* t,
+                               bp__page_t* page,
+                               const uint64_t index) {
+  int ret;
+  bp__page_t* leaf;
+
+  if (page->length != 1 || page->buffer_length == 0) {
+    return bp__page_remove_idx(t, page, index);
+  }
+
+  ret = bp__page_create(t, kLeaf, 0, 0, &leaf);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__page_save(t, leaf);
+  if (ret == BP_OK) {
+    page->keys[index].offset = leaf->offset;
+    page->keys[index].config = leaf->config;
+  }
+
+  bp__page_destroy(t, leaf);
+  return ret;
+}
+
+
 int bp__page_remove(bp_db_t* t,
                     bp__page_t* page,
                     const bp_key_t* key,
                     bp_remove_cb remove_cb,
                     void* arg) {
   int ret;
+  int handled = 0;
   bp__page_search_res_t res;
+
+  /* removal message hides key in subtree, until it is moved down */
+  if (page->type == kPage) {
+    ret = bp__buffer_remove(t, page, key, remove_cb, arg, &handled);
+    if (ret != BP_OK) return ret;
+    if (handled && page->is_head) {
+      ret = bp__buffer_flush(t, &page);
+      if (ret != BP_OK) return ret;
+    }
+    if (handled) return bp__page_save(t, page);
+  }
+
   ret = bp__page_search(t, page, key, kLoad, &res);
   if (ret != BP_OK) return ret;
 
   if (res.child == NULL) {
     if (res.cmp != 0) return BP_ENOTFOUND;
 
+    /* expired values are left for compaction and bp_purge_expired */
+    if (BP__KV_EXPIRED(page->keys[res.index].config, (uint64_t) time(NULL))) {
+      return BP_ENOTFOUND;
+    }
+
     /* remove only if remove_cb returns BP_OK */
     if (remove_cb != NULL) {
       bp_value_t prev_val;
@@ -573,20 +1406,27 @@ int bp__page_remove(bp_db_t* t,
     /* Insert kv in child page */
     ret = bp__page_remove(t, res.child, key, remove_cb, arg);
 
-    if (ret != BP_OK && ret != BP_EEMPTYPAGE) {
-      return ret;
+    /* Update offsets in page */
+    if (ret == BP_OK) {
+      page->keys[res.index].offset = res.child->offset;
+      page->keys[res.index].config = res.child->config;
     }
 
-    /* kv was inserted but page is full now */
-    if (ret == BP_EEMPTYPAGE) {
-      bp__page_remove_idx(t, page, res.index);
+    /* we don't need child now */
+    bp__page_destroy(t, res.child);
+    res.child = NULL;
 
-      /* we don't need child now */
-      bp__page_destroy(t, res.child);
-      res.child = NULL;
+    if (ret != BP_OK && ret != BP_EEMPTYPAGE) return ret;
+
+    if (ret == BP_EEMPTYPAGE) {
+      ret = bp__page_drop_child(t, page, res.index);
+      if (ret != BP_OK) return ret;
 
-      /* only one item left - lift kv from last child to current page */
-      if (page->length == 1) {
+      if (page->length == 0) {
+        if (!page->is_head) return BP_EEMPTYPAGE;
+        bp__page_make_leaf(page);
+      } else if (page->length == 1 && page->buffer_length == 0) {
+        /* only one item left - lift kv from last child to current page */
         page->offset = page->keys[0].offset;
         page->config = page->keys[0].config;
 
@@ -597,14 +1437,6 @@ int bp__page_remove(bp_db_t* t,
         ret = bp__page_read(t, page);
         if (ret != BP_OK) return ret;
       }
-    } else {
-      /* Update offsets in page */
-      page->keys[res.index].offset = res.child->offset;
-      page->keys[res.index].config = res.child->config;
-
-      /* we don't need child now */
-      bp__page_destroy(t, res.child);
-      res.child = NULL;
     }
   }
 
@@ -612,10 +1444,103 @@ int bp__page_remove(bp_db_t* t,
 }
 
 
-int bp__page_copy(bp_db_t* source, bp_db_t* target, bp__page_t* page) {
+/* copy values of buffered messages, expired ones still hide older versions */
+static int bp__page_copy_buffer(bp_db_t* source,
+                                bp_db_t* target,
+                                bp__page_t* page,
+                                const uint64_t now) {
   int ret;
   uint64_t i;
-  for (i = 0; i < page->length; i++) {
+  uint64_t expire;
+  bp__kv_t* msg;
+
+  for (i = 0; i < page->buffer_length; i++) {
+    msg = &page->buffer[i];
+    if (BP__MSG_REMOVED(msg->config)) continue;
+
+    if (BP__KV_EXPIRED(msg->config, now)) {
+      msg->offset = 0;
+      msg->config = 0;
+      continue;
+    }
+
+    expire = BP__KV_EXPIRE(msg->config);
+    msg->config = BP__KV_LENGTH(msg->config);
+    ret = bp__value_copy(source, target, &msg->offset, &msg->config);
+    msg->config |= expire << 32;
+    if (ret != BP_OK) return ret;
+  }
+
+  return BP_OK;
+}
+
+
+/*
+ * Overflow keys (loaded with page) are written to target again. Leaf kv,
+ * separators above it and messages share one block, `keys` maps source
+ * block to its copy already written to target.
+ */
+static int bp__page_copy_keys(bp_db_t* target,
+                              bp__dedup_t* keys,
+                              bp__page_t* page) {
+  int ret;
+  uint64_t i;
+  uint64_t source;
+  bp__kv_t* kv;
+
+  for (i = 0; i < page->length + page->buffer_length; i++) {
+    kv = i < page->length ? &page->keys[i] : &page->buffer[i - page->length];
+    if (kv->key_config == 0) continue;
+
+    source = kv->key_offset;
+    ret = bp__dedup_get(keys,
+                        source,
+                        kv->length,
+                        &kv->key_offset,
+                        &kv->key_config);
+    if (ret == BP_OK) continue;
+
+    kv->key_config = kv->length;
+    ret = bp__writer_write((bp__writer_t*) target,
+                           kCompressed,
+                           kValueBlock,
+                           kv->value,
+                           &kv->key_offset,
+                           &kv->key_config);
+    if (ret != BP_OK) return ret;
+    bp__dedup_put(keys, source, kv->length, kv->key_offset, kv->key_config);
+  }
+
+  return BP_OK;
+}
+
+
+static int bp__page_copy_tree(bp_db_t* source,
+                              bp_db_t* target,
+                              bp__dedup_t* keys,
+                              bp__page_t* page) {
+  int ret;
+  uint64_t i;
+  uint64_t length;
+  uint64_t expire;
+  uint64_t now = (uint64_t) time(NULL);
+
+  ret = bp__page_copy_buffer(source, target, page, now);
+  if (ret != BP_OK) return ret;
+
+  i = 0;
+  while (i < page->length) {
+    /* expired values and subtrees are simply not copied */
+    if (BP__KV_EXPIRED(page->keys[i].config, now)) {
+      length = page->length;
+      ret = bp__page_drop_child(target, page, i);
+      if (ret != BP_OK) return ret;
+
+      /* replaced with empty leaf */
+      if (page->length == length) i++;
+      continue;
+    }
+
     if (page->type == kPage) {
       /* copy child page */
       bp__page_t* child;
@@ -625,8 +1550,19 @@ int bp__page_copy(bp_db_t* source, bp_db_t* target, bp__page_t* page) {
                           &child);
       if (ret != BP_OK) return ret;
 
-      ret = bp__page_copy(source, target, child);
-      if (ret != BP_OK) return ret;
+      ret = bp__page_copy_tree(source, target, keys, child);
+      if (ret == BP_EEMPTYPAGE) {
+        bp__page_destroy(source, child);
+        length = page->length;
+        ret = bp__page_drop_child(target, page, i);
+        if (ret != BP_OK) return ret;
+        if (page->length == length) i++;
+        continue;
+      }
+      if (ret != BP_OK) {
+        bp__page_destroy(source, child);
+        return ret;
+      }
 
       /* update child position */
       page->keys[i].offset = child->offset;
@@ -635,25 +1571,226 @@ int bp__page_copy(bp_db_t* source, bp_db_t* target, bp__page_t* page) {
       bp__page_destroy(source, child);
     } else {
       /* copy value */
-      bp_value_t value;
+      expire = BP__KV_EXPIRE(page->keys[i].config);
+      page->keys[i].config = BP__KV_LENGTH(page->keys[i].config);
+      ret = bp__value_copy(source,
+                           target,
+                           &page->keys[i].offset,
+                           &page->keys[i].config);
+      page->keys[i].config |= expire << 32;
+      if (ret != BP_OK) return ret;
+    }
+    i++;
+  }
 
-      ret = bp__page_load_value(source, page, i, &value);
+  if (page->length == 0) {
+    if (!page->is_head) return BP_EEMPTYPAGE;
+    bp__page_make_leaf(page);
+  }
+
+  ret = bp__page_copy_keys(target, keys, page);
+  if (ret != BP_OK) return ret;
+
+  return bp__page_save(target, page);
+}
+
+
+int bp__page_copy(bp_db_t* source, bp_db_t* target, bp__page_t* page) {
+  int ret;
+  bp__dedup_t* keys;
+
+  ret = bp__dedup_create(&keys, BP__COPY_KEY_SLOTS);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__page_copy_tree(source, target, keys, page);
+  bp__dedup_destroy(keys);
+
+  return ret;
+}
+
+
+int bp__page_purge(bp_db_t* t,
+                   bp__page_t* page,
+                   const uint64_t now,
+                   uint64_t* count) {
+  int ret;
+  int changed = 0;
+  uint64_t i;
+  uint64_t length;
+  uint64_t offset;
+  bp__page_t* child;
+
+  i = 0;
+  while (i < page->length && *count > 0) {
+    /* whole expired subtree is dropped without loading it */
+    if (BP__KV_EXPIRED(page->keys[i].config, now)) {
+      length = page->length;
+      ret = bp__page_drop_child(t, page, i);
       if (ret != BP_OK) return ret;
+      if (page->length == length) i++;
+      *count = *count - 1;
+      changed = 1;
+      continue;
+    }
 
-      page->keys[i].config = value.length;
-      ret = bp__value_save(target,
-                           &value,
-                           NULL,
-                           &page->keys[i].offset,
-                           &page->keys[i].config);
+    if (page->type == kPage) {
+      ret = bp__page_load(t,
+                          page->keys[i].offset,
+                          page->keys[i].config,
+                          &child);
+      if (ret != BP_OK) return ret;
 
-      /* value is not needed anymore */
-      free(value.value);
+      offset = child->offset;
+      ret = bp__page_purge(t, child, now, count);
+      if (ret == BP_EEMPTYPAGE) {
+        bp__page_destroy(t, child);
+        length = page->length;
+        ret = bp__page_drop_child(t, page, i);
+        if (ret != BP_OK) return ret;
+        if (page->length == length) i++;
+        changed = 1;
+        continue;
+      }
+
+      /* child was rewritten */
+      if (ret == BP_OK && child->offset != offset) {
+        page->keys[i].offset = child->offset;
+        page->keys[i].config = child->config;
+        changed = 1;
+      }
+
+      bp__page_destroy(t, child);
       if (ret != BP_OK) return ret;
     }
+    i++;
   }
 
-  return bp__page_save(target, page);
+  if (!changed) return BP_OK;
+
+  if (page->length == 0) {
+    if (!page->is_head) return BP_EEMPTYPAGE;
+    bp__page_make_leaf(page);
+  }
+
+  return bp__page_save(t, page);
+}
+
+
+int bp__page_bound(bp_db_t* t,
+                   bp__page_t* page,
+                   const int last,
+                   bp__kv_t* bound) {
+  int ret;
+  int cmp;
+  uint64_t i, index;
+  bp__page_t* child;
+  bp__kv_t* msg = NULL;
+
+  if (page->buffer_length != 0) {
+    msg = &page->buffer[last ? page->buffer_length - 1 : 0];
+  }
+
+  /* interior page may end with an empty leaf (see bp__page_drop_child) */
+  ret = BP_ENOTFOUND;
+  for (i = 0; ret == BP_ENOTFOUND && i < page->length; i++) {
+    index = last ? page->length - 1 - i : i;
+    if (page->type == kLeaf) {
+      ret = bp__kv_copy(&page->keys[index], bound, 1);
+      break;
+    }
+
+    ret = bp__page_load(t,
+                        page->keys[index].offset,
+                        page->keys[index].config,
+                        &child);
+    if (ret != BP_OK) return ret;
+
+    ret = bp__page_bound(t, child, last, bound);
+    bp__page_destroy(t, child);
+  }
+  if (ret != BP_OK && ret != BP_ENOTFOUND) return ret;
+  if (msg == NULL) return ret;
+
+  /* messages (removals too) are newer than subtree, they bound it as well */
+  if (ret == BP_OK) {
+    cmp = t->compare_cb((bp_key_t*) msg, (bp_key_t*) bound);
+    if (last ? cmp <= 0 : cmp >= 0) return BP_OK;
+    if (bound->allocated) free(bound->value);
+  }
+
+  return bp__kv_copy(msg, bound, 1);
+}
+
+
+int bp__page_attach(bp_db_t* t,
+                    bp__page_t* root,
+                    const bp__kv_t* root_min,
+                    const bp__kv_t* tree_min,
+                    const int first) {
+  int ret;
+  bp__page_t* head = t->head.page;
+  bp__page_t* new_head;
+  bp__kv_t* kv;
+  bp__kv_t separator;
+
+  /* leaf head becomes the only child of new head */
+  if (head->type == kLeaf) {
+    ret = bp__page_create(t, kPage, 0, 0, &new_head);
+    if (ret != BP_OK) return ret;
+
+    new_head->is_head = 1;
+    new_head->keys[0].offset = head->offset;
+    new_head->keys[0].config = head->config;
+
+    t->head.page = new_head;
+    bp__page_destroy(t, head);
+    head = new_head;
+  }
+
+  if (first) {
+    /* separator of former first child is the lowest key of the tree now */
+    ret = bp__kv_copy(tree_min, &separator, 1);
+    if (ret != BP_OK) return ret;
+
+    kv = &head->keys[0];
+    separator.offset = kv->offset;
+    separator.config = kv->config;
+    head->byte_size -= BP__KV_SIZE((*kv));
+    head->byte_size += BP__KV_SIZE(separator);
+    if (kv->allocated) free(kv->value);
+    *kv = separator;
+
+    bp__page_shiftr(t, head, 0);
+    kv = &head->keys[0];
+  } else {
+    kv = &head->keys[head->length];
+  }
+
+  ret = bp__kv_copy(root_min, kv, 1);
+  if (ret != BP_OK) {
+    if (first) bp__page_shiftl(t, head, 0);
+    return ret;
+  }
+  kv->offset = root->offset;
+  kv->config = root->config;
+  head->byte_size += BP__KV_SIZE((*kv));
+  head->length++;
+
+  if (head->length == t->head.page_size) {
+    ret = bp__page_split_head(t, &head);
+    if (ret != BP_OK) return ret;
+  }
+
+  return bp__page_save(t, head);
+}
+
+
+void bp__page_make_leaf(bp__page_t* page) {
+  assert(page->length == 0);
+  assert(page->buffer_length == 0);
+
+  page->type = kLeaf;
+  page->byte_size = 0;
 }
 
 
@@ -710,6 +1847,12 @@ int bp__page_split(bp_db_t* t,
     right->byte_size += BP__KV_SIZE(child->keys[i]);
   }
 
+  /* buffered messages go with subtrees they belong to */
+  ret = bp__buffer_copy(t, child, left, NULL, (bp_key_t*) &middle_key);
+  if (ret != BP_OK) goto fatal;
+  ret = bp__buffer_copy(t, child, right, (bp_key_t*) &middle_key, NULL);
+  if (ret != BP_OK) goto fatal;
+
   /* save left and right parts to get offsets */
   ret = bp__page_save(t, left);
   if (ret != BP_OK) goto fatal;
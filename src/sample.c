@@ -0,0 +1,400 @@
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memcpy */
+#include <time.h> /* time */
+
+#include "bplus.h"
+#include "private/sample.h"
+#include "private/pages.h"
+
+
+/* depth of the deepest leaf below page, only interior pages are read */
+static int bp__sample_height(bp_db_t* t,
+                             bp__page_t* page,
+                             const uint64_t depth,
+                             uint64_t* height) {
+  int ret;
+  bp__page_t* child;
+  bp__kv_t* kv;
+  uint64_t i;
+
+  if (page->type == kLeaf) {
+    if (depth > *height) *height = depth;
+    return BP_OK;
+  }
+
+  for (i = 0; i < page->length; i++) {
+    kv = &page->keys[i];
+    if (kv->config & 1) {
+      if (depth + 1 > *height) *height = depth + 1;
+      continue;
+    }
+
+    ret = bp__page_load(t, kv->offset, kv->config, &child);
+    if (ret != BP_OK) return ret;
+    ret = bp__sample_height(t, child, depth + 1, height);
+    bp__page_destroy(t, child);
+    if (ret != BP_OK) return ret;
+  }
+
+  return BP_OK;
+}
+
+
+/* height of tree, computed once per written head */
+static int bp__tree_height(bp_db_t* t, uint64_t* height) {
+  int ret = BP_OK;
+
+  bp__mutex_lock(&t->sample_lock);
+  if (t->sample_generation == t->generation &&
+      t->sample_offset == t->head.offset) {
+    *height = t->sample_height;
+  } else {
+    *height = 0;
+    ret = bp__sample_height(t, t->head.page, 0, height);
+    if (ret == BP_OK) {
+      t->sample_generation = t->generation;
+      t->sample_offset = t->head.offset;
+      t->sample_height = *height;
+    }
+  }
+  bp__mutex_unlock(&t->sample_lock);
+
+  return ret;
+}
+
+
+static int bp__split_append(bp__split_item_t** items,
+                            uint64_t* count,
+                            uint64_t* size,
+                            const uint64_t offset,
+                            const uint64_t config,
+                            const uint64_t depth,
+                            const uint64_t bytes,
+                            const bp__kv_t* lower) {
+  int ret;
+  bp__split_item_t* grown;
+  bp__split_item_t* item;
+
+  if (*count == *size) {
+    *size = *size == 0 ? 64 : *size * 2;
+    grown = realloc(*items, (size_t) *size * sizeof(**items));
+    if (grown == NULL) return BP_EALLOC;
+    *items = grown;
+  }
+
+  item = &(*items)[*count];
+  item->offset = offset;
+  item->config = config;
+  item->depth = depth;
+  item->bytes = bytes;
+  item->has_lower = 0;
+  if (lower != NULL) {
+    ret = bp__kv_copy(lower, &item->lower, 1);
+    if (ret != BP_OK) return ret;
+    item->has_lower = 1;
+  }
+
+  (*count)++;
+  return BP_OK;
+}
+
+
+static void bp__split_free(bp__split_item_t* items, const uint64_t count) {
+  uint64_t i;
+
+  for (i = 0; i < count; i++) {
+    if (items[i].has_lower) free(items[i].lower.value);
+  }
+  free(items);
+}
+
+
+/* children of interior page at depth, or kvs of leaf head (each weighs 1) */
+static int bp__split_expand(bp_db_t* t,
+                            bp__page_t* page,
+                            const uint64_t depth,
+                            const bp__kv_t* lower,
+                            const uint64_t now,
+                            bp__split_item_t** items,
+                            uint64_t* count,
+                            uint64_t* size) {
+  int ret = BP_OK;
+  bp__kv_t* kv;
+  uint64_t i;
+
+  for (i = 0; ret == BP_OK && i < page->length; i++) {
+    kv = &page->keys[i];
+    if (BP__KV_EXPIRED(kv->config, now)) continue;
+
+    if (page->type == kLeaf) {
+      ret = bp__split_append(items, count, size, 0, 1, depth, 1, kv);
+    } else {
+      ret = bp__split_append(items,
+                             count,
+                             size,
+                             kv->offset,
+                             kv->config,
+                             depth + 1,
+                             BP__KV_LENGTH(kv->config) >> 1,
+                             i == 0 ? lower : kv);
+    }
+  }
+
+  return ret;
+}
+
+
+int bp__split_points(bp_db_t* t,
+                     const uint64_t n,
+                     bp_key_t* keys,
+                     uint64_t* count) {
+  int ret;
+  int expand;
+  bp__page_t* page;
+  bp__split_item_t* items = NULL;
+  bp__split_item_t* next;
+  uint64_t item_count = 0, item_size = 0, next_count, next_size;
+  uint64_t now = (uint64_t) time(NULL);
+  uint64_t i, j, height, level;
+  uint64_t pages = 0, children = 0;
+  double fanout, total, weight;
+
+  *count = 0;
+  if (n < 2) return BP_OK;
+
+  ret = bp__tree_height(t, &height);
+  if (ret != BP_OK) return ret;
+
+  ret = bp__split_expand(t,
+                         t->head.page,
+                         0,
+                         NULL,
+                         now,
+                         &items,
+                         &item_count,
+                         &item_size);
+  if (t->head.page->type == kPage) {
+    pages++;
+    children += t->head.page->length;
+  }
+
+  /* interior children are replaced by their children, level by level */
+  for (expand = 1; ret == BP_OK && expand; ) {
+    if (item_count >= n * BP__SPLIT_OVERSAMPLE) break;
+
+    expand = 0;
+    next = NULL;
+    next_count = 0;
+    next_size = 0;
+    for (i = 0; ret == BP_OK && i < item_count; i++) {
+      if (items[i].config & 1) {
+        ret = bp__split_append(&next,
+                               &next_count,
+                               &next_size,
+                               items[i].offset,
+                               items[i].config,
+                               items[i].depth,
+                               items[i].bytes,
+                               items[i].has_lower ? &items[i].lower : NULL);
+        continue;
+      }
+
+      ret = bp__page_load(t, items[i].offset, items[i].config, &page);
+      if (ret != BP_OK) break;
+      pages++;
+      children += page->length;
+      ret = bp__split_expand(t,
+                             page,
+                             items[i].depth,
+                             items[i].has_lower ? &items[i].lower : NULL,
+                             now,
+                             &next,
+                             &next_count,
+                             &next_size);
+      bp__page_destroy(t, page);
+      expand = 1;
+    }
+
+    bp__split_free(items, item_count);
+    items = next;
+    item_count = next_count;
+  }
+
+  /*
+   * Interior child weighs as much as its page times average fanout for
+   * every level below it. Leaves of shallower subtrees (see sample.h) are
+   * mixed with interior pages of deeper ones, sizes alone would skew points.
+   */
+  fanout = pages == 0 ? 1 : (double) children / pages;
+  if (fanout < 1) fanout = 1;
+  total = 0;
+  for (i = 0; i < item_count; i++) {
+    items[i].weight = (double) items[i].bytes;
+    if (!(items[i].config & 1)) {
+      for (level = items[i].depth; level < height; level++) {
+        items[i].weight *= fanout;
+      }
+    }
+    total += items[i].weight;
+  }
+
+  /* separators are increasing, only the leftmost children have none */
+  weight = 0;
+  for (i = 0, j = 1; ret == BP_OK && i < item_count && *count < n - 1; i++) {
+    if (items[i].has_lower && weight * n >= total * j) {
+      keys[*count].length = items[i].lower.length;
+      keys[*count].value = malloc((size_t) items[i].lower.length + 1);
+      if (keys[*count].value == NULL) {
+        ret = BP_EALLOC;
+        break;
+      }
+      memcpy(keys[*count].value,
+             items[i].lower.value,
+             (size_t) items[i].lower.length);
+      keys[*count].value[items[i].lower.length] = 0;
+      keys[*count]._prev_offset = 0;
+      keys[*count]._prev_length = 0;
+      (*count)++;
+
+      /* large child may cross several points, it starts only one range */
+      while (weight * n >= total * j) j++;
+    }
+    weight += items[i].weight;
+  }
+
+  bp__split_free(items, item_count);
+
+  if (ret != BP_OK) {
+    for (i = 0; i < *count; i++) free(keys[i].value);
+    *count = 0;
+  }
+  return ret;
+}
+
+
+/* xorshift64* */
+static uint64_t bp__sample_random(uint64_t* state) {
+  uint64_t x = *state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+
+  return x * 2685821657736338717u;
+}
+
+
+/* interior pages above the current one */
+typedef struct bp__sample_path_s bp__sample_path_t;
+
+struct bp__sample_path_s {
+  bp__page_t* page;
+  const bp__sample_path_t* up;
+};
+
+
+/* BP_ENOTFOUND - sample is rejected */
+static int bp__sample_page(bp_db_t* t,
+                           bp__page_t* page,
+                           const bp__sample_path_t* up,
+                           const uint64_t depth,
+                           const uint64_t height,
+                           const uint64_t now,
+                           uint64_t* state,
+                           bp_range_cb cb,
+                           void* arg) {
+  int ret;
+  bp__page_t* child;
+  bp__kv_t* kv;
+  bp__kv_t* msg;
+  bp__sample_path_t path;
+  uint64_t slot, index, level;
+
+  slot = bp__sample_random(state) % t->head.page_size;
+  if (slot >= page->length) return BP_ENOTFOUND;
+
+  kv = &page->keys[slot];
+  if (BP__KV_EXPIRED(kv->config, now)) return BP_ENOTFOUND;
+
+  if (page->type == kPage) {
+    ret = bp__page_load(t, kv->offset, kv->config, &child);
+    if (ret != BP_OK) return ret;
+
+    path.page = page;
+    path.up = up;
+    ret = bp__sample_page(t,
+                          child,
+                          &path,
+                          depth + 1,
+                          height,
+                          now,
+                          state,
+                          cb,
+                          arg);
+    bp__page_destroy(t, child);
+    return ret;
+  }
+
+  /* leaf above the deepest one is reached page_size times more often */
+  for (level = depth; level < height; level++) {
+    if (bp__sample_random(state) % t->head.page_size != 0) {
+      return BP_ENOTFOUND;
+    }
+  }
+
+  /* the topmost message is the newest one */
+  msg = NULL;
+  for (; up != NULL; up = up->up) {
+    if (bp__buffer_search(t, up->page, (bp_key_t*) kv, &index) == BP_OK) {
+      msg = &up->page->buffer[index];
+    }
+  }
+  if (msg != NULL &&
+      (BP__MSG_REMOVED(msg->config) || BP__KV_EXPIRED(msg->config, now))) {
+    return BP_ENOTFOUND;
+  }
+
+  cb(arg, (bp_key_t*) kv, NULL);
+  return BP_OK;
+}
+
+
+int bp__sample(bp_db_t* t,
+               const uint64_t count,
+               const uint64_t seed,
+               bp_range_cb cb,
+               void* arg) {
+  int ret;
+  uint64_t state = seed == 0 ? 0x9e3779b97f4a7c15u : seed;
+  uint64_t now = (uint64_t) time(NULL);
+  uint64_t i, rejected, height = 0;
+
+  if (t->head.page->length == 0) return BP_ENOTFOUND;
+
+  ret = bp__tree_height(t, &height);
+  if (ret != BP_OK) return ret;
+
+  for (i = 0, rejected = 0; i < count; ) {
+    ret = bp__sample_page(t,
+                          t->head.page,
+                          NULL,
+                          0,
+                          height,
+                          now,
+                          &state,
+                          cb,
+                          arg);
+    if (ret == BP_OK) {
+      i++;
+      rejected = 0;
+    } else if (ret != BP_ENOTFOUND) {
+      return ret;
+    } else if (++rejected == BP__SAMPLE_ATTEMPTS) {
+      /* empty tree, or (almost) everything has expired */
+      return BP_ENOTFOUND;
+    }
+  }
+
+  return BP_OK;
+}
@@ -0,0 +1,253 @@
+#include <stdlib.h> /* free */
+#include <unistd.h> /* unlink */
+
+#include "bplus.h"
+#include "private/cursor.h"
+#include "private/diff.h"
+#include "private/ingest.h"
+#include "private/pages.h"
+#include "private/split.h"
+
+
+/* `fresh` - files are left from a pass over replaced file */
+static int bp__split_open(bp__split_t* s,
+                          const char* left,
+                          const char* right,
+                          const int fresh) {
+  int ret;
+
+  if (fresh) {
+    unlink(left);
+    unlink(right);
+  }
+
+  ret = bp_open(&s->sides[0], left);
+  if (ret != BP_OK) return ret;
+  ret = bp_open(&s->sides[1], right);
+  if (ret != BP_OK) {
+    bp_close(&s->sides[0]);
+    return ret;
+  }
+  bp_set_compare_cb(&s->sides[0], s->tree->compare_cb);
+  bp_set_compare_cb(&s->sides[1], s->tree->compare_cb);
+
+  /* existing kvs would be lost */
+  ret = bp__build_check_empty(&s->sides[0]);
+  if (ret == BP_OK) ret = bp__build_check_empty(&s->sides[1]);
+  if (ret != BP_OK) {
+    bp_close(&s->sides[0]);
+    bp_close(&s->sides[1]);
+  }
+
+  return ret;
+}
+
+
+/*
+ * Blocks may be read only while file is the one split was started on,
+ * `exclusive` holds writers off too.
+ */
+static int bp__split_lock(bp__split_t* s, const int exclusive) {
+  if (exclusive) {
+    bp__rwlock_wrlock(&s->tree->rwlock);
+  } else {
+    bp__rwlock_rdlock(&s->tree->rwlock);
+  }
+  if (s->tree->generation != s->generation) {
+    bp__rwlock_unlock(&s->tree->rwlock);
+    s->stale = 1;
+    return BP__SPLIT_STALE;
+  }
+  return BP_OK;
+}
+
+
+static int bp__split_side(bp__split_t* s, const bp__kv_t* kv) {
+  return s->tree->compare_cb((bp_key_t*) kv, s->key) < 0 ? 0 : 1;
+}
+
+
+/* stream kvs of snapshot to builders of both sides */
+static int bp__split_copy(bp__split_t* s) {
+  int ret, r, side;
+  bp_db_t* t = s->tree;
+  bp__builder_t* builders[2] = { NULL, NULL };
+  bp__cursor_t cursor;
+  bp__kv_t* kv;
+  bp__kv_t root;
+
+  bp__rwlock_rdlock(&t->rwlock);
+  s->generation = t->generation;
+  ret = bp__page_clone(t, t->head.page, &s->snapshot);
+  bp__rwlock_unlock(&t->rwlock);
+  if (ret != BP_OK) {
+    s->snapshot = NULL;
+    return ret;
+  }
+
+  ret = bp__builder_create(&builders[0]);
+  if (ret == BP_OK) ret = bp__builder_create(&builders[1]);
+
+  /* writers may go on between kvs */
+  bp__cursor_init(t, s->snapshot, &cursor);
+  while (ret == BP_OK) {
+    ret = bp__split_lock(s, 0);
+    if (ret != BP_OK) break;
+
+    ret = bp__cursor_next(&cursor, &kv);
+    if (ret == BP_OK) {
+      side = bp__split_side(s, kv);
+      ret = bp__builder_copy(&s->sides[side], t, builders[side], kv);
+    }
+    bp__rwlock_unlock(&t->rwlock);
+  }
+  bp__cursor_destroy(&cursor);
+  if (ret == BP_ENOTFOUND) ret = BP_OK;
+
+  for (side = 0; side < 2; side++) {
+    if (builders[side] == NULL) continue;
+
+    if (ret == BP_OK) {
+      r = bp__builder_root(&s->sides[side], builders[side], &root);
+      if (r == BP_OK) {
+        r = bp__build_head(&s->sides[side], &root);
+        free(root.value);
+      }
+      /* no kvs on this side */
+      if (r != BP_ENOTFOUND) ret = r;
+    }
+    bp__builder_destroy(&s->sides[side], builders[side]);
+  }
+
+  return ret;
+}
+
+
+static int bp__split_apply(void* arg,
+                           const bp__kv_t* old_kv,
+                           const bp__kv_t* new_kv) {
+  int ret;
+  bp__split_t* s = arg;
+  bp_db_t* side;
+  bp_value_t value;
+
+  side = &s->sides[bp__split_side(s, new_kv != NULL ? new_kv : old_kv)];
+  if (new_kv == NULL) {
+    ret = bp_remove(side, (bp_key_t*) old_kv);
+    return ret == BP_ENOTFOUND ? BP_OK : ret;
+  }
+
+  ret = bp__value_load(s->tree,
+                       new_kv->offset,
+                       BP__KV_LENGTH(new_kv->config),
+                       &value);
+  if (ret != BP_OK) return ret;
+
+  ret = bp_set_expire(side,
+                      (bp_key_t*) new_kv,
+                      &value,
+                      BP__KV_EXPIRE(new_kv->config));
+  free(value.value);
+
+  return ret;
+}
+
+
+/*
+ * Apply writes made since snapshot, `*same` is 1 if there were none. With
+ * `exclusive` tree stays write-locked on success.
+ */
+static int bp__split_round(bp__split_t* s, const int exclusive, int* same) {
+  int ret;
+  bp_db_t* t = s->tree;
+  bp__page_t* next;
+
+  ret = bp__split_lock(s, exclusive);
+  if (ret != BP_OK) return ret;
+
+  *same = t->head.page->offset == s->snapshot->offset &&
+          t->head.page->config == s->snapshot->config;
+  if (*same) {
+    if (!exclusive) bp__rwlock_unlock(&t->rwlock);
+    return BP_OK;
+  }
+
+  ret = bp__page_clone(t, t->head.page, &next);
+  if (ret == BP_OK) {
+    ret = bp__diff(t, s->snapshot, next, bp__split_apply, s);
+    if (ret != BP_OK) bp__page_destroy(t, next);
+  }
+  if (ret != BP_OK || !exclusive) bp__rwlock_unlock(&t->rwlock);
+  if (ret != BP_OK) return ret;
+
+  bp__page_destroy(t, s->snapshot);
+  s->snapshot = next;
+
+  return BP_OK;
+}
+
+
+/*
+ * Apply writes made since snapshot until there are none, then once more
+ * holding writers off: tree is left write-locked on success, so no write
+ * acknowledged before the split returns is missed.
+ */
+static int bp__split_catch_up(bp__split_t* s) {
+  int ret;
+  int same = 0;
+  uint64_t round;
+
+  for (round = 1; !same && round < BP__SPLIT_ROUNDS; round++) {
+    ret = bp__split_round(s, 0, &same);
+    if (ret != BP_OK) return ret;
+  }
+
+  return bp__split_round(s, 1, &same);
+}
+
+
+int bp__split_file(bp_db_t* t,
+                   const bp_key_t* key,
+                   const char* left,
+                   const char* right) {
+  int ret, r;
+  int caught_up = 0;
+  bp__split_t s;
+
+  s.tree = t;
+  s.key = key;
+  s.snapshot = NULL;
+
+  ret = bp__split_open(&s, left, right, 0);
+  if (ret != BP_OK) return ret;
+
+  /* compaction has replaced file, start over from its head */
+  do {
+    s.stale = 0;
+    ret = bp__split_copy(&s);
+    if (ret == BP_OK) {
+      ret = bp__split_catch_up(&s);
+      caught_up = ret == BP_OK;
+    }
+
+    if (s.snapshot != NULL) bp__page_destroy(t, s.snapshot);
+    s.snapshot = NULL;
+
+    if (ret == BP__SPLIT_STALE && s.stale) {
+      bp_close(&s.sides[0]);
+      bp_close(&s.sides[1]);
+      r = bp__split_open(&s, left, right, 1);
+      if (r != BP_OK) return r;
+    }
+  } while (ret == BP__SPLIT_STALE && s.stale);
+
+  r = bp_close(&s.sides[0]);
+  if (ret == BP_OK) ret = r;
+  r = bp_close(&s.sides[1]);
+  if (ret == BP_OK) ret = r;
+
+  /* files are closed, writers may go on */
+  if (caught_up) bp__rwlock_unlock(&t->rwlock);
+
+  return ret;
+}
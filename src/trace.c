@@ -0,0 +1,192 @@
+#include "bplus.h"
+#include "private/trace.h"
+#include "private/utils.h"
+
+#include <fcntl.h> /* open */
+#include <unistd.h> /* close, write */
+#include <sys/stat.h> /* S_IWUSR, S_IRUSR */
+#include <sys/time.h> /* gettimeofday */
+#include <stdlib.h> /* malloc, free */
+#include <string.h> /* memset, memcpy */
+#include <pthread.h> /* pthread_once, pthread_key_t */
+#include <arpa/inet.h> /* htonl */
+
+
+static pthread_once_t bp__trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t bp__trace_op_key;
+
+
+static void bp__trace_init_key(void) {
+  pthread_key_create(&bp__trace_op_key, NULL);
+}
+
+
+static uint64_t bp__trace_now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static int bp__trace_flush(bp__trace_t* trace) {
+  ssize_t written;
+
+  if (trace->used == 0) return BP_OK;
+
+  written = write(trace->fd, trace->buff, (size_t) trace->used);
+  if ((uint64_t) written != trace->used) return BP_EFILEWRITE;
+
+  trace->used = 0;
+  return BP_OK;
+}
+
+
+static void bp__trace_append(bp__trace_t* trace,
+                             const void* data,
+                             const uint64_t size) {
+  /*
+   * Tracing should never fail the operation itself, on flush error
+   * the buffer is just dropped.
+   */
+  if (trace->used + size > BP__TRACE_BUFFER_SIZE &&
+      bp__trace_flush(trace) != BP_OK) {
+    trace->used = 0;
+  }
+
+  /* huge records (i.e. values) are written directly */
+  if (size > BP__TRACE_BUFFER_SIZE) {
+    if (write(trace->fd, data, (size_t) size) != (ssize_t) size) return;
+  } else {
+    memcpy(trace->buff + trace->used, data, (size_t) size);
+    trace->used += size;
+  }
+}
+
+
+int bp__trace_create(bp__writer_t* w,
+                     const char* filename,
+                     const char* magic,
+                     bp__trace_t** trace) {
+  int ret;
+  bp__trace_t* t;
+
+  pthread_once(&bp__trace_once, bp__trace_init_key);
+
+  t = malloc(sizeof(*t));
+  if (t == NULL) return BP_EALLOC;
+
+  ret = bp__mutex_init(&t->mutex);
+  if (ret != BP_OK) {
+    free(t);
+    return ret;
+  }
+
+  t->fd = open(filename,
+               O_WRONLY | O_CREAT | O_TRUNC,
+               S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
+  if (t->fd == -1) {
+    ret = BP_EFILE;
+    goto fatal;
+  }
+
+  if (write(t->fd, magic, BP__TRACE_MAGIC_SIZE) != BP__TRACE_MAGIC_SIZE) {
+    close(t->fd);
+    ret = BP_EFILEWRITE;
+    goto fatal;
+  }
+
+  t->owner = w;
+  t->start = bp__trace_now();
+  t->used = 0;
+
+  *trace = t;
+  return BP_OK;
+
+fatal:
+  bp__mutex_destroy(&t->mutex);
+  free(t);
+  return ret;
+}
+
+
+int bp__trace_destroy(bp__trace_t* trace) {
+  int ret;
+
+  ret = bp__trace_flush(trace);
+  if (close(trace->fd) != 0 && ret == BP_OK) ret = BP_EFILE;
+
+  bp__mutex_destroy(&trace->mutex);
+  free(trace);
+
+  return ret;
+}
+
+
+void bp__trace_set_op(const enum bp__trace_op op) {
+  pthread_once(&bp__trace_once, bp__trace_init_key);
+  pthread_setspecific(bp__trace_op_key, (void*) (intptr_t) op);
+}
+
+
+void bp__trace_record(bp__writer_t* w,
+                      const enum bp__trace_io io,
+                      const enum block_type block,
+                      const uint64_t offset,
+                      const uint64_t size,
+                      const uint64_t raw_size) {
+  bp__trace_t* trace = w->trace;
+  char rec[BP__TRACE_RECORD_SIZE];
+  intptr_t op = (intptr_t) pthread_getspecific(bp__trace_op_key);
+
+  memset(rec, 0, BP__TRACE_RECORD_SIZE);
+
+  *(uint64_t*) (rec + 8) = htonll(offset);
+  *(uint32_t*) (rec + 16) = htonl((uint32_t) size);
+  *(uint32_t*) (rec + 20) = htonl((uint32_t) raw_size);
+  rec[24] = (char) io;
+  rec[25] = (char) block;
+  rec[26] = (char) op;
+  rec[27] = w != trace->owner;
+
+  /* time is taken under the lock, so records in file are in time order */
+  bp__mutex_lock(&trace->mutex);
+  *(uint64_t*) (rec) = htonll(bp__trace_now() - trace->start);
+  bp__trace_append(trace, rec, BP__TRACE_RECORD_SIZE);
+  bp__mutex_unlock(&trace->mutex);
+}
+
+
+void bp__trace_op_record(bp__trace_t* trace,
+                         const enum bp__trace_op op,
+                         const uint64_t count,
+                         const bp_key_t* keys,
+                         const bp_value_t* values,
+                         const int with_values) {
+  char header[BP__OPTRACE_HEADER_SIZE];
+  uint64_t length;
+  uint64_t i;
+
+  memset(header, 0, sizeof(header));
+  header[8] = (char) op;
+  header[9] = (char) (with_values ? BP__OPTRACE_VALUES : 0);
+  *(uint64_t*) (header + 16) = htonll(count);
+
+  /* as for I/O records, time order must match order in file */
+  bp__mutex_lock(&trace->mutex);
+  *(uint64_t*) (header) = htonll(bp__trace_now() - trace->start);
+  bp__trace_append(trace, header, sizeof(header));
+
+  for (i = 0; i < count; i++) {
+    length = htonll(keys[i].length);
+    bp__trace_append(trace, &length, sizeof(length));
+    bp__trace_append(trace, keys[i].value, keys[i].length);
+
+    length = htonll(values == NULL ? 0 : values[i].length);
+    bp__trace_append(trace, &length, sizeof(length));
+    if (with_values && values != NULL) {
+      bp__trace_append(trace, values[i].value, values[i].length);
+    }
+  }
+
+  bp__mutex_unlock(&trace->mutex);
+}
@@ -1,7 +1,10 @@
 #include "bplus.h"
 #include "private/values.h"
+#include "private/parse.h"
+#include "private/dedup.h"
 #include "private/writer.h"
 #include "private/utils.h"
+#include "private/compressor.h"
 
 #include <stdlib.h> /* malloc, free */
 #include <string.h> /* memcpy */
@@ -18,27 +21,71 @@ int bp__value_load(bp_db_t* t,
   /* read data from disk first */
   ret = bp__writer_read((bp__writer_t*) t,
                         kCompressed,
+                        kValueBlock,
                         offset,
                         &buff_len,
                         (void**) &buff);
   if (ret != BP_OK) return ret;
 
-  value->value = malloc(buff_len - 16);
-  if (value->value == NULL) {
-    free(buff);
-    return BP_EALLOC;
-  }
+  ret = bp__value_parse(buff, buff_len, value);
+  free(buff);
+
+  return ret;
+}
+
+
+int bp__value_parse(const char* buff,
+                    const uint64_t size,
+                    bp_value_t* value) {
+  if (size < 16) return BP_EFILEREAD;
+
+  value->value = malloc(size == 16 ? 1 : size - 16);
+  if (value->value == NULL) return BP_EALLOC;
 
   /* first 16 bytes are representing previous value */
   value->_prev_offset = ntohll(*(uint64_t*) (buff));
   value->_prev_length = ntohll(*(uint64_t*) (buff + 8));
 
   /* copy the rest into result buffer */
-  memcpy(value->value, buff + 16, buff_len - 16);
-  value->length = buff_len - 16;
+  memcpy(value->value, buff + 16, size - 16);
+  value->length = size - 16;
+
+  return BP_OK;
+}
+
+
+/* find block with the same data and no previous value link */
+static int bp__value_find(bp_db_t* t,
+                          const bp_value_t* value,
+                          const uint64_t hash,
+                          uint64_t* offset,
+                          uint64_t* length) {
+  int ret;
+  bp_value_t existing;
+
+  ret = bp__dedup_get(t->dedup, hash, value->length, offset, length);
+  if (ret != BP_OK) return ret;
+
+  /* entry may be stale (file was compacted elsewhere) or collide */
+  if (bp__value_load(t, *offset, *length, &existing) != BP_OK) {
+    return BP_ENOTFOUND;
+  }
+  ret = existing.length == value->length &&
+        existing._prev_offset == 0 &&
+        memcmp(existing.value, value->value, value->length) == 0 ?
+            BP_OK : BP_ENOTFOUND;
+  free(existing.value);
+
+  return ret;
+}
 
-  free(buff);
 
+int bp__value_check(const bp_value_t* value) {
+  /* 16 bytes of previous value link, compressed in the worst case */
+  if (value->length > 0xffffffff ||
+      bp__max_compressed_size((size_t) value->length + 16) > 0xffffffff) {
+    return BP_ETOOLARGE;
+  }
   return BP_OK;
 }
 
@@ -50,6 +97,14 @@ int bp__value_save(bp_db_t* t,
                    uint64_t* length) {
   int ret;
   char* buff;
+  uint64_t hash = 0;
+
+  /* shared blocks can't link to previous value of one of their kvs */
+  if (t->dedup != NULL) {
+    hash = bp__dedup_hash(value->value, value->length);
+    if (bp__value_find(t, value, hash, offset, length) == BP_OK) return BP_OK;
+    previous = NULL;
+  }
 
   buff = malloc(value->length + 16);
   if (buff == NULL) return BP_EALLOC;
@@ -69,11 +124,85 @@ int bp__value_save(bp_db_t* t,
   *length = value->length + 16;
   ret = bp__writer_write((bp__writer_t*) t,
                          kCompressed,
+                         kValueBlock,
                          buff,
                          offset,
                          length);
   free(buff);
 
+  if (ret == BP_OK && t->dedup != NULL) {
+    bp__dedup_put(t->dedup, hash, value->length, *offset, *length);
+  }
+
+  return ret;
+}
+
+
+int bp__value_copy(bp_db_t* source,
+                   bp_db_t* target,
+                   uint64_t* offset,
+                   uint64_t* length) {
+  int ret;
+  char* cdata;
+  char* data = NULL;
+  size_t usize;
+  uint64_t csize = *length;
+  uint64_t hash = 0;
+  bp_value_t value;
+
+  ret = bp__writer_read((bp__writer_t*) source,
+                        kNotCompressed,
+                        kValueBlock,
+                        *offset,
+                        &csize,
+                        (void**) &cdata);
+  if (ret != BP_OK) return ret;
+
+  if (bp__uncompressed_length(cdata, csize, &usize) != BP_OK || usize < 16) {
+    ret = BP_EDECOMP;
+    goto fatal;
+  }
+  data = malloc(usize);
+  if (data == NULL) {
+    ret = BP_EALLOC;
+    goto fatal;
+  }
+  if (bp__uncompress(cdata, csize, data, &usize) != BP_OK) {
+    ret = BP_EDECOMP;
+    goto fatal;
+  }
+
+  value.value = data + 16;
+  value.length = usize - 16;
+
+  /* link would point into source, block is written again without it */
+  if (*(uint64_t*) data != 0 || *(uint64_t*) (data + 8) != 0) {
+    ret = bp__value_save(target, &value, NULL, offset, length);
+    goto fatal;
+  }
+
+  if (target->dedup != NULL) {
+    hash = bp__dedup_hash(value.value, value.length);
+    if (bp__value_find(target, &value, hash, offset, length) == BP_OK) {
+      ret = BP_OK;
+      goto fatal;
+    }
+  }
+
+  *length = csize;
+  ret = bp__writer_write((bp__writer_t*) target,
+                         kNotCompressed,
+                         kValueBlock,
+                         cdata,
+                         offset,
+                         length);
+  if (ret == BP_OK && target->dedup != NULL) {
+    bp__dedup_put(target->dedup, hash, value.length, *offset, *length);
+  }
+
+fatal:
+  free(data);
+  free(cdata);
   return ret;
 }
 
@@ -96,6 +225,49 @@ int bp__kv_copy(const bp__kv_t* source, bp__kv_t* target, int alloc) {
   /* copy rest */
   target->offset = source->offset;
   target->config = source->config;
+  target->key_offset = source->key_offset;
+  target->key_config = source->key_config;
+
+  return BP_OK;
+}
+
+
+int bp__kv_save_key(bp_db_t* t, bp__kv_t* kv) {
+  kv->key_offset = 0;
+  kv->key_config = 0;
+  if (t->inline_key_limit == 0 || kv->length <= t->inline_key_limit) {
+    return BP_OK;
+  }
+
+  kv->key_config = kv->length;
+  return bp__writer_write((bp__writer_t*) t,
+                          kCompressed,
+                          kValueBlock,
+                          kv->value,
+                          &kv->key_offset,
+                          &kv->key_config);
+}
+
+
+int bp__kv_load_key(bp_db_t* t, bp__kv_t* kv) {
+  int ret;
+  char* buff;
+  uint64_t size = kv->key_config;
+
+  ret = bp__writer_read((bp__writer_t*) t,
+                        kCompressed,
+                        kValueBlock,
+                        kv->key_offset,
+                        &size,
+                        (void**) &buff);
+  if (ret != BP_OK) return ret;
+
+  if (size != kv->length) {
+    free(buff);
+    return BP_EFILEREAD;
+  }
 
+  kv->value = buff;
+  kv->allocated = 1;
   return BP_OK;
 }
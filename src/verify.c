@@ -0,0 +1,519 @@
+#include "bplus.h"
+#include "private/verify.h"
+#include "private/pages.h"
+#include "private/compressor.h"
+#include "private/utils.h"
+
+#include <unistd.h> /* pread, usleep */
+#include <stdlib.h> /* malloc, realloc, free */
+#include <string.h> /* memset */
+#include <sys/time.h> /* gettimeofday */
+
+
+static uint64_t bp__verify_now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec;
+}
+
+
+static int bp__verify_stopped(bp__verify_t* v) {
+  return v->stop || v->stale || v->ret != BP_OK;
+}
+
+
+/* blocks may be read only while file is the one walk was started on */
+static int bp__verify_lock(bp__verify_t* v) {
+  if (bp__verify_stopped(v)) return BP__VERIFY_STOPPED;
+
+  bp__rwlock_rdlock(&v->tree->rwlock);
+  if (v->tree->generation != v->generation) {
+    bp__rwlock_unlock(&v->tree->rwlock);
+    v->stale = 1;
+    return BP__VERIFY_STOPPED;
+  }
+  return BP_OK;
+}
+
+
+/* count bytes read, and sleep if scrubber is ahead of its rate */
+static void bp__verify_unlock(bp__verify_t* v, const uint64_t bytes) {
+  uint64_t read, due, now;
+
+  bp__rwlock_unlock(&v->tree->rwlock);
+
+  read = __sync_add_and_fetch(&v->stats.bytes, bytes);
+  if (v->rate == 0) return;
+
+  due = v->started +
+        read / v->rate * 1000000 +
+        read % v->rate * 1000000 / v->rate;
+  now = bp__verify_now();
+  for (; now < due && !v->stop; now = bp__verify_now()) {
+    usleep((useconds_t) (due - now > BP__VERIFY_SLEEP ?
+                             BP__VERIFY_SLEEP :
+                             due - now));
+  }
+}
+
+
+/* read and decompress block directly from file, past block cache */
+static int bp__verify_block(bp__verify_t* v,
+                            const uint64_t offset,
+                            const uint64_t csize,
+                            char** data,
+                            uint64_t* size) {
+  int ret;
+  char* cdata;
+  char* uncompressed;
+  size_t usize;
+
+  if (v->tree->filesize < offset + csize) return BP_EFILEREAD_OOB;
+
+  cdata = malloc((size_t) csize);
+  if (cdata == NULL) return BP_EALLOC;
+
+  if (pread(v->tree->fd, cdata, (size_t) csize, (off_t) offset) !=
+      (ssize_t) csize) {
+    free(cdata);
+    return BP_EFILEREAD;
+  }
+
+  uncompressed = NULL;
+  ret = bp__uncompressed_length(cdata, (size_t) csize, &usize);
+  if (ret == BP_OK) {
+    uncompressed = malloc(usize == 0 ? 1 : usize);
+    if (uncompressed == NULL) {
+      ret = BP_EALLOC;
+    } else {
+      ret = bp__uncompress(cdata, (size_t) csize, uncompressed, &usize);
+    }
+  }
+  free(cdata);
+
+  if (ret != BP_OK) {
+    free(uncompressed);
+    return ret == BP_EALLOC ? ret : BP_EDECOMP;
+  }
+
+  *data = uncompressed;
+  *size = usize;
+  return BP_OK;
+}
+
+
+static int bp__verify_load(bp__verify_t* v,
+                           const uint64_t offset,
+                           const uint64_t config,
+                           bp__page_t** page) {
+  int ret;
+  uint64_t csize = BP__KV_LENGTH(config) >> 1;
+  uint64_t size;
+  char* data;
+
+  ret = bp__verify_lock(v);
+  if (ret != BP_OK) return ret;
+
+  /* page itself may come from block cache, its block is checked anyway */
+  ret = BP_OK;
+  if (v->tree->cache != NULL) {
+    ret = bp__verify_block(v, offset, csize, &data, &size);
+    if (ret == BP_OK) free(data);
+  }
+  if (ret == BP_OK) ret = bp__page_load(v->tree, offset, config, page);
+
+  bp__verify_unlock(v, csize);
+
+  if (ret == BP_OK) __sync_fetch_and_add(&v->stats.pages, 1);
+  return ret;
+}
+
+
+static int bp__verify_value(bp__verify_t* v, const bp__kv_t* kv) {
+  int ret;
+  uint64_t csize = BP__KV_LENGTH(kv->config);
+  uint64_t size, prev_offset, prev_length;
+  char* data;
+
+  ret = bp__verify_lock(v);
+  if (ret != BP_OK) return ret;
+  ret = bp__verify_block(v, kv->offset, csize, &data, &size);
+  bp__verify_unlock(v, csize);
+  if (ret != BP_OK) return ret;
+
+  /* link to previous value, blocks are only appended */
+  if (size < 16) {
+    ret = BP_ECORRUPT;
+  } else {
+    prev_offset = ntohll(*(uint64_t*) data);
+    prev_length = ntohll(*(uint64_t*) (data + 8));
+    if (prev_length != 0 && prev_offset >= kv->offset) ret = BP_ECORRUPT;
+  }
+  free(data);
+
+  if (ret == BP_OK) __sync_fetch_and_add(&v->stats.values, 1);
+  return ret;
+}
+
+
+static int bp__verify_key(bp__verify_t* v,
+                          const bp__kv_t* kv,
+                          const bp__kv_t* prev,
+                          const bp__kv_t* lower,
+                          const bp__kv_t* upper) {
+  bp_compare_cb compare = v->tree->compare_cb;
+
+  if (prev != NULL && compare((bp_key_t*) prev, (bp_key_t*) kv) >= 0) {
+    return BP_ECORRUPT;
+  }
+  if (lower != NULL && compare((bp_key_t*) kv, (bp_key_t*) lower) < 0) {
+    return BP_ECORRUPT;
+  }
+  if (upper != NULL && compare((bp_key_t*) kv, (bp_key_t*) upper) >= 0) {
+    return BP_ECORRUPT;
+  }
+  return BP_OK;
+}
+
+
+static int bp__verify_task(bp__verify_task_t** tasks,
+                           uint64_t* count,
+                           uint64_t* size,
+                           const bp__kv_t* child,
+                           const bp__kv_t* lower,
+                           const bp__kv_t* upper) {
+  int ret;
+  bp__verify_task_t* grown;
+  bp__verify_task_t* task;
+
+  if (*count == *size) {
+    *size = *size == 0 ? 64 : *size * 2;
+    grown = realloc(*tasks, (size_t) *size * sizeof(**tasks));
+    if (grown == NULL) return BP_EALLOC;
+    *tasks = grown;
+  }
+
+  task = &(*tasks)[*count];
+  task->offset = child->offset;
+  task->config = child->config;
+  task->has_lower = 0;
+  task->has_upper = 0;
+
+  if (lower != NULL) {
+    ret = bp__kv_copy(lower, &task->lower, 1);
+    if (ret != BP_OK) return ret;
+    task->has_lower = 1;
+  }
+  if (upper != NULL) {
+    ret = bp__kv_copy(upper, &task->upper, 1);
+    if (ret != BP_OK) {
+      if (task->has_lower) free(task->lower.value);
+      return ret;
+    }
+    task->has_upper = 1;
+  }
+
+  (*count)++;
+  return BP_OK;
+}
+
+
+static void bp__verify_free_tasks(bp__verify_task_t* tasks,
+                                  const uint64_t count) {
+  uint64_t i;
+
+  for (i = 0; i < count; i++) {
+    if (tasks[i].has_lower) free(tasks[i].lower.value);
+    if (tasks[i].has_upper) free(tasks[i].upper.value);
+  }
+  free(tasks);
+}
+
+
+/*
+ * Check page and everything below it, or (if `tasks` isn't NULL) only page
+ * itself, its children become tasks.
+ */
+static int bp__verify_page(bp__verify_t* v,
+                           const uint64_t offset,
+                           const uint64_t config,
+                           const bp__kv_t* lower,
+                           const bp__kv_t* upper,
+                           bp__verify_task_t** tasks,
+                           uint64_t* count,
+                           uint64_t* size) {
+  int ret;
+  bp__page_t* page;
+  bp__kv_t* kv;
+  const bp__kv_t* prev;
+  const bp__kv_t* child_lower;
+  const bp__kv_t* child_upper;
+  uint64_t i;
+
+  ret = bp__verify_load(v, offset, config, &page);
+  if (ret != BP_OK) return ret;
+
+  if (page->type == kPage && page->length == 0) ret = BP_ECORRUPT;
+
+  prev = NULL;
+  for (i = 0; ret == BP_OK && i < page->length; i++) {
+    kv = &page->keys[i];
+
+    if (page->type == kLeaf) {
+      ret = bp__verify_key(v, kv, prev, lower, upper);
+      if (ret == BP_OK) ret = bp__verify_value(v, kv);
+      prev = kv;
+      continue;
+    }
+
+    /* key of the first child is never compared with */
+    if (i != 0) {
+      ret = bp__verify_key(v, kv, prev, lower, upper);
+      if (ret != BP_OK) break;
+      prev = kv;
+    }
+
+    child_lower = i == 0 ? lower : kv;
+    child_upper = i + 1 < page->length ? &page->keys[i + 1] : upper;
+    if (tasks != NULL) {
+      ret = bp__verify_task(tasks, count, size, kv, child_lower, child_upper);
+    } else {
+      ret = bp__verify_page(v,
+                            kv->offset,
+                            kv->config,
+                            child_lower,
+                            child_upper,
+                            NULL,
+                            NULL,
+                            NULL);
+    }
+  }
+
+  /* messages are sorted too, and were routed by the same separators */
+  prev = NULL;
+  for (i = 0; ret == BP_OK && i < page->buffer_length; i++) {
+    kv = &page->buffer[i];
+    ret = bp__verify_key(v, kv, prev, lower, upper);
+    if (ret == BP_OK && !BP__MSG_REMOVED(kv->config)) {
+      ret = bp__verify_value(v, kv);
+    }
+    prev = kv;
+  }
+
+  bp__page_destroy(v->tree, page);
+  return ret;
+}
+
+
+static void* bp__verify_worker(void* arg) {
+  int ret;
+  bp__verify_t* v = arg;
+  bp__verify_task_t* task;
+  uint64_t i;
+
+  while (!bp__verify_stopped(v)) {
+    i = __sync_fetch_and_add(&v->next_task, 1);
+    if (i >= v->task_count) break;
+
+    task = &v->tasks[i];
+    ret = bp__verify_page(v,
+                          task->offset,
+                          task->config,
+                          task->has_lower ? &task->lower : NULL,
+                          task->has_upper ? &task->upper : NULL,
+                          NULL,
+                          NULL,
+                          NULL);
+
+    /* first error wins */
+    if (ret != BP_OK && ret != BP__VERIFY_STOPPED) {
+      __sync_bool_compare_and_swap(&v->ret, BP_OK, ret);
+    }
+  }
+
+  return NULL;
+}
+
+
+/* one walk from current head */
+static int bp__verify_pass(bp__verify_t* v, const uint64_t threads) {
+  int ret;
+  bp_db_t* t = v->tree;
+  bp__kv_t head;
+  bp__verify_task_t* tasks;
+  bp__verify_task_t* next;
+  uint64_t count, size, next_count, next_size, i;
+  pthread_t* ids;
+
+  v->stale = 0;
+  v->ret = BP_OK;
+
+  bp__rwlock_rdlock(&t->rwlock);
+  v->generation = t->generation;
+  head.offset = t->head.page->offset;
+  head.config = t->head.page->config;
+
+  /* fresh head of empty database is never written */
+  count = t->head.page->length + t->head.page->buffer_length;
+  bp__rwlock_unlock(&t->rwlock);
+  if (count == 0) return BP_OK;
+
+  if (threads <= 1) {
+    return bp__verify_page(v,
+                           head.offset,
+                           head.config,
+                           NULL,
+                           NULL,
+                           NULL,
+                           NULL,
+                           NULL);
+  }
+
+  tasks = NULL;
+  count = 0;
+  size = 0;
+  ret = bp__verify_task(&tasks, &count, &size, &head, NULL, NULL);
+
+  /* top levels, until there is enough work for all threads */
+  while (ret == BP_OK && count != 0 && count < threads * BP__VERIFY_TASKS) {
+    next = NULL;
+    next_count = 0;
+    next_size = 0;
+    for (i = 0; ret == BP_OK && i < count; i++) {
+      ret = bp__verify_page(v,
+                            tasks[i].offset,
+                            tasks[i].config,
+                            tasks[i].has_lower ? &tasks[i].lower : NULL,
+                            tasks[i].has_upper ? &tasks[i].upper : NULL,
+                            &next,
+                            &next_count,
+                            &next_size);
+    }
+    bp__verify_free_tasks(tasks, count);
+    tasks = next;
+    count = next_count;
+  }
+
+  if (ret == BP_OK && count != 0) {
+    v->tasks = tasks;
+    v->task_count = count;
+    v->next_task = 0;
+
+    ids = malloc((size_t) threads * sizeof(*ids));
+    if (ids == NULL) {
+      ret = BP_EALLOC;
+    } else {
+      for (i = 0; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, bp__verify_worker, v) != 0) break;
+      }
+      /* threads that were started check all subtrees, or this one does */
+      if (i == 0) bp__verify_worker(v);
+      while (i > 0) pthread_join(ids[--i], NULL);
+      free(ids);
+
+      ret = v->ret;
+      if (ret == BP_OK && bp__verify_stopped(v)) ret = BP__VERIFY_STOPPED;
+    }
+
+    v->tasks = NULL;
+    v->task_count = 0;
+  }
+  bp__verify_free_tasks(tasks, count);
+
+  return ret;
+}
+
+
+int bp__verify(bp_db_t* tree, uint32_t threads, bp_verify_stats_t* stats) {
+  int ret;
+  bp__verify_t v;
+
+  memset(&v, 0, sizeof(v));
+  v.tree = tree;
+
+  /* compaction has replaced file, start over from its head */
+  do {
+    ret = bp__verify_pass(&v,
+                          threads == 0 ? BP__VERIFY_THREADS : threads);
+  } while (ret == BP__VERIFY_STOPPED && v.stale);
+
+  if (ret == BP_OK) v.stats.passes = 1;
+  if (stats != NULL) *stats = v.stats;
+  return ret;
+}
+
+
+static void* bp__scrub_thread(void* arg) {
+  int ret;
+  bp__scrub_t* scrub = arg;
+  bp__verify_t* v = &scrub->verify;
+  uint64_t i;
+
+  while (!v->stop) {
+    ret = bp__verify_pass(v, 1);
+    if (ret == BP__VERIFY_STOPPED) continue;
+    if (ret != BP_OK) {
+      scrub->result = ret;
+      break;
+    }
+    v->stats.passes++;
+
+    for (i = 0; i < BP__SCRUB_PAUSE && !v->stop; i += 100) usleep(100000);
+  }
+
+  return NULL;
+}
+
+
+int bp__scrub_start(bp_db_t* tree, const uint64_t rate) {
+  int ret;
+  bp__scrub_t* scrub;
+
+  /* one scrubber at a time, result of previous one is dropped */
+  ret = bp__scrub_stop(tree, NULL);
+  if (ret != BP_OK && ret != BP_ENOTFOUND) return ret;
+
+  scrub = calloc(1, sizeof(*scrub));
+  if (scrub == NULL) return BP_EALLOC;
+
+  scrub->verify.tree = tree;
+  scrub->verify.rate = rate;
+  scrub->verify.started = bp__verify_now();
+  scrub->result = BP_OK;
+
+  if (pthread_create(&scrub->thread, NULL, bp__scrub_thread, scrub) != 0) {
+    free(scrub);
+    return BP_EALLOC;
+  }
+
+  tree->scrub = scrub;
+  return BP_OK;
+}
+
+
+int bp__scrub_status(bp_db_t* tree, bp_verify_stats_t* stats) {
+  bp__scrub_t* scrub = tree->scrub;
+
+  if (scrub == NULL) return BP_ENOTFOUND;
+
+  if (stats != NULL) *stats = scrub->verify.stats;
+  return scrub->result;
+}
+
+
+int bp__scrub_stop(bp_db_t* tree, bp_verify_stats_t* stats) {
+  int ret;
+  bp__scrub_t* scrub = tree->scrub;
+
+  if (scrub == NULL) return BP_ENOTFOUND;
+
+  scrub->verify.stop = 1;
+  pthread_join(scrub->thread, NULL);
+
+  ret = bp__scrub_status(tree, stats);
+
+  tree->scrub = NULL;
+  free(scrub);
+  return ret;
+}
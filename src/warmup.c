@@ -0,0 +1,612 @@
+#include "bplus.h"
+#include "private/warmup.h"
+#include "private/pages.h"
+#include "private/parse.h"
+#include "private/cache.h"
+#include "private/compressor.h"
+#include "private/utils.h"
+
+#include <fcntl.h> /* open */
+#include <unistd.h> /* pread, close, dup */
+#include <sys/stat.h> /* fstat */
+#include <stdlib.h> /* malloc, free, qsort */
+#include <string.h> /* memset, memcpy, strlen */
+#include <time.h> /* time */
+
+typedef struct bp__warmup_level_s bp__warmup_level_t;
+
+/* state of one warmup pass, shared by reader threads */
+struct bp__warmup_level_s {
+  bp_db_t* tree;
+  bp__warmup_t* warmup;
+
+  int fd;
+  uint64_t filesize;
+  uint64_t cache_generation;
+  uint64_t now;
+
+  /* pages of current level sorted by offset, and runs over them */
+  bp__warmup_page_t* pages;
+  uint64_t count;
+  uint64_t* runs;
+  uint64_t run_count;
+  uint64_t next_run;
+  int expand;
+
+  /* children found in current level */
+  bp__mutex_t mutex;
+  bp__warmup_page_t* next;
+  uint64_t next_count;
+  uint64_t next_size;
+
+  uint64_t loaded;
+  int ret;
+};
+
+
+static uint64_t bp__warmup_csize(const uint64_t config) {
+  return BP__KV_LENGTH(config) >> 1;
+}
+
+
+static int bp__warmup_compare(const void* a, const void* b) {
+  uint64_t x = ((const bp__warmup_page_t*) a)->offset;
+  uint64_t y = ((const bp__warmup_page_t*) b)->offset;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+static int bp__warmup_append(bp__warmup_page_t** pages,
+                             uint64_t* count,
+                             uint64_t* size,
+                             const uint64_t offset,
+                             const uint64_t config) {
+  bp__warmup_page_t* grown;
+
+  if (*count == *size) {
+    *size = *size == 0 ? 64 : *size * 2;
+    grown = realloc(*pages, (size_t) *size * sizeof(**pages));
+    if (grown == NULL) return BP_EALLOC;
+    *pages = grown;
+  }
+  (*pages)[*count].offset = offset;
+  (*pages)[*count].config = config;
+  (*pages)[*count].generation = 0;
+  (*count)++;
+  return BP_OK;
+}
+
+
+static int bp__warmup_child(bp__warmup_level_t* level,
+                            const uint64_t offset,
+                            const uint64_t config) {
+  /* leaves are only read if asked to, expired subtrees are never read */
+  if ((config & 1) && !(level->warmup->policy.flags & BP_WARMUP_LEAVES)) {
+    return BP_OK;
+  }
+  if (BP__KV_EXPIRED(config, level->now)) return BP_OK;
+  if (offset + bp__warmup_csize(config) > level->filesize) return BP_OK;
+
+  return bp__warmup_append(&level->next,
+                           &level->next_count,
+                           &level->next_size,
+                           offset,
+                           config);
+}
+
+
+/* base of delta block is read by the next pass, just like upserted children */
+static int bp__warmup_delta(bp__warmup_level_t* level,
+                            const bp__warmup_page_t* page,
+                            const char* buff,
+                            const uint64_t size) {
+  int ret;
+  uint64_t o, op, base_offset, base_config, depth;
+  bp__kv_t kv;
+
+  bp__page_delta_base(buff, &base_offset, &base_config, &depth);
+  ret = bp__page_delta_check(page->offset,
+                             page->config,
+                             0,
+                             base_offset,
+                             base_config);
+  if (ret != BP_OK) return ret;
+
+  bp__mutex_lock(&level->mutex);
+  ret = bp__warmup_child(level, base_offset, base_config);
+
+  /* kvs of leaves point to values */
+  o = BP__DELTA_HEADER_SIZE;
+  while (ret == BP_OK &&
+         (ret = bp__page_delta_entry(buff, size, o, &op, &kv)) == BP_OK) {
+    if (!(page->config & 1) && op == kDeltaUpsert) {
+      ret = bp__warmup_child(level, kv.offset, kv.config);
+    }
+    o += 8 + BP__KV_SIZE(kv);
+  }
+  bp__mutex_unlock(&level->mutex);
+
+  return ret == BP_ENOTFOUND ? BP_OK : ret;
+}
+
+
+/* children of interior page, its buffered messages point to values */
+static int bp__warmup_interior(bp__warmup_level_t* level,
+                               const bp__warmup_page_t* page,
+                               char* buff,
+                               const uint64_t size) {
+  int ret;
+  bp__page_t* p;
+  uint64_t i;
+
+  ret = bp__page_create(level->tree, kPage, page->offset, page->config, &p);
+  if (ret != BP_OK) {
+    free(buff);
+    return ret;
+  }
+
+  /* page owns buff once parsed */
+  ret = bp__page_parse(level->tree, p, buff, size);
+  if (ret != BP_OK) {
+    free(buff);
+  } else {
+    bp__mutex_lock(&level->mutex);
+    for (i = 0; ret == BP_OK && i < p->length; i++) {
+      ret = bp__warmup_child(level, p->keys[i].offset, p->keys[i].config);
+    }
+    bp__mutex_unlock(&level->mutex);
+  }
+
+  bp__page_destroy(level->tree, p);
+  return ret;
+}
+
+
+/* page is in memory, put it to block cache and collect its children */
+static int bp__warmup_page(bp__warmup_level_t* level,
+                           const bp__warmup_page_t* page,
+                           const char* data) {
+  int ret;
+  uint64_t csize = bp__warmup_csize(page->config);
+  int leaf = (page->config & 1) != 0;
+  int expand = level->expand && !leaf;
+  char* uncompressed;
+  size_t usize;
+
+  /* leaves are already in OS page cache, nothing else to do without cache */
+  if (!expand && level->tree->cache == NULL) return BP_OK;
+
+  /* entries of hot file are only hints, they may be torn */
+  if (bp__uncompressed_length(data, (size_t) csize, &usize) != BP_OK) {
+    return level->expand ? BP_EDECOMP : BP_OK;
+  }
+  uncompressed = malloc(usize);
+  if (uncompressed == NULL) return BP_EALLOC;
+  if (bp__uncompress(data, (size_t) csize, uncompressed, &usize) != BP_OK) {
+    free(uncompressed);
+    return level->expand ? BP_EDECOMP : BP_OK;
+  }
+
+  /* replicated to every NUMA partition, they are all cold after open */
+  if (level->tree->cache != NULL) {
+    bp__cache_put_all(level->tree->cache,
+                      level->cache_generation,
+                      page->offset,
+                      csize,
+                      usize,
+                      uncompressed);
+  }
+
+  if (!level->expand) {
+    free(uncompressed);
+    return BP_OK;
+  }
+
+  /* blocks are parsed by the same code as reads of tree (parse.h) */
+  if (bp__page_is_delta(uncompressed, usize)) {
+    ret = bp__warmup_delta(level, page, uncompressed, usize);
+    free(uncompressed);
+  } else if (!leaf) {
+    ret = bp__warmup_interior(level, page, uncompressed, usize);
+  } else {
+    ret = BP_OK;
+    free(uncompressed);
+  }
+
+  return ret;
+}
+
+
+static void* bp__warmup_reader(void* arg) {
+  int ret;
+  bp__warmup_level_t* level = arg;
+  char* buff = NULL;
+  uint64_t buff_size = 0;
+  uint64_t run, first, last, start, end, i;
+
+  while (!level->warmup->stop) {
+    run = __sync_fetch_and_add(&level->next_run, 1);
+    if (run >= level->run_count) break;
+
+    first = level->runs[run];
+    last = level->runs[run + 1];
+    start = level->pages[first].offset;
+    end = start;
+    for (i = first; i < last; i++) {
+      uint64_t page_end = level->pages[i].offset +
+                          bp__warmup_csize(level->pages[i].config);
+      if (page_end > end) end = page_end;
+    }
+
+    if (end - start > buff_size) {
+      free(buff);
+      buff_size = end - start;
+      buff = malloc((size_t) buff_size);
+      if (buff == NULL) {
+        buff_size = 0;
+        level->ret = BP_EALLOC;
+        break;
+      }
+    }
+
+    /* one large sequential read per run */
+    if (pread(level->fd, buff, (size_t) (end - start), (off_t) start) !=
+        (ssize_t) (end - start)) {
+      level->ret = BP_EFILEREAD;
+      continue;
+    }
+
+    for (i = first; i < last; i++) {
+      ret = bp__warmup_page(level,
+                            &level->pages[i],
+                            buff + (level->pages[i].offset - start));
+      if (ret != BP_OK) level->ret = ret;
+      __sync_fetch_and_add(&level->loaded,
+                           bp__warmup_csize(level->pages[i].config));
+    }
+  }
+
+  free(buff);
+  return NULL;
+}
+
+
+/* sort level, split it into runs (within budget) and read them */
+static int bp__warmup_level(bp__warmup_level_t* level) {
+  uint64_t budget = level->warmup->policy.budget;
+  uint64_t threads = level->warmup->policy.threads;
+  uint64_t planned = level->warmup->loaded;
+  uint64_t i, count, run_start, run_end;
+  pthread_t* ids;
+
+  qsort(level->pages,
+        (size_t) level->count,
+        sizeof(*level->pages),
+        bp__warmup_compare);
+
+  level->runs = malloc((size_t) (level->count + 1) * sizeof(*level->runs));
+  if (level->runs == NULL) return BP_EALLOC;
+
+  count = 0;
+  level->run_count = 0;
+  run_start = 0;
+  run_end = 0;
+  for (i = 0; i < level->count; i++) {
+    bp__warmup_page_t* page = &level->pages[i];
+    uint64_t page_end = page->offset + bp__warmup_csize(page->config);
+
+    /* duplicates come from hot file */
+    if (count > 0 && page->offset == level->pages[count - 1].offset) continue;
+
+    if (budget != 0 && planned + (page_end - page->offset) > budget) break;
+    planned += page_end - page->offset;
+
+    if (count == 0 ||
+        page->offset > run_end + BP__WARMUP_GAP ||
+        page_end - run_start > BP__WARMUP_RUN) {
+      level->runs[level->run_count++] = count;
+      run_start = page->offset;
+      run_end = page_end;
+    } else if (page_end > run_end) {
+      run_end = page_end;
+    }
+    level->pages[count++] = *page;
+  }
+  level->runs[level->run_count] = count;
+  level->count = count;
+
+  /* only pages count as loaded, not gaps between them */
+  level->loaded = level->warmup->loaded;
+  level->next_run = 0;
+  level->ret = BP_OK;
+
+  if (threads > level->run_count) threads = level->run_count;
+  ids = malloc((size_t) threads * sizeof(*ids));
+  if (ids == NULL) {
+    free(level->runs);
+    level->runs = NULL;
+    return BP_EALLOC;
+  }
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&ids[i], NULL, bp__warmup_reader, level) != 0) break;
+  }
+  /* threads that were started read all runs, or this one does */
+  threads = i;
+  if (threads == 0) bp__warmup_reader(level);
+  for (i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+
+  free(ids);
+  free(level->runs);
+  level->runs = NULL;
+
+  level->warmup->loaded = level->loaded;
+  return level->ret;
+}
+
+
+static int bp__warmup_hot_load(bp__warmup_level_t* level, uint64_t* size) {
+  int ret;
+  int fd;
+  struct stat st;
+  uint64_t header[4];
+  uint64_t entry[2];
+  uint64_t i;
+
+  fd = open(level->warmup->hot_file, O_RDONLY);
+  if (fd == -1) return BP_OK;
+
+  ret = BP_OK;
+  if (read(fd, header, sizeof(header)) != sizeof(header) ||
+      memcmp(header, BP__WARMUP_MAGIC, 8) != 0 ||
+      fstat(level->fd, &st) != 0 ||
+      ntohll(header[1]) != (uint64_t) st.st_dev ||
+      ntohll(header[2]) != (uint64_t) st.st_ino) {
+    /* missing, damaged or written for other file - not an error */
+    close(fd);
+    return BP_OK;
+  }
+
+  for (i = 0; ret == BP_OK && i < ntohll(header[3]); i++) {
+    if (read(fd, entry, sizeof(entry)) != sizeof(entry)) break;
+    entry[0] = ntohll(entry[0]);
+    entry[1] = ntohll(entry[1]);
+    if (entry[1] == 0) continue;
+    if (entry[0] + bp__warmup_csize(entry[1]) > level->filesize) continue;
+    ret = bp__warmup_append(&level->pages,
+                            &level->count,
+                            size,
+                            entry[0],
+                            entry[1]);
+  }
+  close(fd);
+  return ret;
+}
+
+
+static int bp__warmup_run(bp_db_t* tree, bp__warmup_t* warmup) {
+  int ret;
+  bp__warmup_level_t level;
+  uint64_t size;
+  uint64_t i;
+
+  memset(&level, 0, sizeof(level));
+  level.tree = tree;
+  level.warmup = warmup;
+  level.now = (uint64_t) time(NULL);
+
+  ret = bp__mutex_init(&level.mutex);
+  if (ret != BP_OK) return ret;
+
+  /* snapshot of head, pages below it are immutable */
+  bp__rwlock_rdlock(&tree->rwlock);
+  level.fd = dup(tree->fd);
+  level.filesize = tree->filesize;
+  level.cache_generation = tree->cache_generation;
+  if (level.fd != -1 && tree->head.page->type == kPage) {
+    for (i = 0; ret == BP_OK && i < tree->head.page->length; i++) {
+      ret = bp__warmup_child(&level,
+                             tree->head.page->keys[i].offset,
+                             tree->head.page->keys[i].config);
+    }
+  }
+  bp__rwlock_unlock(&tree->rwlock);
+
+  if (level.fd == -1) ret = BP_EFILE;
+  if (ret != BP_OK) goto fatal;
+
+  /* replay pages that were hot last time, without descending */
+  if (warmup->hot_file != NULL) {
+    size = 0;
+    ret = bp__warmup_hot_load(&level, &size);
+    if (ret == BP_OK && level.count != 0) {
+      level.expand = 0;
+      ret = bp__warmup_level(&level);
+    }
+    free(level.pages);
+    level.pages = NULL;
+    level.count = 0;
+    if (ret != BP_OK) goto fatal;
+  }
+
+  /* interior levels top-down, then leaves */
+  while (level.next_count != 0 && !warmup->stop) {
+    level.pages = level.next;
+    level.count = level.next_count;
+    level.next = NULL;
+    level.next_count = 0;
+    level.next_size = 0;
+    level.expand = 1;
+
+    size = level.count;
+    ret = bp__warmup_level(&level);
+    free(level.pages);
+    level.pages = NULL;
+    if (ret != BP_OK) break;
+
+    /* budget is exhausted */
+    if (warmup->policy.budget != 0 && level.count < size) break;
+  }
+
+fatal:
+  free(level.pages);
+  free(level.next);
+  if (level.fd != -1) close(level.fd);
+  bp__mutex_destroy(&level.mutex);
+  return ret;
+}
+
+
+static void* bp__warmup_thread(void* arg) {
+  bp_db_t* tree = arg;
+  tree->warmup->result = bp__warmup_run(tree, tree->warmup);
+  return NULL;
+}
+
+
+int bp__warmup_start(bp_db_t* tree, const bp_warmup_t* policy) {
+  bp__warmup_t* warmup;
+
+  /* one warmup at a time, result of previous one is dropped */
+  bp__warmup_wait(tree, NULL);
+
+  warmup = tree->warmup;
+  if (warmup == NULL) {
+    warmup = calloc(1, sizeof(*warmup));
+    if (warmup == NULL) return BP_EALLOC;
+  }
+
+  warmup->policy = *policy;
+  if (warmup->policy.threads == 0) warmup->policy.threads = BP__WARMUP_THREADS;
+  warmup->policy.hot_file = NULL;
+  warmup->stop = 0;
+  warmup->loaded = 0;
+  warmup->result = BP_OK;
+
+  if (policy->hot_file != NULL &&
+      (warmup->hot_file == NULL ||
+       strcmp(warmup->hot_file, policy->hot_file) != 0)) {
+    free(warmup->hot_file);
+    warmup->hot_file = malloc(strlen(policy->hot_file) + 1);
+    if (warmup->hot_file == NULL) goto fatal;
+    memcpy(warmup->hot_file, policy->hot_file, strlen(policy->hot_file) + 1);
+  }
+  if (warmup->hot_file != NULL && warmup->hot == NULL) {
+    warmup->hot = calloc(BP__WARMUP_HOT, sizeof(*warmup->hot));
+    if (warmup->hot == NULL) goto fatal;
+  }
+
+  /* readers may record hot pages from now on */
+  if (tree->warmup == NULL) {
+    bp__rwlock_wrlock(&tree->rwlock);
+    tree->warmup = warmup;
+    bp__rwlock_unlock(&tree->rwlock);
+  }
+
+  if (policy->flags & BP_WARMUP_BACKGROUND) {
+    if (pthread_create(&warmup->thread, NULL, bp__warmup_thread, tree) != 0) {
+      return BP_EALLOC;
+    }
+    warmup->running = 1;
+    return BP_OK;
+  }
+
+  warmup->result = bp__warmup_run(tree, warmup);
+  return warmup->result;
+
+fatal:
+  if (tree->warmup == NULL) {
+    free(warmup->hot_file);
+    free(warmup);
+  }
+  return BP_EALLOC;
+}
+
+
+int bp__warmup_wait(bp_db_t* tree, uint64_t* loaded) {
+  bp__warmup_t* warmup = tree->warmup;
+
+  if (warmup == NULL) return BP_ENOTFOUND;
+
+  if (warmup->running) {
+    pthread_join(warmup->thread, NULL);
+    warmup->running = 0;
+  }
+
+  if (loaded != NULL) *loaded = warmup->loaded;
+  return warmup->result;
+}
+
+
+/* pages of files replaced by compaction or refresh are not saved */
+static int bp__warmup_hot_valid(bp_db_t* tree, const bp__warmup_page_t* page) {
+  return page->config != 0 && page->generation == tree->generation;
+}
+
+
+static void bp__warmup_hot_save(bp_db_t* tree, bp__warmup_t* warmup) {
+  int fd;
+  struct stat st;
+  uint64_t header[4];
+  uint64_t entry[2];
+  uint64_t count;
+  uint64_t i;
+
+  if (fstat(tree->fd, &st) != 0) return;
+
+  count = 0;
+  for (i = 0; i < BP__WARMUP_HOT; i++) {
+    if (bp__warmup_hot_valid(tree, &warmup->hot[i])) count++;
+  }
+
+  fd = open(warmup->hot_file, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  if (fd == -1) return;
+
+  memcpy(header, BP__WARMUP_MAGIC, 8);
+  header[1] = htonll((uint64_t) st.st_dev);
+  header[2] = htonll((uint64_t) st.st_ino);
+  header[3] = htonll(count);
+  if (write(fd, header, sizeof(header)) == sizeof(header)) {
+    for (i = 0; i < BP__WARMUP_HOT; i++) {
+      if (!bp__warmup_hot_valid(tree, &warmup->hot[i])) continue;
+      entry[0] = htonll(warmup->hot[i].offset);
+      entry[1] = htonll(warmup->hot[i].config);
+      if (write(fd, entry, sizeof(entry)) != sizeof(entry)) break;
+    }
+  }
+  close(fd);
+}
+
+
+void bp__warmup_destroy(bp_db_t* tree) {
+  bp__warmup_t* warmup = tree->warmup;
+
+  if (warmup == NULL) return;
+
+  warmup->stop = 1;
+  bp__warmup_wait(tree, NULL);
+
+  /* hot file is only a hint, errors are ignored */
+  if (warmup->hot_file != NULL && warmup->hot != NULL) {
+    bp__warmup_hot_save(tree, warmup);
+  }
+
+  tree->warmup = NULL;
+  free(warmup->hot);
+  free(warmup->hot_file);
+  free(warmup);
+}
+
+
+void bp__warmup_record(bp_db_t* tree,
+                       const uint64_t offset,
+                       const uint64_t config) {
+  bp__warmup_page_t* slot;
+
+  if (tree->warmup->hot == NULL) return;
+
+  slot = &tree->warmup->hot[bp__compute_hashl(offset) % BP__WARMUP_HOT];
+  slot->offset = offset;
+  slot->config = config;
+  slot->generation = tree->generation;
+}
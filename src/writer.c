@@ -2,9 +2,11 @@
 #include "private/writer.h"
 #include "private/compressor.h"
 #include "private/threads.h"
+#include "private/trace.h"
+#include "private/cache.h"
 
 #include <fcntl.h> /* open */
-#include <unistd.h> /* close, write, read */
+#include <unistd.h> /* close, write, read, ftruncate */
 #include <sys/stat.h> /* S_IWUSR, S_IRUSR */
 #include <stdlib.h> /* malloc, free */
 #include <stdio.h> /* sprintf */
@@ -22,9 +24,16 @@ int bp__writer_create(bp__writer_t* w, const char* filename) {
   if (w->filename == NULL) return BP_EALLOC;
   memcpy(w->filename, filename, filename_length);
 
-  w->fd = open(filename,
-               O_RDWR | O_APPEND | O_CREAT,
-               S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
+  /* only set while bulk load threads write */
+  w->append_lock = NULL;
+
+  if (w->flags & BP_OPEN_RDONLY) {
+    w->fd = open(filename, O_RDONLY);
+  } else {
+    w->fd = open(filename,
+                 O_RDWR | O_APPEND | O_CREAT,
+                 S_IRUSR | S_IRGRP | S_IWGRP | S_IWUSR);
+  }
   if (w->fd == -1) goto error;
 
   /* Determine filesize */
@@ -33,6 +42,18 @@ int bp__writer_create(bp__writer_t* w, const char* filename) {
 
   w->filesize = (uint64_t) filesize;
 
+  /* offsets of blocks are valid only within one generation of file */
+  w->generation++;
+
+  if (w->cache != NULL &&
+      bp__cache_file(w->cache,
+                     w->fd,
+                     filesize == 0,
+                     &w->cache_generation) != BP_OK) {
+    close(w->fd);
+    goto error;
+  }
+
   /* Nullify padding to shut up valgrind */
   memset(&w->padding, 0, sizeof(w->padding));
 
@@ -52,6 +73,18 @@ int bp__writer_destroy(bp__writer_t* w) {
 }
 
 
+int bp__writer_truncate(bp__writer_t* w, const uint64_t size) {
+  if (ftruncate(w->fd, (off_t) size) != 0) return BP_EFILEWRITE;
+  w->filesize = size;
+
+  /* dropped blocks were put to cache, their offsets will be written again */
+  if (w->cache != NULL) {
+    return bp__cache_file(w->cache, w->fd, 1, &w->cache_generation);
+  }
+  return BP_OK;
+}
+
+
 int bp__writer_fsync(bp__writer_t* w) {
 #ifdef F_FULLFSYNC
   /* OSX support */
@@ -62,6 +95,22 @@ int bp__writer_fsync(bp__writer_t* w) {
 }
 
 
+int bp__writer_stat(bp__writer_t* w, uint64_t* size, int* replaced) {
+  struct stat opened;
+  struct stat current;
+
+  if (fstat(w->fd, &opened) != 0) return BP_EFILE;
+  *size = (uint64_t) opened.st_size;
+
+  /* compaction renames new file over the old one */
+  if (stat(w->filename, &current) != 0) return BP_EFILE;
+  *replaced = opened.st_ino != current.st_ino ||
+              opened.st_dev != current.st_dev;
+
+  return BP_OK;
+}
+
+
 int bp__writer_compact_name(bp__writer_t* w, char** compact_name) {
   char* filename = malloc(strlen(w->filename) + sizeof(".compact") + 1);
   if (filename == NULL) return BP_EALLOC;
@@ -95,9 +144,21 @@ int bp__writer_compact_finalize(bp__writer_t* s, bp__writer_t* t) {
 
   if (rename(compacted_name, name) != 0) return BP_EFILERENAME;
 
+  /* let trace readers know that offsets now refer to compacted file */
+  if (s->trace != NULL) {
+    bp__trace_record(s, kTraceReopen, kHeadBlock, 0, 0, 0);
+  }
+
   /* reopen source tree */
   ret = bp__writer_create(s, name);
   if (ret != BP_OK) goto fatal;
+
+  /* compacted file is new, even if its inode number was seen before */
+  if (s->cache != NULL) {
+    ret = bp__cache_file(s->cache, s->fd, 1, &s->cache_generation);
+    if (ret != BP_OK) goto fatal;
+  }
+
   ret = bp__init((bp_db_t*) s);
 
 fatal:
@@ -110,6 +171,7 @@ fatal:
 
 int bp__writer_read(bp__writer_t* w,
                     const enum comp_type comp,
+                    const enum block_type block,
                     const uint64_t offset,
                     uint64_t* size,
                     void** data) {
@@ -124,6 +186,23 @@ int bp__writer_read(bp__writer_t* w,
     return BP_OK;
   }
 
+  if (comp == kCompressed && w->cache != NULL) {
+    uint64_t csize = *size;
+    int ret = bp__cache_get(w->cache,
+                            w->cache_generation,
+                            offset,
+                            csize,
+                            size,
+                            data);
+    if (ret == BP_OK) {
+      if (w->trace != NULL) {
+        bp__trace_record(w, kTraceRead, block, offset, csize, *size);
+      }
+      return BP_OK;
+    }
+    if (ret != BP_ENOTFOUND) return ret;
+  }
+
   cdata = malloc(*size);
   if (cdata == NULL) return BP_EALLOC;
 
@@ -135,6 +214,9 @@ int bp__writer_read(bp__writer_t* w,
 
   /* no compression for head */
   if (comp == kNotCompressed) {
+    if (w->trace != NULL) {
+      bp__trace_record(w, kTraceRead, block, offset, *size, *size);
+    }
     *data = cdata;
   } else {
     int ret = 0;
@@ -151,6 +233,17 @@ int bp__writer_read(bp__writer_t* w,
       } else if (bp__uncompress(cdata, *size, uncompressed, &usize) != BP_OK) {
         ret = BP_EDECOMP;
       } else {
+        if (w->trace != NULL) {
+          bp__trace_record(w, kTraceRead, block, offset, *size, usize);
+        }
+        if (w->cache != NULL) {
+          bp__cache_put(w->cache,
+                        w->cache_generation,
+                        offset,
+                        *size,
+                        usize,
+                        uncompressed);
+        }
         *data = uncompressed;
         *size = usize;
       }
@@ -170,33 +263,25 @@ int bp__writer_read(bp__writer_t* w,
 
 int bp__writer_write(bp__writer_t* w,
                      const enum comp_type comp,
+                     const enum block_type block,
                      const void* data,
                      uint64_t* offset,
                      uint64_t* size) {
+  int ret;
   ssize_t written;
-  uint32_t padding = sizeof(w->padding) - (w->filesize % sizeof(w->padding));
+  uint64_t raw_size;
+  uint32_t padding;
+  char* compressed = NULL;
 
-  /* Write padding */
-  if (padding != sizeof(w->padding)) {
-    written = write(w->fd, &w->padding, (size_t) padding);
-    if ((uint32_t) written != padding) return BP_EFILEWRITE;
-    w->filesize += padding;
-  }
+  if (w->flags & BP_OPEN_RDONLY) return BP_EREADONLY;
 
-  /* Ignore empty writes */
-  if (size == NULL || *size == 0) {
-    if (offset != NULL) *offset = w->filesize;
-    return BP_OK;
-  }
+  raw_size = size == NULL ? 0 : *size;
 
-  /* head shouldn't be compressed */
-  if (comp == kNotCompressed) {
-    written = write(w->fd, data, *size);
-  } else {
-    int ret;
+  /* compress before taking append lock, writers of bulk load share it */
+  if (comp == kCompressed && raw_size != 0) {
     size_t max_csize = bp__max_compressed_size(*size);
     size_t result_size;
-    char* compressed = malloc(max_csize);
+    compressed = malloc(max_csize);
     if (compressed == NULL) return BP_EALLOC;
 
     result_size = max_csize;
@@ -205,19 +290,66 @@ int bp__writer_write(bp__writer_t* w,
       free(compressed);
       return BP_ECOMP;
     }
-
     *size = result_size;
-    written = write(w->fd, compressed, result_size);
-    free(compressed);
   }
 
-  if ((uint64_t) written != *size) return BP_EFILEWRITE;
+  if (w->append_lock != NULL) bp__mutex_lock(w->append_lock);
+
+  /* Write padding */
+  ret = BP_OK;
+  padding = sizeof(w->padding) - (w->filesize % sizeof(w->padding));
+  if (padding != sizeof(w->padding)) {
+    written = write(w->fd, &w->padding, (size_t) padding);
+    if ((uint32_t) written != padding) {
+      ret = BP_EFILEWRITE;
+      goto fatal;
+    }
+    if (w->trace != NULL) {
+      bp__trace_record(w,
+                       kTraceWrite,
+                       kPaddingBlock,
+                       w->filesize,
+                       padding,
+                       padding);
+    }
+    w->filesize += padding;
+  }
+
+  /* Ignore empty writes */
+  if (raw_size == 0) {
+    if (offset != NULL) *offset = w->filesize;
+    goto fatal;
+  }
+
+  /* head shouldn't be compressed */
+  written = write(w->fd, compressed == NULL ? data : compressed, *size);
+  if ((uint64_t) written != *size) {
+    ret = BP_EFILEWRITE;
+    goto fatal;
+  }
+
+  /* readers of freshly written blocks will find them in cache */
+  if (compressed != NULL && w->cache != NULL) {
+    bp__cache_put(w->cache,
+                  w->cache_generation,
+                  w->filesize,
+                  *size,
+                  raw_size,
+                  data);
+  }
+
+  if (w->trace != NULL) {
+    bp__trace_record(w, kTraceWrite, block, w->filesize, *size, raw_size);
+  }
 
   /* change offset */
   *offset = w->filesize;
   w->filesize += written;
 
-  return BP_OK;
+fatal:
+  if (w->append_lock != NULL) bp__mutex_unlock(w->append_lock);
+  free(compressed);
+  return ret;
 }
 
 
@@ -225,22 +357,33 @@ int bp__writer_find(bp__writer_t* w,
                     const enum comp_type comp,
                     const uint64_t size,
                     void* data,
+                    const uint64_t limit,
                     bp__writer_cb seek,
                     bp__writer_cb miss) {
   int ret = 0;
   int match = 0;
   uint64_t offset, size_tmp;
 
-  /* Write padding first */
-  ret = bp__writer_write(w, kNotCompressed, NULL, NULL, NULL);
-  if (ret != BP_OK) return ret;
+  if (w->flags & BP_OPEN_RDONLY) {
+    /* Can't pad, skip incomplete tail instead */
+    offset = w->filesize - (w->filesize % size);
+  } else {
+    /* Write padding first */
+    ret = bp__writer_write(w, kNotCompressed, kPaddingBlock, NULL, NULL, NULL);
+    if (ret != BP_OK) return ret;
 
-  offset = w->filesize;
+    offset = w->filesize;
+  }
   size_tmp = size;
 
-  /* Start seeking from bottom of file */
-  while (offset >= size) {
-    ret = bp__writer_read(w, comp, offset - size, &size_tmp, &data);
+  /* Start seeking from bottom of file, but not below limit */
+  while (offset >= limit + size) {
+    ret = bp__writer_read(w,
+                          comp,
+                          kHeadBlock,
+                          offset - size,
+                          &size_tmp,
+                          &data);
     if (ret != BP_OK) break;
 
     /* Break if matched */
@@ -0,0 +1,216 @@
+#include "test.h"
+
+/*
+ * Write- and space-amplification benchmark.
+ *
+ * Runs insert-only, update-heavy and delete-heavy workloads on a fresh
+ * database each and periodically prints:
+ *   write amp - bytes appended to file per logical byte written
+ *               (key + value for sets, key for removes)
+ *   space amp - file size per byte of live keys and values
+ * At the end of each workload database is compacted, and its effect on file
+ * size and space amplification is reported.
+ *
+ * Environment:
+ *   BP_BENCH_WORKLOADS  - comma-separated list of insert,update,delete
+ *                         (default: all of them)
+ *   BP_BENCH_ITEMS      - number of distinct keys (default: 20000)
+ *   BP_BENCH_OPS        - number of operations per workload (default: 100000)
+ *   BP_BENCH_VALUE_SIZE - value size in bytes (default: 100)
+ *   BP_BENCH_REPORT     - report every N operations (default: 10000)
+ *   BP_BENCH_DELTA_CHAIN - write pages as deltas, consolidating after
+ *                          N of them (default: 0 - full pages)
+ *   BP_BENCH_BUFFER_MESSAGES - buffer writes in interior pages, moving them
+ *                              down in batches once there are more than N
+ *                              (default: 0 - write to leaves)
+ */
+
+static int env_int(const char* name, int def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : atoi(value);
+}
+
+struct amp_state_s {
+  uint64_t logical;
+  uint64_t appended;
+  uint64_t live;
+  uint64_t last_size;
+};
+
+static void report(const char* workload,
+                   int ops,
+                   amp_state_s* s,
+                   const char* filename) {
+  uint64_t size = file_size(filename);
+
+  s->appended += size - s->last_size;
+  s->last_size = size;
+
+  fprintf(stdout,
+          "%-8s %10d %14.0f %14.0f %9.2f %14.0f %14.0f %9.2f\n",
+          workload,
+          ops,
+          (double) s->logical,
+          (double) s->appended,
+          s->logical == 0 ? 0.0 : (double) s->appended / s->logical,
+          (double) size,
+          (double) s->live,
+          s->live == 0 ? 0.0 : (double) size / s->live);
+  fflush(stdout);
+}
+
+/* scrambled so inserts do not always go to the rightmost leaf */
+static void bench_key(char* key, int i) {
+  sprintf(key, "%08x%08d", (unsigned int) i * 2654435761u, i);
+}
+
+
+static void run(bp_db_t* db,
+                const char* filename,
+                const char* workload,
+                int items,
+                int ops,
+                int value_size,
+                int report_every) {
+  char key[32];
+  char* value = (char*) malloc(value_size + 1);
+  char* present = (char*) calloc(items + ops, 1);
+  unsigned int seed = 42;
+  amp_state_s s;
+  int insert_pct, remove_pct;
+  int next;
+  int i;
+
+  /* value bytes vary a bit to keep compression realistic */
+  for (i = 0; i < value_size; i++) {
+    value[i] = 'a' + ((i << 3) | i) % 52;
+  }
+  value[value_size] = 0;
+
+  if (strcmp(workload, "insert") == 0) {
+    insert_pct = 100;
+    remove_pct = 0;
+  } else if (strcmp(workload, "update") == 0) {
+    insert_pct = 10;
+    remove_pct = 0;
+  } else {
+    insert_pct = 30;
+    remove_pct = 70;
+  }
+
+  memset(&s, 0, sizeof(s));
+  next = 0;
+
+  /* update and delete workloads start from populated database */
+  if (insert_pct != 100) {
+    for (next = 0; next < items; next++) {
+      bench_key(key, next);
+      assert(bp_sets(db, key, value) == BP_OK);
+      present[next] = 1;
+      s.live += strlen(key) + 1 + value_size + 1;
+    }
+  }
+  s.last_size = file_size(filename);
+
+  for (i = 1; i <= ops; i++) {
+    int pick = rand_r(&seed) % 100;
+    int k;
+    int j;
+    uint64_t klen;
+
+    if (pick >= remove_pct && pick < remove_pct + insert_pct) {
+      /* inserts always use fresh keys */
+      k = next++;
+    } else {
+      /* updates and removes pick random present key */
+      k = next == 0 ? 0 : rand_r(&seed) % next;
+      for (j = 0; j < next && !present[k]; j++) k = (k + 1) % next;
+      if (next == 0 || !present[k]) k = next++;
+    }
+
+    bench_key(key, k);
+    klen = strlen(key) + 1;
+
+    if (pick < remove_pct && present[k]) {
+      assert(bp_removes(db, key) == BP_OK);
+      present[k] = 0;
+      s.live -= klen + value_size + 1;
+      s.logical += klen;
+    } else {
+      assert(bp_sets(db, key, value) == BP_OK);
+      if (!present[k]) s.live += klen + value_size + 1;
+      present[k] = 1;
+      s.logical += klen + value_size + 1;
+    }
+
+    if (i % report_every == 0) report(workload, i, &s, filename);
+  }
+
+  {
+    uint64_t before = file_size(filename);
+
+    BENCH_START(compact, 0)
+    assert(bp_compact(db) == BP_OK);
+    BENCH_END(compact, 0)
+
+    s.last_size = file_size(filename);
+    fprintf(stdout,
+            "%-8s compaction: %.0f -> %.0f bytes (%.1f%%), space amp %.2f\n",
+            workload,
+            (double) before,
+            (double) s.last_size,
+            before == 0 ? 0.0 : 100.0 * s.last_size / before,
+            s.live == 0 ? 0.0 : (double) s.last_size / s.live);
+  }
+
+  free(present);
+  free(value);
+}
+
+TEST_START("write/space amplification benchmark", "amplification-bench")
+  int items = env_int("BP_BENCH_ITEMS", 20000);
+  int ops = env_int("BP_BENCH_OPS", 100000);
+  int value_size = env_int("BP_BENCH_VALUE_SIZE", 100);
+  int report_every = env_int("BP_BENCH_REPORT", 10000);
+  bp_options_t options;
+  const char* workloads = getenv("BP_BENCH_WORKLOADS");
+  char* workloads_copy;
+  char* workload;
+
+  if (workloads == NULL || *workloads == 0) workloads = "insert,update,delete";
+
+  bp_options_init(&options);
+  options.delta_chain = env_int("BP_BENCH_DELTA_CHAIN", 0);
+  options.buffer_messages = env_int("BP_BENCH_BUFFER_MESSAGES", 0);
+
+  fprintf(stdout,
+          "%d keys, %d ops per workload, %d bytes values, delta chain %u, "
+          "buffer messages %u\n",
+          items,
+          ops,
+          value_size,
+          options.delta_chain,
+          options.buffer_messages);
+  fprintf(stdout,
+          "%-8s %10s %14s %14s %9s %14s %14s %9s\n",
+          "workload",
+          "ops",
+          "logical",
+          "appended",
+          "write amp",
+          "file size",
+          "live",
+          "space amp");
+
+  workloads_copy = strdup(workloads);
+  for (workload = strtok(workloads_copy, ","); workload != NULL;
+       workload = strtok(NULL, ",")) {
+    /* every workload starts from an empty database */
+    assert(bp_close(&db) == BP_OK);
+    assert(unlink(__db_file) == 0);
+    assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+
+    run(&db, __db_file, workload, items, ops, value_size, report_every);
+  }
+  free(workloads_copy);
+TEST_END("write/space amplification benchmark", "amplification-bench")
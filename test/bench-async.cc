@@ -0,0 +1,227 @@
+#include "test.h"
+#include "bplus-async.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Thread-per-request vs coroutines benchmark.
+ *
+ * Runs the same number of random gets with the same number of requests in
+ * flight ("concurrency") either as one blocking thread per request, or as
+ * coroutines over io_uring spread across one event loop per core. Process is
+ * pinned to BP_BENCH_CORES CPUs, so both modes get equal core counts.
+ * By default database file is evicted from OS page cache before every run,
+ * so reads actually wait for the device.
+ *
+ * Environment:
+ *   BP_BENCH_ITEMS       - number of keys in database (default: 200000)
+ *   BP_BENCH_OPS         - gets per run (default: 20000)
+ *   BP_BENCH_CONCURRENCY - comma-separated list of requests in flight
+ *                          (default: 1,8,64,256)
+ *   BP_BENCH_CORES       - CPUs to run on (default: 1)
+ *   BP_BENCH_COLD        - 0 to keep database in page cache (default: 1)
+ */
+
+static int env_int(const char* name, int def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : atoi(value);
+}
+
+
+static const char* env_str(const char* name, const char* def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : value;
+}
+
+
+static double now_us() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+
+static std::string bench_key(int i) {
+  char key[32];
+  sprintf(key, "%016x", (unsigned) i * 2654435761u);
+  return key;
+}
+
+
+static void evict(const char* filename) {
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  assert(fd != -1);
+  assert(fdatasync(fd) == 0);
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+  assert(close(fd) == 0);
+}
+
+
+struct Worker {
+  bp::Db* db;
+  int items;
+  int ops;
+  unsigned seed;
+  int found;
+};
+
+
+static void* thread_worker(void* arg) {
+  Worker* w = (Worker*) arg;
+  int i;
+
+  for (i = 0; i < w->ops; i++) {
+    if (w->db->get(bench_key(rand_r(&w->seed) % w->items))) w->found++;
+  }
+  return NULL;
+}
+
+
+static bp::async::Task<> coroutine_worker(bp::async::Db& adb, Worker& w) {
+  int i;
+
+  for (i = 0; i < w.ops; i++) {
+    std::optional<bp::Value> value =
+        co_await adb.get(bench_key(rand_r(&w.seed) % w.items));
+    if (value) w.found++;
+  }
+}
+
+
+struct Loop {
+  bp::Db* db;
+  std::vector<Worker>* workers;
+  int first;
+  int count;
+};
+
+
+static void* loop_thread(void* arg) {
+  Loop* l = (Loop*) arg;
+  bp::async::Loop loop(256);
+  bp::async::Db adb(loop, *l->db);
+  int i;
+
+  for (i = l->first; i < l->first + l->count; i++) {
+    loop.spawn(coroutine_worker(adb, (*l->workers)[i]));
+  }
+  loop.run();
+  return NULL;
+}
+
+
+static void run(const char* mode,
+                bp::Db& db,
+                const char* filename,
+                int items,
+                int ops,
+                int concurrency,
+                int cores,
+                int cold) {
+  std::vector<Worker> workers(concurrency);
+  std::vector<pthread_t> threads;
+  int found;
+  int i;
+  double start;
+  double total;
+
+  for (i = 0; i < concurrency; i++) {
+    workers[i].db = &db;
+    workers[i].items = items;
+    workers[i].ops = ops / concurrency;
+    workers[i].seed = (unsigned) i + 1;
+    workers[i].found = 0;
+  }
+
+  if (cold) evict(filename);
+
+  start = now_us();
+  if (strcmp(mode, "threads") == 0) {
+    threads.resize(concurrency);
+    for (i = 0; i < concurrency; i++) {
+      assert(pthread_create(&threads[i], NULL, thread_worker, &workers[i]) == 0);
+    }
+  } else {
+    int loops = cores < concurrency ? cores : concurrency;
+    std::vector<Loop> args(loops);
+
+    threads.resize(loops);
+    for (i = 0; i < loops; i++) {
+      args[i].db = &db;
+      args[i].workers = &workers;
+      args[i].first = concurrency * i / loops;
+      args[i].count = concurrency * (i + 1) / loops - args[i].first;
+    }
+    for (i = 0; i < loops; i++) {
+      assert(pthread_create(&threads[i], NULL, loop_thread, &args[i]) == 0);
+    }
+    for (i = 0; i < loops; i++) assert(pthread_join(threads[i], NULL) == 0);
+    threads.clear();
+  }
+  for (i = 0; i < (int) threads.size(); i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  total = now_us() - start;
+
+  found = 0;
+  for (i = 0; i < concurrency; i++) found += workers[i].found;
+  assert(found == concurrency * (ops / concurrency));
+
+  fprintf(stdout,
+          "%-10s cores=%d concurrency=%-4d %s : %f ops/sec, %f us/op\n",
+          mode,
+          cores,
+          concurrency,
+          cold ? "cold" : "warm",
+          found / total * 1e6,
+          total / found);
+}
+
+
+TEST_START("thread-per-request vs coroutines benchmark", "async-bench")
+  int items = env_int("BP_BENCH_ITEMS", 200000);
+  int ops = env_int("BP_BENCH_OPS", 20000);
+  int cores = env_int("BP_BENCH_CORES", 1);
+  int cold = env_int("BP_BENCH_COLD", 1);
+  std::string list = env_str("BP_BENCH_CONCURRENCY", "1,8,64,256");
+  cpu_set_t cpus;
+  size_t pos;
+  int i;
+
+  assert(bp_close(&db) == BP_OK);
+
+  CPU_ZERO(&cpus);
+  for (i = 0; i < cores; i++) CPU_SET(i, &cpus);
+  assert(sched_setaffinity(0, sizeof(cpus), &cpus) == 0);
+
+  {
+    bp::Db cpp(__db_file);
+    bp::Batch batch;
+    std::string value(100, 'v');
+
+    batch.reserve(items);
+    for (i = 0; i < items; i++) batch.set(bench_key(i), value);
+    cpp.apply(std::move(batch));
+    cpp.fsync();
+
+    for (pos = 0; pos != std::string::npos;) {
+      size_t next = list.find(',', pos);
+      int concurrency = atoi(list.substr(pos, next - pos).c_str());
+      pos = next == std::string::npos ? next : next + 1;
+      if (concurrency <= 0) continue;
+
+      run("threads", cpp, __db_file, items, ops, concurrency, cores, cold);
+      run("coroutines", cpp, __db_file, items, ops, concurrency, cores, cold);
+    }
+  }
+
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("thread-per-request vs coroutines benchmark", "async-bench")
@@ -0,0 +1,118 @@
+#include "test.h"
+
+/*
+ * Random gets served from a large block cache, with regular and with huge
+ * pages (BP_OPEN_HUGE_PAGES). Cache is filled by bp_warmup() and one pass
+ * over all keys (to cache values too) before measuring.
+ *
+ * Environment:
+ *   BP_BENCH_ITEMS      - number of keys (default: 200000)
+ *   BP_BENCH_OPS        - random gets measured (default: 500000)
+ *   BP_BENCH_CACHE_SIZE - cache size in MB (default: 512)
+ */
+
+static int env_int(const char* name, int def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : atoi(value);
+}
+
+
+static double now_us() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+
+static void bench_key(char* key, int i) {
+  sprintf(key, "%016x", (unsigned) i * 2654435761u);
+}
+
+
+static int compare_keys(const void* a, const void* b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+static void measure(const char* filename,
+                    int flags,
+                    int items,
+                    int ops,
+                    uint64_t cache_size) {
+  bp_db_t db;
+  bp_options_t options;
+  bp_warmup_t policy;
+  bp_cache_stats_t before, after;
+  unsigned seed = 1;
+  char key[32];
+  char* value;
+  double start, total;
+  int i;
+
+  bp_warmup_init(&policy);
+  policy.flags = BP_WARMUP_LEAVES;
+
+  bp_options_init(&options);
+  options.flags = flags;
+  options.cache_size = cache_size;
+  options.warmup = &policy;
+  assert(bp_open_ex(&db, filename, &options) == BP_OK);
+  assert(bp_warmup_wait(&db, NULL) == BP_OK);
+
+  for (i = 0; i < items; i++) {
+    bench_key(key, i);
+    assert(bp_gets(&db, key, &value) == BP_OK);
+    free(value);
+  }
+
+  assert(bp_cache_stats(&db, &before) == BP_OK);
+  start = now_us();
+  for (i = 0; i < ops; i++) {
+    bench_key(key, rand_r(&seed) % items);
+    assert(bp_gets(&db, key, &value) == BP_OK);
+    free(value);
+  }
+  total = now_us() - start;
+  assert(bp_cache_stats(&db, &after) == BP_OK);
+
+  fprintf(stdout,
+          "%-7s : %f ops/sec, hit rate %.3f, huge pages %llu MB of %llu MB\n",
+          flags & BP_OPEN_HUGE_PAGES ? "huge" : "regular",
+          ops / total * 1e6,
+          (double) (after.hits - before.hits) /
+              (after.hits - before.hits + after.misses - before.misses + 1),
+          (unsigned long long) (after.huge_pages >> 20),
+          (unsigned long long) (after.size >> 20));
+
+  assert(bp_close(&db) == BP_OK);
+}
+
+
+TEST_START("huge pages benchmark", "huge-pages-bench")
+  int items = env_int("BP_BENCH_ITEMS", 200000);
+  int ops = env_int("BP_BENCH_OPS", 500000);
+  uint64_t cache_size = (uint64_t) env_int("BP_BENCH_CACHE_SIZE", 512) << 20;
+  char key[32];
+  char** keys;
+  int i;
+
+  keys = (char**) malloc(items * sizeof(*keys));
+  for (i = 0; i < items; i++) {
+    bench_key(key, i);
+    keys[i] = strdup(key);
+  }
+  /* bulk set expects sorted keys */
+  qsort(keys, items, sizeof(*keys), compare_keys);
+  assert(bp_bulk_sets(&db,
+                      items,
+                      (const char**) keys,
+                      (const char**) keys) == BP_OK);
+  for (i = 0; i < items; i++) free(keys[i]);
+  free(keys);
+  assert(bp_close(&db) == BP_OK);
+
+  measure(__db_file, 0, items, ops, cache_size);
+  measure(__db_file, BP_OPEN_HUGE_PAGES, items, ops, cache_size);
+
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("huge pages benchmark", "huge-pages-bench")
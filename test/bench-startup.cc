@@ -0,0 +1,233 @@
+#include "test.h"
+
+/*
+ * Startup-time and recovery benchmark.
+ *
+ * Builds databases of increasing size, optionally damages their tail, and
+ * measures bp_open() time and the latency of the first N gets, both with the
+ * database file evicted from OS page cache (cold) and just written (warm).
+ *
+ * Tails:
+ *   clean   - file as it was left by bp_close()
+ *   torn    - last BP_BENCH_TAIL_SIZE bytes are cut off (interrupted write)
+ *   garbage - BP_BENCH_TAIL_SIZE bytes of junk are appended
+ *
+ * Note that bp_open() on a damaged file appends padding, so every
+ * measurement runs on a fresh copy of the database.
+ *
+ * Environment:
+ *   BP_BENCH_SIZES     - comma-separated list of item counts
+ *                        (default: 10000,100000,500000)
+ *   BP_BENCH_TAILS     - comma-separated list of clean,torn,garbage
+ *                        (default: all of them)
+ *   BP_BENCH_TAIL_SIZE - bytes to cut off or append (default: 65536)
+ *   BP_BENCH_GETS      - number of gets measured after open (default: 1000)
+ */
+
+static int env_int(const char* name, int def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : atoi(value);
+}
+
+
+static const char* env_str(const char* name, const char* def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : value;
+}
+
+
+static double now_us() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+
+static void copy_file(const char* from, const char* to) {
+  char buff[65536];
+  ssize_t r;
+  int in, out;
+
+  in = open(from, O_RDONLY);
+  assert(in != -1);
+  out = open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  assert(out != -1);
+
+  while ((r = read(in, buff, sizeof(buff))) > 0) {
+    assert(write(out, buff, r) == r);
+  }
+  assert(r == 0);
+
+  assert(close(in) == 0);
+  assert(close(out) == 0);
+}
+
+
+static void damage_tail(const char* filename, const char* tail, int size) {
+  int fd;
+  off_t filesize;
+
+  if (strcmp(tail, "clean") == 0) return;
+
+  fd = open(filename, O_RDWR);
+  assert(fd != -1);
+  filesize = lseek(fd, 0, SEEK_END);
+  assert(filesize != -1);
+
+  if (strcmp(tail, "torn") == 0) {
+    assert(ftruncate(fd, filesize > size ? filesize - size : 0) == 0);
+  } else {
+    char* junk = (char*) malloc(size);
+    unsigned int seed = 13;
+    int i;
+
+    for (i = 0; i < size; i++) junk[i] = (char) rand_r(&seed);
+    assert(pwrite(fd, junk, size, filesize) == size);
+    free(junk);
+  }
+
+  assert(close(fd) == 0);
+}
+
+
+static void drop_cache(const char* filename) {
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  assert(fd != -1);
+  assert(fdatasync(fd) == 0);
+
+  /* only drops clean pages, hence fdatasync() above */
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+  assert(close(fd) == 0);
+}
+
+
+static void measure(const char* base,
+                    const char* filename,
+                    int items,
+                    const char* tail,
+                    int tail_size,
+                    int gets,
+                    int cold) {
+  bp_db_t db;
+  char key[32];
+  char* value;
+  unsigned int seed = 7;
+  double start, open_us, first_us, gets_us;
+  int i, found;
+
+  copy_file(base, filename);
+  damage_tail(filename, tail, tail_size);
+  if (cold) drop_cache(filename);
+
+  start = now_us();
+  assert(bp_open(&db, filename) == BP_OK);
+  open_us = now_us() - start;
+
+  found = 0;
+  first_us = 0;
+  start = now_us();
+  for (i = 0; i < gets; i++) {
+    sprintf(key, "%0*d", 16, rand_r(&seed) % items);
+    if (bp_gets(&db, key, &value) == BP_OK) {
+      free(value);
+      found++;
+    }
+    if (i == 0) first_us = now_us() - start;
+  }
+  gets_us = now_us() - start;
+
+  assert(bp_close(&db) == BP_OK);
+
+  fprintf(stdout,
+          "%10d %-8s %-5s %12.0f %12.0f %12.2f %8d\n",
+          items,
+          tail,
+          cold ? "cold" : "warm",
+          open_us,
+          first_us,
+          gets == 0 ? 0.0 : gets_us / gets,
+          found);
+  fflush(stdout);
+}
+
+
+static void build(const char* filename, int items) {
+  const int chunk = 10000;
+  bp_db_t db;
+  char** keys;
+  int i, start, count;
+
+  assert(bp_open(&db, filename) == BP_OK);
+
+  /* several bulk writes to get a realistic number of heads in file */
+  keys = (char**) malloc(chunk * sizeof(*keys));
+  for (i = 0; i < chunk; i++) keys[i] = (char*) malloc(32);
+
+  for (start = 0; start < items; start += chunk) {
+    count = items - start < chunk ? items - start : chunk;
+    for (i = 0; i < count; i++) sprintf(keys[i], "%0*d", 16, start + i);
+
+    assert(bp_bulk_sets(&db,
+                        count,
+                        (const char**) keys,
+                        (const char**) keys) == BP_OK);
+  }
+
+  for (i = 0; i < chunk; i++) free(keys[i]);
+  free(keys);
+
+  assert(bp_close(&db) == BP_OK);
+}
+
+
+TEST_START("startup-time and recovery benchmark", "startup-bench")
+  const char* sizes = env_str("BP_BENCH_SIZES", "10000,100000,500000");
+  const char* tails = env_str("BP_BENCH_TAILS", "clean,torn,garbage");
+  int tail_size = env_int("BP_BENCH_TAIL_SIZE", 65536);
+  int gets = env_int("BP_BENCH_GETS", 1000);
+  const char* base = "/tmp/startup-bench.bp.base";
+  char* sizes_copy;
+  char* tails_copy;
+  char* size;
+  char* tail;
+  char* size_state;
+  char* tail_state;
+
+  fprintf(stdout,
+          "%10s %-8s %-5s %12s %12s %12s %8s\n",
+          "items",
+          "tail",
+          "cache",
+          "open us",
+          "1st get us",
+          "avg get us",
+          "found");
+
+  /* benchmark manages its own database files */
+  assert(bp_close(&db) == BP_OK);
+
+  sizes_copy = strdup(sizes);
+  for (size = strtok_r(sizes_copy, ",", &size_state); size != NULL;
+       size = strtok_r(NULL, ",", &size_state)) {
+    int items = atoi(size);
+
+    if (access(base, F_OK) == 0) assert(unlink(base) == 0);
+    build(base, items);
+
+    tails_copy = strdup(tails);
+    for (tail = strtok_r(tails_copy, ",", &tail_state); tail != NULL;
+         tail = strtok_r(NULL, ",", &tail_state)) {
+      measure(base, __db_file, items, tail, tail_size, gets, 1);
+      measure(base, __db_file, items, tail, tail_size, gets, 0);
+    }
+    free(tails_copy);
+  }
+  free(sizes_copy);
+
+  assert(unlink(base) == 0);
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("startup-time and recovery benchmark", "startup-bench")
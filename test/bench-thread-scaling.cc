@@ -0,0 +1,223 @@
+#include "test.h"
+#include <pthread.h>
+#include <time.h>
+#include <algorithm>
+
+/*
+ * Thread-scalability benchmark for mixed workloads.
+ *
+ * Sweeps thread count from 1 to BP_BENCH_THREADS (powers of two, plus the
+ * maximum itself) for every write ratio in BP_BENCH_WRITE_RATIOS and prints
+ * throughput and latency percentiles for each configuration.
+ *
+ * Environment:
+ *   BP_BENCH_THREADS      - maximum number of threads (default: 8)
+ *   BP_BENCH_WRITE_RATIOS - comma-separated write percentages (default: 0,10,50)
+ *   BP_BENCH_ITEMS        - number of keys in database (default: 100000)
+ *   BP_BENCH_OPS          - operations per thread (default: 20000)
+ *   BP_BENCH_COMPACT      - run bp_compact in background when set to 1
+ *   BP_BENCH_FSYNC        - call bp_fsync after every N writes (default: 0)
+ *   BP_BENCH_CACHE_SIZE   - block cache size in MB (default: 0, no cache)
+ *   BP_BENCH_CACHE_NODES  - cache partitions, "auto" - one per NUMA node
+ *                           (default: 0, single cache)
+ */
+
+static int items;
+static int ops;
+static int fsync_every;
+static char** keys;
+
+struct worker_s {
+  bp_db_t* db;
+  int write_ratio;
+  unsigned int seed;
+  uint64_t* latencies;
+};
+
+struct compactor_s {
+  bp_db_t* db;
+  volatile int stop;
+  int runs;
+};
+
+static int env_int(const char* name, int def) {
+  const char* value = getenv(name);
+  return value == NULL || *value == 0 ? def : atoi(value);
+}
+
+static uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void* worker_thread(void* arg) {
+  worker_s* w = (worker_s*) arg;
+  int writes = 0;
+
+  for (int i = 0; i < ops; i++) {
+    int key = rand_r(&w->seed) % items;
+    int is_write = (int) (rand_r(&w->seed) % 100) < w->write_ratio;
+    uint64_t start = now_ns();
+
+    if (is_write) {
+      assert(bp_sets(w->db, keys[key], keys[key]) == BP_OK);
+      if (fsync_every != 0 && ++writes % fsync_every == 0) {
+        assert(bp_fsync(w->db) == BP_OK);
+      }
+    } else {
+      char* value;
+      if (bp_gets(w->db, keys[key], &value) == BP_OK) free(value);
+    }
+
+    w->latencies[i] = now_ns() - start;
+  }
+
+  return NULL;
+}
+
+void* compactor_thread(void* arg) {
+  compactor_s* c = (compactor_s*) arg;
+
+  while (!c->stop) {
+    assert(bp_compact(c->db) == BP_OK);
+    c->runs++;
+  }
+
+  return NULL;
+}
+
+static double percentile(uint64_t* sorted, size_t count, double p) {
+  size_t index = (size_t) (p * (count - 1));
+  return sorted[index] / 1000.0;
+}
+
+static void run(bp_db_t* db, int threads, int write_ratio, int compact) {
+  pthread_t* tids = new pthread_t[threads];
+  worker_s* workers = new worker_s[threads];
+  uint64_t* latencies = new uint64_t[(size_t) threads * ops];
+  compactor_s compactor;
+  pthread_t compactor_tid;
+  uint64_t start, total;
+
+  compactor.db = db;
+  compactor.stop = 0;
+  compactor.runs = 0;
+  if (compact) {
+    assert(pthread_create(&compactor_tid,
+                          NULL,
+                          compactor_thread,
+                          &compactor) == 0);
+  }
+
+  start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    workers[i].db = db;
+    workers[i].write_ratio = write_ratio;
+    workers[i].seed = i * 7919 + write_ratio;
+    workers[i].latencies = latencies + (size_t) i * ops;
+    assert(pthread_create(&tids[i], NULL, worker_thread, &workers[i]) == 0);
+  }
+  for (int i = 0; i < threads; i++) {
+    assert(pthread_join(tids[i], NULL) == 0);
+  }
+  total = now_ns() - start;
+
+  if (compact) {
+    compactor.stop = 1;
+    assert(pthread_join(compactor_tid, NULL) == 0);
+  }
+
+  size_t count = (size_t) threads * ops;
+  std::sort(latencies, latencies + count);
+
+  fprintf(stdout,
+          "%7d %6d%% %14.1f %10.1f %10.1f %10.1f %10.1f %8d\n",
+          threads,
+          write_ratio,
+          count / (total * 1e-9),
+          percentile(latencies, count, 0.5),
+          percentile(latencies, count, 0.99),
+          percentile(latencies, count, 0.999),
+          latencies[count - 1] / 1000.0,
+          compactor.runs);
+  fflush(stdout);
+
+  delete[] latencies;
+  delete[] workers;
+  delete[] tids;
+}
+
+TEST_START("thread scaling benchmark", "thread-scaling-bench")
+  int max_threads = env_int("BP_BENCH_THREADS", 8);
+  int compact = env_int("BP_BENCH_COMPACT", 0);
+  const char* ratios = getenv("BP_BENCH_WRITE_RATIOS");
+  const char* cache_nodes = getenv("BP_BENCH_CACHE_NODES");
+  int cache_size = env_int("BP_BENCH_CACHE_SIZE", 0);
+  bp_options_t options;
+  char* ratios_copy;
+  char* ratio;
+  int i;
+
+  items = env_int("BP_BENCH_ITEMS", 100000);
+  ops = env_int("BP_BENCH_OPS", 20000);
+  fsync_every = env_int("BP_BENCH_FSYNC", 0);
+  if (ratios == NULL || *ratios == 0) ratios = "0,10,50";
+
+  keys = (char**) malloc(sizeof(*keys) * items);
+  for (i = 0; i < items; i++) {
+    keys[i] = (char*) malloc(21);
+    sprintf(keys[i], "%0*d", 20, i);
+  }
+
+  bp_bulk_sets(&db,
+               items,
+               (const char**) keys,
+               (const char**) keys);
+
+  if (cache_size != 0) {
+    bp_options_init(&options);
+    options.cache_size = (uint64_t) cache_size << 20;
+    if (cache_nodes != NULL && strcmp(cache_nodes, "auto") == 0) {
+      options.cache_nodes = BP_CACHE_NUMA_AUTO;
+    } else if (cache_nodes != NULL) {
+      options.cache_nodes = (uint32_t) atoi(cache_nodes);
+    }
+    assert(bp_close(&db) == BP_OK);
+    assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  }
+
+  fprintf(stdout,
+          "%d items in db, %d ops per thread, compact: %s, fsync every: %d\n",
+          items,
+          ops,
+          compact ? "yes" : "no",
+          fsync_every);
+  fprintf(stdout,
+          "%7s %7s %14s %10s %10s %10s %10s %8s\n",
+          "threads",
+          "writes",
+          "ops/sec",
+          "p50 us",
+          "p99 us",
+          "p99.9 us",
+          "max us",
+          "compact");
+
+  ratios_copy = strdup(ratios);
+  for (ratio = strtok(ratios_copy, ","); ratio != NULL;
+       ratio = strtok(NULL, ",")) {
+    int write_ratio = atoi(ratio);
+
+    for (i = 1; i < max_threads; i <<= 1) {
+      run(&db, i, write_ratio, compact);
+    }
+    run(&db, max_threads, write_ratio, compact);
+  }
+  free(ratios_copy);
+
+  for (i = 0; i < items; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+TEST_END("thread scaling benchmark", "thread-scaling-bench")
@@ -0,0 +1,156 @@
+#include "test.h"
+#include "bplus-async.hpp"
+
+#include <string>
+#include <vector>
+
+static std::string key_of(int i) {
+  char key[32];
+  sprintf(key, "key %06d", i);
+  return key;
+}
+
+static bp::async::Task<> check_range(bp::async::Db& adb,
+                                     std::string start,
+                                     std::string end,
+                                     std::vector<std::string>& keys) {
+  bp::async::Generator<bp::Entry> range = adb.range(start, end);
+  while (const bp::Entry* entry = co_await range.next()) {
+    assert(entry->value == "value " + std::string(entry->key.substr(4)));
+    keys.push_back(std::string(entry->key));
+  }
+}
+
+static bp::async::Task<> check_get(bp::async::Db& adb, int i, int& found) {
+  std::optional<bp::Value> value = co_await adb.get(key_of(i));
+  if (value) {
+    assert(value->view() == "value " + key_of(i).substr(4));
+    found++;
+  }
+}
+
+static bp::async::Task<int> update(bp::async::Db& adb) {
+  co_await adb.set("key 000005", "value 000005", 1);
+  bool removed = co_await adb.remove("key 000006");
+  assert(removed);
+  co_return (co_await adb.get("key 000005")) ? 1 : 0;
+}
+
+static bp::async::Task<> write(bp::async::Db& adb, int i) {
+  co_await adb.set(key_of(i), "value " + key_of(i).substr(4));
+}
+
+TEST_START("async coroutine api test", "async")
+  const int n = 5000;
+  int found;
+  int i;
+
+  assert(bp_close(&db) == BP_OK);
+
+  {
+    /* pages are written as deltas, async reads apply them too */
+    bp::Options options;
+    options.delta_chain = 4;
+    bp::Db cpp(__db_file, options);
+    bp::async::Loop loop(32);
+    bp::async::Db adb(loop, cpp);
+
+    bp::Batch batch;
+    for (i = 0; i < n; i += 2) {
+      batch.set(key_of(i), "value " + key_of(i).substr(4));
+    }
+    cpp.apply(std::move(batch));
+
+    /* many lookups in flight at once, more than ring size */
+    found = 0;
+    for (i = 0; i < n; i++) loop.spawn(check_get(adb, i, found));
+    loop.run();
+    assert(found == n / 2);
+
+    std::vector<std::string> keys;
+    loop.wait(check_range(adb, key_of(100), key_of(200), keys));
+    assert(keys.size() == 51);
+    assert(keys.front() == key_of(100) && keys.back() == key_of(200));
+    for (i = 1; i < (int) keys.size(); i++) assert(keys[i - 1] < keys[i]);
+
+    /* range matches synchronous one */
+    keys.clear();
+    loop.wait(check_range(adb, "", "z", keys));
+    assert(keys.size() == (size_t) n / 2);
+    i = 0;
+    for (const bp::Entry& entry : cpp.range("", "z")) {
+      assert(entry.key == keys[i++]);
+    }
+
+    keys.clear();
+    loop.wait(check_range(adb, "x", "z", keys));
+    assert(keys.empty());
+
+    /* writes, expired value is not returned */
+    assert(loop.wait(update(adb)) == 0);
+    found = 0;
+    loop.wait(check_get(adb, 6, found));
+    assert(found == 0);
+
+    /* file is replaced by compaction, reads use new one */
+    cpp.set(key_of(1), "value " + key_of(1).substr(4));
+    cpp.compact();
+    found = 0;
+    for (i = 0; i < 10; i++) loop.spawn(check_get(adb, i, found));
+    loop.run();
+    assert(found == 5);
+  }
+
+  {
+    /*
+     * sets and removes wait in page buffers, async reads merge them, keys
+     * are all in their own blocks
+     */
+    bp::Options options;
+    options.buffer_messages = 32;
+    options.inline_key_limit = 8;
+    bp::Db cpp(__db_file, options);
+    bp::async::Loop loop(32);
+    bp::async::Db adb(loop, cpp);
+
+    for (i = 0; i < n; i++) {
+      int k = (i * 7919) % n;
+      if (k % 4 == 3) {
+        cpp.remove(key_of(k));
+      } else {
+        cpp.set(key_of(k), "value " + key_of(k).substr(4));
+      }
+    }
+
+    found = 0;
+    for (i = 0; i < n; i++) loop.spawn(check_get(adb, i, found));
+    loop.run();
+    assert(found == n - n / 4);
+
+    std::vector<std::string> keys;
+    loop.wait(check_range(adb, "", "z", keys));
+    assert(keys.size() == (size_t) found);
+    i = 0;
+    for (const bp::Entry& entry : cpp.range("", "z")) {
+      assert(entry.key == keys[i++]);
+    }
+    assert(i == found);
+
+    /* read of value buffered in head doesn't hold tree lock, set goes on */
+    cpp.set(key_of(n), "value " + key_of(n).substr(4));
+    bp_key_t raw_key = bp::detail::key(key_of(n));
+    std::uint64_t index;
+    assert(bp__buffer_search(cpp.native(),
+                             cpp.native()->head.page,
+                             &raw_key,
+                             &index) == BP_OK);
+    found = 0;
+    loop.spawn(check_get(adb, n, found));
+    loop.spawn(write(adb, n + 1));
+    loop.run();
+    assert(found == 1);
+    assert(cpp.get(key_of(n + 1)));
+  }
+
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("async coroutine api test", "async")
@@ -0,0 +1,149 @@
+#include "test.h"
+
+/* keys are written in scattered order, to spread messages over children */
+#define SCATTER 7919
+
+static void remove_all(bp_db_t* db, int n) {
+  char key[100];
+  char* value;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %06d", test_scatter(i, n, SCATTER));
+    assert(bp_removes(db, key) == BP_OK);
+  }
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %06d", i);
+    assert(bp_gets(db, key, &value) == BP_ENOTFOUND);
+  }
+}
+
+static void bulk(bp_db_t* db, int n) {
+  char** keys;
+  char** values;
+  int i, count;
+
+  keys = (char**) malloc(n * sizeof(*keys));
+  values = (char**) malloc(n * sizeof(*values));
+  for (i = 0, count = 0; i < n; i++) {
+    if (i % 3 != 0 || i % 7 == 0) continue;
+    keys[count] = (char*) malloc(100);
+    values[count] = (char*) malloc(100);
+    sprintf(keys[count], "key %06d", i);
+    sprintf(values[count], "new %06d", i);
+    count++;
+  }
+  assert(bp_bulk_sets(db,
+                      count,
+                      (const char**) keys,
+                      (const char**) values) == BP_OK);
+  for (i = 0; i < count; i++) {
+    free(keys[i]);
+    free(values[i]);
+  }
+  free(keys);
+  free(values);
+}
+
+static int range_count;
+static char range_last[100];
+
+static void count_range(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  /* messages are merged into results in key order */
+  assert(strcmp(range_last, key->value) < 0);
+  strcpy(range_last, key->value);
+  range_count++;
+}
+
+static void check_range(bp_db_t* db, int expected) {
+  range_count = 0;
+  range_last[0] = 0;
+  assert(bp_get_ranges(db, "key 000000", "key 000999", count_range, NULL) ==
+         BP_OK);
+  assert(range_count == expected);
+}
+
+static int reject_update(void* arg,
+                         const bp_value_t* previous,
+                         const bp_value_t* value) {
+  return strncmp(previous->value, "old", 3) != 0;
+}
+
+TEST_START("buffered messages test", "buffers")
+  const int n = 5000;
+  bp_options_t options;
+  char* value;
+
+  assert(bp_close(&db) == BP_OK);
+  bp_options_init(&options);
+  options.buffer_messages = 32;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+
+  fill(&db, n, "old", SCATTER);
+  check(&db, n, 0, 0);
+  check_range(&db, 1000);
+
+  update(&db, n, n, n, SCATTER);
+  check(&db, n, n, n);
+  check_range(&db, 1000 - 143);
+
+  /* removed keys are not found by removal, update_cb sees buffered values */
+  assert(bp_removes(&db, "key 000000") == BP_ENOTFOUND);
+  assert(bp_updates(&db, "key 000001", "new 000001", reject_update, NULL) ==
+         BP_EUPDATECONFLICT);
+  assert(bp_updates(&db, "key 000003", "new 000003", reject_update, NULL) ==
+         BP_OK);
+  assert(bp_sets(&db, "key 000000", "old 000000") == BP_OK);
+  assert(bp_gets(&db, "key 000000", &value) == BP_OK);
+  assert(strcmp(value, "old 000000") == 0);
+  free(value);
+  assert(bp_removes(&db, "key 000000") == BP_OK);
+  check(&db, n, n, n);
+
+  /* bulk replaces buffered messages of its keys */
+  bulk(&db, n);
+  check(&db, n, n, n);
+
+  /* messages written in B-epsilon mode are readable without it */
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  check(&db, n, n, n);
+  check_range(&db, 1000 - 143);
+  fill(&db, n, "old", SCATTER);
+  check(&db, n, 0, 0);
+  update(&db, n, n, n / 2, SCATTER);
+  check(&db, n, n, n / 2);
+  assert(bp_close(&db) == BP_OK);
+
+  /* compaction keeps buffered messages */
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  fill(&db, n, "old", SCATTER);
+  update(&db, n, n, n, SCATTER);
+  assert(bp_compact(&db) == BP_OK);
+  check(&db, n, n, n);
+  check_range(&db, 1000 - 143);
+
+  /* remove everything, with messages and then directly from leaves */
+  fill(&db, n, "old", SCATTER);
+  remove_all(&db, n);
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  fill(&db, n, "old", SCATTER);
+  check(&db, n, 0, 0);
+  remove_all(&db, n);
+  check_range(&db, 0);
+  assert(bp_close(&db) == BP_OK);
+
+  /* buffers combined with delta pages */
+  options.buffer_messages = 16;
+  options.delta_chain = 4;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  fill(&db, n, "old", SCATTER);
+  update(&db, n, n, n, SCATTER);
+  check(&db, n, n, n);
+  check_range(&db, 1000 - 143);
+  assert(bp_close(&db) == BP_OK);
+
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  check(&db, n, n, n);
+TEST_END("buffered messages test", "buffers")
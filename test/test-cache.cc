@@ -0,0 +1,132 @@
+#include "test.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+TEST_START("shared block cache test", "cache")
+  const int n = 500;
+  bp_options_t options;
+  bp_cache_stats_t stats;
+  bp_cache_stats_t after;
+  bp_warmup_t warmup;
+  bp_db_t cached;
+  char name[64];
+  pid_t child;
+  int status;
+
+  assert(bp_cache_stats(&db, &stats) == BP_ENOTFOUND);
+  assert(bp_close(&db) == BP_OK);
+
+  /* private cache, so small that it is constantly evicted */
+  bp_options_init(&options);
+  options.cache_size = 64 * 1024;
+  options.cache_block_size = 4096;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  fill(&db, n, "value");
+  check_kvs(&db, 0, n, "value", 0, 0);
+
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.slots > 0);
+  assert(stats.block_size == 4096);
+  assert(stats.hits > 0);
+  assert(stats.inserts > 0);
+  assert(stats.huge_pages == 0);
+  assert(bp_close(&db) == BP_OK);
+
+  /* huge pages, if system has none - regular ones */
+  bp_options_init(&options);
+  options.flags = BP_OPEN_HUGE_PAGES;
+  options.cache_size = 3 * 1024 * 1024;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  check_kvs(&db, 0, n, "value", 0, 0);
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.hits > 0);
+  assert(stats.huge_pages <= 4 * 1024 * 1024);
+  assert(bp_close(&db) == BP_OK);
+
+  /* partitions, warmup fills all of them */
+  bp_options_init(&options);
+  options.cache_size = 1024 * 1024;
+  options.cache_nodes = 3;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.nodes == 3);
+  assert(stats.size == 3 * 1024 * 1024);
+  bp_warmup_init(&warmup);
+  warmup.flags = BP_WARMUP_LEAVES;
+  assert(bp_warmup(&db, &warmup) == BP_OK);
+  assert(bp_cache_stats(&db, &after) == BP_OK);
+  assert(after.inserts > stats.inserts);
+  assert((after.inserts - stats.inserts) % 3 == 0);
+  stats = after;
+  check_kvs(&db, 0, n, "value", 0, 0);
+  assert(bp_cache_stats(&db, &after) == BP_OK);
+  assert(after.hits > stats.hits);
+  assert(bp_close(&db) == BP_OK);
+
+  options.cache_nodes = BP_CACHE_NUMA_AUTO;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.nodes >= 1);
+  check_kvs(&db, 0, n, "value", 0, 0);
+  assert(bp_close(&db) == BP_OK);
+
+  /* named partitions */
+  sprintf(name, "/bp-test-numa-%d", (int) getpid());
+  options.cache_name = name;
+  options.cache_nodes = 2;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  check_kvs(&db, 0, n, "value", 0, 0);
+  assert(bp_close(&db) == BP_OK);
+  assert(shm_unlink(name) == 0);
+  strcat(name, ".1");
+  assert(shm_unlink(name) == 0);
+
+  /* shared cache: writer populates it, other process reads from it */
+  sprintf(name, "/bp-test-cache-%d", (int) getpid());
+  shm_unlink(name);
+
+  bp_options_init(&options);
+  options.cache_name = name;
+  options.cache_size = 4 * 1024 * 1024;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  fill(&db, n, "updated");
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+
+  child = fork();
+  assert(child != -1);
+  if (child == 0) {
+    options.flags = BP_OPEN_RDONLY;
+    if (bp_open_ex(&cached, __db_file, &options) != BP_OK) _exit(1);
+    check_kvs(&cached, 0, n, "updated", 0, 0);
+    bp_close(&cached);
+    _exit(0);
+  }
+  assert(waitpid(child, &status, 0) == child);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  /* counters live in shared segment */
+  assert(bp_cache_stats(&db, &after) == BP_OK);
+  assert(after.hits > stats.hits);
+
+  /* compacted file gets new generation, stale blocks aren't returned */
+  options.flags = BP_OPEN_RDONLY;
+  assert(bp_open_ex(&cached, __db_file, &options) == BP_OK);
+  assert(bp_compact(&db) == BP_OK);
+  fill(&db, n, "compacted");
+  check_kvs(&db, 0, n, "compacted", 0, 0);
+  assert(bp_refresh(&cached) == BP_OK);
+  check_kvs(&cached, 0, n, "compacted", 0, 0);
+  assert(bp_close(&cached) == BP_OK);
+
+  /* reopen attaches to existing segment */
+  assert(bp_close(&db) == BP_OK);
+  options.flags = 0;
+  options.cache_size = 1024;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.size == 4 * 1024 * 1024);
+  check_kvs(&db, 0, n, "compacted", 0, 0);
+
+  assert(shm_unlink(name) == 0);
+TEST_END("shared block cache test", "cache")
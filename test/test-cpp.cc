@@ -0,0 +1,136 @@
+#include "test.h"
+#include "bplus.hpp"
+
+#include <new>
+#include <string>
+#include <vector>
+
+/* count C++ allocations to check that hot paths don't allocate */
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t /* size */) noexcept {
+  free(p);
+}
+
+static void set_key(char* key, int i) {
+  sprintf(key, "key %06d", i);
+}
+
+TEST_START("C++ wrapper test", "cpp")
+  const int n = 3000;
+  char key[32];
+  char buff[64];
+  size_t before;
+  int i;
+
+  assert(bp_close(&db) == BP_OK);
+
+  {
+    bp::Db cpp(__db_file);
+    assert(cpp.is_open());
+
+    /* batch in reverse order, sorted on apply */
+    bp::Batch batch;
+    batch.reserve(n);
+    for (i = n - 1; i >= 0; i--) {
+      set_key(key, i);
+      batch.set(key, "value " + std::to_string(i));
+    }
+    cpp.apply(std::move(batch));
+    assert(batch.empty());
+
+    std::optional<bp::Value> value = cpp.get("key 000042");
+    assert(value);
+    assert(value->owns());
+    assert(value->view() == "value 42");
+    assert(!cpp.get("missing"));
+
+    /* previous versions */
+    cpp.set("key 000042", "updated");
+    value = cpp.get("key 000042");
+    assert(value->str() == "updated");
+    std::optional<bp::Value> previous = cpp.previous(*value);
+    assert(previous && previous->view() == "value 42");
+
+    /* move-only handle */
+    bp::Db moved(std::move(cpp));
+    assert(!cpp.is_open());
+    assert(moved.is_open());
+    assert(moved.remove("key 000001"));
+    assert(!moved.remove("key 000001"));
+
+    /* get_into doesn't allocate on C++ side */
+    before = allocations;
+    for (i = 2; i < n; i++) {
+      set_key(key, i);
+      std::optional<size_t> size = moved.get_into(key, std::span<char>(buff));
+      assert(size && *size <= sizeof(buff));
+    }
+    assert(allocations == before);
+    assert(!moved.get_into("missing", std::span<char>(buff)));
+
+    /* truncated copy reports full size */
+    assert(*moved.get_into("key 000042", buff, 3) == 7);
+    assert(memcmp(buff, "upd", 3) == 0);
+
+    std::string out;
+    assert(moved.get_into("key 000100", out));
+    assert(out == "value 100");
+
+    /* ranges: inclusive, lazy, in order */
+    std::vector<std::string> keys;
+    for (const bp::Entry& entry : moved.range("key 000010", "key 000020", 4)) {
+      keys.push_back(std::string(entry.key));
+    }
+    assert(keys.size() == 11);
+    assert(keys.front() == "key 000010");
+    assert(keys.back() == "key 000020");
+    for (i = 1; i < (int) keys.size(); i++) assert(keys[i - 1] < keys[i]);
+
+    /* whole database, chunk buffers are reused */
+    bp::Range all = moved.range("", "key 999999", 128);
+    bp::Range::iterator it = all.begin();
+    for (i = 0; i < 300; i++) ++it;
+    before = allocations;
+    int count = 300;
+    for (; it != all.end(); ++it) {
+      assert(it->key.substr(0, 4) == "key ");
+      count++;
+    }
+    assert(count == n - 1);
+    assert(allocations == before);
+
+    /* empty ranges */
+    assert(moved.range("x", "z").begin() == moved.range("x", "z").end());
+    assert(moved.range("key 000001", "key 000001").begin() ==
+           moved.range("key 000001", "key 000001").end());
+
+    /* errors are exceptions */
+    bp::Options options;
+    options.read_only = true;
+    bp::Db follower(__db_file, options);
+    try {
+      follower.set("a", "b");
+      assert(0);
+    } catch (const bp::Error& err) {
+      assert(err.code() == BP_EREADONLY);
+    }
+
+    /* borrowed values */
+    bp::Value borrowed = bp::Value::borrow("abc");
+    assert(!borrowed.owns() && borrowed.size() == 3);
+  }
+
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("C++ wrapper test", "cpp")
@@ -0,0 +1,115 @@
+#include "test.h"
+
+#define VALUE_SIZE (16 * 1024)
+
+/* only a few distinct values, of 16 kb each, which don't compress well */
+static void make_value(char* value, int kind) {
+  uint32_t seed = 1 + kind;
+  int i;
+
+  for (i = 0; i < VALUE_SIZE - 1; i++) {
+    seed = seed * 1103515245 + 12345;
+    value[i] = 'a' + (seed >> 16) % 26;
+  }
+  value[VALUE_SIZE - 1] = 0;
+}
+
+static void fill_values(bp_db_t* db, int n, int offset) {
+  char key[100];
+  char value[VALUE_SIZE];
+  int i;
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %06d", i);
+    make_value(value, (i + offset) % 4);
+    assert(bp_sets(db, key, value) == BP_OK);
+  }
+}
+
+static void check_values(bp_db_t* db, int n, int offset, int removed) {
+  char key[100];
+  char expected[VALUE_SIZE];
+  char* value;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %06d", i);
+    if (i % 7 == 0 && i < removed) {
+      assert(bp_gets(db, key, &value) == BP_ENOTFOUND);
+      continue;
+    }
+    make_value(expected, (i + offset) % 4);
+    assert(bp_gets(db, key, &value) == BP_OK);
+    assert(strcmp(value, expected) == 0);
+    free(value);
+  }
+}
+
+TEST_START("value dedup test", "dedup")
+  const int n = 2000;
+  const char* full_file = "/tmp/dedup-full.bp";
+  bp_db_t full;
+  bp_key_t key;
+  bp_value_t value, previous;
+  bp_options_t options;
+  uint64_t full_bytes, dedup_bytes, before;
+
+  /* same values, with and without dedup */
+  assert(bp_close(&db) == BP_OK);
+  unlink(full_file);
+  assert(bp_open(&full, full_file) == BP_OK);
+  bp_options_init(&options);
+  options.dedup_slots = 1024;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+
+  fill_values(&full, n, 0);
+  fill_values(&db, n, 0);
+  full_bytes = file_size(full_file);
+  dedup_bytes = file_size(__db_file);
+  assert(dedup_bytes * 3 < full_bytes);
+  check_values(&db, n, 0, 0);
+
+  /* shared values have no previous version */
+  fill_values(&db, n, 1);
+  check_values(&db, n, 1, 0);
+  BP__STOVAL("key 000001", key);
+  assert(bp_get(&db, &key, &value) == BP_OK);
+  assert(bp_get_previous(&db, &value, &previous) == BP_ENOTFOUND);
+  free(value.value);
+
+  update(&db, n, 0, n);
+  check_values(&db, n, 1, n);
+
+  /* index is empty after reopen, it is filled by new writes */
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  check_values(&db, n, 1, n);
+  before = file_size(__db_file);
+  fill_values(&db, n, 2);
+  assert(file_size(__db_file) - before < full_bytes / 3);
+  check_values(&db, n, 2, 0);
+
+  /* handle without dedup reads shared values and writes its own copies */
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  check_values(&db, n, 2, 0);
+  fill_values(&db, n / 2, 3);
+  assert(bp_close(&db) == BP_OK);
+
+  /* compaction shares blocks of equal values, writes go to compacted file */
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_compact(&db) == BP_OK);
+  assert(file_size(__db_file) * 3 < full_bytes);
+  check_values(&db, n / 2, 3, 0);
+  fill_values(&db, n, 0);
+  check_values(&db, n, 0, 0);
+  assert(bp_compact(&db) == BP_OK);
+  check_values(&db, n, 0, 0);
+
+  /* compacted without dedup, every value has its own block */
+  assert(bp_compact(&full) == BP_OK);
+  check_values(&full, n, 0, 0);
+  assert(file_size(__db_file) * 3 < file_size(full_file));
+  assert(bp_close(&full) == BP_OK);
+  assert(unlink(full_file) == 0);
+TEST_END("value dedup test", "dedup")
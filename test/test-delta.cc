@@ -0,0 +1,75 @@
+#include "test.h"
+
+static int range_count;
+
+static void count_range(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  range_count++;
+}
+
+TEST_START("delta pages test", "delta")
+  const int n = 5000;
+  const char* full_file = "/tmp/delta-full.bp";
+  bp_db_t full;
+  bp_options_t options;
+  uint64_t before, delta_bytes, full_bytes;
+
+  /* same updates, with full pages and with deltas */
+  assert(bp_close(&db) == BP_OK);
+  unlink(full_file);
+  assert(bp_open(&full, full_file) == BP_OK);
+  bp_options_init(&options);
+  options.delta_chain = 8;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+
+  fill(&full, n, "old");
+  fill(&db, n, "old");
+  check(&db, n, 0, 0);
+
+  before = file_size(full_file);
+  update(&full, n, n, 0);
+  full_bytes = file_size(full_file) - before;
+
+  before = file_size(__db_file);
+  update(&db, n, n, 0);
+  delta_bytes = file_size(__db_file) - before;
+
+  assert(delta_bytes < full_bytes);
+  check(&db, n, n, 0);
+  check(&full, n, n, 0);
+
+  /* removes (and merges of pages) */
+  update(&db, n, 0, n);
+  check(&db, n, n, n);
+
+  range_count = 0;
+  assert(bp_get_ranges(&db, "key 000000", "key 000099", count_range, NULL) ==
+         BP_OK);
+  assert(range_count == 100 - 15);
+
+  /* deltas are readable without delta mode, which writes full pages */
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  check(&db, n, n, n);
+  fill(&db, n, "old");
+  check(&db, n, 0, 0);
+  assert(bp_close(&db) == BP_OK);
+
+  /* consolidation after every delta and compaction */
+  options.delta_chain = 1;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  update(&db, n, n, n / 2);
+  check(&db, n, n, n / 2);
+  assert(bp_compact(&db) == BP_OK);
+  check(&db, n, n, n / 2);
+  fill(&db, n, "old");
+  update(&db, n, n, n);
+  check(&db, n, n, n);
+  assert(bp_close(&db) == BP_OK);
+
+  assert(bp_close(&full) == BP_OK);
+  assert(unlink(full_file) == 0);
+
+  options.delta_chain = 8;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  check(&db, n, n, n);
+TEST_END("delta pages test", "delta")
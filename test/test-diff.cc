@@ -0,0 +1,161 @@
+#include "test.h"
+
+typedef struct {
+  int added;
+  int removed;
+  int changed;
+  char last[100];
+} changes_t;
+
+static int diff_cb(void* arg,
+                   const bp_key_t* key,
+                   const bp_value_t* old_value,
+                   const bp_value_t* new_value) {
+  changes_t* c = (changes_t*) arg;
+
+  /* keys are increasing */
+  assert(strcmp(key->value, c->last) > 0);
+  strcpy(c->last, key->value);
+
+  if (old_value == NULL) {
+    assert(new_value != NULL);
+    c->added++;
+  } else if (new_value == NULL) {
+    c->removed++;
+  } else {
+    assert(strcmp(old_value->value, new_value->value) != 0);
+    c->changed++;
+  }
+  return BP_OK;
+}
+
+static int stop_cb(void* arg,
+                   const bp_key_t* key,
+                   const bp_value_t* old_value,
+                   const bp_value_t* new_value) {
+  return 42;
+}
+
+static void diff(bp_db_t* db,
+                 const bp_head_t* a,
+                 const bp_head_t* b,
+                 changes_t* c) {
+  memset(c, 0, sizeof(*c));
+  assert(bp_diff(db, a, b, diff_cb, c) == BP_OK);
+}
+
+/* compressed blocks read since previous call */
+static uint64_t reads(bp_db_t* db) {
+  static uint64_t last;
+  bp_cache_stats_t stats;
+  uint64_t total, delta;
+
+  assert(bp_cache_stats(db, &stats) == BP_OK);
+  total = stats.hits + stats.misses;
+  delta = total - last;
+  last = total;
+  return delta;
+}
+
+/* 10 changed, 5 removed, 3 added */
+static void modify(bp_db_t* db) {
+  char key[100];
+  int i;
+
+  for (i = 0; i < 10; i++) {
+    sprintf(key, "key %06d", i * 997);
+    assert(bp_sets(db, key, "changed") == BP_OK);
+  }
+  for (i = 0; i < 5; i++) {
+    sprintf(key, "key %06d", i * 991 + 1);
+    assert(bp_removes(db, key) == BP_OK);
+  }
+  for (i = 0; i < 3; i++) {
+    sprintf(key, "new %d", i);
+    assert(bp_sets(db, key, "added") == BP_OK);
+  }
+}
+
+TEST_START("tree diff test", "diff")
+  const int n = 50000;
+  bp_db_t cached, buffered;
+  bp_options_t options;
+  bp_head_t empty, filled, modified, heads[4];
+  changes_t c;
+  uint64_t found;
+
+  assert(bp_close(&db) == BP_OK);
+  bp_options_init(&options);
+  options.cache_size = 16 * 1024 * 1024;
+  assert(bp_open_ex(&cached, __db_file, &options) == BP_OK);
+
+  assert(bp_head(&cached, &empty) == BP_OK);
+  fill(&cached, n, "value", 7919);
+  assert(bp_head(&cached, &filled) == BP_OK);
+  diff(&cached, &empty, &filled, &c);
+  assert(c.added == n && c.removed == 0 && c.changed == 0);
+  diff(&cached, &filled, &empty, &c);
+  assert(c.added == 0 && c.removed == n && c.changed == 0);
+  diff(&cached, &filled, &filled, &c);
+  assert(c.added == 0 && c.removed == 0 && c.changed == 0);
+
+  /* only pages on paths to changed keys are read */
+  modify(&cached);
+  assert(bp_head(&cached, &modified) == BP_OK);
+  reads(&cached);
+  diff(&cached, &filled, &modified, &c);
+  assert(c.added == 3 && c.removed == 5 && c.changed == 10);
+  assert(reads(&cached) < 200);
+  assert(bp_diff(&cached, &filled, &modified, stop_cb, NULL) == 42);
+
+  /* historical heads, newest first */
+  assert(bp_sets(&cached, "last", "one") == BP_OK);
+  assert(bp_heads(&cached, 4, heads, &found) == BP_OK);
+  assert(found == 4);
+  assert(bp_head(&cached, &modified) == BP_OK);
+  assert(heads[0].offset == modified.offset);
+  diff(&cached, &heads[1], &heads[0], &c);
+  assert(c.added == 1 && c.removed == 0 && c.changed == 0);
+  diff(&cached, &heads[3], &heads[1], &c);
+  assert(c.added == 2 && c.removed == 0 && c.changed == 0);
+
+  /* heads further apart than one chunk read by bp_heads */
+  {
+    const int size = 300000;
+    char* big = (char*) malloc(size);
+    uint32_t seed = 1;
+    int i;
+
+    for (i = 0; i < size - 1; i++) {
+      seed = seed * 1103515245 + 12345;
+      big[i] = 'a' + (seed >> 16) % 26;
+    }
+    big[size - 1] = 0;
+    assert(bp_head(&cached, &modified) == BP_OK);
+    assert(bp_sets(&cached, "big", big) == BP_OK);
+    assert(bp_heads(&cached, 2, heads, &found) == BP_OK);
+    assert(found == 2);
+    assert(heads[1].offset == modified.offset);
+    free(big);
+  }
+
+  /* heads of replaced file are gone */
+  assert(bp_compact(&cached) == BP_OK);
+  assert(bp_diff(&cached, &filled, &modified, diff_cb, &c) == BP_ENOTFOUND);
+  assert(bp_close(&cached) == BP_OK);
+
+  /* buffered messages are walked, not skipped */
+  unlink(__db_file);
+  bp_options_init(&options);
+  options.buffer_messages = 64;
+  assert(bp_open_ex(&buffered, __db_file, &options) == BP_OK);
+  fill(&buffered, n, "value", 7919);
+  assert(bp_head(&buffered, &filled) == BP_OK);
+  modify(&buffered);
+  assert(bp_head(&buffered, &modified) == BP_OK);
+  diff(&buffered, &filled, &modified, &c);
+  assert(c.added == 3 && c.removed == 5 && c.changed == 10);
+  assert(bp_close(&buffered) == BP_OK);
+
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("tree diff test", "diff")
@@ -0,0 +1,119 @@
+#include "test.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int found(bp_db_t* db, const char* key, const char* expected) {
+  char* value;
+  int ret;
+
+  ret = bp_gets(db, key, &value);
+  if (ret == BP_ENOTFOUND) return 0;
+  assert(ret == BP_OK);
+
+  assert(strcmp(value, expected) == 0);
+  free(value);
+  return 1;
+}
+
+TEST_START("follower (read-only) mode test", "follower")
+  const int n = 300;
+  bp_options_t options;
+  bp_db_t follower;
+  char key[100];
+  char val[100];
+  struct stat st;
+  struct sockaddr_un addr;
+  off_t size;
+  int i, fd, sock;
+
+  bp_options_init(&options);
+  options.flags = BP_OPEN_RDONLY;
+
+  /* follower may be opened before anything is written */
+  assert(bp_open_ex(&follower, __db_file, &options) == BP_OK);
+  assert(found(&follower, "key 0", "") == 0);
+
+  /* it never writes */
+  assert(bp_sets(&follower, "key", "value") == BP_EREADONLY);
+  assert(bp_removes(&follower, "key") == BP_EREADONLY);
+  assert(bp_compact(&follower) == BP_EREADONLY);
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %d", i);
+    sprintf(val, "value %d", i);
+    assert(bp_sets(&db, key, val) == BP_OK);
+  }
+
+  /* new commits are invisible until refresh */
+  assert(found(&follower, "key 0", "value 0") == 0);
+  assert(bp_refresh(&follower) == BP_OK);
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %d", i);
+    sprintf(val, "value %d", i);
+    assert(found(&follower, key, val) == 1);
+  }
+
+  /* refresh without changes is no-op */
+  assert(bp_refresh(&follower) == BP_OK);
+  assert(found(&follower, "key 1", "value 1") == 1);
+
+  /* updates and removals */
+  assert(bp_sets(&db, "key 1", "updated") == BP_OK);
+  assert(bp_removes(&db, "key 2") == BP_OK);
+  assert(bp_refresh(&follower) == BP_OK);
+  assert(found(&follower, "key 1", "updated") == 1);
+  assert(found(&follower, "key 2", "value 2") == 0);
+
+  /* compaction replaces file, follower should reopen it */
+  assert(bp_compact(&db) == BP_OK);
+  assert(bp_sets(&db, "after compact", "yes") == BP_OK);
+  assert(bp_refresh(&follower) == BP_OK);
+  assert(found(&follower, "after compact", "yes") == 1);
+  assert(found(&follower, "key 1", "updated") == 1);
+  assert(found(&follower, "key 3", "value 3") == 1);
+
+  /* garbage tail is skipped, and left as is */
+  assert(bp_close(&db) == BP_OK);
+  fd = open(__db_file, O_WRONLY | O_APPEND);
+  assert(fd != -1);
+  memset(val, 0xff, sizeof(val));
+  assert(write(fd, val, sizeof(val)) == sizeof(val));
+  assert(close(fd) == 0);
+  assert(stat(__db_file, &st) == 0);
+  size = st.st_size;
+
+  assert(bp_refresh(&follower) == BP_OK);
+  assert(found(&follower, "after compact", "yes") == 1);
+  assert(bp_close(&follower) == BP_OK);
+
+  assert(bp_open_ex(&follower, __db_file, &options) == BP_OK);
+  assert(found(&follower, "key 4", "value 4") == 1);
+  assert(stat(__db_file, &st) == 0);
+  assert(st.st_size == size);
+
+  /* writer pads garbage and continues, follower catches up */
+  assert(bp_open(&db, __db_file) == BP_OK);
+  assert(bp_sets(&db, "after garbage", "yes") == BP_OK);
+  assert(bp_refresh(&follower) == BP_OK);
+  assert(found(&follower, "after garbage", "yes") == 1);
+
+  /* file can't be reopened, follower keeps the old one */
+  assert(link(__db_file, "/tmp/follower.bp.saved") == 0);
+  assert(unlink(__db_file) == 0);
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(sock != -1);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, __db_file);
+  assert(bind(sock, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+  assert(bp_refresh(&follower) == BP_EFILE);
+  assert(found(&follower, "after garbage", "yes") == 1);
+  assert(close(sock) == 0);
+  assert(unlink(__db_file) == 0);
+  assert(rename("/tmp/follower.bp.saved", __db_file) == 0);
+  assert(bp_sets(&db, "after failed reopen", "yes") == BP_OK);
+  assert(bp_refresh(&follower) == BP_OK);
+  assert(found(&follower, "after failed reopen", "yes") == 1);
+
+  assert(bp_close(&follower) == BP_OK);
+TEST_END("follower (read-only) mode test", "follower")
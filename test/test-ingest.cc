@@ -0,0 +1,182 @@
+#include "test.h"
+
+/* file with kvs [from, to) of fill(), written by builder */
+static void build(const char* filename, int from, int to, const char* prefix) {
+  bp_db_t db;
+  bp_key_t k;
+  bp_value_t v;
+  char key[100];
+  char value[100];
+  int i;
+
+  unlink(filename);
+  assert(bp_open(&db, filename) == BP_OK);
+  for (i = from; i < to; i++) {
+    test_key(&k, key, i);
+    test_value(&v, value, prefix, i);
+    assert(bp_build_add(&db, &k, &v) == BP_OK);
+  }
+  assert(bp_build_finish(&db) == BP_OK);
+  assert(bp_close(&db) == BP_OK);
+}
+
+static void count_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  (*(int*) arg)++;
+}
+
+static int count(bp_db_t* db) {
+  int n = 0;
+  assert(bp_get_ranges(db, "key", "key 999999", count_cb, &n) == BP_OK);
+  return n;
+}
+
+TEST_START("sorted build and ingestion test", "ingest")
+  const char* file = "/tmp/ingest-part.bp";
+  bp_db_t part;
+  bp_key_t k;
+  bp_value_t v;
+  uint64_t before;
+  char* value;
+
+  /* builder checks order and needs empty database */
+  unlink(file);
+  assert(bp_open(&part, file) == BP_OK);
+  BP__STOVAL("b", k);
+  BP__STOVAL("value", v);
+  assert(bp_build_add(&part, &k, &v) == BP_OK);
+  assert(bp_build_add(&part, &k, &v) == BP_EUNSORTED);
+  BP__STOVAL("a", k);
+  assert(bp_build_add(&part, &k, &v) == BP_EUNSORTED);
+  BP__STOVAL("c", k);
+  assert(bp_build_add(&part, &k, &v) == BP_OK);
+  assert(bp_build_finish(&part) == BP_OK);
+  assert(bp_gets(&part, "c", &value) == BP_OK);
+  assert(strcmp(value, "value") == 0);
+  free(value);
+  assert(bp_build_add(&part, &k, &v) == BP_EUNSORTED);
+  assert(bp_close(&part) == BP_OK);
+
+  /* writes made while build is open are not overwritten by it */
+  unlink(file);
+  assert(bp_open(&part, file) == BP_OK);
+  BP__STOVAL("b", k);
+  assert(bp_build_add(&part, &k, &v) == BP_OK);
+  assert(bp_sets(&part, "a", "written") == BP_OK);
+  BP__STOVAL("c", k);
+  assert(bp_build_add(&part, &k, &v) == BP_OK);
+  assert(bp_build_finish(&part) == BP_EBUILDCONFLICT);
+  assert(bp_gets(&part, "a", &value) == BP_OK);
+  assert(strcmp(value, "written") == 0);
+  free(value);
+  assert(bp_gets(&part, "b", &value) == BP_ENOTFOUND);
+  assert(bp_close(&part) == BP_OK);
+
+  /* so is compaction, pages of build are left in old file */
+  unlink(file);
+  assert(bp_open(&part, file) == BP_OK);
+  assert(bp_build_add(&part, &k, &v) == BP_OK);
+  assert(bp_compact(&part) == BP_OK);
+  assert(bp_build_finish(&part) == BP_EBUILDCONFLICT);
+  assert(bp_gets(&part, "c", &value) == BP_ENOTFOUND);
+  assert(bp_close(&part) == BP_OK);
+
+  /* many levels of pages */
+  build(file, 10000, 30000, "v0");
+  assert(bp_open(&part, file) == BP_OK);
+  check_kvs(&part, 10000, 30000, "v0", 0, 0);
+  assert(count(&part) == 20000);
+  assert(bp_close(&part) == BP_OK);
+
+  /* empty database takes whole file */
+  before = file_size(__db_file);
+  assert(bp_ingest(&db, file) == BP_OK);
+  assert(file_size(__db_file) - before < file_size(file) * 2);
+  check_kvs(&db, 10000, 30000, "v0", 0, 0);
+
+  /* after and before all keys: pages are attached to root */
+  build(file, 30000, 35000, "v1");
+  before = file_size(__db_file);
+  assert(bp_ingest(&db, file) == BP_OK);
+  assert(file_size(__db_file) - before < file_size(file) * 2);
+  build(file, 0, 10000, "v2");
+  assert(bp_ingest(&db, file) == BP_OK);
+  check_kvs(&db, 0, 10000, "v2", 0, 0);
+  check_kvs(&db, 10000, 30000, "v0", 0, 0);
+  check_kvs(&db, 30000, 35000, "v1", 0, 0);
+  assert(count(&db) == 35000);
+
+  /* overlapping keys replace existing ones */
+  build(file, 20000, 40000, "v3");
+  assert(bp_ingest(&db, file) == BP_OK);
+  check_kvs(&db, 0, 10000, "v2", 0, 0);
+  check_kvs(&db, 10000, 20000, "v0", 0, 0);
+  check_kvs(&db, 20000, 40000, "v3", 0, 0);
+  assert(count(&db) == 40000);
+
+  /* failed merge leaves tree as it was, even after next write */
+  {
+    char junk[4096];
+    int fd;
+
+    build(file, 20000, 40000, "v5");
+    memset(junk, 0xff, sizeof(junk));
+    fd = open(file, O_WRONLY);
+    assert(fd != -1);
+    assert(pwrite(fd, junk, sizeof(junk), file_size(file) / 2) ==
+           (ssize_t) sizeof(junk));
+    assert(close(fd) == 0);
+
+    assert(bp_ingest(&db, file) != BP_OK);
+    check_kvs(&db, 20000, 40000, "v3", 0, 0);
+    assert(bp_sets(&db, "key 000000", "v2 000000") == BP_OK);
+    assert(bp_close(&db) == BP_OK);
+    assert(bp_open(&db, __db_file) == BP_OK);
+    check_kvs(&db, 20000, 40000, "v3", 0, 0);
+    assert(count(&db) == 40000);
+  }
+
+  /* removals in buffers of source hide its kvs, not those of tree */
+  {
+    bp_options_t options;
+    int i;
+
+    unlink(file);
+    bp_options_init(&options);
+    options.buffer_messages = 16;
+    assert(bp_open_ex(&part, file, &options) == BP_OK);
+    fill(&part, 2000, "v4");
+    update(&part, 2000, 0, 2000);
+    assert(bp_close(&part) == BP_OK);
+
+    assert(bp_ingest(&db, file) == BP_OK);
+    for (i = 0; i < 2000; i++) {
+      check_kvs(&db, i, i + 1, i % 7 == 0 ? "v2" : "v4", 0, 0);
+    }
+    assert(count(&db) == 40000);
+  }
+
+  /* empty file changes nothing */
+  unlink(file);
+  assert(bp_open(&part, file) == BP_OK);
+  assert(bp_build_finish(&part) == BP_OK);
+  assert(bp_close(&part) == BP_OK);
+  assert(bp_ingest(&db, file) == BP_OK);
+  assert(count(&db) == 40000);
+
+  /* tree is a regular one after reopen and compaction */
+  BP__STOVAL("key 000000", k);
+  assert(bp_build_add(&db, &k, &v) == BP_EUNSORTED);
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  check_kvs(&db, 2000, 10000, "v2", 0, 0);
+  check_kvs(&db, 10000, 20000, "v0", 0, 0);
+  check_kvs(&db, 20000, 40000, "v3", 0, 0);
+  assert(bp_removes(&db, "key 000100") == BP_OK);
+  assert(bp_sets(&db, "key 050000", "value") == BP_OK);
+  assert(bp_compact(&db) == BP_OK);
+  check_kvs(&db, 20000, 40000, "v3", 0, 0);
+  assert(bp_gets(&db, "key 000100", &value) == BP_ENOTFOUND);
+  assert(count(&db) == 40000);
+
+  assert(unlink(file) == 0);
+TEST_END("sorted build and ingestion test", "ingest")
@@ -0,0 +1,52 @@
+#include "test.h"
+
+#include <time.h>
+
+/* run bp_inspect on database file, return its exit status */
+static int inspect(const char* flags, const char* file, uint64_t* keys) {
+  char cmd[256];
+  char line[256];
+  double count = -1;
+  FILE* out;
+  int status;
+
+  snprintf(cmd, sizeof(cmd), "./bp_inspect %s %s 2>&1", flags, file);
+  out = popen(cmd, "r");
+  assert(out != NULL);
+  while (fgets(line, sizeof(line), out) != NULL) {
+    sscanf(line, "keys            : %lf", &count);
+  }
+  status = pclose(out);
+
+  *keys = (uint64_t) count;
+  return status;
+}
+
+TEST_START("inspect tool test", "inspect")
+  const int n = 5000;
+  uint64_t now = (uint64_t) time(NULL);
+  uint64_t keys;
+  char key[100];
+  int i;
+
+  /* every head has expire bits in high half of its config */
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %05d", i);
+    assert(bp_sets_expire(&db, key, "expiring", now + 3600) == BP_OK);
+  }
+  assert(inspect("-s", __db_file, &keys) == 0);
+  assert(keys == (uint64_t) n);
+  assert(inspect("", __db_file, &keys) == 0);
+  assert(keys == (uint64_t) n);
+
+  for (i = 0; i < n; i += 2) {
+    sprintf(key, "key %05d", i);
+    assert(bp_sets(&db, key, "value") == BP_OK);
+  }
+  for (i = n; i < 2 * n; i++) {
+    sprintf(key, "key %05d", i);
+    assert(bp_sets(&db, key, "value") == BP_OK);
+  }
+  assert(inspect("", __db_file, &keys) == 0);
+  assert(keys == (uint64_t) 2 * n);
+TEST_END("inspect tool test", "inspect")
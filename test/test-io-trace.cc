@@ -0,0 +1,108 @@
+#include "test.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+
+#include "private/trace.h"
+#include "private/utils.h"
+
+static int toggling;
+
+/* restart and stop trace while compaction writes to it */
+static void* toggle_trace(void* arg) {
+  bp_db_t* db = (bp_db_t*) arg;
+
+  while (__sync_fetch_and_add(&toggling, 0)) {
+    assert(bp_io_trace_start(db, "/tmp/io-trace.bp.trace") == BP_OK);
+    assert(bp_io_trace_stop(db) == BP_OK);
+  }
+
+  return NULL;
+}
+
+TEST_START("I/O trace test", "io-trace")
+  const int n = 500;
+  const char* trace_file = "/tmp/io-trace.bp.trace";
+  char key[100];
+  int i;
+
+  assert(bp_io_trace_start(&db, trace_file) == BP_OK);
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %d", i);
+    assert(bp_sets(&db, key, key) == BP_OK);
+  }
+  for (i = 0; i < n; i++) {
+    char* value;
+    sprintf(key, "key %d", i);
+    assert(bp_gets(&db, key, &value) == BP_OK);
+    free(value);
+  }
+  assert(bp_compact(&db) == BP_OK);
+
+  assert(bp_io_trace_stop(&db) == BP_OK);
+
+  /* parse trace */
+  FILE* f = fopen(trace_file, "rb");
+  assert(f != NULL);
+
+  char magic[BP__TRACE_MAGIC_SIZE];
+  assert(fread(magic, 1, sizeof(magic), f) == sizeof(magic));
+  assert(memcmp(magic, BP__TRACE_MAGIC, sizeof(magic)) == 0);
+
+  unsigned char rec[BP__TRACE_RECORD_SIZE];
+  int value_writes = 0;
+  int value_reads = 0;
+  int compact_writes = 0;
+  int reopens = 0;
+  uint64_t last_time = 0;
+
+  while (fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+    uint64_t time = ntohll(*(uint64_t*) rec);
+    uint32_t size = ntohl(*(uint32_t*) (rec + 16));
+    uint32_t raw_size = ntohl(*(uint32_t*) (rec + 20));
+
+    assert(time >= last_time);
+    last_time = time;
+
+    if (rec[24] == kTraceReopen) {
+      reopens++;
+      continue;
+    }
+
+    assert(size > 0);
+    assert(raw_size > 0);
+
+    if (rec[25] != kValueBlock) continue;
+    if (rec[24] == kTraceWrite && rec[26] == kTraceOpSet) value_writes++;
+    if (rec[24] == kTraceRead && rec[26] == kTraceOpGet) value_reads++;
+    if (rec[24] == kTraceWrite && rec[26] == kTraceOpCompact) {
+      /* compacted values are written to compaction target */
+      assert(rec[27] == 1);
+      compact_writes++;
+    }
+  }
+  fclose(f);
+
+  assert(value_writes == n);
+  assert(value_reads == n);
+  assert(compact_writes == n);
+  assert(reopens == 1);
+
+  assert(unlink(trace_file) == 0);
+
+  /* start and stop wait for compaction */
+  pthread_t toggler;
+  for (i = 0; i < 20 * n; i++) {
+    sprintf(key, "key %d", i);
+    assert(bp_sets(&db, key, key) == BP_OK);
+  }
+  assert(bp_io_trace_start(&db, trace_file) == BP_OK);
+  toggling = 1;
+  assert(pthread_create(&toggler, NULL, toggle_trace, &db) == 0);
+  for (i = 0; i < 3; i++) assert(bp_compact(&db) == BP_OK);
+  __sync_lock_release(&toggling);
+  assert(pthread_join(toggler, NULL) == 0);
+  assert(bp_io_trace_stop(&db) == BP_OK);
+
+  assert(unlink(trace_file) == 0);
+TEST_END("I/O trace test", "io-trace")
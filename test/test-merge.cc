@@ -0,0 +1,131 @@
+#include "test.h"
+
+static const char* file_a = "/tmp/merge-a.bp";
+static const char* file_b = "/tmp/merge-b.bp";
+
+/*
+ * a: even keys, every 10th is removed, b: multiples of 3. With buffered
+ * messages and overflow keys in a.
+ */
+static void fill(const int n) {
+  bp_db_t a, b;
+  bp_options_t options;
+  char key[100];
+  char value[100];
+  int i, k;
+
+  unlink(file_a);
+  unlink(file_b);
+
+  bp_options_init(&options);
+  options.buffer_messages = 64;
+  options.inline_key_limit = 8;
+  assert(bp_open_ex(&a, file_a, &options) == BP_OK);
+  assert(bp_open(&b, file_b) == BP_OK);
+  for (i = 0; i < n; i++) {
+    k = (int) ((i * 7919L) % n);
+    sprintf(key, "key %06d", k);
+    if (k % 2 == 0) {
+      sprintf(value, "a %d", k);
+      assert(bp_sets(&a, key, value) == BP_OK);
+    }
+    if (k % 3 == 0) {
+      sprintf(value, "b %d", k);
+      assert(bp_sets(&b, key, value) == BP_OK);
+    }
+  }
+  for (i = 0; i < n; i += 10) {
+    sprintf(key, "key %06d", i);
+    assert(bp_removes(&a, key) == BP_OK);
+  }
+
+  /* expired kv is skipped */
+  assert(bp_sets_expire(&a, "key 999999", "expired", 1) == BP_OK);
+  assert(bp_close(&a) == BP_OK);
+  assert(bp_close(&b) == BP_OK);
+}
+
+static void check(bp_db_t* db, const int n, const int prefer_b) {
+  char key[100];
+  char expected[100];
+  char* value;
+  int i, ret;
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %06d", i);
+    if (i % 3 == 0 && (prefer_b || i % 2 != 0 || i % 10 == 0)) {
+      sprintf(expected, "b %d", i);
+    } else if (i % 2 == 0 && i % 10 != 0) {
+      sprintf(expected, "a %d", i);
+    } else {
+      assert(bp_gets(db, key, &value) == BP_ENOTFOUND);
+      continue;
+    }
+
+    ret = bp_gets(db, key, &value);
+    assert(ret == BP_OK);
+    assert(strcmp(value, expected) == 0);
+    free(value);
+  }
+  assert(bp_gets(db, "key 999999", &value) == BP_ENOTFOUND);
+  assert(bp_verify(db, 0, NULL) == BP_OK);
+}
+
+static void count_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  (*(int*) arg)++;
+}
+
+static int count(bp_db_t* db) {
+  int n = 0;
+  assert(bp_get_ranges(db, "key", "key 999999", count_cb, &n) == BP_OK);
+  return n;
+}
+
+TEST_START("merge files test", "merge")
+  const int n = 30000;
+  uint64_t before;
+  int expected, i;
+
+  fill(n);
+  expected = 0;
+  for (i = 0; i < n; i++) {
+    if ((i % 2 == 0 && i % 10 != 0) || i % 3 == 0) expected++;
+  }
+
+  assert(bp_merge_files(file_a, file_b, &db, BP_MERGE_PREFER_A) == BP_OK);
+  check(&db, n, 0);
+  assert(count(&db) == expected);
+
+  /* only empty database can be filled */
+  assert(bp_merge_files(file_a, file_b, &db, BP_MERGE_PREFER_A) ==
+         BP_EUNSORTED);
+
+  assert(bp_close(&db) == BP_OK);
+  unlink(__db_file);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  before = file_size(__db_file);
+  assert(bp_merge_files(file_a, file_b, &db, BP_MERGE_FAIL) ==
+         BP_EMERGECONFLICT);
+  assert(file_size(__db_file) == before);
+  assert(count(&db) == 0);
+  assert(bp_merge_files(file_a, file_b, &db, BP_MERGE_PREFER_B) == BP_OK);
+  check(&db, n, 1);
+
+  /* survives reopen, and is writable as usual */
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  check(&db, n, 1);
+  assert(bp_sets(&db, "key 000001", "new") == BP_OK);
+  assert(count(&db) == expected + 1);
+
+  /* with itself, and with missing file */
+  assert(bp_close(&db) == BP_OK);
+  unlink(__db_file);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  assert(bp_merge_files(file_b, file_b, &db, BP_MERGE_PREFER_A) == BP_OK);
+  assert(count(&db) == (n + 2) / 3);
+  assert(bp_merge_files(file_a, "/tmp/merge-missing.bp", &db, 0) != BP_OK);
+
+  unlink(file_a);
+  unlink(file_b);
+TEST_END("merge files test", "merge")
@@ -0,0 +1,91 @@
+#include "test.h"
+#include <arpa/inet.h>
+
+#include "private/trace.h"
+#include "private/utils.h"
+
+static void range_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+}
+
+static uint64_t read_u64(FILE* f) {
+  uint64_t value;
+  assert(fread(&value, 1, sizeof(value), f) == sizeof(value));
+  return ntohll(value);
+}
+
+TEST_START("operation trace test", "op-trace")
+  const char* trace_file = "/tmp/op-trace.bp.trace";
+  const char* bulk_keys[] = { "bulk 1", "bulk 2", "bulk 3" };
+  char* value;
+
+  assert(bp_op_trace_start(&db, trace_file, BP_TRACE_VALUES) == BP_OK);
+
+  assert(bp_sets(&db, "key", "value") == BP_OK);
+  assert(bp_gets(&db, "key", &value) == BP_OK);
+  free(value);
+  assert(bp_bulk_sets(&db, 3, bulk_keys, bulk_keys) == BP_OK);
+  assert(bp_get_ranges(&db, "a", "z", range_cb, NULL) == BP_OK);
+  assert(bp_removes(&db, "key") == BP_OK);
+  assert(bp_compact(&db) == BP_OK);
+
+  assert(bp_op_trace_stop(&db) == BP_OK);
+
+  /* not recorded */
+  assert(bp_sets(&db, "key", "value") == BP_OK);
+
+  FILE* f = fopen(trace_file, "rb");
+  assert(f != NULL);
+
+  char magic[BP__TRACE_MAGIC_SIZE];
+  assert(fread(magic, 1, sizeof(magic), f) == sizeof(magic));
+  assert(memcmp(magic, BP__OPTRACE_MAGIC, sizeof(magic)) == 0);
+
+  const int expected_ops[] = {
+    kTraceOpSet, kTraceOpGet, kTraceOpBulk,
+    kTraceOpRange, kTraceOpRemove, kTraceOpCompact
+  };
+  const int expected_counts[] = { 1, 1, 3, 1, 1, 0 };
+
+  unsigned char header[BP__OPTRACE_HEADER_SIZE];
+  int n = 0;
+  while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+    uint64_t count = ntohll(*(uint64_t*) (header + 16));
+
+    assert(n < 6);
+    assert(header[8] == expected_ops[n]);
+    assert(count == (uint64_t) expected_counts[n]);
+
+    for (uint64_t i = 0; i < count; i++) {
+      char key[100];
+      char val[100];
+      uint64_t klen = read_u64(f);
+      assert(klen < sizeof(key));
+      assert(fread(key, 1, klen, f) == klen);
+
+      uint64_t vlen = read_u64(f);
+      if (header[9] & BP__OPTRACE_VALUES) {
+        assert(vlen < sizeof(val));
+        assert(fread(val, 1, vlen, f) == vlen);
+      }
+
+      if (header[8] == kTraceOpSet) {
+        assert(strcmp(key, "key") == 0);
+        assert(strcmp(val, "value") == 0);
+      } else if (header[8] == kTraceOpBulk) {
+        assert(strcmp(key, bulk_keys[i]) == 0);
+        assert(strcmp(val, bulk_keys[i]) == 0);
+      } else if (header[8] == kTraceOpRange) {
+        assert(strcmp(key, "a") == 0);
+        assert(strcmp(val, "z") == 0);
+      } else {
+        assert(strcmp(key, "key") == 0);
+        assert(vlen == 0);
+      }
+    }
+    n++;
+  }
+  fclose(f);
+  assert(n == 6);
+
+  assert(unlink(trace_file) == 0);
+TEST_END("operation trace test", "op-trace")
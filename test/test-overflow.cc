@@ -0,0 +1,95 @@
+#include "test.h"
+
+/* written in scattered order, so that separators have overflow keys too */
+#define SCATTER 7919
+
+/* every fourth key is short and stays inline, others are up to 3000 bytes */
+static void make_key(bp_key_t* key, char* buff, int i) {
+  int length = i % 4 == 0 ? 11 : 1000 + (i % 5) * 500;
+
+  memset(buff, 'x', length);
+  sprintf(buff, "key %06d", i);
+  buff[10] = i % 4 == 0 ? 0 : '_';
+  key->value = buff;
+  key->length = length;
+}
+
+static int range_count;
+
+static void count_range(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  /* callbacks get full keys */
+  assert(key->length == 11 || key->length >= 1000);
+  assert(key->length == 11 || ((const char*) key->value)[key->length - 1] == 'x');
+  range_count++;
+}
+
+static void check_range(bp_db_t* db, int expected) {
+  char start[3000];
+  char end[3000];
+  bp_key_t key_start, key_end;
+
+  make_key(&key_start, start, 0);
+  make_key(&key_end, end, 99);
+  range_count = 0;
+  assert(bp_get_range(db, &key_start, &key_end, count_range, NULL) == BP_OK);
+  assert(range_count == expected);
+}
+
+TEST_START("overflow keys test", "overflow")
+  const int n = 2000;
+  const char* inline_file = "/tmp/overflow-inline.bp";
+  bp_db_t full;
+  bp_options_t options;
+  uint64_t inline_bytes, overflow_bytes;
+
+  /* same keys, inline and in their own blocks */
+  assert(bp_close(&db) == BP_OK);
+  unlink(inline_file);
+  assert(bp_open(&full, inline_file) == BP_OK);
+  bp_options_init(&options);
+  options.inline_key_limit = 256;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+
+  fill(&full, n, "old", SCATTER, make_key);
+  fill(&db, n, "old", SCATTER, make_key);
+  inline_bytes = file_size(inline_file);
+  overflow_bytes = file_size(__db_file);
+  assert(overflow_bytes < inline_bytes);
+  check(&db, n, 0, 0, make_key);
+  check_range(&db, 100);
+
+  update(&db, n, n, n, SCATTER, make_key);
+  check(&db, n, n, n, make_key);
+  check_range(&db, 100 - 15);
+
+  assert(bp_close(&full) == BP_OK);
+  assert(unlink(inline_file) == 0);
+
+  /* overflow keys are readable and writable without the option */
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  check(&db, n, n, n, make_key);
+  fill(&db, n, "old", SCATTER, make_key);
+  check(&db, n, 0, 0, make_key);
+  update(&db, n, n, n / 2, SCATTER, make_key);
+  check(&db, n, n, n / 2, make_key);
+
+  /* compaction keeps keys out of line */
+  assert(bp_compact(&db) == BP_OK);
+  check(&db, n, n, n / 2, make_key);
+  check_range(&db, 100 - 15);
+  assert(bp_close(&db) == BP_OK);
+
+  /* combined with buffered messages and delta pages */
+  options.buffer_messages = 16;
+  options.delta_chain = 4;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  fill(&db, n, "old", SCATTER, make_key);
+  update(&db, n, n, n, SCATTER, make_key);
+  check(&db, n, n, n, make_key);
+  check_range(&db, 100 - 15);
+  assert(bp_close(&db) == BP_OK);
+
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  check(&db, n, n, n, make_key);
+TEST_END("overflow keys test", "overflow")
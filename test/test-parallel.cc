@@ -0,0 +1,122 @@
+#include "test.h"
+
+#define RUNS 7
+
+static void make_kv(char* key, char* value, int i) {
+  sprintf(key, "key %06d", i);
+  sprintf(value, "value %d", i);
+}
+
+static void count_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  (*(int*) arg)++;
+}
+
+static int count(bp_db_t* db) {
+  int n = 0;
+  assert(bp_get_ranges(db, "key", "key 999999", count_cb, &n) == BP_OK);
+  return n;
+}
+
+TEST_START("parallel bulk load test", "parallel")
+  /* empty runs, tiny ones and ones of several levels */
+  const uint64_t sizes[RUNS] = { 0, 1, 5000, 0, 63 * 63 + 1, 20000, 7 };
+  bp_key_t* keys[RUNS];
+  bp_value_t* values[RUNS];
+  uint64_t counts[RUNS];
+  bp_key_t unsorted[2];
+  bp_value_t unsorted_values[2];
+  const bp_key_t* runs[2];
+  const bp_value_t* run_values[2];
+  uint64_t run_counts[2];
+  bp_verify_stats_t stats;
+  char key[100];
+  char expected[100];
+  char* value;
+  uint64_t r, j;
+  int i, total;
+
+  total = 0;
+  for (r = 0; r < RUNS; r++) {
+    counts[r] = sizes[r];
+    keys[r] = (bp_key_t*) calloc(sizes[r] + 1, sizeof(bp_key_t));
+    values[r] = (bp_value_t*) calloc(sizes[r] + 1, sizeof(bp_value_t));
+    for (j = 0; j < sizes[r]; j++) {
+      make_kv(key, expected, total++);
+      value = strdup(key);
+      BP__STOVAL(value, keys[r][j]);
+      value = strdup(expected);
+      BP__STOVAL(value, values[r][j]);
+    }
+  }
+
+  /* runs overlap */
+  counts[0] = 1;
+  keys[0][0] = keys[2][0];
+  values[0][0] = values[2][0];
+  assert(bp_build_parallel(&db,
+                           RUNS,
+                           counts,
+                           (const bp_key_t**) keys,
+                           (const bp_value_t**) values,
+                           4) == BP_EUNSORTED);
+  counts[0] = 0;
+
+  /* keys inside a run aren't sorted, nothing becomes visible */
+  unsorted[0] = keys[2][1];
+  unsorted[1] = keys[2][0];
+  unsorted_values[0] = values[2][1];
+  unsorted_values[1] = values[2][0];
+  runs[0] = unsorted;
+  runs[1] = keys[2];
+  run_values[0] = unsorted_values;
+  run_values[1] = values[2];
+  run_counts[0] = 2;
+  run_counts[1] = 0;
+  assert(bp_build_parallel(&db, 2, run_counts, runs, run_values, 2) ==
+         BP_EUNSORTED);
+  assert(count(&db) == 0);
+
+  /* nothing to build */
+  assert(bp_build_parallel(&db, 1, counts, NULL, NULL, 4) == BP_OK);
+  assert(count(&db) == 0);
+
+  assert(bp_build_parallel(&db,
+                           RUNS,
+                           counts,
+                           (const bp_key_t**) keys,
+                           (const bp_value_t**) values,
+                           4) == BP_OK);
+  assert(bp_build_parallel(&db,
+                           RUNS,
+                           counts,
+                           (const bp_key_t**) keys,
+                           (const bp_value_t**) values,
+                           4) == BP_EUNSORTED);
+
+  for (i = 0; i < total; i++) {
+    make_kv(key, expected, i);
+    assert(bp_gets(&db, key, &value) == BP_OK);
+    assert(strcmp(value, expected) == 0);
+    free(value);
+  }
+  assert(count(&db) == total);
+  assert(bp_verify(&db, 0, &stats) == BP_OK);
+  assert(stats.values == (uint64_t) total);
+
+  /* tree is writable as usual, and survives reopen */
+  assert(bp_sets(&db, "key 999998", "last") == BP_OK);
+  assert(bp_removes(&db, "key 000000") == BP_OK);
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  assert(count(&db) == total);
+  assert(bp_verify(&db, 0, NULL) == BP_OK);
+
+  for (r = 0; r < RUNS; r++) {
+    for (j = 0; j < sizes[r]; j++) {
+      free(keys[r][j].value);
+      free(values[r][j].value);
+    }
+    free(keys[r]);
+    free(values[r]);
+  }
+TEST_END("parallel bulk load test", "parallel")
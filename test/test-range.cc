@@ -44,6 +44,20 @@ TEST_START("range get test", "range")
 
   matched = 0;
 
+  /* end between two keys, the one after it is not included */
+  bp_get_ranges(&db, "key: \x05", "key: \x1f!", range_cb, &matched);
+
+  assert(matched == (0x1f - 0x05 + 1));
+
+  matched = 0;
+
+  /* start and end between the same two keys */
+  bp_get_ranges(&db, "key: \x05!", "key: \x05~", range_cb, &matched);
+
+  assert(matched == 0);
+
+  matched = 0;
+
   /* try getting all key-values */
   bp_get_ranges(&db, "key: \x01", "key: \xfa", range_cb, &matched);
 
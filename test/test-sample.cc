@@ -0,0 +1,191 @@
+#include "test.h"
+
+#define RANGES 8
+#define BUCKETS 10
+
+typedef struct {
+  const bp_key_t* points;
+  uint64_t point_count;
+  int counts[RANGES];
+} ranges_t;
+
+static void range_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  ranges_t* r = (ranges_t*) arg;
+  uint64_t i;
+
+  for (i = 0; i < r->point_count; i++) {
+    if (bp__default_compare_cb(key, &r->points[i]) < 0) break;
+  }
+  r->counts[i]++;
+}
+
+static int sample_cb_calls;
+static int sample_counts[BUCKETS];
+static int sample_odd;
+static int sample_small;
+static int sample_n;
+
+static void sample_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  char buff[100];
+  int i;
+
+  assert(value == NULL);
+  assert(key->length < sizeof(buff));
+  memcpy(buff, key->value, key->length);
+  buff[key->length] = 0;
+  assert(sscanf(buff, "key %d", &i) == 1);
+
+  sample_counts[i * BUCKETS / sample_n]++;
+  if (i % 2 == 1) sample_odd++;
+  if (i < 2000) sample_small++;
+  sample_cb_calls++;
+}
+
+static void check_split(bp_db_t* db, int n) {
+  bp_key_t points[RANGES - 1];
+  uint64_t count, i;
+  ranges_t r;
+
+  assert(bp_split_points(db, RANGES, points, &count) == BP_OK);
+  assert(count == RANGES - 1);
+  for (i = 1; i < count; i++) {
+    assert(bp__default_compare_cb(&points[i - 1], &points[i]) < 0);
+  }
+
+  /* every range holds about 1/8 of keys */
+  memset(&r, 0, sizeof(r));
+  r.points = points;
+  r.point_count = count;
+  assert(bp_get_ranges(db, "key", "key 999999", range_cb, &r) == BP_OK);
+  for (i = 0; i < RANGES; i++) {
+    assert(r.counts[i] > n / RANGES / 2);
+    assert(r.counts[i] < n / RANGES * 3 / 2);
+  }
+
+  for (i = 0; i < count; i++) free(points[i].value);
+}
+
+TEST_START("split points and sampling test", "sample")
+  const int n = 50000;
+  bp_key_t points[RANGES - 1];
+  bp_db_t buffered;
+  bp_options_t options;
+  char key[100];
+  char value[100];
+  uint64_t count;
+  int i, first[4];
+
+  /* empty tree */
+  assert(bp_split_points(&db, RANGES, points, &count) == BP_OK);
+  assert(count == 0);
+  assert(bp_sample(&db, 10, 0, sample_cb, NULL) == BP_ENOTFOUND);
+
+  /* kvs of leaf head are points themselves */
+  for (i = 0; i < 16; i++) {
+    sprintf(key, "key %06d", i);
+    assert(bp_sets(&db, key, "value") == BP_OK);
+  }
+  assert(bp_split_points(&db, 4, points, &count) == BP_OK);
+  assert(count == 3);
+  assert(strcmp(points[0].value, "key 000004") == 0);
+  assert(strcmp(points[2].value, "key 000012") == 0);
+  for (i = 0; i < 3; i++) free(points[i].value);
+  assert(bp_split_points(&db, 1, points, &count) == BP_OK);
+  assert(count == 0);
+
+  for (i = 16; i < n; i++) {
+    sprintf(key, "key %06d", (int) ((i * 7919L) % (n - 16)) + 16);
+    sprintf(value, "value %d", i);
+    assert(bp_sets(&db, key, value) == BP_OK);
+  }
+  check_split(&db, n);
+
+  /* uniform over keys, repeatable with the same seed */
+  sample_n = n;
+  assert(bp_sample(&db, 20000, 42, sample_cb, NULL) == BP_OK);
+  assert(sample_cb_calls == 20000);
+  for (i = 0; i < BUCKETS; i++) {
+    assert(sample_counts[i] > 20000 / BUCKETS * 3 / 4);
+    assert(sample_counts[i] < 20000 / BUCKETS * 5 / 4);
+  }
+  memcpy(first, sample_counts, sizeof(first));
+  memset(sample_counts, 0, sizeof(sample_counts));
+  assert(bp_sample(&db, 20000, 42, sample_cb, NULL) == BP_OK);
+  assert(memcmp(first, sample_counts, sizeof(first)) == 0);
+
+  /* keys removed by buffered messages are never picked */
+  assert(bp_close(&db) == BP_OK);
+  bp_options_init(&options);
+  options.buffer_messages = 1000;
+  assert(bp_open_ex(&buffered, __db_file, &options) == BP_OK);
+  for (i = 0; i < n; i += 2) {
+    sprintf(key, "key %06d", i);
+    assert(bp_removes(&buffered, key) == BP_OK);
+  }
+  sample_odd = 0;
+  sample_cb_calls = 0;
+  assert(bp_sample(&buffered, 1000, 7, sample_cb, NULL) == BP_OK);
+  assert(sample_odd == 1000);
+  assert(bp_close(&buffered) == BP_OK);
+
+  /* after compaction pages are full */
+  assert(bp_open(&db, __db_file) == BP_OK);
+  assert(bp_compact(&db) == BP_OK);
+  check_split(&db, n / 2);
+
+  /* subtree of small run is shallower than subtree of large one */
+  const uint64_t sizes[2] = { 2000, 200000 };
+  bp_key_t* keys[2];
+  bp_value_t* values[2];
+  bp_db_t uneven;
+  uint64_t r, j;
+
+  i = 0;
+  for (r = 0; r < 2; r++) {
+    keys[r] = (bp_key_t*) calloc(sizes[r], sizeof(bp_key_t));
+    values[r] = (bp_value_t*) calloc(sizes[r], sizeof(bp_value_t));
+    for (j = 0; j < sizes[r]; j++, i++) {
+      sprintf(key, "key %06d", i);
+      keys[r][j].value = strdup(key);
+      keys[r][j].length = strlen(key);
+      values[r][j].value = strdup("value");
+      values[r][j].length = 5;
+    }
+  }
+  sample_n = i;
+
+  unlink("/tmp/sample-uneven.bp");
+  assert(bp_open(&uneven, "/tmp/sample-uneven.bp") == BP_OK);
+  assert(bp_build_parallel(&uneven,
+                           2,
+                           sizes,
+                           (const bp_key_t**) keys,
+                           (const bp_value_t**) values,
+                           2) == BP_OK);
+
+  /* 2000 of 202000 keys, about 200 of 20000 samples */
+  sample_small = 0;
+  sample_cb_calls = 0;
+  memset(sample_counts, 0, sizeof(sample_counts));
+  assert(bp_sample(&uneven, 20000, 3, sample_cb, NULL) == BP_OK);
+  assert(sample_cb_calls == 20000);
+  assert(sample_small > 100 && sample_small < 300);
+  for (i = 0; i < BUCKETS; i++) {
+    assert(sample_counts[i] > 20000 / BUCKETS * 3 / 4);
+    assert(sample_counts[i] < 20000 / BUCKETS * 5 / 4);
+  }
+
+  /* subtrees are weighted by their size, not by size of their root */
+  check_split(&uneven, sample_n);
+  assert(bp_close(&uneven) == BP_OK);
+  unlink("/tmp/sample-uneven.bp");
+
+  for (r = 0; r < 2; r++) {
+    for (j = 0; j < sizes[r]; j++) {
+      free(keys[r][j].value);
+      free(values[r][j].value);
+    }
+    free(keys[r]);
+    free(values[r]);
+  }
+TEST_END("split points and sampling test", "sample")
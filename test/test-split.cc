@@ -0,0 +1,124 @@
+#include "test.h"
+#include <pthread.h>
+
+static const char* file_left = "/tmp/split-left.bp";
+static const char* file_right = "/tmp/split-right.bp";
+
+static int writes;
+static int stop;
+
+/* "w" keys sort after all "key" ones, they go to the right */
+static void* writer(void* db_) {
+  bp_db_t* db = (bp_db_t*) db_;
+  char key[100];
+  int i;
+
+  for (i = 0; !__sync_add_and_fetch(&stop, 0); i++) {
+    sprintf(key, "w %06d", i);
+    assert(bp_sets(db, key, key) == BP_OK);
+    __sync_fetch_and_add(&writes, 1);
+  }
+
+  return NULL;
+}
+
+static void count_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  (*(int*) arg)++;
+}
+
+static int count(bp_db_t* db, const char* start, const char* end) {
+  int n = 0;
+  assert(bp_get_ranges(db, start, end, count_cb, &n) == BP_OK);
+  return n;
+}
+
+/* kvs of fill() and update() with keys in [from, to) are there, no others */
+static void check(const char* file, const int from, const int to) {
+  bp_db_t side;
+
+  assert(bp_open(&side, file) == BP_OK);
+  check_kvs(&side, from, to, "old", 0, to);
+  assert(count(&side, "key", "key 999999") ==
+         (to - from) - ((to + 6) / 7 - (from + 6) / 7));
+  assert(bp_verify(&side, 0, NULL) == BP_OK);
+  assert(bp_close(&side) == BP_OK);
+}
+
+TEST_START("range split test", "split")
+  const int n = 40000;
+  bp_db_t buffered, side;
+  bp_options_t options;
+  bp_key_t split;
+  pthread_t thread;
+  char key[100];
+  char* value;
+  int i, found, acked;
+
+  fill(&db, n, "old", 7919);
+  update(&db, n, 0, n, 7919);
+  BP__STOVAL("key 010000", split);
+
+  unlink(file_left);
+  unlink(file_right);
+  assert(bp_split_file(&db, &split, file_left, file_right) == BP_OK);
+  check(file_left, 0, 10000);
+  check(file_right, 10000, n);
+
+  /* files already hold kvs */
+  assert(bp_split_file(&db, &split, file_left, file_right) == BP_EUNSORTED);
+
+  /* split point outside of keys, one side is empty */
+  unlink(file_left);
+  unlink(file_right);
+  BP__STOVAL("a", split);
+  assert(bp_split_file(&db, &split, file_left, file_right) == BP_OK);
+  check(file_right, 0, n);
+  assert(bp_open(&side, file_left) == BP_OK);
+  assert(count(&side, "key", "key 999999") == 0);
+  assert(bp_close(&side) == BP_OK);
+
+  /* writes during split are caught up, files are a consistent snapshot */
+  unlink(file_left);
+  unlink(file_right);
+  BP__STOVAL("key 020000", split);
+  writes = 0;
+  stop = 0;
+  assert(pthread_create(&thread, NULL, writer, &db) == 0);
+  while (__sync_add_and_fetch(&writes, 0) < 100) usleep(1000);
+  assert(bp_split_file(&db, &split, file_left, file_right) == BP_OK);
+  acked = __sync_add_and_fetch(&writes, 0);
+  __sync_fetch_and_add(&stop, 1);
+  assert(pthread_join(thread, NULL) == 0);
+
+  /* writes never stop, catch up runs out of rounds, all acked are there */
+  check(file_left, 0, 20000);
+  assert(bp_open(&side, file_right) == BP_OK);
+  found = count(&side, "w", "w 999999");
+  assert(found >= acked && found <= writes);
+  for (i = 0; i < writes; i++) {
+    sprintf(key, "w %06d", i);
+    assert(bp_gets(&side, key, &value) == (i < found ? BP_OK : BP_ENOTFOUND));
+    if (i < found) free(value);
+  }
+  assert(bp_close(&side) == BP_OK);
+
+  /* buffered messages above leaves */
+  assert(bp_close(&db) == BP_OK);
+  unlink(__db_file);
+  bp_options_init(&options);
+  options.buffer_messages = 64;
+  assert(bp_open_ex(&buffered, __db_file, &options) == BP_OK);
+  fill(&buffered, n, "old", 7919);
+  update(&buffered, n, 0, n, 7919);
+  unlink(file_left);
+  unlink(file_right);
+  BP__STOVAL("key 030000", split);
+  assert(bp_split_file(&buffered, &split, file_left, file_right) == BP_OK);
+  check(file_left, 0, 30000);
+  check(file_right, 30000, n);
+  assert(bp_close(&buffered) == BP_OK);
+
+  unlink(file_left);
+  unlink(file_right);
+  assert(bp_open(&db, __db_file) == BP_OK);
+TEST_END("range split test", "split")
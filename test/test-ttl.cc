@@ -0,0 +1,156 @@
+#include "test.h"
+
+#include <time.h>
+
+static int count_cb_calls;
+
+static void count_cb(void* arg, const bp_key_t* key, const bp_value_t* value) {
+  assert(strncmp(value->value, "live", 4) == 0);
+  count_cb_calls++;
+}
+
+static int found(bp_db_t* db, const char* key) {
+  char* value;
+  int ret;
+
+  ret = bp_gets(db, key, &value);
+  if (ret == BP_ENOTFOUND) return 0;
+  assert(ret == BP_OK);
+  free(value);
+  return 1;
+}
+
+TEST_START("expiring values test", "ttl")
+  const int n = 2000;
+  uint64_t now = (uint64_t) time(NULL);
+  uint64_t purged;
+  uint64_t total;
+  bp_value_t value;
+  bp_value_t previous;
+  char key[100];
+  struct stat before, after;
+  int i;
+
+  /* interleaved: expired, expiring in future, never expiring */
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %05d", i);
+    if (i % 3 == 0) {
+      assert(bp_sets_expire(&db, key, "dead", now - 1) == BP_OK);
+    } else if (i % 3 == 1) {
+      assert(bp_sets_expire(&db, key, "live", now + 3600) == BP_OK);
+    } else {
+      assert(bp_sets(&db, key, "live") == BP_OK);
+    }
+  }
+
+  /* a run of expired keys to get whole expired subtrees */
+  for (i = 0; i < n; i++) {
+    sprintf(key, "old %05d", i);
+    assert(bp_sets_expire(&db, key, "dead", now - 10) == BP_OK);
+  }
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %05d", i);
+    assert(found(&db, key) == (i % 3 != 0));
+  }
+  assert(found(&db, "old 00000") == 0);
+
+  count_cb_calls = 0;
+  assert(bp_get_ranges(&db, "key", "old 99999", count_cb, NULL) == BP_OK);
+  assert(count_cb_calls == n - (n + 2) / 3);
+
+  /* expired values can't be removed, but can be overwritten */
+  assert(bp_removes(&db, "key 00000") == BP_ENOTFOUND);
+  assert(bp_sets(&db, "key 00000", "live again") == BP_OK);
+  assert(found(&db, "key 00000") == 1);
+
+  value.value = (char*) "live";
+  value.length = 5;
+  assert(bp_gets(&db, "key 00000", &value.value) == BP_OK);
+  assert(strcmp(value.value, "live again") == 0);
+  free(value.value);
+
+  {
+    bp_key_t bkey;
+    BP__STOVAL("key 00000", bkey);
+    assert(bp_get(&db, &bkey, &value) == BP_OK);
+    assert(bp_get_previous(&db, &value, &previous) == BP_ENOTFOUND);
+    free(value.value);
+  }
+
+  /* purge in small batches */
+  total = 0;
+  do {
+    assert(bp_purge_expired(&db, 50, &purged) == BP_OK);
+    assert(purged <= 50);
+    total += purged;
+  } while (purged != 0);
+  assert(total > 0);
+  assert(total < (uint64_t) (n + (n + 2) / 3));
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %05d", i);
+    assert(found(&db, key) == (i == 0 || i % 3 != 0));
+  }
+
+  /* nothing left to purge */
+  assert(bp_purge_expired(&db, 0, &purged) == BP_OK);
+  assert(purged == 0);
+
+  /* compaction drops expired values */
+  for (i = 0; i < n; i++) {
+    sprintf(key, "new %05d", i);
+    assert(bp_sets_expire(&db, key, "dead", now - 1) == BP_OK);
+  }
+  assert(bp_compact(&db) == BP_OK);
+  assert(stat(__db_file, &before) == 0);
+
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %05d", i);
+    assert(found(&db, key) == (i == 0 || i % 3 != 0));
+  }
+  count_cb_calls = 0;
+  assert(bp_get_ranges(&db, "new", "new 99999", count_cb, NULL) == BP_OK);
+  assert(count_cb_calls == 0);
+
+  /* compacting again keeps the same live set */
+  assert(bp_compact(&db) == BP_OK);
+  assert(stat(__db_file, &after) == 0);
+  assert(after.st_size <= before.st_size);
+
+  /* everything expires - database becomes empty, but usable */
+  for (i = 0; i < n; i++) {
+    sprintf(key, "key %05d", i);
+    assert(bp_sets_expire(&db, key, "dead", now - 1) == BP_OK);
+  }
+  assert(bp_purge_expired(&db, 0, &purged) == BP_OK);
+  assert(purged > 0);
+  assert(found(&db, "key 00001") == 0);
+  assert(bp_sets(&db, "key 00001", "live") == BP_OK);
+  assert(found(&db, "key 00001") == 1);
+
+  /* expiration survives reopen */
+  assert(bp_sets_expire(&db, "later", "live", now + 3600) == BP_OK);
+  assert(bp_sets_expire(&db, "earlier", "dead", now - 1) == BP_OK);
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open(&db, __db_file) == BP_OK);
+  assert(found(&db, "later") == 1);
+  assert(found(&db, "earlier") == 0);
+
+  /* length shares kv config with expiration, 4 GB values are rejected */
+  {
+    bp_key_t k;
+    bp_value_t v;
+    const bp_key_t* keys = &k;
+    const bp_value_t* values = &v;
+
+    BP__STOVAL("huge", k);
+    v.value = key;
+    v.length = (uint64_t) 1 << 32;
+    assert(bp_set(&db, &k, &v) == BP_ETOOLARGE);
+    assert(bp_set_expire(&db, &k, &v, now + 3600) == BP_ETOOLARGE);
+    assert(bp_bulk_set(&db, 1, &keys, &values) == BP_ETOOLARGE);
+    assert(found(&db, "huge") == 0);
+    assert(found(&db, "later") == 1);
+  }
+TEST_END("expiring values test", "ttl")
@@ -0,0 +1,92 @@
+#include "test.h"
+
+static int reverse_compare_cb(const bp_key_t* a, const bp_key_t* b) {
+  uint32_t i, len = a->length < b->length ? a->length : b->length;
+
+  for (i = 0; i < len; i++) {
+    if (a->value[i] != b->value[i]) {
+      return (uint8_t) a->value[i] > (uint8_t) b->value[i] ? -1 : 1;
+    }
+  }
+  return a->length == b->length ? 0 : a->length > b->length ? -1 : 1;
+}
+
+/* scrubber's result after it has completed one pass, or failed */
+static int scrub_pass(bp_db_t* db, bp_verify_stats_t* stats) {
+  int ret, i;
+
+  for (i = 0; i < 1000; i++) {
+    ret = bp_scrub_status(db, stats);
+    if (ret != BP_OK || stats->passes != 0) break;
+    usleep(10000);
+  }
+  return ret;
+}
+
+TEST_START("verify and scrub test", "verify")
+  const int n = 20000;
+  const int kept = n - (n + 6) / 7;
+  bp_db_t buffered;
+  bp_options_t options;
+  bp_verify_stats_t stats;
+  char buff[4096];
+  int fd;
+  off_t size;
+
+  /* empty database */
+  assert(bp_verify(&db, 0, &stats) == BP_OK);
+  assert(stats.pages == 0 && stats.passes == 1);
+
+  fill(&db, n, "old", 7919);
+  update(&db, n, 0, n, 7919);
+  assert(bp_verify(&db, 0, &stats) == BP_OK);
+  assert(stats.values == kept);
+  assert(stats.pages > n / 64);
+  assert(bp_verify(&db, 1, NULL) == BP_OK);
+
+  /* keys in wrong order for another compare function */
+  bp_set_compare_cb(&db, reverse_compare_cb);
+  assert(bp_verify(&db, 3, NULL) == BP_ECORRUPT);
+  bp_set_compare_cb(&db, NULL);
+
+  /* buffered messages and overflow keys */
+  assert(bp_close(&db) == BP_OK);
+  bp_options_init(&options);
+  options.buffer_messages = 32;
+  options.inline_key_limit = 8;
+  options.cache_size = 1024 * 1024;
+  assert(bp_open_ex(&buffered, __db_file, &options) == BP_OK);
+  fill(&buffered, n, "old", 7919);
+  update(&buffered, n, 0, n, 7919);
+  assert(bp_verify(&buffered, 8, &stats) == BP_OK);
+  assert(stats.values >= kept);
+
+  /* scrubber runs meanwhile, with and without a limit */
+  assert(bp_scrub_status(&buffered, &stats) == BP_ENOTFOUND);
+  assert(bp_scrub_start(&buffered, 64 * 1024) == BP_OK);
+  usleep(200000);
+  assert(bp_scrub_status(&buffered, &stats) == BP_OK);
+  assert(stats.bytes <= 64 * 1024 / 4 && stats.passes == 0);
+  assert(bp_scrub_start(&buffered, 0) == BP_OK);
+  assert(bp_sets(&buffered, "written", "while scrubbing") == BP_OK);
+  assert(bp_compact(&buffered) == BP_OK);
+  assert(scrub_pass(&buffered, &stats) == BP_OK);
+  assert(stats.passes >= 1);
+  assert(bp_scrub_stop(&buffered, &stats) == BP_OK);
+  assert(bp_scrub_stop(&buffered, NULL) == BP_ENOTFOUND);
+  assert(bp_close(&buffered) == BP_OK);
+
+  /* compacted file holds only live blocks, damage one of them */
+  fd = open(__db_file, O_RDWR);
+  assert(fd != -1);
+  size = lseek(fd, 0, SEEK_END);
+  memset(buff, 0xff, sizeof(buff));
+  assert(pwrite(fd, buff, sizeof(buff), size / 2) == sizeof(buff));
+  assert(close(fd) == 0);
+
+  assert(bp_open(&db, __db_file) == BP_OK);
+  assert(bp_verify(&db, 0, NULL) != BP_OK);
+  assert(bp_scrub_start(&db, 0) == BP_OK);
+  assert(scrub_pass(&db, &stats) != BP_OK);
+  assert(bp_scrub_stop(&db, NULL) != BP_OK);
+TEST_END("verify and scrub test", "verify")
@@ -0,0 +1,95 @@
+#include "test.h"
+
+static void check_some(bp_db_t* db, int n, int step) {
+  int i;
+
+  for (i = 0; i < n; i += step) check_kvs(db, i, i + 1, "old", 0, 0);
+}
+
+TEST_START("cache warmup test", "warmup")
+  const int n = 20000;
+  const char* hot_file = "/tmp/warmup.bp.hot";
+  bp_warmup_t policy;
+  bp_options_t options;
+  bp_cache_stats_t stats;
+  uint64_t interior;
+  uint64_t all;
+  uint64_t loaded;
+  struct stat st;
+
+  unlink(hot_file);
+
+  assert(bp_warmup_wait(&db, &loaded) == BP_ENOTFOUND);
+  fill(&db, n, "old");
+
+  /* interior levels only */
+  bp_warmup_init(&policy);
+  assert(bp_warmup(&db, &policy) == BP_OK);
+  assert(bp_warmup_wait(&db, &interior) == BP_OK);
+  assert(interior > 0);
+
+  /* whole tree */
+  policy.flags = BP_WARMUP_LEAVES;
+  policy.threads = 3;
+  assert(bp_warmup(&db, &policy) == BP_OK);
+  assert(bp_warmup_wait(&db, &all) == BP_OK);
+  assert(all > interior);
+
+  /* budget */
+  policy.budget = all / 2;
+  assert(bp_warmup(&db, &policy) == BP_OK);
+  assert(bp_warmup_wait(&db, &loaded) == BP_OK);
+  assert(loaded > 0 && loaded <= all / 2);
+
+  /* background warmup while writing */
+  policy.flags = BP_WARMUP_LEAVES | BP_WARMUP_BACKGROUND;
+  policy.budget = 0;
+  assert(bp_warmup(&db, &policy) == BP_OK);
+  fill(&db, n / 10, "old");
+  check_some(&db, n, 97);
+  assert(bp_warmup_wait(&db, &loaded) == BP_OK);
+  assert(loaded > 0);
+
+  /* closing stops unfinished warmup */
+  assert(bp_warmup(&db, &policy) == BP_OK);
+  assert(bp_close(&db) == BP_OK);
+
+  /* warmup at open fills block cache */
+  bp_warmup_init(&policy);
+  policy.flags = BP_WARMUP_LEAVES | BP_WARMUP_BACKGROUND;
+  policy.hot_file = hot_file;
+  bp_options_init(&options);
+  options.cache_size = 16 * 1024 * 1024;
+  options.warmup = &policy;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_warmup_wait(&db, &loaded) == BP_OK);
+  assert(loaded > interior);
+
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.inserts > 0);
+  assert(stats.hits == 0);
+  check_some(&db, n, 101);
+  assert(bp_cache_stats(&db, &stats) == BP_OK);
+  assert(stats.hits > 0);
+
+  /* hot pages are saved at close ... */
+  assert(bp_close(&db) == BP_OK);
+  assert(stat(hot_file, &st) == 0);
+  assert(st.st_size > 32);
+
+  /* ... and replayed on next open */
+  policy.flags = 0;
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_warmup_wait(&db, &loaded) == BP_OK);
+  assert(loaded > interior);
+  check_some(&db, n, 101);
+
+  /* file replaced by compaction - hot file is ignored */
+  assert(bp_compact(&db) == BP_OK);
+  assert(bp_close(&db) == BP_OK);
+  assert(bp_open_ex(&db, __db_file, &options) == BP_OK);
+  assert(bp_warmup_wait(&db, &loaded) == BP_OK);
+  check_some(&db, n, 101);
+
+  assert(unlink(hot_file) == 0);
+TEST_END("cache warmup test", "warmup")
@@ -34,6 +34,125 @@
       return 0;\
     }
 
+/*
+ * Shared kvs. Kv i has key "key %06d" (or one made by key_fn) and value
+ * "<prefix> %06d". After fill(db, n, "old"), update() sets every third kv
+ * below `updated` to "new" and removes every seventh below `removed`,
+ * check() expects exactly that. Step coprime with n scatters the writes.
+ */
+typedef void (*test_key_fn)(bp_key_t* key, char* buff, int i);
+
+#define TEST_KEY_SIZE 3000
+
+static inline uint64_t file_size(const char* filename) {
+  struct stat st;
+  assert(stat(filename, &st) == 0);
+  return st.st_size;
+}
+
+static inline void test_key(bp_key_t* key, char* buff, int i) {
+  sprintf(buff, "key %06d", i);
+  key->value = buff;
+  key->length = strlen(buff) + 1;
+}
+
+static inline void test_value(bp_value_t* value,
+                              char* buff,
+                              const char* prefix,
+                              int i) {
+  sprintf(buff, "%s %06d", prefix, i);
+  value->value = buff;
+  value->length = strlen(buff) + 1;
+}
+
+static inline int test_scatter(int i, int n, int step) {
+  return (int) (((long) i * step) % n);
+}
+
+static inline void fill(bp_db_t* db,
+                        int n,
+                        const char* prefix,
+                        int step = 1,
+                        test_key_fn key_fn = test_key) {
+  char kbuff[TEST_KEY_SIZE];
+  char vbuff[100];
+  bp_key_t key;
+  bp_value_t value;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    key_fn(&key, kbuff, test_scatter(i, n, step));
+    test_value(&value, vbuff, prefix, test_scatter(i, n, step));
+    assert(bp_set(db, &key, &value) == BP_OK);
+  }
+}
+
+static inline void update(bp_db_t* db,
+                          int n,
+                          int updated,
+                          int removed,
+                          int step = 1,
+                          test_key_fn key_fn = test_key) {
+  char kbuff[TEST_KEY_SIZE];
+  char vbuff[100];
+  bp_key_t key;
+  bp_value_t value;
+  int i, k;
+
+  for (i = 0; i < n; i++) {
+    k = test_scatter(i, n, step);
+    if (k % 3 != 0 || k >= updated) continue;
+    key_fn(&key, kbuff, k);
+    test_value(&value, vbuff, "new", k);
+    assert(bp_set(db, &key, &value) == BP_OK);
+  }
+  for (i = 0; i < n; i++) {
+    k = test_scatter(i, n, step);
+    if (k % 7 != 0 || k >= removed) continue;
+    key_fn(&key, kbuff, k);
+    assert(bp_remove(db, &key) == BP_OK);
+  }
+}
+
+/* kvs [from, to) of fill(db, to, prefix) and update(db, to, ...) */
+static inline void check_kvs(bp_db_t* db,
+                             int from,
+                             int to,
+                             const char* prefix,
+                             int updated,
+                             int removed,
+                             test_key_fn key_fn = test_key) {
+  char kbuff[TEST_KEY_SIZE];
+  char vbuff[100];
+  bp_key_t key;
+  bp_value_t expected;
+  bp_value_t value;
+  int i;
+
+  for (i = from; i < to; i++) {
+    key_fn(&key, kbuff, i);
+    if (i % 7 == 0 && i < removed) {
+      assert(bp_get(db, &key, &value) == BP_ENOTFOUND);
+      continue;
+    }
+    test_value(&expected,
+               vbuff,
+               i % 3 == 0 && i < updated ? "new" : prefix,
+               i);
+    assert(bp_get(db, &key, &value) == BP_OK);
+    assert(strcmp(value.value, expected.value) == 0);
+    free(value.value);
+  }
+}
+
+static inline void check(bp_db_t* db,
+                         int n,
+                         int updated,
+                         int removed,
+                         test_key_fn key_fn = test_key) {
+  check_kvs(db, 0, n, "old", updated, removed, key_fn);
+}
+
 #define BENCH_START(name, num)\
     timeval __bench_##name##_start;\
     gettimeofday(&__bench_##name##_start, NULL);
@@ -0,0 +1,561 @@
+/*
+ * bp_inspect - read-only database layout analysis.
+ *
+ * Walks a database file starting from its most recent valid head and prints
+ * tree shape, page fill, key/value size distributions, compression ratios,
+ * garbage ratio and on-disk locality of leaves and values.
+ *
+ * The file is opened with O_RDONLY and is never modified, so it is safe to
+ * run against a database that is being written by another process: the walk
+ * is done against a snapshot of the file size taken at startup.
+ */
+#include <stdlib.h> /* malloc, free */
+#include <stdio.h> /* fprintf */
+#include <string.h> /* memset, strcmp */
+#include <fcntl.h> /* open */
+#include <unistd.h> /* pread, close */
+#include <sys/stat.h> /* fstat */
+
+#include "bplus.h"
+#include "private/pages.h"
+#include "private/utils.h"
+
+#define INSPECT_MAX_LEVELS 32
+#define INSPECT_HIST_SIZE 48
+#define INSPECT_SCAN_CHUNK (1024 * 1024)
+
+typedef struct inspect_block_s inspect_block_t;
+typedef struct inspect_ref_s inspect_ref_t;
+typedef struct inspect_s inspect_t;
+
+struct inspect_block_s {
+  uint64_t count;
+  uint64_t raw;
+  uint64_t compressed;
+};
+
+/* value block referenced by a leaf kv */
+struct inspect_ref_s {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct inspect_s {
+  bp_db_t db;
+  int skip_values;
+
+  uint64_t head_offset;
+  uint64_t heads;
+
+  uint64_t height;
+  uint64_t pages_per_level[INSPECT_MAX_LEVELS];
+  uint64_t fill[11];
+
+  inspect_block_t interior;
+  inspect_block_t leaf;
+  inspect_block_t value;
+
+  uint64_t keys;
+  uint64_t key_hist[INSPECT_HIST_SIZE];
+  uint64_t value_hist[INSPECT_HIST_SIZE];
+
+  uint64_t live;
+
+  /* pages stored as delta chains (see bp_options_t.delta_chain) */
+  uint64_t deltas;
+  uint64_t delta_depth;
+
+  /* messages in buffers of interior pages (see bp_options_t.buffer_messages) */
+  uint64_t messages;
+  uint64_t removals;
+
+  /* keys stored in their own blocks (see bp_options_t.inline_key_limit) */
+  uint64_t overflow_keys;
+
+  /* blocks shared by several kvs (see bp_options_t.dedup_slots) */
+  inspect_ref_t* refs;
+  uint64_t ref_count;
+  uint64_t ref_capacity;
+  uint64_t shared_values;
+
+  /* leaf locality (in key order) */
+  uint64_t leaf_prev;
+  uint64_t leaf_jumps;
+  uint64_t leaf_forward;
+  double leaf_distance;
+
+  /* value locality (relative to the leaf referencing them) */
+  double value_distance;
+  double value_span;
+};
+
+
+static uint64_t inspect_padded(uint64_t size) {
+  return (size + BP_PADDING - 1) / BP_PADDING * BP_PADDING;
+}
+
+
+static uint64_t inspect_log2(uint64_t value) {
+  uint64_t r = 0;
+  while (value > 1 && r < INSPECT_HIST_SIZE - 1) {
+    value >>= 1;
+    r++;
+  }
+  return r;
+}
+
+
+static double inspect_distance(uint64_t a, uint64_t b) {
+  return a > b ? (double) (a - b) : (double) (b - a);
+}
+
+
+static int inspect_add_ref(inspect_t* ins, uint64_t offset, uint64_t size) {
+  inspect_ref_t* refs;
+
+  if (ins->ref_count == ins->ref_capacity) {
+    ins->ref_capacity = ins->ref_capacity == 0 ? 1024 : ins->ref_capacity * 2;
+    refs = realloc(ins->refs, ins->ref_capacity * sizeof(*refs));
+    if (refs == NULL) return -1;
+    ins->refs = refs;
+  }
+
+  ins->refs[ins->ref_count].offset = offset;
+  ins->refs[ins->ref_count].size = size;
+  ins->ref_count++;
+  return 0;
+}
+
+
+static int inspect_ref_compare(const void* a, const void* b) {
+  uint64_t ao = ((const inspect_ref_t*) a)->offset;
+  uint64_t bo = ((const inspect_ref_t*) b)->offset;
+  return ao < bo ? -1 : ao > bo ? 1 : 0;
+}
+
+
+/* shared value blocks were counted as live once per kv */
+static void inspect_shared(inspect_t* ins) {
+  uint64_t i;
+
+  qsort(ins->refs, (size_t) ins->ref_count, sizeof(*ins->refs),
+        inspect_ref_compare);
+  for (i = 1; i < ins->ref_count; i++) {
+    if (ins->refs[i].offset != ins->refs[i - 1].offset) continue;
+    ins->shared_values++;
+    ins->live -= inspect_padded(ins->refs[i].size);
+  }
+}
+
+
+/*
+ * Check that 32 bytes at `slot` look like a tree head written by
+ * bp__tree_write_head: hash matches and the root lies before the head.
+ */
+static int inspect_is_head(const char* data,
+                           uint64_t slot,
+                           uint64_t* offset,
+                           uint64_t* config) {
+  const uint64_t* fields = (const uint64_t*) data;
+  uint64_t o = ntohll(fields[0]);
+  uint64_t c = ntohll(fields[1]);
+  uint64_t page_size = ntohll(fields[2]);
+  uint64_t hash = ntohll(fields[3]);
+
+  if (bp__compute_hashl(o) != hash) return 0;
+  if (page_size == 0 || o >= slot ||
+      (BP__KV_LENGTH(c) >> 1) > slot - o) {
+    return 0;
+  }
+
+  *offset = o;
+  *config = c;
+  return 1;
+}
+
+
+static int inspect_find_head(inspect_t* ins) {
+  bp_db_t* db = &ins->db;
+  uint64_t slot = db->filesize - db->filesize % BP__HEAD_SIZE;
+  char data[BP__HEAD_SIZE];
+
+  while (slot >= BP__HEAD_SIZE) {
+    uint64_t offset, config;
+
+    slot -= BP__HEAD_SIZE;
+    if (pread(db->fd, data, BP__HEAD_SIZE, (off_t) slot) != BP__HEAD_SIZE) {
+      return BP_EFILEREAD;
+    }
+    if (!inspect_is_head(data, slot, &offset, &config)) continue;
+
+    db->head.page_size = ntohll(((uint64_t*) data)[2]);
+    if (bp__page_load(db, offset, config, &db->head.page) != BP_OK) continue;
+
+    db->head.offset = offset;
+    db->head.config = config;
+    ins->head_offset = slot;
+    return BP_OK;
+  }
+
+  return BP_ENOTFOUND;
+}
+
+
+/* Count every valid head in the file (historical roots) */
+static int inspect_count_heads(inspect_t* ins) {
+  bp_db_t* db = &ins->db;
+  char* chunk;
+  uint64_t start;
+
+  chunk = malloc(INSPECT_SCAN_CHUNK);
+  if (chunk == NULL) return BP_EALLOC;
+
+  for (start = 0; start < db->filesize; start += INSPECT_SCAN_CHUNK) {
+    uint64_t size = db->filesize - start;
+    uint64_t o;
+
+    if (size > INSPECT_SCAN_CHUNK) size = INSPECT_SCAN_CHUNK;
+    if (pread(db->fd, chunk, (size_t) size, (off_t) start) != (ssize_t) size) {
+      free(chunk);
+      return BP_EFILEREAD;
+    }
+
+    /* heads are always written at padded offsets */
+    for (o = 0; o + BP__HEAD_SIZE <= size; o += BP_PADDING) {
+      uint64_t offset, config;
+      if (inspect_is_head(chunk + o, start + o, &offset, &config)) {
+        ins->heads++;
+      }
+    }
+  }
+
+  free(chunk);
+  return BP_OK;
+}
+
+
+static int inspect_leaf(inspect_t* ins, bp__page_t* page) {
+  uint64_t i;
+  uint64_t min_value = 0;
+  uint64_t max_value = 0;
+
+  /* leaf locality: distance from previous leaf in key order */
+  if (ins->leaf.count > 1) {
+    ins->leaf_jumps++;
+    ins->leaf_distance += inspect_distance(page->offset, ins->leaf_prev);
+    if (page->offset > ins->leaf_prev) ins->leaf_forward++;
+  }
+  ins->leaf_prev = page->offset;
+
+  for (i = 0; i < page->length; i++) {
+    bp__kv_t* kv = &page->keys[i];
+
+    ins->keys++;
+    ins->key_hist[inspect_log2(kv->length)]++;
+    ins->live += inspect_padded(BP__KV_LENGTH(kv->config));
+    if (inspect_add_ref(ins, kv->offset, BP__KV_LENGTH(kv->config)) != 0) {
+      return BP_EALLOC;
+    }
+    if (kv->key_config != 0) {
+      ins->overflow_keys++;
+      ins->live += inspect_padded(kv->key_config);
+    }
+
+    ins->value_distance += inspect_distance(kv->offset, page->offset);
+    if (i == 0 || kv->offset < min_value) min_value = kv->offset;
+    if (i == 0 || kv->offset > max_value) max_value = kv->offset;
+
+    ins->value.count++;
+    ins->value.compressed += BP__KV_LENGTH(kv->config);
+
+    if (!ins->skip_values) {
+      bp_value_t value;
+      int ret = bp__page_load_value(&ins->db, page, i, &value);
+      if (ret != BP_OK) return ret;
+
+      /* 16 bytes of previous value's offset and length */
+      ins->value.raw += value.length + 16;
+      ins->value_hist[inspect_log2(value.length)]++;
+      free(value.value);
+    }
+  }
+
+  if (page->length != 0) ins->value_span += (double) (max_value - min_value);
+
+  return BP_OK;
+}
+
+
+/* older versions of page that its delta chain is applied to are live too */
+static int inspect_chain(inspect_t* ins, bp__page_t* page) {
+  int ret;
+  uint64_t offset, config, depth, size;
+  char* buff;
+
+  ins->deltas++;
+  ins->delta_depth += page->depth;
+
+  offset = page->offset;
+  config = page->config;
+  for (;;) {
+    size = BP__KV_LENGTH(config) >> 1;
+    ret = bp__writer_read((bp__writer_t*) &ins->db,
+                          kCompressed,
+                          config & 1 ? kLeafBlock : kPageBlock,
+                          offset,
+                          &size,
+                          (void**) &buff);
+    if (ret != BP_OK) return ret;
+    if (!bp__page_is_delta(buff, size)) break;
+
+    bp__page_delta_base(buff, &offset, &config, &depth);
+    free(buff);
+
+    ins->live += inspect_padded(BP__KV_LENGTH(config) >> 1);
+  }
+
+  free(buff);
+  return BP_OK;
+}
+
+
+static int inspect_page(inspect_t* ins, bp__page_t* page, uint64_t level) {
+  int ret;
+  uint64_t i;
+  uint64_t fill;
+  inspect_block_t* block;
+
+  if (level >= INSPECT_MAX_LEVELS) return BP_EFILEREAD_OOB;
+
+  if (level + 1 > ins->height) ins->height = level + 1;
+  ins->pages_per_level[level]++;
+  fill = page->length * 10 / ins->db.head.page_size;
+  ins->fill[fill > 10 ? 10 : fill]++;
+  ins->live += inspect_padded(BP__KV_LENGTH(page->config) >> 1);
+
+  block = page->type == kLeaf ? &ins->leaf : &ins->interior;
+  block->count++;
+  block->raw += page->byte_size;
+  block->compressed += BP__KV_LENGTH(page->config) >> 1;
+
+  if (page->depth != 0) {
+    ret = inspect_chain(ins, page);
+    if (ret != BP_OK) return ret;
+  }
+
+  if (page->type == kLeaf) return inspect_leaf(ins, page);
+
+  /* values of buffered messages are live, they are newer than leaves */
+  if (page->buffer_length != 0) {
+    block->raw += BP__BUFFER_HEADER_SIZE + page->buffer_size;
+  }
+  for (i = 0; i < page->buffer_length; i++) {
+    ins->messages++;
+    if (BP__MSG_REMOVED(page->buffer[i].config)) {
+      ins->removals++;
+    } else {
+      ins->live += inspect_padded(BP__KV_LENGTH(page->buffer[i].config));
+    }
+    if (page->buffer[i].key_config != 0) {
+      ins->live += inspect_padded(page->buffer[i].key_config);
+    }
+  }
+
+  for (i = 0; i < page->length; i++) {
+    bp__page_t* child;
+
+    ret = bp__page_load(&ins->db,
+                        page->keys[i].offset,
+                        page->keys[i].config,
+                        &child);
+    if (ret != BP_OK) return ret;
+
+    ret = inspect_page(ins, child, level + 1);
+    bp__page_destroy(&ins->db, child);
+    if (ret != BP_OK) return ret;
+  }
+
+  return BP_OK;
+}
+
+
+static void inspect_print_block(const char* name, inspect_block_t* block) {
+  fprintf(stdout,
+          "  %-9s %12.0f blocks %16.0f raw %16.0f stored  ratio %.3f\n",
+          name,
+          (double) block->count,
+          (double) block->raw,
+          (double) block->compressed,
+          block->raw == 0 ? 0.0 : (double) block->compressed / block->raw);
+}
+
+
+static void inspect_print_hist(const char* name, uint64_t* hist) {
+  uint64_t i;
+  double low = 1;
+
+  fprintf(stdout, "%s:\n", name);
+  for (i = 0; i < INSPECT_HIST_SIZE; i++, low *= 2) {
+    if (hist[i] == 0) continue;
+    fprintf(stdout,
+            "  %12.0f - %12.0f bytes : %.0f\n",
+            i == 0 ? 0.0 : low,
+            low * 2 - 1,
+            (double) hist[i]);
+  }
+}
+
+
+static void inspect_print(inspect_t* ins) {
+  uint64_t i;
+  double size = (double) ins->db.filesize;
+
+  fprintf(stdout, "file size       : %.0f bytes\n", size);
+  fprintf(stdout, "head offset     : %.0f\n", (double) ins->head_offset);
+  fprintf(stdout, "historical heads: %.0f\n", (double) ins->heads);
+  fprintf(stdout, "page size       : %.0f keys\n",
+          (double) ins->db.head.page_size);
+  fprintf(stdout, "keys            : %.0f\n", (double) ins->keys);
+  fprintf(stdout, "tree height     : %.0f\n", (double) ins->height);
+  for (i = 0; i < ins->height; i++) {
+    fprintf(stdout, "  level %-3.0f : %.0f pages\n",
+            (double) i,
+            (double) ins->pages_per_level[i]);
+  }
+
+  fprintf(stdout, "page fill:\n");
+  for (i = 0; i < 11; i++) {
+    if (ins->fill[i] == 0) continue;
+    fprintf(stdout, "  %3.0f%% - %3.0f%% : %.0f\n",
+            (double) i * 10,
+            i == 10 ? 100.0 : (double) i * 10 + 9,
+            (double) ins->fill[i]);
+  }
+
+  inspect_print_hist("key sizes", ins->key_hist);
+  if (!ins->skip_values) inspect_print_hist("value sizes", ins->value_hist);
+
+  fprintf(stdout, "blocks:\n");
+  inspect_print_block("interior", &ins->interior);
+  inspect_print_block("leaf", &ins->leaf);
+  if (!ins->skip_values) inspect_print_block("value", &ins->value);
+
+  if (ins->deltas != 0) {
+    fprintf(stdout,
+            "delta pages     : %.0f, average chain %.2f\n",
+            (double) ins->deltas,
+            (double) ins->delta_depth / ins->deltas);
+  }
+
+  if (ins->messages != 0) {
+    fprintf(stdout,
+            "buffered msgs   : %.0f (%.0f removals)\n",
+            (double) ins->messages,
+            (double) ins->removals);
+  }
+
+  if (ins->shared_values != 0) {
+    fprintf(stdout,
+            "shared values   : %.0f\n",
+            (double) ins->shared_values);
+  }
+
+  if (ins->overflow_keys != 0) {
+    fprintf(stdout,
+            "overflow keys   : %.0f\n",
+            (double) ins->overflow_keys);
+  }
+
+  fprintf(stdout, "live bytes      : %.0f\n", (double) ins->live);
+  fprintf(stdout, "garbage ratio   : %.3f\n",
+          size == 0 ? 0.0 : 1.0 - ins->live / size);
+
+  fprintf(stdout, "locality:\n");
+  fprintf(stdout, "  leaf jump avg    : %.0f bytes\n",
+          ins->leaf_jumps == 0 ? 0.0 : ins->leaf_distance / ins->leaf_jumps);
+  fprintf(stdout, "  leaf forward     : %.1f%%\n",
+          ins->leaf_jumps == 0 ?
+              100.0 :
+              100.0 * ins->leaf_forward / ins->leaf_jumps);
+  fprintf(stdout, "  value-leaf avg   : %.0f bytes\n",
+          ins->keys == 0 ? 0.0 : ins->value_distance / ins->keys);
+  fprintf(stdout, "  value span avg   : %.0f bytes per leaf\n",
+          ins->leaf.count == 0 ? 0.0 : ins->value_span / ins->leaf.count);
+}
+
+
+static int inspect_run(inspect_t* ins, const char* filename) {
+  int ret;
+  struct stat st;
+
+  ins->db.fd = open(filename, O_RDONLY);
+  if (ins->db.fd == -1) return BP_EFILE;
+
+  if (fstat(ins->db.fd, &st) != 0) {
+    ret = BP_EFILE;
+    goto fatal;
+  }
+  ins->db.filesize = (uint64_t) st.st_size;
+  ins->db.head.page = NULL;
+  ins->db.flags = BP_OPEN_RDONLY;
+  bp_set_compare_cb(&ins->db, bp__default_compare_cb);
+
+  ret = inspect_find_head(ins);
+  if (ret != BP_OK) goto fatal;
+
+  ret = inspect_count_heads(ins);
+  if (ret != BP_OK) goto fatal;
+
+  /* head record itself */
+  ins->live += BP_PADDING;
+  ret = inspect_page(ins, ins->db.head.page, 0);
+  if (ret == BP_OK) inspect_shared(ins);
+
+  bp__page_destroy(&ins->db, ins->db.head.page);
+  ins->db.head.page = NULL;
+
+fatal:
+  close(ins->db.fd);
+  return ret;
+}
+
+
+int main(int argc, char** argv) {
+  int ret;
+  inspect_t* ins;
+  const char* filename = NULL;
+  int i;
+
+  ins = malloc(sizeof(*ins));
+  if (ins == NULL) return 1;
+  memset(ins, 0, sizeof(*ins));
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0) {
+      ins->skip_values = 1;
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  if (filename == NULL) {
+    fprintf(stderr, "Usage: %s [-s] <database>\n", argv[0]);
+    fprintf(stderr, "  -s  skip loading values (no value sizes/ratio)\n");
+    free(ins);
+    return 1;
+  }
+
+  ret = inspect_run(ins, filename);
+  if (ret == BP_OK) {
+    inspect_print(ins);
+  } else {
+    fprintf(stderr, "%s: failed to inspect %s (error 0x%x)\n",
+            argv[0],
+            filename,
+            ret);
+  }
+
+  free(ins->refs);
+  free(ins);
+  return ret == BP_OK ? 0 : 1;
+}
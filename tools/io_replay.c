@@ -0,0 +1,611 @@
+/*
+ * bp_io_replay - inspect, replay and simulate I/O traces.
+ *
+ * Traces are recorded with bp_io_trace_start() (see include/private/trace.h
+ * for the format).
+ *
+ *   bp_io_replay stat <trace>
+ *     print number of I/Os and bytes by direction, block type and operation.
+ *
+ *   bp_io_replay replay [-r] [-x speed] <trace> <file>
+ *     re-issue every I/O against <file> with pread/pwrite and report
+ *     throughput and latency. Writes overwrite <file> with zeroes, so use a
+ *     scratch copy of the database. `-r` replays reads only, `-x` honors
+ *     trace timestamps sped up `speed` times (default: as fast as possible).
+ *
+ *   bp_io_replay simulate [-W] <trace> <size>...
+ *     simulate LRU caches of decompressed blocks of given sizes (suffixes
+ *     k, m and g are accepted) and print hit rates per block type. Written
+ *     blocks populate the cache unless `-W` is given.
+ */
+#include <stdlib.h> /* malloc, free, strtod */
+#include <stdio.h> /* fprintf, fopen */
+#include <string.h> /* memset, strcmp */
+#include <fcntl.h> /* open */
+#include <unistd.h> /* pread, pwrite, close, usleep */
+#include <sys/time.h> /* gettimeofday */
+#include <arpa/inet.h> /* ntohl */
+
+#include "bplus.h"
+#include "private/trace.h"
+#include "private/utils.h"
+
+#define REPLAY_BLOCK_TYPES 5
+#define REPLAY_OPS 8
+#define REPLAY_MAX_CACHES 16
+
+typedef struct replay_record_s replay_record_t;
+typedef struct replay_lru_s replay_lru_t;
+typedef struct replay_node_s replay_node_t;
+
+struct replay_record_s {
+  uint64_t time;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t raw_size;
+  uint8_t io;
+  uint8_t block;
+  uint8_t op;
+  uint8_t file;
+};
+
+struct replay_node_s {
+  uint64_t offset;
+  uint32_t size;
+  uint8_t file;
+
+  /* LRU list and hash chain, -1 terminated */
+  int64_t prev;
+  int64_t next;
+  int64_t chain;
+};
+
+struct replay_lru_s {
+  uint64_t capacity;
+  uint64_t used;
+
+  replay_node_t* nodes;
+  uint64_t node_count;
+  uint64_t node_size;
+  int64_t free_list;
+
+  int64_t* buckets;
+  uint64_t bucket_count;
+
+  int64_t head;
+  int64_t tail;
+
+  uint64_t hits[REPLAY_BLOCK_TYPES];
+  uint64_t misses[REPLAY_BLOCK_TYPES];
+};
+
+static const char* block_names[REPLAY_BLOCK_TYPES] = {
+  "head", "page", "leaf", "value", "padding"
+};
+
+static const char* op_names[REPLAY_OPS] = {
+  "none", "open", "get", "set", "bulk", "remove", "range", "compact"
+};
+
+
+static uint64_t replay_now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static FILE* replay_open_trace(const char* filename) {
+  char magic[BP__TRACE_MAGIC_SIZE];
+  FILE* f = fopen(filename, "rb");
+
+  if (f == NULL) {
+    fprintf(stderr, "failed to open %s\n", filename);
+    return NULL;
+  }
+  if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+      memcmp(magic, BP__TRACE_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "%s is not an I/O trace\n", filename);
+    fclose(f);
+    return NULL;
+  }
+
+  return f;
+}
+
+
+static int replay_next(FILE* f, replay_record_t* rec) {
+  unsigned char buff[BP__TRACE_RECORD_SIZE];
+
+  if (fread(buff, 1, sizeof(buff), f) != sizeof(buff)) return 0;
+
+  rec->time = ntohll(*(uint64_t*) (buff));
+  rec->offset = ntohll(*(uint64_t*) (buff + 8));
+  rec->size = ntohl(*(uint32_t*) (buff + 16));
+  rec->raw_size = ntohl(*(uint32_t*) (buff + 20));
+  rec->io = buff[24];
+  rec->block = buff[25] < REPLAY_BLOCK_TYPES ? buff[25] : kPaddingBlock;
+  rec->op = buff[26] < REPLAY_OPS ? buff[26] : kTraceOpNone;
+  rec->file = buff[27];
+
+  return 1;
+}
+
+
+static uint64_t replay_parse_size(const char* str) {
+  char* end;
+  double value = strtod(str, &end);
+
+  if (*end == 'k' || *end == 'K') value *= 1024.0;
+  if (*end == 'm' || *end == 'M') value *= 1024.0 * 1024.0;
+  if (*end == 'g' || *end == 'G') value *= 1024.0 * 1024.0 * 1024.0;
+
+  return (uint64_t) value;
+}
+
+
+/* stat */
+
+
+static int replay_stat(const char* filename) {
+  FILE* f;
+  replay_record_t rec;
+  uint64_t count[2][REPLAY_BLOCK_TYPES];
+  uint64_t bytes[2][REPLAY_BLOCK_TYPES];
+  uint64_t raw[2][REPLAY_BLOCK_TYPES];
+  uint64_t ops[2][REPLAY_OPS];
+  uint64_t reopens = 0;
+  uint64_t duration = 0;
+  int i, j;
+
+  f = replay_open_trace(filename);
+  if (f == NULL) return 1;
+
+  memset(count, 0, sizeof(count));
+  memset(bytes, 0, sizeof(bytes));
+  memset(raw, 0, sizeof(raw));
+  memset(ops, 0, sizeof(ops));
+
+  while (replay_next(f, &rec)) {
+    duration = rec.time;
+    if (rec.io == kTraceReopen) {
+      reopens++;
+      continue;
+    }
+    if (rec.io > kTraceWrite) continue;
+
+    count[rec.io][rec.block]++;
+    bytes[rec.io][rec.block] += rec.size;
+    raw[rec.io][rec.block] += rec.raw_size;
+    ops[rec.io][rec.op]++;
+  }
+  fclose(f);
+
+  fprintf(stdout, "duration : %.3fs\n", duration * 1e-6);
+  fprintf(stdout, "reopens  : %.0f\n", (double) reopens);
+  for (i = 0; i < 2; i++) {
+    fprintf(stdout, "%s:\n", i == kTraceRead ? "reads" : "writes");
+    for (j = 0; j < REPLAY_BLOCK_TYPES; j++) {
+      if (count[i][j] == 0) continue;
+      fprintf(stdout,
+              "  %-8s %12.0f ios %16.0f bytes %16.0f raw\n",
+              block_names[j],
+              (double) count[i][j],
+              (double) bytes[i][j],
+              (double) raw[i][j]);
+    }
+    for (j = 0; j < REPLAY_OPS; j++) {
+      if (ops[i][j] == 0) continue;
+      fprintf(stdout,
+              "  by %-8s %9.0f ios\n",
+              op_names[j],
+              (double) ops[i][j]);
+    }
+  }
+
+  return 0;
+}
+
+
+/* replay */
+
+
+static int replay_replay(const char* filename,
+                         const char* target,
+                         int reads_only,
+                         double speed) {
+  FILE* f;
+  int fd;
+  replay_record_t rec;
+  char* buff = NULL;
+  uint64_t buff_size = 0;
+  uint64_t start, first = 0, ios = 0, bytes = 0, short_ios = 0;
+  double latency = 0, max_latency = 0, total;
+  int have_first = 0;
+
+  f = replay_open_trace(filename);
+  if (f == NULL) return 1;
+
+  fd = open(target, reads_only ? O_RDONLY : O_RDWR);
+  if (fd == -1) {
+    fprintf(stderr, "failed to open %s\n", target);
+    fclose(f);
+    return 1;
+  }
+
+  start = replay_now();
+  while (replay_next(f, &rec)) {
+    uint64_t io_start;
+    ssize_t res;
+    double elapsed;
+
+    /* compaction target and reopen events have no meaning for one file */
+    if (rec.io > kTraceWrite || rec.file != 0 || rec.size == 0) continue;
+    if (reads_only && rec.io == kTraceWrite) continue;
+
+    if (!have_first) {
+      first = rec.time;
+      have_first = 1;
+    }
+
+    /* honor trace timing */
+    if (speed > 0) {
+      uint64_t due = start + (uint64_t) ((rec.time - first) / speed);
+      uint64_t now = replay_now();
+      if (due > now) usleep((useconds_t) (due - now));
+    }
+
+    if (rec.size > buff_size) {
+      free(buff);
+      buff_size = rec.size;
+      buff = calloc(1, (size_t) buff_size);
+      if (buff == NULL) {
+        fprintf(stderr, "failed to allocate %.0f bytes\n", (double) rec.size);
+        close(fd);
+        fclose(f);
+        return 1;
+      }
+    }
+
+    io_start = replay_now();
+    if (rec.io == kTraceRead) {
+      res = pread(fd, buff, rec.size, (off_t) rec.offset);
+    } else {
+      memset(buff, 0, rec.size);
+      res = pwrite(fd, buff, rec.size, (off_t) rec.offset);
+    }
+    elapsed = (double) (replay_now() - io_start);
+
+    if (res != (ssize_t) rec.size) short_ios++;
+    latency += elapsed;
+    if (elapsed > max_latency) max_latency = elapsed;
+    ios++;
+    bytes += rec.size;
+  }
+  total = (replay_now() - start) * 1e-6;
+
+  free(buff);
+  close(fd);
+  fclose(f);
+
+  fprintf(stdout, "ios       : %.0f (%.0f short)\n",
+          (double) ios,
+          (double) short_ios);
+  fprintf(stdout, "bytes     : %.0f\n", (double) bytes);
+  fprintf(stdout, "time      : %.3fs\n", total);
+  fprintf(stdout, "iops      : %.1f\n", total > 0 ? ios / total : 0.0);
+  fprintf(stdout, "MB/s      : %.1f\n",
+          total > 0 ? bytes / total / (1024 * 1024) : 0.0);
+  fprintf(stdout, "avg lat   : %.1fus\n", ios > 0 ? latency / ios : 0.0);
+  fprintf(stdout, "max lat   : %.1fus\n", max_latency);
+
+  return 0;
+}
+
+
+/* simulate */
+
+
+static uint64_t replay_lru_hash(replay_lru_t* lru,
+                                uint8_t file,
+                                uint64_t offset) {
+  return bp__compute_hashl(offset ^ ((uint64_t) file << 63)) %
+         lru->bucket_count;
+}
+
+
+static int replay_lru_init(replay_lru_t* lru, uint64_t capacity) {
+  uint64_t i;
+
+  memset(lru, 0, sizeof(*lru));
+  lru->capacity = capacity;
+  lru->head = -1;
+  lru->tail = -1;
+  lru->free_list = -1;
+
+  lru->bucket_count = 1 << 16;
+  lru->buckets = malloc(sizeof(*lru->buckets) * lru->bucket_count);
+  if (lru->buckets == NULL) return BP_EALLOC;
+  for (i = 0; i < lru->bucket_count; i++) lru->buckets[i] = -1;
+
+  return BP_OK;
+}
+
+
+static void replay_lru_destroy(replay_lru_t* lru) {
+  free(lru->nodes);
+  free(lru->buckets);
+}
+
+
+static int64_t replay_lru_find(replay_lru_t* lru,
+                               uint8_t file,
+                               uint64_t offset) {
+  int64_t i = lru->buckets[replay_lru_hash(lru, file, offset)];
+
+  while (i != -1) {
+    if (lru->nodes[i].offset == offset && lru->nodes[i].file == file) break;
+    i = lru->nodes[i].chain;
+  }
+
+  return i;
+}
+
+
+static void replay_lru_unlink(replay_lru_t* lru, int64_t i) {
+  replay_node_t* node = &lru->nodes[i];
+
+  if (node->prev != -1) {
+    lru->nodes[node->prev].next = node->next;
+  } else {
+    lru->head = node->next;
+  }
+  if (node->next != -1) {
+    lru->nodes[node->next].prev = node->prev;
+  } else {
+    lru->tail = node->prev;
+  }
+}
+
+
+static void replay_lru_push(replay_lru_t* lru, int64_t i) {
+  replay_node_t* node = &lru->nodes[i];
+
+  node->prev = -1;
+  node->next = lru->head;
+  if (lru->head != -1) lru->nodes[lru->head].prev = i;
+  lru->head = i;
+  if (lru->tail == -1) lru->tail = i;
+}
+
+
+static void replay_lru_unchain(replay_lru_t* lru, int64_t i) {
+  replay_node_t* node = &lru->nodes[i];
+  int64_t* p = &lru->buckets[replay_lru_hash(lru, node->file, node->offset)];
+
+  while (*p != i) p = &lru->nodes[*p].chain;
+  *p = node->chain;
+}
+
+
+static void replay_lru_remove(replay_lru_t* lru, int64_t i) {
+  replay_lru_unlink(lru, i);
+  replay_lru_unchain(lru, i);
+
+  lru->used -= lru->nodes[i].size;
+  lru->nodes[i].chain = lru->free_list;
+  lru->free_list = i;
+}
+
+
+static int replay_lru_insert(replay_lru_t* lru,
+                             uint8_t file,
+                             uint64_t offset,
+                             uint32_t size) {
+  int64_t i;
+  uint64_t bucket;
+
+  if (size > lru->capacity) return BP_OK;
+
+  while (lru->used + size > lru->capacity) {
+    replay_lru_remove(lru, lru->tail);
+  }
+
+  if (lru->free_list != -1) {
+    i = lru->free_list;
+    lru->free_list = lru->nodes[i].chain;
+  } else {
+    if (lru->node_count == lru->node_size) {
+      uint64_t node_size = lru->node_size == 0 ? 1024 : lru->node_size * 2;
+      replay_node_t* nodes = realloc(lru->nodes, sizeof(*nodes) * node_size);
+
+      if (nodes == NULL) return BP_EALLOC;
+      lru->nodes = nodes;
+      lru->node_size = node_size;
+    }
+    i = (int64_t) lru->node_count++;
+  }
+
+  lru->nodes[i].offset = offset;
+  lru->nodes[i].file = file;
+  lru->nodes[i].size = size;
+
+  bucket = replay_lru_hash(lru, file, offset);
+  lru->nodes[i].chain = lru->buckets[bucket];
+  lru->buckets[bucket] = i;
+
+  replay_lru_push(lru, i);
+  lru->used += size;
+
+  return BP_OK;
+}
+
+
+/*
+ * After compaction the old file is gone and the compaction target
+ * becomes the database itself.
+ */
+static void replay_lru_reopen(replay_lru_t* lru) {
+  int64_t i = lru->head;
+
+  while (i != -1) {
+    int64_t next = lru->nodes[i].next;
+
+    if (lru->nodes[i].file == 0) {
+      replay_lru_remove(lru, i);
+    } else {
+      replay_lru_unchain(lru, i);
+      lru->nodes[i].file = 0;
+      lru->nodes[i].chain =
+          lru->buckets[replay_lru_hash(lru, 0, lru->nodes[i].offset)];
+      lru->buckets[replay_lru_hash(lru, 0, lru->nodes[i].offset)] = i;
+    }
+
+    i = next;
+  }
+}
+
+
+static int replay_lru_access(replay_lru_t* lru,
+                             replay_record_t* rec,
+                             int populate_on_write) {
+  int64_t i;
+
+  if (rec->io == kTraceReopen) {
+    replay_lru_reopen(lru);
+    return BP_OK;
+  }
+
+  if (rec->block == kHeadBlock || rec->block == kPaddingBlock) return BP_OK;
+
+  i = replay_lru_find(lru, rec->file, rec->offset);
+
+  if (rec->io == kTraceWrite) {
+    if (!populate_on_write || i != -1) return BP_OK;
+    return replay_lru_insert(lru, rec->file, rec->offset, rec->raw_size);
+  }
+
+  if (i != -1) {
+    lru->hits[rec->block]++;
+    replay_lru_unlink(lru, i);
+    replay_lru_push(lru, i);
+    return BP_OK;
+  }
+
+  lru->misses[rec->block]++;
+  return replay_lru_insert(lru, rec->file, rec->offset, rec->raw_size);
+}
+
+
+static int replay_simulate(const char* filename,
+                           int count,
+                           char** sizes,
+                           int populate_on_write) {
+  FILE* f;
+  replay_record_t rec;
+  replay_lru_t lrus[REPLAY_MAX_CACHES];
+  int i, j, ret = 0;
+
+  if (count > REPLAY_MAX_CACHES) count = REPLAY_MAX_CACHES;
+
+  f = replay_open_trace(filename);
+  if (f == NULL) return 1;
+
+  for (i = 0; i < count; i++) {
+    if (replay_lru_init(&lrus[i], replay_parse_size(sizes[i])) != BP_OK) {
+      count = i;
+      ret = 1;
+      goto done;
+    }
+  }
+
+  while (replay_next(f, &rec)) {
+    for (i = 0; i < count; i++) {
+      if (replay_lru_access(&lrus[i], &rec, populate_on_write) != BP_OK) {
+        fprintf(stderr, "out of memory\n");
+        ret = 1;
+        goto done;
+      }
+    }
+  }
+
+  fprintf(stdout, "%14s %8s %12s %12s %8s\n",
+          "cache", "block", "hits", "misses", "hit %");
+  for (i = 0; i < count; i++) {
+    uint64_t hits = 0, misses = 0;
+
+    for (j = kPageBlock; j <= kValueBlock; j++) {
+      hits += lrus[i].hits[j];
+      misses += lrus[i].misses[j];
+      fprintf(stdout, "%14.0f %8s %12.0f %12.0f %7.2f%%\n",
+              (double) lrus[i].capacity,
+              block_names[j],
+              (double) lrus[i].hits[j],
+              (double) lrus[i].misses[j],
+              lrus[i].hits[j] + lrus[i].misses[j] == 0 ?
+                  0.0 :
+                  100.0 * lrus[i].hits[j] /
+                      (lrus[i].hits[j] + lrus[i].misses[j]));
+    }
+    fprintf(stdout, "%14.0f %8s %12.0f %12.0f %7.2f%%\n",
+            (double) lrus[i].capacity,
+            "total",
+            (double) hits,
+            (double) misses,
+            hits + misses == 0 ? 0.0 : 100.0 * hits / (hits + misses));
+  }
+
+done:
+  for (i = 0; i < count; i++) replay_lru_destroy(&lrus[i]);
+  fclose(f);
+  return ret;
+}
+
+
+static void replay_usage(const char* name) {
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  %s stat <trace>\n", name);
+  fprintf(stderr, "  %s replay [-r] [-x speed] <trace> <file>\n", name);
+  fprintf(stderr, "  %s simulate [-W] <trace> <size>...\n", name);
+}
+
+
+int main(int argc, char** argv) {
+  int i;
+  int reads_only = 0;
+  int populate_on_write = 1;
+  double speed = 0;
+
+  if (argc < 3) {
+    replay_usage(argv[0]);
+    return 1;
+  }
+
+  /* parse flags following the command */
+  for (i = 2; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-r") == 0) {
+      reads_only = 1;
+    } else if (strcmp(argv[i], "-W") == 0) {
+      populate_on_write = 0;
+    } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+      speed = strtod(argv[++i], NULL);
+    } else {
+      replay_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (strcmp(argv[1], "stat") == 0 && i + 1 == argc) {
+    return replay_stat(argv[i]);
+  } else if (strcmp(argv[1], "replay") == 0 && i + 2 == argc) {
+    return replay_replay(argv[i], argv[i + 1], reads_only, speed);
+  } else if (strcmp(argv[1], "simulate") == 0 && i + 1 < argc) {
+    return replay_simulate(argv[i],
+                           argc - i - 1,
+                           argv + i + 1,
+                           populate_on_write);
+  }
+
+  replay_usage(argv[0]);
+  return 1;
+}
@@ -0,0 +1,493 @@
+/*
+ * bp_op_replay - replay operation traces against a database.
+ *
+ * Traces are recorded with bp_op_trace_start() (see include/private/trace.h
+ * for the format).
+ *
+ *   bp_op_replay [-t threads] [-x speed] <trace> <database>
+ *
+ * Operations are distributed between threads by hash of their (first) key,
+ * so operations on the same key are always replayed in their original order;
+ * with one thread (default) the whole trace is replayed deterministically.
+ * Compactions and bulk operations with keys of several threads act as
+ * barriers: all threads finish preceding operations before it starts and
+ * wait for it to finish.
+ * `-x` honors trace timestamps sped up `speed` times, by default operations
+ * are issued as fast as possible. If trace has no values, values of recorded
+ * sizes are synthesized.
+ */
+#include <stdlib.h> /* malloc, free, strtod */
+#include <stdio.h> /* fprintf, fopen */
+#include <string.h> /* memset, strcmp */
+#include <unistd.h> /* usleep */
+#include <pthread.h> /* pthread_create */
+#include <sys/time.h> /* gettimeofday */
+#include <arpa/inet.h> /* ntohl */
+
+#include "bplus.h"
+#include "private/trace.h"
+#include "private/utils.h"
+
+#define REPLAY_OPS 8
+#define REPLAY_BARRIER -1
+
+typedef struct replay_op_s replay_op_t;
+typedef struct replay_s replay_t;
+typedef struct replay_thread_s replay_thread_t;
+
+struct replay_op_s {
+  uint64_t time;
+  uint8_t op;
+  uint64_t count;
+
+  /* replaying thread, REPLAY_BARRIER - all threads wait for it */
+  int owner;
+
+  bp_key_t* keys;
+  bp_value_t* values;
+};
+
+struct replay_s {
+  bp_db_t db;
+
+  char* data;
+  replay_op_t* ops;
+  uint64_t op_count;
+
+  bp_key_t* keys;
+  bp_value_t* values;
+
+  char* filler;
+  uint64_t filler_size;
+
+  int threads;
+  double speed;
+  uint64_t start;
+
+  /* barrier of compaction or bulk set */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int waiting;
+  uint64_t generation;
+};
+
+struct replay_thread_s {
+  replay_t* replay;
+  int index;
+
+  uint64_t errors;
+  uint64_t count[REPLAY_OPS];
+  double latency[REPLAY_OPS];
+  double max_latency[REPLAY_OPS];
+};
+
+static const char* op_names[REPLAY_OPS] = {
+  "none", "open", "get", "set", "bulk", "remove", "range", "compact"
+};
+
+
+static uint64_t replay_now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static int replay_read_file(const char* filename, char** data, uint64_t* size) {
+  FILE* f;
+  long length;
+
+  f = fopen(filename, "rb");
+  if (f == NULL) return BP_EFILE;
+
+  if (fseek(f, 0, SEEK_END) != 0 || (length = ftell(f)) < 0) {
+    fclose(f);
+    return BP_EFILEREAD;
+  }
+  rewind(f);
+
+  *data = malloc(length + 1);
+  if (*data == NULL) {
+    fclose(f);
+    return BP_EALLOC;
+  }
+
+  if (fread(*data, 1, length, f) != (size_t) length) {
+    free(*data);
+    fclose(f);
+    return BP_EFILEREAD;
+  }
+  fclose(f);
+
+  *size = (uint64_t) length;
+  return BP_OK;
+}
+
+
+/*
+ * Return size of record at `o` or 0 if it is truncated
+ * (i.e. trace was copied while still being written).
+ */
+static uint64_t replay_record_size(replay_t* r, uint64_t o, uint64_t size) {
+  uint64_t start = o;
+  int with_values;
+  uint64_t count, i;
+
+  if (o + BP__OPTRACE_HEADER_SIZE > size) return 0;
+  with_values = r->data[o + 9] & BP__OPTRACE_VALUES;
+  count = ntohll(*(uint64_t*) (r->data + o + 16));
+  o += BP__OPTRACE_HEADER_SIZE;
+
+  for (i = 0; i < count; i++) {
+    uint64_t klen, vlen;
+
+    if (o + 8 > size) return 0;
+    klen = ntohll(*(uint64_t*) (r->data + o));
+    if (klen > size || o + 16 + klen > size) return 0;
+    vlen = ntohll(*(uint64_t*) (r->data + o + 8 + klen));
+    if (vlen > r->filler_size) r->filler_size = vlen;
+
+    o += 16 + klen;
+    if (with_values) {
+      if (vlen > size || o + vlen > size) return 0;
+      o += vlen;
+    }
+  }
+
+  return o - start;
+}
+
+
+/* Parse whole trace into operations pointing into file data */
+static int replay_parse(replay_t* r, uint64_t size) {
+  uint64_t o, n, entries, i, record;
+
+  if (size < BP__TRACE_MAGIC_SIZE ||
+      memcmp(r->data, BP__OPTRACE_MAGIC, BP__TRACE_MAGIC_SIZE) != 0) {
+    return BP_EFILEREAD;
+  }
+
+  /* count complete records and entries first */
+  o = BP__TRACE_MAGIC_SIZE;
+  n = 0;
+  entries = 0;
+  while ((record = replay_record_size(r, o, size)) != 0) {
+    entries += ntohll(*(uint64_t*) (r->data + o + 16));
+    o += record;
+    n++;
+  }
+
+  r->op_count = n;
+  r->ops = malloc(sizeof(*r->ops) * (n + 1));
+  r->keys = malloc(sizeof(*r->keys) * (entries + 1));
+  r->values = malloc(sizeof(*r->values) * (entries + 1));
+  r->filler = malloc(r->filler_size + 1);
+  if (r->ops == NULL || r->keys == NULL || r->values == NULL ||
+      r->filler == NULL) {
+    return BP_EALLOC;
+  }
+  memset(r->filler, 'x', r->filler_size + 1);
+
+  /* fill operations, missing values are synthesized from filler */
+  o = BP__TRACE_MAGIC_SIZE;
+  entries = 0;
+  for (n = 0; n < r->op_count; n++) {
+    replay_op_t* op = &r->ops[n];
+    int with_values = r->data[o + 9] & BP__OPTRACE_VALUES;
+
+    op->time = ntohll(*(uint64_t*) (r->data + o));
+    op->op = (uint8_t) r->data[o + 8];
+    op->count = ntohll(*(uint64_t*) (r->data + o + 16));
+    op->keys = r->keys + entries;
+    op->values = r->values + entries;
+    if (op->op >= REPLAY_OPS) op->op = kTraceOpNone;
+    o += BP__OPTRACE_HEADER_SIZE;
+
+    for (i = 0; i < op->count; i++) {
+      op->keys[i].length = ntohll(*(uint64_t*) (r->data + o));
+      op->keys[i].value = r->data + o + 8;
+      o += 8 + op->keys[i].length;
+
+      op->values[i].length = ntohll(*(uint64_t*) (r->data + o));
+      op->values[i].value = with_values ? r->data + o + 8 : r->filler;
+      o += 8 + (with_values ? op->values[i].length : 0);
+    }
+    entries += op->count;
+  }
+
+  return BP_OK;
+}
+
+
+static int replay_key_owner(replay_t* r, const bp_key_t* key) {
+  uint64_t hash = 0;
+  uint64_t i;
+
+  for (i = 0; i < key->length; i++) {
+    hash = hash * 31 + (uint8_t) key->value[i];
+  }
+
+  return (int) (bp__compute_hashl(hash) % r->threads);
+}
+
+
+static int replay_owner(replay_t* r, replay_op_t* op) {
+  int owner;
+  uint64_t i;
+
+  if (op->op == kTraceOpCompact) return REPLAY_BARRIER;
+  if (r->threads == 1 || op->count == 0) return 0;
+
+  /* bulk set must not overtake (or be overtaken by) ops of other threads */
+  owner = replay_key_owner(r, &op->keys[0]);
+  for (i = 1; i < op->count; i++) {
+    if (replay_key_owner(r, &op->keys[i]) != owner) return REPLAY_BARRIER;
+  }
+
+  return owner;
+}
+
+
+static void replay_range_cb(void* arg,
+                            const bp_key_t* key,
+                            const bp_value_t* value) {
+  (*(uint64_t*) arg)++;
+}
+
+
+static int replay_execute(replay_t* r, replay_op_t* op) {
+  int ret = BP_OK;
+  bp_value_t value;
+  uint64_t matched = 0;
+
+  switch (op->op) {
+    case kTraceOpGet:
+      ret = bp_get(&r->db, &op->keys[0], &value);
+      if (ret == BP_OK) free(value.value);
+      if (ret == BP_ENOTFOUND) ret = BP_OK;
+      break;
+    case kTraceOpSet:
+      ret = bp_set(&r->db, &op->keys[0], &op->values[0]);
+      break;
+    case kTraceOpBulk:
+      ret = bp_bulk_set(&r->db,
+                        op->count,
+                        (const bp_key_t**) &op->keys,
+                        (const bp_value_t**) &op->values);
+      break;
+    case kTraceOpRemove:
+      ret = bp_remove(&r->db, &op->keys[0]);
+      if (ret == BP_ENOTFOUND) ret = BP_OK;
+      break;
+    case kTraceOpRange:
+      ret = bp_get_range(&r->db,
+                         &op->keys[0],
+                         (bp_key_t*) &op->values[0],
+                         replay_range_cb,
+                         &matched);
+      break;
+    case kTraceOpCompact:
+      ret = bp_compact(&r->db);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+
+static void replay_barrier(replay_t* r) {
+  uint64_t generation;
+
+  pthread_mutex_lock(&r->mutex);
+  generation = r->generation;
+  if (++r->waiting == r->threads) {
+    r->waiting = 0;
+    r->generation++;
+    pthread_cond_broadcast(&r->cond);
+  } else {
+    while (generation == r->generation) {
+      pthread_cond_wait(&r->cond, &r->mutex);
+    }
+  }
+  pthread_mutex_unlock(&r->mutex);
+}
+
+
+static void* replay_thread(void* arg) {
+  replay_thread_t* t = (replay_thread_t*) arg;
+  replay_t* r = t->replay;
+  uint64_t first = r->op_count > 0 ? r->ops[0].time : 0;
+  uint64_t i;
+
+  for (i = 0; i < r->op_count; i++) {
+    replay_op_t* op = &r->ops[i];
+    uint64_t start;
+    double elapsed;
+
+    if (op->owner == REPLAY_BARRIER) {
+      if (r->threads > 1) {
+        replay_barrier(r);
+        if (t->index != 0) {
+          replay_barrier(r);
+          continue;
+        }
+      }
+    } else if (op->owner != t->index) {
+      continue;
+    }
+
+    if (r->speed > 0) {
+      uint64_t due = r->start + (uint64_t) ((op->time - first) / r->speed);
+      uint64_t now = replay_now();
+      if (due > now) usleep((useconds_t) (due - now));
+    }
+
+    start = replay_now();
+    if (replay_execute(r, op) != BP_OK) t->errors++;
+    elapsed = (double) (replay_now() - start);
+
+    t->count[op->op]++;
+    t->latency[op->op] += elapsed;
+    if (elapsed > t->max_latency[op->op]) t->max_latency[op->op] = elapsed;
+
+    if (op->owner == REPLAY_BARRIER && r->threads > 1) replay_barrier(r);
+  }
+
+  return NULL;
+}
+
+
+static int replay_run(replay_t* r) {
+  replay_thread_t* threads;
+  pthread_t* tids;
+  uint64_t count[REPLAY_OPS];
+  double latency[REPLAY_OPS];
+  double max_latency[REPLAY_OPS];
+  uint64_t errors = 0, total = 0;
+  double elapsed;
+  uint64_t k;
+  int i, j;
+
+  threads = calloc(r->threads, sizeof(*threads));
+  tids = calloc(r->threads, sizeof(*tids));
+  if (threads == NULL || tids == NULL) {
+    free(threads);
+    free(tids);
+    return BP_EALLOC;
+  }
+
+  for (k = 0; k < r->op_count; k++) {
+    r->ops[k].owner = replay_owner(r, &r->ops[k]);
+  }
+
+  pthread_mutex_init(&r->mutex, NULL);
+  pthread_cond_init(&r->cond, NULL);
+
+  r->start = replay_now();
+  for (i = 0; i < r->threads; i++) {
+    threads[i].replay = r;
+    threads[i].index = i;
+    pthread_create(&tids[i], NULL, replay_thread, &threads[i]);
+  }
+  for (i = 0; i < r->threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  elapsed = (replay_now() - r->start) * 1e-6;
+
+  pthread_cond_destroy(&r->cond);
+  pthread_mutex_destroy(&r->mutex);
+
+  memset(count, 0, sizeof(count));
+  memset(latency, 0, sizeof(latency));
+  memset(max_latency, 0, sizeof(max_latency));
+  for (i = 0; i < r->threads; i++) {
+    errors += threads[i].errors;
+    for (j = 0; j < REPLAY_OPS; j++) {
+      count[j] += threads[i].count[j];
+      latency[j] += threads[i].latency[j];
+      if (threads[i].max_latency[j] > max_latency[j]) {
+        max_latency[j] = threads[i].max_latency[j];
+      }
+    }
+  }
+
+  fprintf(stdout, "%-8s %12s %12s %12s %12s\n",
+          "op", "count", "ops/sec", "avg us", "max us");
+  for (j = 0; j < REPLAY_OPS; j++) {
+    if (count[j] == 0) continue;
+    total += count[j];
+    fprintf(stdout, "%-8s %12.0f %12.1f %12.1f %12.1f\n",
+            op_names[j],
+            (double) count[j],
+            elapsed > 0 ? count[j] / elapsed : 0.0,
+            latency[j] / count[j],
+            max_latency[j]);
+  }
+  fprintf(stdout, "total    %12.0f ops in %.3fs, %.0f errors\n",
+          (double) total,
+          elapsed,
+          (double) errors);
+
+  free(threads);
+  free(tids);
+  return errors == 0 ? BP_OK : BP_EFILEREAD;
+}
+
+
+int main(int argc, char** argv) {
+  int ret;
+  int i;
+  uint64_t size;
+  replay_t r;
+
+  memset(&r, 0, sizeof(r));
+  r.threads = 1;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      r.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+      r.speed = strtod(argv[++i], NULL);
+    } else {
+      break;
+    }
+  }
+
+  if (i + 2 != argc || r.threads < 1) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-x speed] <trace> <database>\n",
+            argv[0]);
+    return 1;
+  }
+
+  ret = replay_read_file(argv[i], &r.data, &size);
+  if (ret != BP_OK) {
+    fprintf(stderr, "failed to read %s\n", argv[i]);
+    return 1;
+  }
+
+  ret = replay_parse(&r, size);
+  if (ret != BP_OK) {
+    fprintf(stderr, "%s is not a valid operation trace\n", argv[i]);
+    goto done;
+  }
+
+  ret = bp_open(&r.db, argv[i + 1]);
+  if (ret != BP_OK) {
+    fprintf(stderr, "failed to open %s\n", argv[i + 1]);
+    goto done;
+  }
+
+  ret = replay_run(&r);
+  bp_close(&r.db);
+
+done:
+  free(r.ops);
+  free(r.keys);
+  free(r.values);
+  free(r.filler);
+  free(r.data);
+  return ret == BP_OK ? 0 : 1;
+}